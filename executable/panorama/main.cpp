@@ -2,8 +2,12 @@
 
 int main_label(int argc, char **argv);
 int main_run(int argc, char **argv);
+int main_serve(int argc, char **argv);
 
 int main(int argc, char **argv) {
   auto routine = &main_run;
+  if (argc > 1 && std::string(argv[1]) == "--serve") {
+    routine = &main_serve;
+  }
   return routine(argc, argv);
 }
\ No newline at end of file
@@ -13,9 +13,10 @@ int main_label(int argc, char **argv) {
 
   auto anno = LoadOrInitializeNewLayoutAnnotation(impath);
 
+  LayoutAnnotationReconstructionCache reconCache;
   while (true) {
     EditLayoutAnnotation(impath, anno);
-    ReconstructLayoutAnnotation(anno, matlab);
+    ReconstructLayoutAnnotationIncrementally(anno, matlab, reconCache);
     VisualizeLayoutAnnotation(anno, 0.08);
     int selected = pano::gui::SelectFrom(
         {"Accept", "Edit Again", "Abandon"}, "Your decision?",
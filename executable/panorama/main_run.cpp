@@ -10,6 +10,7 @@ int main_run(int argc, char **argv) {
   std::vector<std::string> impaths;
   gui::FileDialog::PickImages(PANORAMIX_TEST_DATA_DIR_STR, &impaths);
 
+  bool failed = false;
   for (auto &&impath : impaths) {
     auto anno = LoadOrInitializeNewLayoutAnnotation(impath);
     anno.impath = impath;
@@ -26,6 +27,13 @@ int main_run(int argc, char **argv) {
 
     options.notUseOcclusions = false;
     options.notUseCoplanarity = false;
+    options.useNativeGeometricContext = false;
+    options.useSinglePrecisionGeometricContext = false;
+    options.refineLinesInPyramid = false;
+
+    options.budget_preparation = 0;
+    options.budget_lsw = 0;
+    options.budget_mg_reconstructed = 0;
 
     options.refresh_preparation = false;
     options.refresh_mg_init = options.refresh_preparation || false;
@@ -36,13 +44,27 @@ int main_run(int argc, char **argv) {
         options.refresh_lsw || options.refresh_line2leftRightSegs || false;
     options.refresh_mg_reconstructed = options.refresh_mg_occdetected || false;
 
-    RunPanoramaReconstruction(anno, options, matlab, true, false);
+    PanoramaReconstructionResult result;
+    auto report = RunPanoramaReconstruction(anno, options, matlab, true,
+                                            false, &result);
+    if (!report.succeeded) {
+      failed = true;
+      continue;
+    }
 
-    SaveMatlabResultsOfPanoramaReconstruction(anno, options, matlab,
-                                              impath + ".result.mat");
-    SaveObjModelResultsOfPanoramaReconstruction(anno, options, matlab,
+    failed = !SaveMatlabResultsOfPanoramaReconstruction(
+                 result, impath + ".result.mat") ||
+             failed;
+    auto compactPolygons = GetCompactModelOfPanoramaReconstruction(result);
+    SaveObjModelResultsOfPanoramaReconstruction(compactPolygons,
                                                 impath + ".result.obj");
+    failed = !SaveMeshModelResultsOfPanoramaReconstruction(
+                 anno, compactPolygons, impath + ".result.ply") ||
+             failed;
+    failed = !SaveMeshModelResultsOfPanoramaReconstruction(
+                 anno, compactPolygons, impath + ".result.glb") ||
+             failed;
   }
 
-  return 0;
+  return failed ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "panorama_service.hpp"
+
+namespace {
+// the whole of value as an integer
+bool ParseInteger(const std::string &value, int64_t &number) {
+  try {
+    size_t end = 0;
+    number = std::stoll(value, &end);
+    return end == value.size();
+  } catch (const std::logic_error &) {
+    return false; // not a number or out of range
+  }
+}
+}
+
+// Panorama --serve [--socket path] [--concurrency n] [--queue n]
+//                  [--annotations n] [--memory MB] [--engines n]
+int main_serve(int argc, char **argv) {
+  misc::SetCachePath(PANORAMIX_CACHE_DATA_DIR_STR "\\Panorama\\");
+  pano::misc::MakeDir(pano::misc::CachePath());
+
+  PanoramaServiceOptions options;
+  std::map<std::string, int *> intOptions = {
+      {"--concurrency", &options.maxConcurrentRequests},
+      {"--queue", &options.maxQueuedRequests},
+      {"--annotations", &options.maxCachedAnnotations},
+      {"--engines", &options.matlabEngines}};
+  for (int i = 2; i < argc; i += 2) {
+    std::string key = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "no value of " << key << std::endl;
+      return 1;
+    }
+    std::string value = argv[i + 1];
+    if (key == "--socket") {
+      options.socketPath = value;
+      continue;
+    }
+    if (key != "--memory" && !Contains(intOptions, key)) {
+      std::cerr << "unknown argument " << key << std::endl;
+      return 1;
+    }
+    int64_t number = 0;
+    if (!ParseInteger(value, number) ||
+        (key != "--memory" && (number < std::numeric_limits<int>::min() ||
+                               number > std::numeric_limits<int>::max()))) {
+      std::cerr << "bad value " << value << " of " << key << std::endl;
+      return 1;
+    }
+    if (key == "--memory") {
+      options.memoryBudgetMB = number;
+    } else {
+      *intOptions.at(key) = static_cast<int>(number);
+    }
+  }
+
+  return RunPanoramaService(options);
+}
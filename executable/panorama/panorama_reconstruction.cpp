@@ -4,6 +4,7 @@
 #include "line_detection.hpp"
 #include "panorama_reconstruction.hpp"
 #include "segmentation.hpp"
+#include "single_view.hpp"
 
 template <class T> double ElapsedInMS(const T &start) {
   return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
@@ -28,6 +29,15 @@ std::string PanoramaReconstructionOptions::algorithmOptionsTag() const {
   if (notUseCoplanarity) {
     ss << "_nocop";
   }
+  if (useNativeGeometricContext) {
+    ss << "_nativegc";
+  }
+  if (useSinglePrecisionGeometricContext) {
+    ss << "_gcf";
+  }
+  if (refineLinesInPyramid) {
+    ss << "_lpyr";
+  }
   return ss.str();
 }
 
@@ -50,6 +60,15 @@ void PanoramaReconstructionOptions::print() const {
             << std::endl;
   std::cout << " notUseOcclusions = " << notUseOcclusions << std::endl;
   std::cout << " notUseCoplanarity = " << notUseCoplanarity << std::endl;
+  std::cout << " useNativeGeometricContext = " << useNativeGeometricContext
+            << std::endl;
+  std::cout << " useSinglePrecisionGeometricContext = "
+            << useSinglePrecisionGeometricContext << std::endl;
+  std::cout << " refineLinesInPyramid = " << refineLinesInPyramid << std::endl;
+  std::cout << " budget_preparation = " << budget_preparation << std::endl;
+  std::cout << " budget_lsw = " << budget_lsw << std::endl;
+  std::cout << " budget_mg_reconstructed = " << budget_mg_reconstructed
+            << std::endl;
   std::cout << "------------------------------" << std::endl;
   std::cout << " refresh_preparation = " << refresh_preparation << std::endl;
   std::cout << " refresh_mg_init = " << refresh_mg_init << std::endl;
@@ -72,7 +91,10 @@ PanoramaReconstructionReport::PanoramaReconstructionReport() {
   time_lsw = -1;
   time_mg_occdetected = -1;
   time_mg_reconstructed = -1;
+  time_solve_lp = -1;
+  peakResidentBytes = -1;
   succeeded = false;
+  cancelled = false;
 }
 
 void PanoramaReconstructionReport::print() const {
@@ -86,28 +108,199 @@ void PanoramaReconstructionReport::print() const {
   std::cout << " time_mg_occdetected = " << time_mg_occdetected << std::endl;
   std::cout << " time_mg_reconstructed = " << time_mg_reconstructed
             << std::endl;
+  auto printMemory = [](const char *name, const misc::MemoryStats &stats) {
+    if (stats.nallocs == 0) {
+      return;
+    }
+    std::cout << " memory_" << name << " = " << stats.peakBytes / (1 << 20)
+              << "MB peak, " << stats.bytes / (1 << 20) << "MB in "
+              << stats.nallocs << " allocations" << std::endl;
+  };
+  printMemory("preparation", memory_preparation);
+  printMemory("mg_init", memory_mg_init);
+  printMemory("line2leftRightSegs", memory_line2leftRightSegs);
+  printMemory("mg_oriented", memory_mg_oriented);
+  printMemory("lsw", memory_lsw);
+  printMemory("mg_occdetected", memory_mg_occdetected);
+  printMemory("mg_reconstructed", memory_mg_reconstructed);
+  if (peakResidentBytes >= 0) {
+    std::cout << " peakResidentBytes = " << peakResidentBytes / (1 << 20)
+              << "MB" << std::endl;
+  }
+  if (cancelled) {
+    std::cout << " cancelled" << std::endl;
+  }
+  for (auto &d : degradations) {
+    std::cout << " degraded " << d.stage << ": " << d.action << ", "
+              << d.reason << std::endl;
+  }
   std::cout << "##############################" << std::endl;
 }
 
+int64_t PanoramaReconstructionReport::peakBytes() const {
+  return std::max({memory_preparation.peakBytes, memory_mg_init.peakBytes,
+                   memory_line2leftRightSegs.peakBytes,
+                   memory_mg_oriented.peakBytes, memory_lsw.peakBytes,
+                   memory_mg_occdetected.peakBytes,
+                   memory_mg_reconstructed.peakBytes});
+}
+
 static const double thetaTiny = DegreesToRadians(2);
 static const double thetaMid = DegreesToRadians(5);
 static const double thetaLarge = DegreesToRadians(15);
 
+namespace {
+// the panoramic gc merged from the gcs of horizontal perspective views, both
+// are cached, T is their scalar type
+template <class T>
+Image_<Vec<T, 5>> GetPanoramicGeometricContext(
+    const PILayoutAnnotation &anno,
+    const PanoramaReconstructionOptions &options,
+    PanoramaReconstructionResources &resources,
+    const View<PanoramicCamera, Image3ub> &view, const std::vector<Vec3> &vps,
+    int vertVPId) {
+  std::vector<PerspectiveCamera> hcams;
+  std::vector<Weighted<View<PerspectiveCamera, Image_<Vec<T, 5>>>>> gcs;
+  Image_<Vec<T, 5>> gc;
+  static const int hcamNum = 16;
+  static const Sizei hcamScreenSize(500, 500);
+  // static const Sizei hcamScreenSize(500, 700);
+  static const int hcamFocal = 200;
+  // float caches are stored under their own names
+  const char *scalarTag = std::is_same<T, float>::value ? "_f" : "";
+  std::string hcamsgcsFileName;
+  {
+    std::stringstream ss;
+    ss << "hcamsgcs_" << hcamNum << "_" << hcamScreenSize.width << "_"
+       << hcamScreenSize.height << "_" << hcamFocal;
+    if (options.useNativeGeometricContext) {
+      ss << "_native";
+    }
+    ss << scalarTag;
+    hcamsgcsFileName = ss.str();
+  }
+  if (0 || !misc::LoadCache(anno.impath, hcamsgcsFileName, hcams, gcs)) {
+    // extract gcs
+    hcams = CreateHorizontalPerspectiveCameras(
+        view.camera, hcamNum, hcamScreenSize.width, hcamScreenSize.height,
+        hcamFocal);
+    auto &gcEstimator = resources.geometricContextEstimator(options);
+    std::unique_lock<std::mutex> lock(resources.matlabMutex(),
+                                      std::defer_lock);
+    if (!gcEstimator.isThreadSafe()) {
+      lock.lock();
+    }
+    gcs = ComputeIndoorGeometricContextOfViews<T>(gcEstimator, view, hcams,
+                                                  vps, vertVPId);
+    misc::SaveCache(anno.impath, hcamsgcsFileName, hcams, gcs);
+  }
+  std::string gcmergedFileName;
+  {
+    std::stringstream ss;
+    ss << "gc_" << hcamNum << "_" << hcamScreenSize.width << "_"
+       << hcamScreenSize.height << "_" << hcamFocal;
+    if (options.useNativeGeometricContext) {
+      ss << "_native";
+    }
+    ss << scalarTag;
+    gcmergedFileName = ss.str();
+  }
+  if (0 || !misc::LoadCache(anno.impath, gcmergedFileName, gc)) {
+    gc = Combine(view.camera, gcs).image;
+    misc::SaveCache(anno.impath, gcmergedFileName, gc);
+  }
+  return gc;
+}
+}
+
+const GeometricContextEstimator &
+PanoramaReconstructionResources::geometricContextEstimator(
+    const PanoramaReconstructionOptions &options) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (options.useNativeGeometricContext) {
+    if (!_nativeGC) {
+      std::cerr << "the native geometric context estimator is experimental, "
+                   "its model is not trained"
+                << std::endl;
+      _nativeGC = std::make_unique<NativeGeometricContextEstimator>();
+    }
+    return *_nativeGC;
+  }
+  if (!_matlabGC && _matlabPool) {
+    _matlabGC = std::make_unique<MatlabGeometricContextEstimator>(*_matlabPool);
+  } else if (!_matlabGC) {
+    _matlabGC = std::make_unique<MatlabGeometricContextEstimator>(*_matlab);
+  }
+  return *_matlabGC;
+}
+
+std::shared_ptr<const PanoramaReconstructionResources::CubicSamplers>
+PanoramaReconstructionResources::cubicSamplers(
+    const PanoramicCamera &panoCam,
+    const std::vector<PerspectiveCamera> &cams) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!_cubicSamplers || _cubicSize != panoCam.screenSize() ||
+      _cubicSamplers->size() != cams.size()) {
+    auto samplers = std::make_shared<CubicSamplers>();
+    samplers->reserve(cams.size());
+    for (auto &cam : cams) {
+      samplers->push_back(MakeCameraSampler(cam, panoCam));
+    }
+    _cubicSize = panoCam.screenSize();
+    _cubicSamplers = std::move(samplers);
+  }
+  return _cubicSamplers;
+}
+
 PanoramaReconstructionReport
 RunPanoramaReconstruction(const PILayoutAnnotation &anno,
                           const PanoramaReconstructionOptions &options,
                           misc::Matlab &matlab, bool showGUI,
-                          bool writeToFile) {
+                          bool writeToFile,
+                          PanoramaReconstructionResult *result) {
+  PanoramaReconstructionResources resources(matlab);
+  return RunPanoramaReconstruction(anno, options, resources, showGUI,
+                                   writeToFile, result);
+}
+
+PanoramaReconstructionReport
+RunPanoramaReconstruction(const PILayoutAnnotation &anno,
+                          const PanoramaReconstructionOptions &options,
+                          PanoramaReconstructionResources &resources,
+                          bool showGUI, bool writeToFile,
+                          PanoramaReconstructionResult *result) {
 
   PanoramaReconstructionReport report;
+  // the stages are intervals of the scope of the caller, whose peak then
+  // covers the whole run
+  std::unique_ptr<misc::MemoryScope> memoryScope;
+  if (misc::MemoryScope::CurrentId() == -1) {
+    memoryScope = std::make_unique<misc::MemoryScope>();
+  }
 #define START_TIME_RECORD(name)                                                \
+  misc::MemoryInterval memory_interval_##name;                                 \
   auto start_##name = std::chrono::system_clock::now()
 
 #define STOP_TIME_RECORD(name)                                                 \
   report.time_##name = ElapsedInMS(start_##name);                              \
+  report.memory_##name = memory_interval_##name.stats();                       \
   std::cout << "refresh_" #name " time cost: " << report.time_##name << "ms"   \
             << std::endl
 
+  // a stage over its budget degrades, and nothing after it is cached since
+  // the identity does not tell degraded results apart
+  auto degrade = [&report](const char *stage, const std::string &action,
+                           const std::string &reason) {
+    std::cout << "degrading " << stage << ": " << action << ", " << reason
+              << std::endl;
+    report.degradations.push_back({stage, action, reason});
+  };
+  auto cacheable = [&report]() { return report.degradations.empty(); };
+  auto cancelled = [&options, &report]() {
+    report.cancelled = options.deadline.cancelled();
+    return report.cancelled;
+  };
+
   options.print();
   const auto identity = options.identityOfImage(anno.impath);
   misc::SaveCache(identity, "options", options);
@@ -120,10 +313,10 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
     misc::MakeDir(folder);
   }
   if (writeToFile) {
-    cv::imwrite(folder + "im.png", anno.view.image);
+    cv::imwrite(folder + "im.png", anno.viewImage.get());
   }
 
-  auto image = anno.rectifiedImage.clone();
+  auto image = anno.rectifiedImage.get().clone();
   ResizeToHeight(image, 700);
 
   /// prepare things!
@@ -136,23 +329,49 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
   Imagei segs;
   int nsegs;
 
+  if (cancelled()) {
+    return report;
+  }
   if (options.refresh_preparation ||
       !misc::LoadCache(identity, "preparation", view, cams, rawLine2s, line3s,
                        vps, vertVPId, segs, nsegs)) {
     START_TIME_RECORD(preparation);
+    // line detection has the first part of the budget
+    auto preparationDeadline =
+        options.deadline.within(options.budget_preparation);
+    auto linesDeadline =
+        options.deadline.within(options.budget_preparation * 0.4);
 
     view = CreatePanoramicView(image);
 
     // collect lines in each view
     cams = CreateCubicFacedCameras(view.camera, image.rows, image.rows,
                                    image.rows * 0.4);
+    auto samplers = resources.cubicSamplers(view.camera, cams);
     std::vector<Line3> rawLine3s;
     rawLine2s.resize(cams.size());
+    int nhalfFaces = 0;
     for (int i = 0; i < cams.size(); i++) {
-      auto pim = view.sampled(cams[i]).image;
+      if (cancelled()) {
+        return report;
+      }
+      auto pim = (*samplers)[i](view.image);
       LineSegmentExtractor lineExtractor;
       lineExtractor.params().algorithm = LineSegmentExtractor::LSD;
-      auto ls = lineExtractor(pim); // use pyramid
+      std::vector<Line2> ls;
+      if (!linesDeadline.expired()) {
+        ls = lineExtractor(pim); // use pyramid
+      } else {
+        // the remaining faces at half resolution
+        Image halfPim;
+        cv::pyrDown(pim, halfPim);
+        ls = lineExtractor(halfPim);
+        for (auto &l : ls) {
+          l.first *= 2.0;
+          l.second *= 2.0;
+        }
+        nhalfFaces++;
+      }
       rawLine2s[i] = ClassifyEachAs(ls, -1);
       for (auto &l : ls) {
         rawLine3s.emplace_back(normalize(cams[i].toSpace(l.first)),
@@ -160,11 +379,62 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
       }
     }
     rawLine3s = MergeLines(rawLine3s, DegreesToRadians(3), DegreesToRadians(5));
+    if (nhalfFaces > 0) {
+      // the vp estimation and the pigraph are quadratic in the lines, keep the
+      // longest ones
+      static const int maxLinesWhenDegraded = 300;
+      std::stringstream action;
+      action << "detected lines of " << nhalfFaces << " of " << cams.size()
+             << " faces at half resolution";
+      if (rawLine3s.size() > maxLinesWhenDegraded) {
+        std::sort(rawLine3s.begin(), rawLine3s.end(),
+                  [](const Line3 &a, const Line3 &b) {
+                    return AngleBetweenDirected(a.first, a.second) >
+                           AngleBetweenDirected(b.first, b.second);
+                  });
+        action << ", kept the " << maxLinesWhenDegraded << " longest of "
+               << rawLine3s.size() << " lines";
+        rawLine3s.resize(maxLinesWhenDegraded);
+      }
+      degrade("preparation", action.str(),
+              "line detection ran out of its share of the budget");
+    }
+    if (options.refineLinesInPyramid && linesDeadline.expired()) {
+      degrade("preparation", "lines not refined in the pyramid",
+              "line detection ran out of its share of the budget");
+    } else if (options.refineLinesInPyramid) {
+      std::vector<LineRefinementLevel> levels;
+      rawLine3s = RefineLinesInPanoramaPyramid(
+          rawLine3s, anno.rectifiedImage.get(), image.rows, 800, M_PI / 3,
+          &levels, linesDeadline);
+      for (auto &level : levels) {
+        std::cout << "refined " << level.nrefined << " lines in "
+                  << level.ntiles << " tiles at height " << level.height
+                  << ", " << level.time << "ms, "
+                  << level.peakBytes / (1 << 20) << "MB" << std::endl;
+      }
+      if (linesDeadline.expired() && !levels.empty()) {
+        std::stringstream action;
+        action << "stopped refining lines in the pyramid at height "
+               << levels.back().height;
+        degrade("preparation", action.str(),
+                "line detection ran out of its share of the budget");
+      }
+    }
 
     // estimate vp
+    if (cancelled()) {
+      return report;
+    }
     line3s = ClassifyEachAs(rawLine3s, -1);
-    vps = EstimateVanishingPointsAndClassifyLines(line3s, nullptr, true);
+    vps = EstimateVanishingPointsAndClassifyLines(line3s, nullptr, true,
+                                                  preparationDeadline);
     vertVPId = NearestDirectionId(vps, Vec3(0, 0, 1));
+    if (preparationDeadline.expired()) {
+      degrade("preparation",
+              "voted vanishing points by part of the line intersections",
+              "the preparation budget ran out");
+    }
 
     if (showGUI) {
       gui::ColorTable ctable = gui::RGBGreys;
@@ -185,8 +455,33 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
       }
     }
 
-    // estimate segs
-    nsegs = SegmentationForPIGraph(view, line3s, segs, DegreesToRadians(1));
+    // estimate segs, coarser if less than a third of the budget is left
+    if (cancelled()) {
+      return report;
+    }
+    if (preparationDeadline.expired() ||
+        preparationDeadline.remaining() <
+            options.budget_preparation * (1.0 / 3.0)) {
+      Image3ub halfImage;
+      cv::pyrDown(view.image, halfImage);
+      Imagei halfSegs;
+      SegmentationForPIGraph(CreatePanoramicView(halfImage), line3s, halfSegs,
+                             DegreesToRadians(1), 10.0, 1.0, 200, 2,
+                             preparationDeadline);
+      cv::resize(halfSegs, segs, view.image.size(), 0, 0, cv::INTER_NEAREST);
+      degrade("preparation", "segmented at half resolution",
+              "less than a third of the preparation budget was left");
+    } else {
+      nsegs = SegmentationForPIGraph(view, line3s, segs, DegreesToRadians(1),
+                                     10.0, 1.0, 200, 2, preparationDeadline);
+    }
+    if (cancelled()) {
+      return report;
+    }
+    if (preparationDeadline.expired()) {
+      degrade("preparation", "stopped segmenting by color and lines early",
+              "the preparation budget ran out");
+    }
     RemoveThinRegionInSegmentation(segs, 1, true);
     RemoveEmbededRegionsInSegmentation(segs, true);
     nsegs = DensifySegmentation(segs, true);
@@ -223,78 +518,66 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
     STOP_TIME_RECORD(preparation);
 
     // save
-    misc::SaveCache(identity, "preparation", view, cams, rawLine2s, line3s, vps,
-                    vertVPId, segs, nsegs);
+    if (cacheable()) {
+      misc::SaveCache(identity, "preparation", view, cams, rawLine2s, line3s,
+                      vps, vertVPId, segs, nsegs);
+    }
   }
 
   // gc !!!!
-  std::vector<PerspectiveCamera> hcams;
-  std::vector<Weighted<View<PerspectiveCamera, Image5d>>> gcs;
-  Image5d gc;
-  static const int hcamNum = 16;
-  static const Sizei hcamScreenSize(500, 500);
-  // static const Sizei hcamScreenSize(500, 700);
-  static const int hcamFocal = 200;
-  std::string hcamsgcsFileName;
-  {
-    std::stringstream ss;
-    ss << "hcamsgcs_" << hcamNum << "_" << hcamScreenSize.width << "_"
-       << hcamScreenSize.height << "_" << hcamFocal;
-    hcamsgcsFileName = ss.str();
+  if (cancelled()) {
+    return report;
   }
-  if (0 || !misc::LoadCache(anno.impath, hcamsgcsFileName, hcams, gcs)) {
-    // extract gcs
-    hcams = CreateHorizontalPerspectiveCameras(
-        view.camera, hcamNum, hcamScreenSize.width, hcamScreenSize.height,
-        hcamFocal);
-    gcs.resize(hcams.size());
-    for (int i = 0; i < hcams.size(); i++) {
-      auto pim = view.sampled(hcams[i]);
-      auto pgc = ComputeIndoorGeometricContextHedau(matlab, pim.image);
-      gcs[i].component.camera = hcams[i];
-      gcs[i].component.image = pgc;
-      gcs[i].score = abs(
-          1.0 - normalize(hcams[i].forward()).dot(normalize(view.camera.up())));
-    }
-    misc::SaveCache(anno.impath, hcamsgcsFileName, hcams, gcs);
-  }
-  std::string gcmergedFileName;
-  {
-    std::stringstream ss;
-    ss << "gc_" << hcamNum << "_" << hcamScreenSize.width << "_"
-       << hcamScreenSize.height << "_" << hcamFocal;
-    gcmergedFileName = ss.str();
-  }
-  if (0 || !misc::LoadCache(anno.impath, gcmergedFileName, gc)) {
-    gc = Combine(view.camera, gcs).image;
-    misc::SaveCache(anno.impath, gcmergedFileName, gc);
+  Image5d gc;
+  Image5f gcf;
+  if (options.useSinglePrecisionGeometricContext) {
+    gcf = GetPanoramicGeometricContext<float>(anno, options, resources, view,
+                                              vps, vertVPId);
+  } else {
+    gc = GetPanoramicGeometricContext<double>(anno, options, resources, view,
+                                              vps, vertVPId);
   }
 
   // build pigraph!
   PIGraph<PanoramicCamera> mg;
-  if (options.refresh_mg_init || !misc::LoadCache(identity, "mg_init", mg)) {
+  if (cancelled()) {
+    return report;
+  }
+  if (!cacheable() || options.refresh_mg_init ||
+      !misc::LoadCache(identity, "mg_init", mg)) {
     std::cout << "########## refreshing mg init ###########" << std::endl;
     START_TIME_RECORD(mg_init);
     mg = BuildPIGraph(view, vps, vertVPId, segs, line3s, DegreesToRadians(1),
                       DegreesToRadians(1), DegreesToRadians(1), thetaTiny,
-                      thetaLarge, thetaTiny);
+                      thetaLarge, thetaTiny, options.deadline);
+    if (cancelled()) {
+      return report;
+    }
+    if (options.deadline.expired()) {
+      degrade("mg_init", "stopped collecting line relations early",
+              "the run ran out of its deadline");
+    }
     STOP_TIME_RECORD(mg_init);
-    misc::SaveCache(identity, "mg_init", mg);
+    if (cacheable()) {
+      misc::SaveCache(identity, "mg_init", mg);
+    }
   }
 
   std::vector<std::array<std::set<int>, 2>> line2leftRightSegs;
-  if (options.refresh_line2leftRightSegs ||
+  if (!cacheable() || options.refresh_line2leftRightSegs ||
       !misc::LoadCache(identity, "line2leftRightSegs", line2leftRightSegs)) {
     std::cout << "########## refreshing line2leftRightSegs ###########"
               << std::endl;
     START_TIME_RECORD(line2leftRightSegs);
     line2leftRightSegs = CollectSegsNearLines(mg, thetaMid * 2);
     STOP_TIME_RECORD(line2leftRightSegs);
-    misc::SaveCache(identity, "line2leftRightSegs", line2leftRightSegs);
+    if (cacheable()) {
+      misc::SaveCache(identity, "line2leftRightSegs", line2leftRightSegs);
+    }
   }
 
   // attach orientation constraints
-  if (options.refresh_mg_oriented ||
+  if (!cacheable() || options.refresh_mg_oriented ||
       !misc::LoadCache(identity, "mg_oriented", mg)) {
     std::cout << "########## refreshing mg oriented ###########" << std::endl;
     START_TIME_RECORD(mg_oriented);
@@ -305,31 +588,52 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
       AttachWallConstraints(mg, thetaTiny);
     }
     if (options.useGeometricContextPrior) {
-      AttachGCConstraints(mg, gc, 0.7, 0.7, true);
+      if (options.useSinglePrecisionGeometricContext) {
+        AttachGCConstraints(mg, gcf, 0.7, 0.7, true);
+      } else {
+        AttachGCConstraints(mg, gc, 0.7, 0.7, true);
+      }
     }
     STOP_TIME_RECORD(mg_oriented);
-    misc::SaveCache(identity, "mg_oriented", mg);
+    if (cacheable()) {
+      misc::SaveCache(identity, "mg_oriented", mg);
+    }
   }
 
   // detect occlusions
   std::vector<LineSidingWeight> lsw;
-  if (options.refresh_lsw || !misc::LoadCache(identity, "lsw", lsw)) {
+  if (cancelled()) {
+    return report;
+  }
+  if (!cacheable() || options.refresh_lsw ||
+      !misc::LoadCache(identity, "lsw", lsw)) {
     std::cout << "########## refreshing lsw ###########" << std::endl;
     START_TIME_RECORD(lsw);
+    auto lswDeadline = options.deadline.within(options.budget_lsw);
     if (options.notUseOcclusions) {
       lsw.resize(mg.nlines(), LineSidingWeight{0.5, 0.5});
+    } else if (!options.useGTOcclusions && lswDeadline.expired()) {
+      lsw.resize(mg.nlines(), LineSidingWeight{0.5, 0.5});
+      degrade("lsw", "no occlusions detected", "the run is out of time");
     } else if (!options.useGTOcclusions) {
       lsw = ComputeLinesSidingWeights2(mg, DegreesToRadians(3), 0.2, 0.1,
-                                       thetaMid);
+                                       thetaMid, nullptr, nullptr,
+                                       lswDeadline);
+      if (lswDeadline.expired()) {
+        degrade("lsw", "kept the best occlusion labels so far",
+                "the occlusion factor graph ran out of the lsw budget");
+      }
     } else {
       lsw = ComputeLinesSidingWeightsFromAnnotation(
           mg, anno, DegreesToRadians(0.5), DegreesToRadians(8), 0.6);
     }
     STOP_TIME_RECORD(lsw);
-    misc::SaveCache(identity, "lsw", lsw);
+    if (cacheable()) {
+      misc::SaveCache(identity, "lsw", lsw);
+    }
   }
 
-  if (options.refresh_mg_occdetected ||
+  if (!cacheable() || options.refresh_mg_occdetected ||
       !misc::LoadCache(identity, "mg_occdetected", mg)) {
     std::cout << "########## refreshing mg occdetected ###########"
               << std::endl;
@@ -342,12 +646,17 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
       DisableBottomSeg(mg);
     }
     STOP_TIME_RECORD(mg_occdetected);
-    misc::SaveCache(identity, "mg_occdetected", mg);
+    if (cacheable()) {
+      misc::SaveCache(identity, "mg_occdetected", mg);
+    }
   }
 
   PIConstraintGraph cg;
   PICGDeterminablePart dp;
-  if (options.refresh_mg_reconstructed ||
+  if (cancelled()) {
+    return report;
+  }
+  if (!cacheable() || options.refresh_mg_reconstructed ||
       !misc::LoadCache(identity, "mg_reconstructed", mg, cg, dp)) {
     std::cout << "########## refreshing mg reconstructed ###########"
               << std::endl;
@@ -355,15 +664,32 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
     cg = BuildPIConstraintGraph(mg, DegreesToRadians(1), 0.01);
 
     dp = LocateDeterminablePart(cg, DegreesToRadians(3), false);
+    auto solveDeadline =
+        options.deadline.within(options.budget_mg_reconstructed);
     auto start = std::chrono::system_clock::now();
-    double energy = Solve(dp, cg, matlab, 5, 1e6, !options.notUseCoplanarity);
+    static const int maxReweightings = 5;
+    double energy = 0.0;
+    int nreweightings = 0;
+    energy = resources.withMatlab([&](misc::Matlab &matlab) {
+      return Solve(dp, cg, matlab, maxReweightings, 1e6,
+                   !options.notUseCoplanarity, solveDeadline, &nreweightings);
+    });
     report.time_solve_lp = ElapsedInMS(start);
+    if (nreweightings < maxReweightings && solveDeadline.expired()) {
+      std::stringstream action;
+      action << "stopped reweighting after " << nreweightings << " of "
+             << maxReweightings << " iterations";
+      degrade("mg_reconstructed", action.str(),
+              "the solver ran out of the mg_reconstructed budget");
+    }
     if (IsInfOrNaN(energy)) {
       std::cout << "solve failed" << std::endl;
       return report;
     }
     STOP_TIME_RECORD(mg_reconstructed);
-    misc::SaveCache(identity, "mg_reconstructed", mg, cg, dp);
+    if (cacheable()) {
+      misc::SaveCache(identity, "mg_reconstructed", mg, cg, dp);
+    }
   }
 
   if (showGUI) {
@@ -385,16 +711,51 @@ RunPanoramaReconstruction(const PILayoutAnnotation &anno,
                             },
                             nullptr, true);
 
-    VisualizeReconstructionCompact(anno.rectifiedImage, dp, cg, mg, true,
+    VisualizeReconstructionCompact(anno.rectifiedImage.get(), dp, cg, mg, true,
                                    false);
   }
 
+  if (result) {
+    result->mg = std::move(mg);
+    result->cg = std::move(cg);
+    result->dp = std::move(dp);
+  }
+  report.peakResidentBytes = misc::PeakResidentBytes();
   report.succeeded = true;
   misc::SaveCache(identity, "report", report);
 
   return report;
 }
 
+int64_t EstimatePeakBytesOfPanoramaReconstruction(
+    const PILayoutAnnotation &anno,
+    const PanoramaReconstructionOptions &options) {
+  // everything but the pyramid refinement runs on the 700 rows working view
+  const int64_t height = 700;
+  // the size is known without decoding the image
+  const Sizei size = anno.rectifiedImage.size();
+  const int64_t width =
+      size.height > 0 ? height * size.width / size.height : height * 2;
+  const int64_t npixels = width * height;
+  const int64_t scalarBytes =
+      options.useSinglePrecisionGeometricContext ? sizeof(float)
+                                                 : sizeof(double);
+
+  // the working image, the view and the cubic faces
+  int64_t bytes = npixels * 3 * 3;
+  // the graph segmentation holds about 4 weighted edges per pixel, then the
+  // segment map and the per pixel directions of the pigraph
+  bytes += npixels * 4 * 16 + npixels * sizeof(int) + npixels * 24;
+  // the gcs of the 16 horizontal 500x500 views and the panoramic gc
+  bytes += 16 * 500 * 500 * 5 * scalarBytes + npixels * 5 * scalarBytes;
+  if (options.refineLinesInPyramid) {
+    // the decoded full resolution panorama, kept by the annotation for the
+    // rest of the run, one level below it and the tiles in flight
+    bytes += int64_t(size.area()) * 3 * 2;
+  }
+  return bytes;
+}
+
 bool GetPanoramaReconstructionResult(
     const PILayoutAnnotation &anno,
     const PanoramaReconstructionOptions &options, PIGraph<PanoramicCamera> &mg,
@@ -403,6 +764,23 @@ bool GetPanoramaReconstructionResult(
   return misc::LoadCache(identity, "mg_reconstructed", mg, cg, dp);
 }
 
+namespace {
+// the cached result, a run is never started here since its result may be
+// degraded and then it is not cached
+PanoramaReconstructionResult
+LoadPanoramaReconstructionResult(const PILayoutAnnotation &anno,
+                                 const PanoramaReconstructionOptions &options) {
+  PanoramaReconstructionResult result;
+  if (!GetPanoramaReconstructionResult(anno, options, result.mg, result.cg,
+                                       result.dp)) {
+    throw std::runtime_error("no cached panorama reconstruction of " +
+                             anno.impath +
+                             ", run RunPanoramaReconstruction first");
+  }
+  return result;
+}
+}
+
 std::vector<LineSidingWeight> GetPanoramaReconstructionOcclusionResult(
     const PILayoutAnnotation &anno,
     const PanoramaReconstructionOptions &options) {
@@ -412,38 +790,41 @@ std::vector<LineSidingWeight> GetPanoramaReconstructionOcclusionResult(
   return lsw;
 }
 
-void SaveMatlabResultsOfPanoramaReconstruction(
+bool SaveMatlabResultsOfPanoramaReconstruction(
     const PILayoutAnnotation &anno,
-    const PanoramaReconstructionOptions &options, misc::Matlab &matlab,
+    const PanoramaReconstructionOptions &options,
     const std::string &fileName) {
-  PIGraph<PanoramicCamera> mg;
-  PIConstraintGraph cg;
-  PICGDeterminablePart dp;
-  if (!GetPanoramaReconstructionResult(anno, options, mg, cg, dp)) {
-    std::cout << "failed to load panoramix result, performing "
-                 "RunPanoramaReconstruction ..."
-              << std::endl;
-    RunPanoramaReconstruction(anno, options, matlab, false);
-    GetPanoramaReconstructionResult(anno, options, mg, cg, dp);
-  }
+  return SaveMatlabResultsOfPanoramaReconstruction(
+      LoadPanoramaReconstructionResult(anno, options), fileName);
+}
 
-  misc::MAT matFile(fileName, misc::MAT::Write);
+bool SaveMatlabResultsOfPanoramaReconstruction(
+    const PanoramaReconstructionResult &result, const std::string &fileName) {
+  auto &mg = result.mg;
+  auto &cg = result.cg;
+  auto &dp = result.dp;
+
+  // results are written without the matlab runtime, .npz or .mat by the
+  // extension of fileName
+  std::vector<std::pair<std::string, misc::MatArray>> vars;
 
   // segs
-  matFile.setVar("segs", cv::InputArray(mg.segs + 1));
-  auto planes = misc::MXA::createStructMatrix(mg.nsegs, 1,
-                                              {"reconstructed", "plane_coeff"});
+  vars.emplace_back("segs", misc::MatArray(cv::Mat(mg.segs + 1)));
+  std::vector<uint8_t> seg2reconstructed(mg.nsegs, false);
+  auto planes = misc::MatArray::createStructMatrix(
+      mg.nsegs, 1, {"reconstructed", "plane_coeff"});
   for (int seg = 0; seg < mg.nsegs; seg++) {
     int ent = cg.seg2ent[seg];
     bool reconstructed = Contains(dp.determinableEnts, ent);
+    seg2reconstructed[seg] = reconstructed;
     planes.setField("reconstructed", seg, reconstructed);
     if (reconstructed) {
       planes.setField("plane_coeff", seg,
-                      misc::MXA(Plane3ToEquation(
-                          cg.entities[ent].supportingPlane.reconstructed)));
+                      Plane3ToEquation(
+                          cg.entities[ent].supportingPlane.reconstructed));
     }
   }
-  matFile.setVar("planes", planes);
+  vars.emplace_back("planes", std::move(planes));
 
   // lines
   std::vector<Line3> reconstructedLines;
@@ -466,54 +847,90 @@ void SaveMatlabResultsOfPanoramaReconstruction(
     }
   }
 
-  auto lines = misc::MXA::createStructMatrix(reconstructedLines.size(), 1,
-                                             {"line_p1", "line_p2"});
+  auto lines = misc::MatArray::createStructMatrix(reconstructedLines.size(),
+                                                  1, {"line_p1", "line_p2"});
   for (int i = 0; i < reconstructedLines.size(); i++) {
-    lines.setField("line_p1", i, misc::MXA(reconstructedLines[i].first));
-    lines.setField("line_p2", i, misc::MXA(reconstructedLines[i].second));
+    lines.setField("line_p1", i, reconstructedLines[i].first);
+    lines.setField("line_p2", i, reconstructedLines[i].second);
   }
-  matFile.setVar("lines", lines);
-
+  vars.emplace_back("lines", std::move(lines));
 
-  // depthMap
+  // depthMap and normalMap, rows are shared among threads
   Imaged depthMap(mg.segs.size(), 0.0);
-  for (auto it = depthMap.begin(); it != depthMap.end(); ++it) {
-    int seg = mg.segs(it.pos());
-    int ent = cg.seg2ent[seg];
-    bool reconstructed = Contains(dp.determinableEnts, ent);
-    if (reconstructed) {
-      auto & plane = cg.entities[ent].supportingPlane.reconstructed;
-      Vec3 dir = mg.view.camera.direction(it.pos());
-      double depth = norm(Intersection(Ray3(Origin(), dir), plane));
-      *it = depth;
+  Image3d normalMap(mg.segs.size(), Vec3());
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    for (int y = t; y < mg.segs.rows; y += concurrency) {
+      for (int x = 0; x < mg.segs.cols; x++) {
+        int seg = mg.segs(y, x);
+        if (!seg2reconstructed[seg]) {
+          continue;
+        }
+        auto &plane =
+            cg.entities[cg.seg2ent[seg]].supportingPlane.reconstructed;
+        Vec3 dir = mg.view.camera.direction(Pixel(x, y));
+        depthMap(y, x) = norm(Intersection(Ray3(Origin(), dir), plane));
+        normalMap(y, x) = normalize(plane.normal);
+      }
+    }
+  });
+  vars.emplace_back("depths", misc::MatArray(depthMap));
+  vars.emplace_back("normals", misc::MatArray(normalMap));
+
+  bool npz = fileName.size() >= 4 &&
+             fileName.compare(fileName.size() - 4, 4, ".npz") == 0;
+  auto save = [&vars, &fileName](auto &file) {
+    for (auto &var : vars) {
+      if (!file.setVar(var.first, var.second)) {
+        std::cout << "failed to write " << var.first << " to " << fileName
+                  << std::endl;
+        return false;
+      }
     }
+    return true;
+  };
+  if (npz) {
+    misc::NpzWriter npzFile(fileName, true);
+    return save(npzFile);
   }
-  matFile.setVar("depths", depthMap);
+  misc::MatWriter matFile(fileName, true);
+  return save(matFile);
 }
 
-void SaveObjModelResultsOfPanoramaReconstruction(
+std::vector<Polygon3> GetCompactModelOfPanoramaReconstruction(
     const PILayoutAnnotation &anno,
-    const PanoramaReconstructionOptions &options, misc::Matlab &matlab,
-    const std::string &fileName) {
+    const PanoramaReconstructionOptions &options) {
+  return GetCompactModelOfPanoramaReconstruction(
+      LoadPanoramaReconstructionResult(anno, options));
+}
+
+std::vector<Polygon3> GetCompactModelOfPanoramaReconstruction(
+    const PanoramaReconstructionResult &result) {
+  return CompactModel(result.dp, result.cg, result.mg, 0.1);
+}
+
+namespace {
+size_t FileSizeInBytes(const std::string &fileName) {
+  std::ifstream ifs(fileName, std::ios::binary | std::ios::ate);
+  return ifs ? static_cast<size_t>(ifs.tellg()) : 0;
+}
 
+void ReportModelExport(const std::string &fileName,
+                       const std::chrono::system_clock::time_point &start) {
+  double ms = ElapsedInMS(start);
+  std::cout << "model exported to " << fileName << " in " << ms << "ms, "
+            << FileSizeInBytes(fileName) << " bytes" << std::endl;
+}
+}
+
+void SaveObjModelResultsOfPanoramaReconstruction(
+    const std::vector<Polygon3> &compactPolygons, const std::string &fileName) {
+  auto start = std::chrono::system_clock::now();
   std::ofstream ofs(fileName);
   if (!ofs) {
     return;
   }
 
-  PIGraph<PanoramicCamera> mg;
-  PIConstraintGraph cg;
-  PICGDeterminablePart dp;
-  if (!GetPanoramaReconstructionResult(anno, options, mg, cg, dp)) {
-    std::cout << "failed to load panoramix result, performing "
-                 "RunPanoramaReconstruction ..."
-              << std::endl;
-    RunPanoramaReconstruction(anno, options, matlab, false);
-    GetPanoramaReconstructionResult(anno, options, mg, cg, dp);
-  }
-
-  auto compactPolygons = CompactModel(dp, cg, mg, 0.1);
-  
   // write vertex
   std::vector<Point3> vertices;
   std::vector<std::vector<int>> faceInds;
@@ -529,7 +946,7 @@ void SaveObjModelResultsOfPanoramaReconstruction(
   }
 
   for (auto & v : vertices) {
-    ofs << "v " << v[0] << " " << v[1] << " " << v[2] << std::endl;
+    ofs << "v " << v[0] << " " << v[1] << " " << v[2] << '\n';
   }
   for (auto & f : faceInds) {
     if (f.size() < 3) {
@@ -539,6 +956,33 @@ void SaveObjModelResultsOfPanoramaReconstruction(
     for (int vid : f) {
       ofs << (vid + 1) << "/" << 1 << "/" << 1 << " ";
     }
-    ofs << std::endl;
+    ofs << '\n';
+  }
+  ofs.close();
+  ReportModelExport(fileName, start);
+}
+
+bool SaveMeshModelResultsOfPanoramaReconstruction(
+    const PILayoutAnnotation &anno,
+    const std::vector<Polygon3> &compactPolygons, const std::string &fileName) {
+  auto ext = fileName.substr(std::min(fileName.size(), fileName.rfind('.')));
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  if (ext != ".ply" && ext != ".glb") {
+    std::cout << "unsupported model format: " << fileName << std::endl;
+    return false;
+  }
+
+  auto start = std::chrono::system_clock::now();
+  ExportMeshOptions exportOptions;
+  exportOptions.withNormals = true;
+  exportOptions.withTexCoords = true;
+  exportOptions.panorama = &anno.viewCamera;
+  exportOptions.textureFile = anno.impath;
+  auto mesh = MakeExportMesh(compactPolygons, exportOptions);
+  bool saved = ext == ".ply" ? SaveToPLY(fileName, mesh)
+                             : SaveToGLB(fileName, mesh);
+  if (saved) {
+    ReportModelExport(fileName, start);
   }
+  return saved;
 }
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <mutex>
+
 #include "file.hpp"
 #include "clock.hpp"
+#include "geo_context.hpp"
+#include "mat_file.hpp"
+#include "memory.hpp"
+#include "mesh_export.hpp"
 #include "parallel.hpp"
+#include "rasterizer.hpp"
 
 #include "canvas.hpp"
 #include "gui_util.hpp"
@@ -34,6 +41,28 @@ struct PanoramaReconstructionOptions {
 
   bool notUseCoplanarity;
 
+  // estimate geometric context natively instead of calling matlab gc(),
+  // experimental: the native model has hand set, untrained weights and is no
+  // replacement for gc(), see NativeGeometricContextEstimator
+  bool useNativeGeometricContext;
+  // merge the 5 label gcs of the perspective views and the panoramic gc in
+  // float, and cache them as float. the raw 7 label gc of the estimator and
+  // the samples in PIGraph stay double
+  bool useSinglePrecisionGeometricContext;
+  // refine the lines found at the working height against the full resolution
+  // panorama, coarse to fine in tiles around them. the full panorama is
+  // decoded for it, and segmentation and siding weights are not refined
+  bool refineLinesInPyramid;
+
+  // time budgets of the stages in ms, unlimited if <= 0, a stage that runs out
+  // of its budget degrades and records it in the report
+  double budget_preparation;
+  double budget_lsw;
+  double budget_mg_reconstructed;
+  // bounds the whole run, once cancelled the run stops at the next stage,
+  // neither serialized nor part of the identity
+  misc::Deadline deadline;
+
   static const std::string parseOption(bool b);
   std::string algorithmOptionsTag() const;
   std::string identityOfImage(const std::string &impath) const;
@@ -53,13 +82,26 @@ struct PanoramaReconstructionOptions {
   template <class Archiver> void serialize(Archiver &ar) {
     ar(useWallPrior, usePrincipleDirectionPrior, useGeometricContextPrior,
        useGTOcclusions, looseLinesSecondTime, looseSegsSecondTime,
-       restrictSegsSecondTime, notUseOcclusions, notUseCoplanarity);
+       restrictSegsSecondTime, notUseOcclusions, notUseCoplanarity,
+       useNativeGeometricContext, useSinglePrecisionGeometricContext,
+       refineLinesInPyramid);
+    ar(budget_preparation, budget_lsw, budget_mg_reconstructed);
     ar(refresh_preparation, refresh_mg_init, refresh_line2leftRightSegs,
        refresh_mg_oriented, refresh_lsw, refresh_mg_occdetected,
        refresh_mg_reconstructed);
   }
 };
 
+// a stage that ran out of its budget and what it gave up
+struct PanoramaReconstructionDegradation {
+  std::string stage;
+  std::string action;
+  std::string reason;
+  template <class Archiver> void serialize(Archiver &ar) {
+    ar(stage, action, reason);
+  }
+};
+
 // report
 struct PanoramaReconstructionReport {
   double time_preparation;
@@ -72,25 +114,123 @@ struct PanoramaReconstructionReport {
 
   double time_solve_lp;
 
+  // heap used by the stages above what was live when they started, including
+  // their parallel runs
+  misc::MemoryStats memory_preparation;
+  misc::MemoryStats memory_mg_init;
+  misc::MemoryStats memory_line2leftRightSegs;
+  misc::MemoryStats memory_mg_oriented;
+  misc::MemoryStats memory_lsw;
+  misc::MemoryStats memory_mg_occdetected;
+  misc::MemoryStats memory_mg_reconstructed;
+  // of the whole process at the end of the run, -1 where unknown
+  int64_t peakResidentBytes;
+
   bool succeeded;
+  bool cancelled;
+  // the results are not cached if any
+  std::vector<PanoramaReconstructionDegradation> degradations;
 
   PanoramaReconstructionReport();
 
+  // the largest heap peak of the stages run
+  int64_t peakBytes() const;
+
   void print() const;
 
   template <class Archiver> void serialize(Archiver &ar) {
     ar(time_preparation, time_mg_init, time_line2leftRightSegs,
        time_mg_oriented, time_lsw, time_mg_occdetected, time_mg_reconstructed,
        time_solve_lp, succeeded);
+    ar(cancelled, degradations);
+    ar(memory_preparation, memory_mg_init, memory_line2leftRightSegs,
+       memory_mg_oriented, memory_lsw, memory_mg_occdetected,
+       memory_mg_reconstructed, peakResidentBytes);
   }
 };
 
-// run the main algorithm
+// resources
+// state of the reconstruction that does not depend on the image, a long
+// running caller keeps one alive so that it is built once for all images,
+// reconstructions may share it concurrently but take turns on the matlab engine
+// or on the engines of the pool if there is one
+class PanoramaReconstructionResources {
+public:
+  using CubicSamplers =
+      std::vector<CameraSampler<PerspectiveCamera, PanoramicCamera>>;
+
+  explicit PanoramaReconstructionResources(
+      misc::Matlab &matlab, misc::MatlabPool *matlabPool = nullptr)
+      : _matlab(&matlab), _matlabPool(matlabPool) {}
+  // runs everything on the pool without a single engine
+  explicit PanoramaReconstructionResources(misc::MatlabPool &matlabPool)
+      : _matlab(nullptr), _matlabPool(&matlabPool) {}
+
+  // the single engine, null if there is only the pool
+  misc::Matlab *matlab() const { return _matlab; }
+  misc::MatlabPool *matlabPool() const { return _matlabPool; }
+  // held while the matlab engine is in use
+  std::mutex &matlabMutex() const { return _matlabMutex; }
+
+  // withMatlab
+  // runs fun(misc::Matlab &) on the first free engine of the pool, or on the
+  // matlab engine holding its mutex
+  template <class FunT>
+  std::result_of_t<FunT &(misc::Matlab &)> withMatlab(FunT &&fun) const {
+    if (_matlabPool) {
+      return _matlabPool->submit(std::forward<FunT>(fun)).get();
+    }
+    std::lock_guard<std::mutex> lock(_matlabMutex);
+    return fun(*_matlab);
+  }
+
+  // the gc estimator chosen by the options, made on first use
+  const GeometricContextEstimator &
+  geometricContextEstimator(const PanoramaReconstructionOptions &options);
+
+  // samplers of the panorama into cameras toward the cubic faces, these are
+  // the same for all panoramas of one size and are kept for the last size
+  std::shared_ptr<const CubicSamplers>
+  cubicSamplers(const PanoramicCamera &panoCam,
+                const std::vector<PerspectiveCamera> &cams);
+
+private:
+  misc::Matlab *_matlab;
+  misc::MatlabPool *_matlabPool;
+  mutable std::mutex _matlabMutex;
+  std::mutex _mutex;
+  std::unique_ptr<GeometricContextEstimator> _matlabGC, _nativeGC;
+  Sizei _cubicSize;
+  std::shared_ptr<const CubicSamplers> _cubicSamplers;
+};
+
+// the reconstructed graphs of a run
+struct PanoramaReconstructionResult {
+  PIGraph<PanoramicCamera> mg;
+  PIConstraintGraph cg;
+  PICGDeterminablePart dp;
+};
+
+// run the main algorithm, result is filled if the run succeeds, degraded runs
+// included, whose results are not cached and can only be exported from it
 PanoramaReconstructionReport
 RunPanoramaReconstruction(const PILayoutAnnotation &anno,
                           const PanoramaReconstructionOptions &options,
                           misc::Matlab &matlab, bool showGUI,
-                          bool writeToFile = false);
+                          bool writeToFile = false,
+                          PanoramaReconstructionResult *result = nullptr);
+PanoramaReconstructionReport
+RunPanoramaReconstruction(const PILayoutAnnotation &anno,
+                          const PanoramaReconstructionOptions &options,
+                          PanoramaReconstructionResources &resources,
+                          bool showGUI, bool writeToFile = false,
+                          PanoramaReconstructionResult *result = nullptr);
+
+// a rough upper bound of the heap peak of a run in bytes, from the size of the
+// panorama and the options, for schedulers to admit runs by
+int64_t EstimatePeakBytesOfPanoramaReconstruction(
+    const PILayoutAnnotation &anno,
+    const PanoramaReconstructionOptions &options);
 
 // get result
 bool GetPanoramaReconstructionResult(
@@ -101,74 +241,76 @@ std::vector<LineSidingWeight> GetPanoramaReconstructionOcclusionResult(
     const PILayoutAnnotation &anno,
     const PanoramaReconstructionOptions &options);
 
-// save matlab results
-void SaveMatlabResultsOfPanoramaReconstruction(
+// the exporters below taking anno and options read the cached result, and
+// throw std::runtime_error if there is none, they never run the reconstruction
+
+// save matlab results, as .mat or .npz, the matlab runtime is not needed,
+// returns false if a variable could not be written
+bool SaveMatlabResultsOfPanoramaReconstruction(
+    const PILayoutAnnotation &anno,
+    const PanoramaReconstructionOptions &options, const std::string &fileName);
+bool SaveMatlabResultsOfPanoramaReconstruction(
+    const PanoramaReconstructionResult &result, const std::string &fileName);
+
+// get the compact polygons of the reconstructed model
+std::vector<Polygon3> GetCompactModelOfPanoramaReconstruction(
     const PILayoutAnnotation &anno,
-    const PanoramaReconstructionOptions &options, misc::Matlab &matlab,
-    const std::string &fileName);
+    const PanoramaReconstructionOptions &options);
+std::vector<Polygon3> GetCompactModelOfPanoramaReconstruction(
+    const PanoramaReconstructionResult &result);
 
-// save .obj model files
+// save .obj model files of the compact polygons
 void SaveObjModelResultsOfPanoramaReconstruction(
+    const std::vector<Polygon3> &compactPolygons, const std::string &fileName);
+
+// save binary .ply/.glb model files of the compact polygons, textured by the
+// input panorama
+bool SaveMeshModelResultsOfPanoramaReconstruction(
     const PILayoutAnnotation &anno,
-    const PanoramaReconstructionOptions &options, misc::Matlab &matlab,
-    const std::string &fileName);
+    const std::vector<Polygon3> &compactPolygons, const std::string &fileName);
 
-// get surface normal maps
+// render depth, normal and face id maps of the compact model into the test
+// cameras, occlusions are resolved per pixel so no hole filling is needed, the
+// face ids index the polygons of GetCompactModelOfPanoramaReconstruction, not
+// the segments of the PIGraph
 template <class CameraT>
-std::vector<Image3d> GetSurfaceNormalMapsOfPanoramaReconstruction(
+std::vector<RasterizedPolygons> RenderSurfaceMapsOfPanoramaReconstruction(
     const std::vector<CameraT> &testCams, const PILayoutAnnotation &anno,
-    const PanoramaReconstructionOptions &options, misc::Matlab &matlab) {
-
-  PIGraph<PanoramicCamera> mg;
-  PIConstraintGraph cg;
-  PICGDeterminablePart dp;
-  if (!GetPanoramaReconstructionResult(anno, options, mg, cg, dp)) {
-    std::cout << "failed to load panoramix result, performing "
-                 "RunPanoramaReconstruction ..."
-              << std::endl;
-    RunPanoramaReconstruction(anno, options, matlab, false);
-    GetPanoramaReconstructionResult(anno, options, mg, cg, dp);
+    const PanoramaReconstructionOptions &options) {
+  auto polygons = GetCompactModelOfPanoramaReconstruction(anno, options);
+  std::vector<RasterizedPolygons> maps;
+  maps.reserve(testCams.size());
+  for (auto &cam : testCams) {
+    // each camera is rendered by all threads
+    maps.push_back(RasterizePolygons(polygons, cam));
   }
+  return maps;
+}
 
-  std::vector<Image3d> surfaceNormalMaps(testCams.size());
-  ParallelRun(
-      testCams.size(), std::thread::hardware_concurrency() - 1, [&](int i) {
-        std::cout
-            << "computing surface normal map for panoramix on testCamera - "
-            << i << std::endl;
-        auto &map = surfaceNormalMaps[i];
-        auto &cam = testCams[i];
-        map = SurfaceNormalMap(cam, dp, cg, mg, true);
-      });
+// get surface normal maps, pixels seeing no polygon have a zero normal
+template <class CameraT>
+std::vector<Image3d> GetSurfaceNormalMapsOfPanoramaReconstruction(
+    const std::vector<CameraT> &testCams, const PILayoutAnnotation &anno,
+    const PanoramaReconstructionOptions &options) {
+  auto maps =
+      RenderSurfaceMapsOfPanoramaReconstruction(testCams, anno, options);
+  std::vector<Image3d> surfaceNormalMaps(maps.size());
+  for (int i = 0; i < maps.size(); i++) {
+    surfaceNormalMaps[i] = maps[i].normals;
+  }
   return surfaceNormalMaps;
 }
 
-// get surface depth maps
+// get surface depth maps, pixels seeing no polygon have depth 0
 template <class CameraT>
 std::vector<Imaged> GetSurfaceDepthMapsOfPanoramaReconstruction(
     const std::vector<CameraT> &testCams, const PILayoutAnnotation &anno,
-    const PanoramaReconstructionOptions &options, misc::Matlab &matlab) {
-
-  PIGraph<PanoramicCamera> mg;
-  PIConstraintGraph cg;
-  PICGDeterminablePart dp;
-  if (!GetPanoramaReconstructionResult(anno, options, mg, cg, dp)) {
-    std::cout << "failed to load panoramix result, performing "
-                 "RunPanoramaReconstruction ..."
-              << std::endl;
-    RunPanoramaReconstruction(anno, options, matlab, false);
-    GetPanoramaReconstructionResult(anno, options, mg, cg, dp);
+    const PanoramaReconstructionOptions &options) {
+  auto maps =
+      RenderSurfaceMapsOfPanoramaReconstruction(testCams, anno, options);
+  std::vector<Imaged> surfaceDepthMaps(maps.size());
+  for (int i = 0; i < maps.size(); i++) {
+    surfaceDepthMaps[i] = maps[i].depths;
   }
-
-  std::vector<Imaged> surfaceDepthMaps(testCams.size());
-  ParallelRun(
-      testCams.size(), std::thread::hardware_concurrency() - 1, [&](int i) {
-        std::cout
-            << "computing surface normal map for panoramix on testCamera - "
-            << i << std::endl;
-        auto &map = surfaceDepthMaps[i];
-        auto &cam = testCams[i];
-        map = SurfaceDepthMap(cam, dp, cg, mg, true);
-      });
   return surfaceDepthMaps;
 }
@@ -0,0 +1,834 @@
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <map>
+#include <set>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <cereal/external/rapidjson/document.h>
+#include <cereal/external/rapidjson/stringbuffer.h>
+#include <cereal/external/rapidjson/writer.h>
+
+#include "panorama_service.hpp"
+
+namespace {
+
+// the options of the Panorama executable, requests override them by name
+PanoramaReconstructionOptions DefaultOptions() {
+  PanoramaReconstructionOptions options;
+  options.useWallPrior = true;
+  options.usePrincipleDirectionPrior = true;
+  options.useGeometricContextPrior = true;
+
+  options.useGTOcclusions = false;
+  options.looseLinesSecondTime = false;
+  options.looseSegsSecondTime = false;
+  options.restrictSegsSecondTime = false;
+
+  options.notUseOcclusions = false;
+  options.notUseCoplanarity = false;
+  options.useNativeGeometricContext = false;
+  options.useSinglePrecisionGeometricContext = false;
+  options.refineLinesInPyramid = false;
+
+  options.budget_preparation = 0;
+  options.budget_lsw = 0;
+  options.budget_mg_reconstructed = 0;
+
+  options.refresh_preparation = false;
+  options.refresh_mg_init = false;
+  options.refresh_mg_oriented = false;
+  options.refresh_line2leftRightSegs = false;
+  options.refresh_lsw = false;
+  options.refresh_mg_occdetected = false;
+  options.refresh_mg_reconstructed = false;
+  return options;
+}
+
+using OptionField = bool PanoramaReconstructionOptions::*;
+const std::pair<const char *, OptionField> OptionFields[] = {
+    {"useWallPrior", &PanoramaReconstructionOptions::useWallPrior},
+    {"usePrincipleDirectionPrior",
+     &PanoramaReconstructionOptions::usePrincipleDirectionPrior},
+    {"useGeometricContextPrior",
+     &PanoramaReconstructionOptions::useGeometricContextPrior},
+    {"useGTOcclusions", &PanoramaReconstructionOptions::useGTOcclusions},
+    {"looseLinesSecondTime",
+     &PanoramaReconstructionOptions::looseLinesSecondTime},
+    {"looseSegsSecondTime",
+     &PanoramaReconstructionOptions::looseSegsSecondTime},
+    {"restrictSegsSecondTime",
+     &PanoramaReconstructionOptions::restrictSegsSecondTime},
+    {"notUseOcclusions", &PanoramaReconstructionOptions::notUseOcclusions},
+    {"notUseCoplanarity", &PanoramaReconstructionOptions::notUseCoplanarity},
+    {"useNativeGeometricContext",
+     &PanoramaReconstructionOptions::useNativeGeometricContext},
+    {"useSinglePrecisionGeometricContext",
+     &PanoramaReconstructionOptions::useSinglePrecisionGeometricContext},
+    {"refineLinesInPyramid",
+     &PanoramaReconstructionOptions::refineLinesInPyramid},
+    {"refresh_preparation",
+     &PanoramaReconstructionOptions::refresh_preparation},
+    {"refresh_mg_init", &PanoramaReconstructionOptions::refresh_mg_init},
+    {"refresh_line2leftRightSegs",
+     &PanoramaReconstructionOptions::refresh_line2leftRightSegs},
+    {"refresh_mg_oriented",
+     &PanoramaReconstructionOptions::refresh_mg_oriented},
+    {"refresh_lsw", &PanoramaReconstructionOptions::refresh_lsw},
+    {"refresh_mg_occdetected",
+     &PanoramaReconstructionOptions::refresh_mg_occdetected},
+    {"refresh_mg_reconstructed",
+     &PanoramaReconstructionOptions::refresh_mg_reconstructed}};
+
+using BudgetField = double PanoramaReconstructionOptions::*;
+const std::pair<const char *, BudgetField> BudgetFields[] = {
+    {"preparation", &PanoramaReconstructionOptions::budget_preparation},
+    {"lsw", &PanoramaReconstructionOptions::budget_lsw},
+    {"mg_reconstructed",
+     &PanoramaReconstructionOptions::budget_mg_reconstructed}};
+
+size_t FileSize(const std::string &fileName) {
+  std::ifstream ifs(fileName, std::ios::binary | std::ios::ate);
+  return ifs ? static_cast<size_t>(ifs.tellg()) : 0;
+}
+
+// a reply line
+class Reply {
+public:
+  Reply(const std::string &id, const char *event) : _writer(_buffer) {
+    _writer.StartObject();
+    if (!id.empty()) {
+      add("id", id);
+    }
+    add("event", event);
+  }
+  Reply &add(const char *key, const char *value) {
+    _writer.Key(key);
+    _writer.String(value);
+    return *this;
+  }
+  Reply &add(const char *key, const std::string &value) {
+    _writer.Key(key);
+    _writer.String(value.c_str(), (rapidjson::SizeType)value.size());
+    return *this;
+  }
+  Reply &add(const char *key, double value) {
+    _writer.Key(key);
+    _writer.Double(value);
+    return *this;
+  }
+  Reply &add(const char *key, int64_t value) {
+    _writer.Key(key);
+    _writer.Int64(value);
+    return *this;
+  }
+  Reply &add(const char *key, bool value) {
+    _writer.Key(key);
+    _writer.Bool(value);
+    return *this;
+  }
+  Reply &add(const char *key, const PanoramaReconstructionReport &report) {
+    _writer.Key(key);
+    _writer.StartObject();
+    std::pair<const char *, double> times[] = {
+        {"time_preparation", report.time_preparation},
+        {"time_mg_init", report.time_mg_init},
+        {"time_line2leftRightSegs", report.time_line2leftRightSegs},
+        {"time_mg_oriented", report.time_mg_oriented},
+        {"time_lsw", report.time_lsw},
+        {"time_mg_occdetected", report.time_mg_occdetected},
+        {"time_mg_reconstructed", report.time_mg_reconstructed},
+        {"time_solve_lp", report.time_solve_lp}};
+    for (auto &t : times) {
+      _writer.Key(t.first);
+      _writer.Double(t.second);
+    }
+    std::pair<const char *, const misc::MemoryStats &> memories[] = {
+        {"memory_preparation", report.memory_preparation},
+        {"memory_mg_init", report.memory_mg_init},
+        {"memory_line2leftRightSegs", report.memory_line2leftRightSegs},
+        {"memory_mg_oriented", report.memory_mg_oriented},
+        {"memory_lsw", report.memory_lsw},
+        {"memory_mg_occdetected", report.memory_mg_occdetected},
+        {"memory_mg_reconstructed", report.memory_mg_reconstructed}};
+    for (auto &m : memories) {
+      _writer.Key(m.first);
+      _writer.StartObject();
+      _writer.Key("allocations");
+      _writer.Int64(m.second.nallocs);
+      _writer.Key("bytes");
+      _writer.Int64(m.second.bytes);
+      _writer.Key("peakBytes");
+      _writer.Int64(m.second.peakBytes);
+      _writer.EndObject();
+    }
+    _writer.Key("peakResidentBytes");
+    _writer.Int64(report.peakResidentBytes);
+    _writer.Key("succeeded");
+    _writer.Bool(report.succeeded);
+    _writer.Key("cancelled");
+    _writer.Bool(report.cancelled);
+    _writer.Key("degradations");
+    _writer.StartArray();
+    for (auto &d : report.degradations) {
+      _writer.StartObject();
+      _writer.Key("stage");
+      _writer.String(d.stage.c_str());
+      _writer.Key("action");
+      _writer.String(d.action.c_str());
+      _writer.Key("reason");
+      _writer.String(d.reason.c_str());
+      _writer.EndObject();
+    }
+    _writer.EndArray();
+    _writer.EndObject();
+    return *this;
+  }
+  std::string str() {
+    _writer.EndObject();
+    return std::string(_buffer.GetString(), _buffer.GetSize());
+  }
+
+private:
+  rapidjson::StringBuffer _buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> _writer;
+};
+
+// a client, replies of the requests running on different workers are sent
+// whole lines at a time
+class Connection {
+public:
+  virtual ~Connection() {}
+  virtual bool readLine(std::string &line) = 0;
+  virtual void close() {}
+  void send(const std::string &line) {
+    std::lock_guard<std::mutex> lock(_sendMutex);
+    write(line + "\n");
+  }
+
+protected:
+  virtual void write(const std::string &data) = 0;
+
+private:
+  std::mutex _sendMutex;
+};
+
+class StreamConnection : public Connection {
+public:
+  StreamConnection(std::istream &in, std::ostream &out) : _in(in), _out(out) {}
+  bool readLine(std::string &line) override {
+    return bool(std::getline(_in, line));
+  }
+
+protected:
+  void write(const std::string &data) override {
+    _out << data << std::flush;
+  }
+
+private:
+  std::istream &_in;
+  std::ostream &_out;
+};
+
+#ifndef _WIN32
+class SocketConnection : public Connection {
+public:
+  explicit SocketConnection(int fd) : _fd(fd) {}
+  ~SocketConnection() { ::close(_fd); }
+  bool readLine(std::string &line) override {
+    while (true) {
+      auto end = _buffer.find('\n');
+      if (end != std::string::npos) {
+        line = _buffer.substr(0, end);
+        _buffer.erase(0, end + 1);
+        return true;
+      }
+      char chunk[4096];
+      auto n = ::recv(_fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        return false;
+      }
+      _buffer.append(chunk, n);
+    }
+  }
+  void close() override { ::shutdown(_fd, SHUT_RD); }
+
+protected:
+  void write(const std::string &data) override {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      auto n = ::send(_fd, data.data() + sent, data.size() - sent,
+                      MSG_NOSIGNAL);
+      if (n <= 0) {
+        return; // the client has gone, its requests still finish
+      }
+      sent += n;
+    }
+  }
+
+private:
+  int _fd;
+  std::string _buffer;
+};
+#endif
+
+class Service {
+public:
+  // the single matlab engine is only opened without a pool
+  explicit Service(const PanoramaServiceOptions &options)
+      : _options(options),
+        _matlabPool(options.matlabEngines > 1
+                        ? std::make_unique<misc::MatlabPool>(
+                              options.matlabEngines)
+                        : nullptr),
+        _matlab(_matlabPool ? nullptr : std::make_unique<misc::Matlab>()),
+        _resources(
+            _matlabPool
+                ? std::make_unique<PanoramaReconstructionResources>(
+                      *_matlabPool)
+                : std::make_unique<PanoramaReconstructionResources>(*_matlab)),
+        _stopping(false), _running(0),
+        _served(0), _reservedBytes(0), _estimateScale(1.0) {
+    int nworkers = std::max(_options.maxConcurrentRequests, 1);
+    for (int i = 0; i < nworkers; i++) {
+      _workers.emplace_back([this]() { work(); });
+    }
+  }
+
+  // finishes the accepted requests
+  ~Service() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _queueChanged.notify_all();
+    for (auto &w : _workers) {
+      w.join();
+    }
+  }
+
+  bool stopping() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stopping;
+  }
+
+  // reads the requests of the connection until it ends or the service stops,
+  // returns false on a shutdown request
+  bool serve(const std::shared_ptr<Connection> &connection) {
+    std::string line;
+    while (!stopping() && connection->readLine(line)) {
+      if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        continue;
+      }
+      if (!handle(connection, line)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  struct Job {
+    std::shared_ptr<Connection> connection;
+    std::string id;
+    std::string image;
+    std::string outputPrefix;
+    std::vector<std::string> outputs;
+    PanoramaReconstructionOptions options;
+    // ms from the start of the run, unlimited if <= 0
+    double timeout = 0;
+    // the estimated heap peak of the run, and what the scheduler reserved for
+    // it once started
+    int64_t estimatedBytes = 0;
+    int64_t reservedBytes = 0;
+  };
+
+  bool handle(const std::shared_ptr<Connection> &connection,
+              const std::string &line) {
+    rapidjson::Document request;
+    request.Parse(line.c_str());
+    if (request.HasParseError() || !request.IsObject()) {
+      connection->send(Reply("", "error").add("message", "not a json object")
+                           .str());
+      return true;
+    }
+    Job job;
+    job.connection = connection;
+    if (request.HasMember("id") && request["id"].IsString()) {
+      job.id = request["id"].GetString();
+    }
+
+    if (request.HasMember("command")) {
+      std::string command = request["command"].IsString()
+                                ? request["command"].GetString()
+                                : "";
+      if (command == "shutdown") {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        connection->send(Reply(job.id, "shutdown")
+                             .add("queued", (int64_t)_queue.size())
+                             .str());
+        return false;
+      }
+      if (command == "cancel") {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto range = _cancellables.equal_range(job.id);
+        int ncancelled = 0;
+        for (auto it = range.first; it != range.second; ++it) {
+          it->second.cancel();
+          ncancelled++;
+        }
+        connection->send(Reply(job.id, "cancel")
+                             .add("cancelled", (int64_t)ncancelled)
+                             .str());
+        return true;
+      }
+      if (command == "status") {
+        std::lock_guard<std::mutex> lock(_mutex);
+        connection->send(Reply(job.id, "status")
+                             .add("running", (int64_t)_running)
+                             .add("queued", (int64_t)_queue.size())
+                             .add("served", (int64_t)_served)
+                             .add("annotations", (int64_t)_annotations.size())
+                             .add("reservedBytes", _reservedBytes)
+                             .add("estimateScale", _estimateScale)
+                             .str());
+        return true;
+      }
+      connection->send(Reply(job.id, "error")
+                           .add("message", "unknown command " + command)
+                           .str());
+      return true;
+    }
+
+    std::string error = parse(request, job);
+    if (!error.empty()) {
+      connection->send(Reply(job.id, "error").add("message", error).str());
+      return true;
+    }
+    // loads the annotation early, the run finds it among the recent ones
+    auto anno = annotation(job.image);
+    if (!anno) {
+      connection->send(
+          Reply(job.id, "error")
+              .add("message", "no layout annotation of " + job.image)
+              .str());
+      return true;
+    }
+    job.estimatedBytes =
+        EstimatePeakBytesOfPanoramaReconstruction(*anno, job.options);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if ((int)_queue.size() >= _options.maxQueuedRequests) {
+      connection->send(Reply(job.id, "rejected")
+                           .add("message", "busy")
+                           .add("queued", (int64_t)_queue.size())
+                           .str());
+      return true;
+    }
+    _cancellables.emplace(job.id, job.options.deadline);
+    _queue.push_back(std::move(job));
+    _queue.back().connection->send(
+        Reply(_queue.back().id, "accepted")
+            .add("queued", (int64_t)_queue.size())
+            .add("estimatedBytes", _queue.back().estimatedBytes)
+            .str());
+    _queueChanged.notify_one();
+    return true;
+  }
+
+  // fills the job from the request, returns an error message if it is invalid
+  static std::string parse(const rapidjson::Document &request, Job &job) {
+    if (!request.HasMember("image") || !request["image"].IsString()) {
+      return "no image";
+    }
+    job.image = request["image"].GetString();
+    job.outputPrefix = job.image + ".result";
+    if (request.HasMember("output")) {
+      if (!request["output"].IsString()) {
+        return "output is not a string";
+      }
+      job.outputPrefix = request["output"].GetString();
+    }
+
+    job.options = DefaultOptions();
+    if (request.HasMember("timeout")) {
+      if (!request["timeout"].IsNumber()) {
+        return "timeout is not a number";
+      }
+      job.timeout = request["timeout"].GetDouble();
+    }
+    if (request.HasMember("budgets")) {
+      auto &budgets = request["budgets"];
+      if (!budgets.IsObject()) {
+        return "budgets is not an object";
+      }
+      for (auto it = budgets.MemberBegin(); it != budgets.MemberEnd(); ++it) {
+        std::string name = it->name.GetString();
+        auto field = std::find_if(
+            std::begin(BudgetFields), std::end(BudgetFields),
+            [&name](const std::pair<const char *, BudgetField> &f) {
+              return name == f.first;
+            });
+        if (field == std::end(BudgetFields)) {
+          return "unknown budget " + name;
+        }
+        if (!it->value.IsNumber()) {
+          return "budget " + name + " is not a number";
+        }
+        job.options.*(field->second) = it->value.GetDouble();
+      }
+    }
+    if (request.HasMember("options")) {
+      auto &options = request["options"];
+      if (!options.IsObject()) {
+        return "options is not an object";
+      }
+      for (auto it = options.MemberBegin(); it != options.MemberEnd(); ++it) {
+        std::string name = it->name.GetString();
+        auto field = std::find_if(
+            std::begin(OptionFields), std::end(OptionFields),
+            [&name](const std::pair<const char *, OptionField> &f) {
+              return name == f.first;
+            });
+        if (field == std::end(OptionFields)) {
+          return "unknown option " + name;
+        }
+        if (!it->value.IsBool()) {
+          return "option " + name + " is not a bool";
+        }
+        job.options.*(field->second) = it->value.GetBool();
+      }
+    }
+    auto &o = job.options;
+    o.refresh_mg_init = o.refresh_mg_init || o.refresh_preparation;
+    o.refresh_mg_oriented = o.refresh_mg_oriented || o.refresh_mg_init;
+    o.refresh_line2leftRightSegs =
+        o.refresh_line2leftRightSegs || o.refresh_mg_init;
+    o.refresh_lsw = o.refresh_lsw || o.refresh_mg_oriented;
+    o.refresh_mg_occdetected = o.refresh_mg_occdetected || o.refresh_lsw ||
+                               o.refresh_line2leftRightSegs;
+    o.refresh_mg_reconstructed =
+        o.refresh_mg_reconstructed || o.refresh_mg_occdetected;
+
+    if (request.HasMember("outputs")) {
+      static const std::set<std::string> kinds = {"mat", "npz", "obj", "ply",
+                                                  "glb"};
+      auto &outputs = request["outputs"];
+      if (!outputs.IsArray()) {
+        return "outputs is not an array";
+      }
+      for (auto it = outputs.Begin(); it != outputs.End(); ++it) {
+        if (!it->IsString() || !kinds.count(it->GetString())) {
+          return "unknown output, expect mat, npz, obj, ply or glb";
+        }
+        job.outputs.push_back(it->GetString());
+      }
+    }
+    return "";
+  }
+
+  // whether a job reserving the bytes may start beside the running ones
+  bool admissible(int64_t bytes) const {
+    return _options.memoryBudgetMB <= 0 || _running == 0 ||
+           _reservedBytes + bytes <= _options.memoryBudgetMB * (1 << 20);
+  }
+
+  // runs the queued jobs, the jobs of one image never run at once since they
+  // share its caches, and a job waits while its estimated peak does not fit
+  // in the memory budget beside the running ones
+  void work() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto next = _queue.end();
+        _queueChanged.wait(lock, [this, &next]() {
+          next = std::find_if(
+              _queue.begin(), _queue.end(), [this](const Job &j) {
+                return !_runningImages.count(j.image) &&
+                       admissible(int64_t(j.estimatedBytes * _estimateScale));
+              });
+          return next != _queue.end() || (_stopping && _queue.empty());
+        });
+        if (next == _queue.end()) {
+          return;
+        }
+        job = std::move(*next);
+        _queue.erase(next);
+        job.reservedBytes = int64_t(job.estimatedBytes * _estimateScale);
+        _reservedBytes += job.reservedBytes;
+        _runningImages.insert(job.image);
+        _running++;
+      }
+      int64_t peakBytes = process(job);
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // the estimate is rough, scale the later ones by the worst miss of
+        // the recent jobs, never below the estimate itself
+        if (job.estimatedBytes > 0 && peakBytes > 0) {
+          _estimateMisses.push_back(double(peakBytes) / job.estimatedBytes);
+          if (_estimateMisses.size() > EstimateMissWindow) {
+            _estimateMisses.pop_front();
+          }
+          _estimateScale = std::max(1.0, *std::max_element(
+                                             _estimateMisses.begin(),
+                                             _estimateMisses.end()));
+        }
+        _reservedBytes -= job.reservedBytes;
+        auto range = _cancellables.equal_range(job.id);
+        for (auto it = range.first; it != range.second; ++it) {
+          if (it->second.sameAs(job.options.deadline)) {
+            _cancellables.erase(it);
+            break;
+          }
+        }
+        _runningImages.erase(job.image);
+        _running--;
+        _served++;
+      }
+      _queueChanged.notify_all();
+    }
+  }
+
+  // returns the heap peak of the whole job, 0 if the reconstruction did not
+  // run
+  int64_t process(const Job &job) {
+    misc::MemoryScope scope;
+    return run(job) ? scope.stats().peakBytes : 0;
+  }
+
+  // returns false if the reconstruction did not run
+  bool run(const Job &job) {
+    auto &connection = *job.connection;
+    auto start = std::chrono::system_clock::now();
+    connection.send(Reply(job.id, "started").str());
+    try {
+      auto anno = annotation(job.image);
+      if (!anno) {
+        connection.send(Reply(job.id, "error")
+                            .add("message", "no layout annotation of " +
+                                                job.image)
+                            .str());
+        return false;
+      }
+      auto options = job.options;
+      options.deadline = job.options.deadline.within(job.timeout);
+      // degraded results are not cached, so they are exported from here
+      PanoramaReconstructionResult result;
+      auto report = RunPanoramaReconstruction(*anno, options, *_resources,
+                                              false, false, &result);
+      connection.send(
+          Reply(job.id, "reconstructed").add("report", report).str());
+      if (!report.succeeded) {
+        connection.send(Reply(job.id, "error")
+                            .add("message", report.cancelled
+                                                ? "cancelled"
+                                                : "reconstruction failed")
+                            .str());
+        return true;
+      }
+      // the model outputs share one compact model
+      std::unique_ptr<std::vector<Polygon3>> compactPolygons;
+      for (auto &kind : job.outputs) {
+        std::string path = job.outputPrefix + "." + kind;
+        bool saved = true;
+        if (kind == "mat" || kind == "npz") {
+          saved = SaveMatlabResultsOfPanoramaReconstruction(result, path);
+        } else {
+          if (!compactPolygons) {
+            compactPolygons = std::make_unique<std::vector<Polygon3>>(
+                GetCompactModelOfPanoramaReconstruction(result));
+          }
+          if (kind == "obj") {
+            SaveObjModelResultsOfPanoramaReconstruction(*compactPolygons,
+                                                        path);
+          } else {
+            saved = SaveMeshModelResultsOfPanoramaReconstruction(
+                *anno, *compactPolygons, path);
+          }
+        }
+        if (!saved) {
+          connection.send(Reply(job.id, "error")
+                              .add("message", "failed to write " + path)
+                              .str());
+          return true;
+        }
+        connection.send(Reply(job.id, "output")
+                            .add("kind", kind)
+                            .add("path", path)
+                            .add("bytes", (int64_t)FileSize(path))
+                            .str());
+      }
+    } catch (std::exception &e) {
+      connection.send(Reply(job.id, "error").add("message", e.what()).str());
+      return true;
+    }
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::system_clock::now() - start;
+    connection.send(Reply(job.id, "done").add("time", time.count()).str());
+    return true;
+  }
+
+  // the annotation of the image, the recently used ones stay loaded
+  std::shared_ptr<const PILayoutAnnotation>
+  annotation(const std::string &image) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto it = _annotations.begin(); it != _annotations.end(); ++it) {
+        if (it->first == image) {
+          _annotations.splice(_annotations.begin(), _annotations, it);
+          return it->second;
+        }
+      }
+    }
+    // never rectify and annotate by hand here as the executable does
+    auto anno = std::make_shared<PILayoutAnnotation>();
+    if (!LoadFromDisk(LayoutAnnotationFilePath(image), *anno)) {
+      return nullptr;
+    }
+    anno->impath = image;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _annotations.emplace_front(image, anno);
+    while ((int)_annotations.size() > _options.maxCachedAnnotations) {
+      _annotations.pop_back();
+    }
+    return anno;
+  }
+
+private:
+  const PanoramaServiceOptions _options;
+  std::unique_ptr<misc::MatlabPool> _matlabPool;
+  std::unique_ptr<misc::Matlab> _matlab;
+  std::unique_ptr<PanoramaReconstructionResources> _resources;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _queueChanged;
+  std::deque<Job> _queue;
+  std::set<std::string> _runningImages;
+  // deadlines of the accepted jobs by id
+  std::multimap<std::string, misc::Deadline> _cancellables;
+  bool _stopping;
+  int _running, _served;
+  // bytes reserved by the running jobs, and the factor of the estimates
+  int64_t _reservedBytes;
+  double _estimateScale;
+  // peak over estimate of the last jobs
+  static const size_t EstimateMissWindow = 16;
+  std::deque<double> _estimateMisses;
+  std::list<std::pair<std::string, std::shared_ptr<const PILayoutAnnotation>>>
+      _annotations;
+  std::vector<std::thread> _workers;
+};
+
+#ifndef _WIN32
+int ServeSocket(Service &service, const std::string &socketPath) {
+  int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (listenFd < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+    std::cerr << "cannot create socket " << socketPath << std::endl;
+    return 1;
+  }
+  std::strcpy(address.sun_path, socketPath.c_str());
+  ::unlink(socketPath.c_str());
+  if (::bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 ||
+      ::listen(listenFd, 16) != 0) {
+    std::cerr << "cannot listen on " << socketPath << std::endl;
+    ::close(listenFd);
+    return 1;
+  }
+  std::cout << "serving on " << socketPath << std::endl;
+
+  // a reader per client, the connection is only held by the reader and the
+  // jobs of the client so its socket closes once both are done
+  struct Reader {
+    std::thread thread;
+    std::weak_ptr<Connection> connection;
+    bool done = false;
+  };
+  std::mutex mutex;
+  std::list<Reader> readers;
+  while (true) {
+    int fd = ::accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break; // shut down by a reader
+    }
+    auto connection = std::make_shared<SocketConnection>(fd);
+    std::lock_guard<std::mutex> lock(mutex);
+    // join the readers of the clients that have gone
+    for (auto it = readers.begin(); it != readers.end();) {
+      if (it->done) {
+        it->thread.join();
+        it = readers.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    readers.emplace_back();
+    auto reader = std::prev(readers.end());
+    reader->connection = connection;
+    reader->thread = std::thread(
+        [&service, &mutex, reader, connection, listenFd]() mutable {
+          if (!service.serve(connection)) {
+            ::shutdown(listenFd, SHUT_RDWR);
+          }
+          connection.reset();
+          std::lock_guard<std::mutex> lock(mutex);
+          reader->done = true;
+        });
+  }
+  {
+    // wake the readers of idle clients
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &r : readers) {
+      if (auto connection = r.connection.lock()) {
+        connection->close();
+      }
+    }
+  }
+  for (auto &r : readers) {
+    r.thread.join();
+  }
+  ::close(listenFd);
+  ::unlink(socketPath.c_str());
+  return 0;
+}
+#endif
+}
+
+int RunPanoramaService(const PanoramaServiceOptions &options) {
+  if (!options.socketPath.empty()) {
+#ifndef _WIN32
+    Service service(options);
+    return ServeSocket(service, options.socketPath);
+#else
+    std::cerr << "unix domain sockets are not supported here, serve on stdin"
+              << std::endl;
+    return 1;
+#endif
+  }
+
+  // the reconstruction logs to std::cout, which now goes to std::cerr so that
+  // stdout only carries replies
+  std::ostream out(std::cout.rdbuf());
+  std::cout.rdbuf(std::cerr.rdbuf());
+  {
+    Service service(options);
+    service.serve(std::make_shared<StreamConnection>(std::cin, out));
+  }
+  std::cout.rdbuf(out.rdbuf());
+  return 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "panorama_reconstruction.hpp"
+
+// options of the service
+struct PanoramaServiceOptions {
+  // the unix domain socket to listen on, stdin and stdout are used if empty
+  std::string socketPath;
+  // reconstructions running at once, the matlab steps of them take turns
+  int maxConcurrentRequests;
+  // matlab engines the reconstructions share, above one they run on a pool of
+  // that many engines and the single engine is not opened
+  int matlabEngines;
+  // accepted requests waiting for a worker, more are rejected as busy
+  int maxQueuedRequests;
+  // layout annotations kept loaded between requests
+  int maxCachedAnnotations;
+  // heap the running reconstructions may use together in MB, a request only
+  // starts if its estimated peak fits beside the running ones or nothing else
+  // runs, unlimited if <= 0. the peaks are those of misc::MemoryScope, which
+  // are only the mat data unless built with PANORAMIX_TRACK_OPERATOR_NEW
+  int64_t memoryBudgetMB;
+
+  PanoramaServiceOptions()
+      : maxConcurrentRequests(2), matlabEngines(1), maxQueuedRequests(16),
+        maxCachedAnnotations(8), memoryBudgetMB(0) {}
+};
+
+// RunPanoramaService
+// serves reconstructions until a shutdown request or the end of stdin, the
+// matlab engine, the gc estimators, the camera samplers, the workers and the
+// loaded annotations stay alive between requests.
+//
+// requests and replies are json objects, one per line. a request
+//   {"id": "1", "image": "path/to/panorama.jpg",
+//    "options": {"useNativeGeometricContext": true},
+//    "outputs": ["npz", "ply"], "output": "path/to/prefix",
+//    "timeout": 60000, "budgets": {"preparation": 20000, "lsw": 10000}}
+// reconstructs an annotated image, the options override the defaults of the
+// Panorama executable by name, the outputs are any of mat, npz, obj, ply and
+// glb and are written to the prefix (the image path + ".result" by default).
+// the timeout bounds the run and the budgets its stages (preparation, lsw and
+// mg_reconstructed) in ms, stages out of time degrade as the report tells.
+// the replies of it are streamed as they happen, each carries its id:
+//   {"event": "accepted", "queued": n, "estimatedBytes": n},
+//   {"event": "started"},
+//   {"event": "reconstructed", "report": {...}},
+//   {"event": "output", "kind": "ply", "path": "...", "bytes": n} per output,
+//   {"event": "done", "time": ms}
+// or {"event": "rejected" / "error", "message": "..."}.
+// {"id": "2", "command": "status"} replies the counts of the service,
+// {"id": "1", "command": "cancel"} stops the requests of the id at their next
+// stage and {"command": "shutdown"} finishes the accepted requests and quits
+int RunPanoramaService(const PanoramaServiceOptions &options);
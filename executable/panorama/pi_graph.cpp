@@ -115,7 +115,8 @@ int SegmentationForPIGraph(const PanoramicView &view,
                            const std::vector<Classified<Line3>> &lines,
                            Imagei &segs, double lineExtendAngle, double sigma,
                            double c, double minSize,
-                           int widthThresToRemoveThinRegions) {
+                           int widthThresToRemoveThinRegions,
+                           const misc::Deadline &deadline) {
 
   Image3ub im = view.image;
   int width = im.cols;
@@ -175,16 +176,24 @@ int SegmentationForPIGraph(const PanoramicView &view,
   std::vector<Edge> edges;
   edges.reserve(4 * width * height);
 
+  // checked per row, past the deadline no pixels are cut by lines
+  bool cutByLines = true;
   for (int y = 0; y < height; y++) {
+    if (cutByLines && deadline.expired()) {
+      cutByLines = false;
+    }
     for (int x = 0; x < width; x++) {
       Pixel p(x, y);
       Vec3 dir = ind2dir[Sub2Ind(p, width, height)];
       std::set<int> nearbyLines;
-      linesRTree.search(BoundingBox(dir).expand(lineSampleAngle * 3),
-                        [&nearbyLines](const std::pair<Vec3, int> &lineSample) {
-                          nearbyLines.insert(lineSample.second);
-                          return true;
-                        });
+      if (cutByLines) {
+        linesRTree.search(
+            BoundingBox(dir).expand(lineSampleAngle * 3),
+            [&nearbyLines](const std::pair<Vec3, int> &lineSample) {
+              nearbyLines.insert(lineSample.second);
+              return true;
+            });
+      }
 
       static const int dx[] = {1, 0, 1, -1};
       static const int dy[] = {0, 1, 1, 1};
@@ -244,7 +253,11 @@ int SegmentationForPIGraph(const PanoramicView &view,
 
   std::vector<double> thresholds(vertices.size(), c);
   MergeFindSet<Vertex> mfset(vertices.begin(), vertices.end());
+  static const int edgesPerDeadlineCheck = 1 << 14;
   for (int i = 0; i < edges.size(); i++) {
+    if (i % edgesPerDeadlineCheck == 0 && deadline.expired()) {
+      break;
+    }
     const Edge &edge = edges[i];
     int a = mfset.find(edge.ind1);
     int b = mfset.find(edge.ind2);
@@ -1147,7 +1160,8 @@ PIGraph<PanoramicCamera> BuildPIGraph(
     double bndPieceSplitAngleThres, double bndPieceClassifyAngleThres,
     double bndPieceBoundToLineAngleThres, double intersectionAngleThreshold,
     double incidenceAngleAlongDirectionThreshold,
-    double incidenceAngleVerticalDirectionThreshold) {
+    double incidenceAngleVerticalDirectionThreshold,
+    const misc::Deadline &deadline) {
 
   static constexpr bool _inPerspectiveMode =
       std::is_same<std::decay_t<decltype(view.camera)>,
@@ -1654,8 +1668,11 @@ PIGraph<PanoramicCamera> BuildPIGraph(
     }
   }
 
-  // build line relations
+  // build line relations, checked per line
   for (int i = 0; i < mg.lines.size(); i++) {
+    if (deadline.expired()) {
+      break;
+    }
     for (int j = i + 1; j < mg.lines.size(); j++) {
       auto &linei = mg.lines[i].component;
       int clazi = mg.lines[i].claz;
@@ -1748,7 +1765,7 @@ PIGraph<PanoramicCamera> BuildPIGraph(
     // std::cout << lr.topo.hd.id << std::endl;
     if (mg.lineRelation2IsIncidence[i]) {
       mg.lineRelation2weight[i] = IncidenceJunctionWeight(false);
-    } else {
+    } else if (!deadline.expired()) {
       Mat<float, 3, 2> votingData;
       std::fill(std::begin(votingData), std::end(votingData), 0);
 
@@ -2,6 +2,7 @@
 
 #include "basic_types.hpp"
 #include "cameras.hpp"
+#include "clock.hpp"
 #include "utility.hpp"
 
 #include "color.hpp"
@@ -122,21 +123,29 @@ template <class CameraT> struct PIGraph {
   }
 };
 
+// once the deadline expires the remaining pixels are linked without testing
+// the lines between them, and the merging by color stops, the regions are
+// then only merged up to minSize
 int SegmentationForPIGraph(const PanoramicView &view,
                            const std::vector<Classified<Line3>> &lines,
                            Imagei &segs,
                            double lineExtendAngle = DegreesToRadians(5),
                            double sigma = 10.0, double c = 1.0,
                            double minSize = 200,
-                           int widthThresToRemoveThinRegions = 2);
+                           int widthThresToRemoveThinRegions = 2,
+                           const misc::Deadline &deadline = misc::Deadline());
 
+// segs, bnds and line pieces are always complete, once the deadline expires no
+// further line relations are collected and the remaining intersections keep
+// their initial weights
 PIGraph<PanoramicCamera> BuildPIGraph(
     const PanoramicView &view, const std::vector<Vec3> &vps, int verticalVPId,
     const Imagei &segs, const std::vector<Classified<Line3>> &lines,
     double bndPieceSplitAngleThres, double bndPieceClassifyAngleThres,
     double bndPieceBoundToLineAngleThres, double intersectionAngleThreshold,
     double incidenceAngleAlongDirectionThreshold,
-    double incidenceAngleVerticalDirectionThreshold);
+    double incidenceAngleVerticalDirectionThreshold,
+    const misc::Deadline &deadline = misc::Deadline());
 
 PIGraph<PerspectiveCamera> BuildPIGraph(
     const PerspectiveView &view, const std::vector<Vec3> &vps, int verticalVPId,
@@ -0,0 +1,114 @@
+#include <sstream>
+
+#include "pi_graph.hpp"
+
+#include "panoramix.unittest.hpp"
+
+using namespace pano;
+using namespace pano::core;
+using namespace pano::experimental;
+
+namespace {
+// two segs split by one bnd with a line along it
+PIGraph<PanoramicCamera> MakeTwoSegGraph() {
+  PIGraph<PanoramicCamera> mg;
+  mg.view.camera = PanoramicCamera(20);
+  mg.view.image = Image3ub(mg.view.camera.screenSize(), Vec3ub(1, 2, 3));
+  mg.vps = {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)};
+  mg.verticalVPId = 2;
+  mg.segs = Imagei(mg.view.camera.screenSize(), 0);
+  mg.segs.colRange(0, mg.segs.cols / 2).setTo(1);
+  mg.nsegs = 2;
+  mg.seg2bnds = {{0}, {0}};
+  mg.seg2linePieces = {{0}, {}};
+  mg.seg2control = {SegControl{-1, -1, true}, SegControl{2, -1, true}};
+  mg.seg2areaRatio = {0.5, 0.5};
+  mg.fullArea = 4 * M_PI;
+  mg.seg2center = {Vec3(0, 1, 0), Vec3(0, -1, 0)};
+  mg.seg2contours = {{{Vec3(1, 0, 0), Vec3(0, 0, 1), Vec3(-1, 0, 0)},
+                      {Vec3(0, 1, 1)}},
+                     {{Vec3(1, 0, 0), Vec3(0, 0, -1)}, {}}};
+  mg.linePiece2samples = {{Vec3(1, 0, 0.1), Vec3(1, 0, 0.2)}};
+  mg.linePiece2length = {0.1};
+  mg.linePiece2line = {0};
+  mg.linePiece2seg = {0};
+  mg.linePiece2segLineRelation = {SegLineRelation::Attached};
+  mg.linePiece2bndPiece = {-1};
+  mg.linePiece2bndPieceInSameDirection = {true};
+  mg.lines = {Classified<Line3>{2, Line3(Vec3(1, 0, 0.1), Vec3(1, 0, 0.2))}};
+  mg.line2linePieces = {{0}};
+  mg.line2lineRelations = {{}};
+  mg.bndPiece2dirs = {{Vec3(1, 0, 0), Vec3(0, 0, 1)}};
+  mg.bndPiece2length = {M_PI / 2};
+  mg.bndPiece2classes = {-1};
+  mg.bndPiece2bnd = {0};
+  mg.bndPiece2linePieces = {{}};
+  mg.bndPiece2segRelation = {SegRelation::LeftIsFront};
+  mg.bnd2bndPieces = {{0}};
+  mg.bnd2segs = {std::make_pair(0, 1)};
+  mg.bnd2juncs = {std::make_pair(-1, -1)};
+  return mg;
+}
+}
+
+TEST(PIGraph, SaveAndLoad) {
+  auto mg = MakeTwoSegGraph();
+  std::stringstream ss;
+  {
+    BinaryOutputArchive archive(ss);
+    archive(mg);
+  }
+  PIGraph<PanoramicCamera> loaded;
+  {
+    BinaryInputArchive archive(ss);
+    archive(loaded);
+  }
+  EXPECT_EQ(loaded.nsegs, mg.nsegs);
+  EXPECT_EQ(cv::countNonZero(loaded.segs != mg.segs), 0);
+  EXPECT_TRUE(loaded.seg2bnds == mg.seg2bnds);
+  EXPECT_TRUE(loaded.seg2linePieces == mg.seg2linePieces);
+  EXPECT_TRUE(loaded.seg2contours == mg.seg2contours);
+  EXPECT_TRUE(loaded.linePiece2samples == mg.linePiece2samples);
+  EXPECT_TRUE(loaded.linePiece2segLineRelation ==
+              mg.linePiece2segLineRelation);
+  EXPECT_TRUE(loaded.line2linePieces == mg.line2linePieces);
+  EXPECT_TRUE(loaded.line2lineRelations == mg.line2lineRelations);
+  EXPECT_TRUE(loaded.bndPiece2dirs == mg.bndPiece2dirs);
+  EXPECT_TRUE(loaded.bndPiece2linePieces == mg.bndPiece2linePieces);
+  EXPECT_TRUE(loaded.bndPiece2segRelation == mg.bndPiece2segRelation);
+  EXPECT_TRUE(loaded.bnd2bndPieces == mg.bnd2bndPieces);
+  EXPECT_TRUE(loaded.bnd2segs == mg.bnd2segs);
+  EXPECT_TRUE(loaded.junc2bnds == mg.junc2bnds);
+}
+
+TEST(PIGraph, SegmentationStopsAtDeadline) {
+  std::default_random_engine rng(0);
+  std::uniform_int_distribution<int> dist(0, 255);
+  Image3ub im(100, 200);
+  for (auto &p : im) {
+    p = Vec3ub(dist(rng), dist(rng), dist(rng));
+  }
+  auto view = CreatePanoramicView(im);
+  std::vector<Classified<Line3>> lines = {
+      ClassifyAs(Line3(normalize(Vec3(1, 0, -1)), normalize(Vec3(1, 0, 1))),
+                 0)};
+
+  // cancelled, no pixels are cut by the line and nothing is merged by color,
+  // the regions are still merged up to minSize
+  misc::Deadline deadline;
+  deadline.cancel();
+  const int minSize = 200;
+  Imagei segs;
+  int nsegs = SegmentationForPIGraph(view, lines, segs, DegreesToRadians(5),
+                                     10.0, 1.0, minSize, 2, deadline);
+  ASSERT_EQ(im.size(), segs.size());
+  ASSERT_LT(0, nsegs);
+  std::vector<int> seg2size(nsegs, 0);
+  for (int seg : segs) {
+    ASSERT_TRUE(0 <= seg && seg < nsegs);
+    seg2size[seg]++;
+  }
+  for (int size : seg2size) {
+    EXPECT_LE(minSize, size);
+  }
+}
@@ -7,6 +7,7 @@
 #include "segmentation.hpp"
 #include "line_detection.hpp"
 #include "geo_context.hpp"
+#include "rasterizer.hpp"
 
 #include "pi_graph_annotation.hpp"
 #include "pi_graph_annotation_widgets.hpp"
@@ -51,21 +52,28 @@ int PILayoutAnnotation::splitBorderBy(int b, int c) {
   return addBorder(c, secondCornerOfTheHitBorder);
 }
 
+std::vector<int> CanonicalFaceLoop(const std::vector<int> &face) {
+  std::vector<int> loop = face;
+  std::rotate(loop.begin(), std::min_element(loop.begin(), loop.end()),
+              loop.end());
+  return loop;
+}
+
 void PILayoutAnnotation::regenerateFaces() {
+  face2corners.clear();
+  face2control.clear();
+  face2plane.clear();
+  coplanarFacePairs.clear();
+  updateFaces();
+}
 
-  auto oldFace2Plane = std::move(face2plane);
-  auto oldFace2Corners = std::move(face2corners);
-  auto oldFace2Control = std::move(face2control);
+void PILayoutAnnotation::updateFaces() {
 
   std::map<std::pair<int, int>, int> corners2border;
   for (int b = 0; b < nborders(); b++) {
     corners2border[border2corners[b]] = b;
   }
 
-  face2corners.clear();
-  face2plane.clear();
-  coplanarFacePairs.clear();
-
   std::vector<std::pair<int, int>> border2faces(nborders(),
                                                 std::make_pair(-1, -1));
 
@@ -96,11 +104,81 @@ void PILayoutAnnotation::regenerateFaces() {
     });
   }
 
+  // the face on the left of border fromC -> toC, fromC and toC must be
+  // connected
+  auto leftFaceOf = [&corners2border, &border2faces](int fromC,
+                                                     int toC) -> int & {
+    return Contains(corners2border, std::make_pair(fromC, toC))
+               ? border2faces[corners2border.at(std::make_pair(fromC, toC))]
+                     .first
+               : border2faces[corners2border.at(std::make_pair(toC, fromC))]
+                     .second;
+  };
+  // the corner following toC on that face
+  auto nextCornerOf = [&corner2orderedAdjacentCorners](int fromC, int toC) {
+    auto &orderedAdjCs = corner2orderedAdjacentCorners[toC];
+    int fromPositionInAdjCs = -1;
+    for (int i = 0; i < orderedAdjCs.size(); i++) {
+      if (orderedAdjCs[i] == fromC) {
+        fromPositionInAdjCs = i;
+        break;
+      }
+    }
+    assert(fromPositionInAdjCs != -1);
+    return orderedAdjCs[(fromPositionInAdjCs + 1) % orderedAdjCs.size()];
+  };
+
+  // keep the faces whose corner loops are still walked the same way, with
+  // their ids in order, controls, planes and coplanarities
+  std::vector<int> oldFace2face(nfaces(), -1);
+  int nkeptFaces = 0;
+  for (int oldFace = 0; oldFace < nfaces(); oldFace++) {
+    auto &loop = face2corners[oldFace];
+    int n = loop.size();
+    bool kept = n > 0;
+    for (int i = 0; kept && i < n; i++) {
+      int fromC = loop[(i + n - 1) % n], toC = loop[i];
+      kept = fromC != toC &&
+             (Contains(corners2border, std::make_pair(fromC, toC)) ||
+              Contains(corners2border, std::make_pair(toC, fromC))) &&
+             leftFaceOf(fromC, toC) == -1 &&
+             nextCornerOf(fromC, toC) == loop[(i + 1) % n];
+    }
+    if (!kept) {
+      continue;
+    }
+    int faceId = nkeptFaces++;
+    for (int i = 0; i < n; i++) {
+      leftFaceOf(loop[(i + n - 1) % n], loop[i]) = faceId;
+    }
+    oldFace2face[oldFace] = faceId;
+    if (faceId != oldFace) {
+      face2corners[faceId] = std::move(loop);
+      face2control[faceId] = face2control[oldFace];
+      face2plane[faceId] = face2plane[oldFace];
+    }
+  }
+  face2corners.resize(nkeptFaces);
+  face2control.resize(nkeptFaces);
+  face2plane.resize(nkeptFaces);
+  std::vector<std::pair<int, int>> keptCoplanarFacePairs;
+  for (auto &fp : coplanarFacePairs) {
+    int f1 = oldFace2face[fp.first];
+    int f2 = oldFace2face[fp.second];
+    if (f1 != -1 && f2 != -1) {
+      keptCoplanarFacePairs.emplace_back(f1, f2);
+    }
+  }
+  coplanarFacePairs = std::move(keptCoplanarFacePairs);
+
   // start finding faces
+  // border sides are only ever filled, so the scan for the next unfilled one
+  // resumes where the last one stopped
+  int scanStart = 0;
   while (true) {
     int boundaryBorder = -1;
     bool hasNoLeftFace = true;
-    for (int i = 0; i < nborders(); i++) {
+    for (int i = scanStart; i < nborders(); i++) {
       if (border2faces[i].first == -1) {
         hasNoLeftFace = true;
         boundaryBorder = i;
@@ -115,6 +193,7 @@ void PILayoutAnnotation::regenerateFaces() {
     if (boundaryBorder == -1) { // all boundaries are connected
       break;
     }
+    scanStart = boundaryBorder;
 
     int fromC, toC;
     std::tie(fromC, toC) = border2corners[boundaryBorder];
@@ -126,12 +205,7 @@ void PILayoutAnnotation::regenerateFaces() {
     int faceId = face2corners.size() - 1;
 
     while (true) {
-      int &leftFace =
-          Contains(corners2border, std::make_pair(fromC, toC))
-              ? border2faces[corners2border.at(std::make_pair(fromC, toC))]
-                    .first
-              : border2faces[corners2border.at(std::make_pair(toC, fromC))]
-                    .second;
+      int &leftFace = leftFaceOf(fromC, toC);
       if (leftFace != -1) {
         break;
       }
@@ -140,17 +214,7 @@ void PILayoutAnnotation::regenerateFaces() {
       face2corners[faceId].push_back(toC);
 
       // move to next
-      auto &orderedAdjCs = corner2orderedAdjacentCorners[toC];
-      int fromPositionInAdjCs = -1;
-      for (int i = 0; i < orderedAdjCs.size(); i++) {
-        if (orderedAdjCs[i] == fromC) {
-          fromPositionInAdjCs = i;
-          break;
-        }
-      }
-      assert(fromPositionInAdjCs != -1);
-
-      int nextC = orderedAdjCs[(fromPositionInAdjCs + 1) % orderedAdjCs.size()];
+      int nextC = nextCornerOf(fromC, toC);
       assert(nextC != fromC);
       fromC = toC;
       toC = nextC;
@@ -204,29 +268,31 @@ LoadOrInitializeNewLayoutAnnotation(const std::string &imagePath) {
   if (!annofinfo.exists() ||
       !LoadFromDisk(annofinfo.absoluteFilePath().toStdString(), anno)) {
 
-    // initialize new annotation
-    anno.originalImage = cv::imread(imagePath);
+    // initialize new annotation, the original stays in its file
+    anno.originalImage = LazyImage::Referencing(imagePath);
 
     // rectify the image
     std::cout << "rectifying image" << std::endl;
-    anno.rectifiedImage = anno.originalImage.clone();
-    gui::MakePanoramaByHand(anno.rectifiedImage, &anno.extendedOnTop,
+    anno.rectifiedImage = anno.originalImage.get().clone();
+    gui::MakePanoramaByHand(anno.rectifiedImage.edit(), &anno.extendedOnTop,
                             &anno.extendedOnBottom, &anno.topIsPlane,
                             &anno.bottomIsPlane);
 
     // create view
     std::cout << "creating views" << std::endl;
-    Image image = anno.rectifiedImage.clone();
+    Image image = anno.rectifiedImage.get().clone();
     ResizeToHeight(image, 700);
-    anno.view = CreatePanoramicView(image);
+    auto view = CreatePanoramicView(image);
+    anno.viewCamera = view.camera;
+    anno.viewImage = view.image;
 
     // collect lines
     std::cout << "collecting lines" << std::endl;
-    auto cams = CreateCubicFacedCameras(anno.view.camera, image.rows,
-                                        image.rows, image.rows * 0.4);
+    auto cams = CreateCubicFacedCameras(view.camera, image.rows, image.rows,
+                                        image.rows * 0.4);
     std::vector<Line3> rawLine3s;
     for (int i = 0; i < cams.size(); i++) {
-      auto pim = anno.view.sampled(cams[i]).image;
+      auto pim = view.sampled(cams[i]).image;
       LineSegmentExtractor lineExtractor;
       lineExtractor.params().algorithm = LineSegmentExtractor::LSD;
       auto ls = lineExtractor(pim, 3, 300); // use pyramid
@@ -280,10 +346,12 @@ void SaveTempLayoutAnnotation(const std::string &imagePath,
   SaveToDisk(annofinfo.absoluteFilePath().toStdString(), anno);
 }
 
-PIGraph<PanoramicCamera> ConvertToPIGraph(const PILayoutAnnotation &anno) {
-
-  std::vector<Polygon3> polygons(anno.nfaces());
-  for (int i = 0; i < anno.nfaces(); i++) {
+Imagei RasterizeLayoutAnnotation(const PILayoutAnnotation &anno,
+                                 const PanoramicCamera &cam,
+                                 Imaged *depths) {
+  int nfaces = anno.nfaces();
+  std::vector<Polygon3> polygons(nfaces);
+  for (int i = 0; i < nfaces; i++) {
     auto &plane = anno.face2plane[i];
     auto &poly = polygons[i];
     poly.normal = plane.normal;
@@ -293,53 +361,47 @@ PIGraph<PanoramicCamera> ConvertToPIGraph(const PILayoutAnnotation &anno) {
     }
   }
 
+  auto rasterized = RasterizePolygons(polygons, cam);
+  if (depths) {
+    *depths = rasterized.depths;
+  }
+  return rasterized.faceIds;
+}
+
+PIGraph<PanoramicCamera> ConvertToPIGraph(const PILayoutAnnotation &anno,
+                                          int height) {
   View<PanoramicCamera, Image3ub> view =
-      CreatePanoramicView(Image3ub(300, 600));
+      CreatePanoramicView(Image3ub(height, height * 2));
 
-  auto ctable = gui::CreateRandomColorTableWithSize(anno.nfaces());
+  // the face ids are the segmentation
+  Imagei segs = RasterizeLayoutAnnotation(anno, view.camera);
 
+  auto ctable = gui::CreateRandomColorTableWithSize(anno.nfaces());
   for (auto it = view.image.begin(); it != view.image.end(); ++it) {
-    auto p = it.pos();
-    auto direction = view.camera.toSpace(p);
-    Ray3 ray(Origin(), direction);
-    double depth = std::numeric_limits<double>::infinity();
-    int faceid = -1;
-    for (int i = 0; i < anno.nfaces(); i++) {
-      auto &poly = polygons[i];
-      auto inter = IntersectionOfLineAndPolygon(ray, poly);
-      if (inter.failed()) {
-        continue;
-      }
-      double curDepth = norm(inter.unwrap());
-      if (curDepth < depth) {
-        depth = curDepth;
-        faceid = i;
-      }
+    int faceid = segs(it.pos());
+    if (faceid == -1) {
+      *it = Vec3ub(0, 0, 0);
+    } else {
+      *it = ctable[faceid];
     }
-    *it = ctable[faceid];
   }
 
-  Imagei segs;
-  int nsegs;
-
-  // estimate segs
-  nsegs = SegmentationForPIGraph(view, {}, segs, DegreesToRadians(1));
   RemoveThinRegionInSegmentation(segs, 1, true);
-  nsegs = DensifySegmentation(segs, true);
+  DensifySegmentation(segs, true);
   assert(IsDenseSegmentation(segs));
 
-  PIGraph<PanoramicCamera> mg = BuildPIGraph(view, anno.vps, anno.vertVPId, segs, {},
-                            DegreesToRadians(1), DegreesToRadians(1),
-                            DegreesToRadians(2), DegreesToRadians(5),
-                            DegreesToRadians(60), DegreesToRadians(5));
+  PIGraph<PanoramicCamera> mg = BuildPIGraph(
+      view, anno.vps, anno.vertVPId, segs, {}, DegreesToRadians(1),
+      DegreesToRadians(1), DegreesToRadians(2), DegreesToRadians(5),
+      DegreesToRadians(60), DegreesToRadians(5));
 
   return mg;
 }
 
 Imageb GuessMask(const PILayoutAnnotation &anno) {
-  int w = anno.rectifiedImage.cols;
-  int h = anno.rectifiedImage.rows;
-  Image3ub im = anno.rectifiedImage;
+  Image3ub im = anno.rectifiedImage.get();
+  int w = im.cols;
+  int h = im.rows;
   int topH = 0;
   if (anno.extendedOnTop) {
     for (; topH < h / 2; topH++) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "basic_types.hpp"
+#include "lazy_image.hpp"
 #include "utility.hpp"
 
 #include "pi_graph.hpp"
@@ -13,15 +14,19 @@ using namespace pano::core;
 struct PILayoutAnnotation {
   std::string impath; // ver1
 
-  Image originalImage;
-  Image rectifiedImage;
+  // decoded on first access, the original refers to the image file since
+  // ver2, the others are png encoded
+  LazyImage originalImage;
+  LazyImage rectifiedImage;
   bool extendedOnTop;
   bool extendedOnBottom;
 
   bool topIsPlane;    // ver1
   bool bottomIsPlane; // ver1
 
-  PanoramicView view;
+  // the view of the rectified image at the working height
+  PanoramicCamera viewCamera;
+  LazyImage viewImage;
   std::vector<Vec3> vps;
   int vertVPId;
 
@@ -47,28 +52,68 @@ struct PILayoutAnnotation {
   int addBorder(int c1, int c2);
   int splitBorderBy(int b, int c);
 
+  // traces all faces anew, resetting their controls, planes and coplanarities
   void regenerateFaces();
+  // traces only the faces whose corner loops were broken by edits to corners
+  // or borders, the others keep their ids in order, controls, planes and
+  // coplanarities
+  void updateFaces();
   int setCoplanar(int f1, int f2);
 
+  PanoramicView view() const {
+    return PanoramicView(viewImage.get(), viewCamera);
+  }
+
   template <class Archiver>
-  inline void serialize(Archiver &ar, std::int32_t version) {
-    if (version == 0) {
-      ar(originalImage, rectifiedImage, extendedOnTop, extendedOnBottom);
-      ar(view, vps, vertVPId);
-      ar(corners, border2corners, border2connected);
-      ar(face2corners, face2control, face2plane, coplanarFacePairs, clutters);
-    } else if (version == 1) {
+  inline void save(Archiver &ar, std::int32_t version) const {
+    ar(impath);
+    ar(originalImage, rectifiedImage, extendedOnTop, extendedOnBottom);
+    ar(topIsPlane, bottomIsPlane);
+    ar(viewCamera, viewImage, vps, vertVPId);
+    ar(lines);
+    ar(corners, border2corners, border2connected);
+    ar(face2corners, face2control, face2plane, coplanarFacePairs, clutters);
+  }
+
+  template <class Archiver>
+  inline void load(Archiver &ar, std::int32_t version) {
+    if (version >= 2) {
       ar(impath);
       ar(originalImage, rectifiedImage, extendedOnTop, extendedOnBottom);
       ar(topIsPlane, bottomIsPlane);
-      ar(view, vps, vertVPId);
+      ar(viewCamera, viewImage, vps, vertVPId);
       ar(lines);
       ar(corners, border2corners, border2connected);
       ar(face2corners, face2control, face2plane, coplanarFacePairs, clutters);
+      return;
     }
+    // the raw images of ver0 and ver1 are png encoded when saved again
+    Image original, rectified;
+    PanoramicView rawView;
+    if (version == 1) {
+      ar(impath);
+    }
+    ar(original, rectified, extendedOnTop, extendedOnBottom);
+    if (version == 1) {
+      ar(topIsPlane, bottomIsPlane);
+    }
+    ar(rawView, vps, vertVPId);
+    if (version == 1) {
+      ar(lines);
+    }
+    ar(corners, border2corners, border2connected);
+    ar(face2corners, face2control, face2plane, coplanarFacePairs, clutters);
+    originalImage = original;
+    rectifiedImage = rectified;
+    viewCamera = rawView.camera;
+    viewImage = rawView.image;
   }
 };
 
+// CanonicalFaceLoop
+// rotates the corner loop of a face to start from its smallest corner
+std::vector<int> CanonicalFaceLoop(const std::vector<int> &face);
+
 std::string LayoutAnnotationFilePath(const std::string &imagePath);
 
 PILayoutAnnotation
@@ -81,7 +126,18 @@ void SaveLayoutAnnotation(const std::string &imagePath,
                           const PILayoutAnnotation &anno);
 
 Imageb GuessMask(const PILayoutAnnotation &anno);
+
+// RasterizeLayoutAnnotation
+// renders the face id (-1 if none) visible at each pixel of the panorama of
+// cam, writes the distance to the visible face into depths (0 if none)
+Imagei RasterizeLayoutAnnotation(const PILayoutAnnotation &anno,
+                                 const PanoramicCamera &cam,
+                                 Imaged *depths = nullptr);
+
+// ConvertToPIGraph
+PIGraph<PanoramicCamera> ConvertToPIGraph(const PILayoutAnnotation &anno,
+                                          int height = 300);
 }
 }
 
-CEREAL_CLASS_VERSION(pano::experimental::PILayoutAnnotation, 1);
\ No newline at end of file
+CEREAL_CLASS_VERSION(pano::experimental::PILayoutAnnotation, 2);
\ No newline at end of file
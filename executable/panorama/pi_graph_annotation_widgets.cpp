@@ -237,6 +237,15 @@ PILayoutAnnotationWidget::PILayoutAnnotationWidget(
           });
   defaultAction->setShortcut(tr("Ctrl+Shift+F"));
   addAction(defaultAction);
+  connect(defaultAction = new QAction(tr("Update Faces"), this),
+          &QAction::triggered, [this]() {
+            _anno->updateFaces();
+            rebuildLayoutScene();
+            clearStroke();
+            update();
+          });
+  defaultAction->setShortcut(tr("Ctrl+Shift+U"));
+  addAction(defaultAction);
 
   {
     QAction *sep = new QAction(this);
@@ -267,12 +276,12 @@ void PILayoutAnnotationWidget::setCurAnnotation(PILayoutAnnotation *anno,
 
   _cornerClicked = _borderClicked = _faceClicked = -1;
 
-  assert(!anno->view.image.empty());
-  auto im = anno->view.image;
+  assert(!anno->viewImage.empty());
+  auto im = anno->viewImage.get();
 
   // build image scene
   SceneBuilder sb;
-  ResourceStore::set("tex", anno->rectifiedImage);
+  ResourceStore::set("tex", anno->rectifiedImage.get());
   Sphere3 sp;
   sp.center = Origin();
   sp.radius = visualDepthImage;
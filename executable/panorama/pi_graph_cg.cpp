@@ -1,6 +1,8 @@
 #include "pch.hpp"
 
+#include "algorithms.hpp"
 #include "containers.hpp"
+#include "parallel.hpp"
 #include "geo_context.hpp"
 #include "line_detection.hpp"
 #include "segmentation.hpp"
@@ -163,6 +165,64 @@ PIConstraintGraph::Entity::SupportingPlane::SupportingPlane(
   }
 }
 
+namespace {
+// runs emit(i, buffer) for items [0, n) on contiguous chunks in parallel, and
+// concatenates the per-chunk buffers in item order
+template <class T, class EmitFunT>
+std::vector<T> EmitInParallel(int n, EmitFunT &&emit) {
+  int nchunks =
+      std::min<int>(std::max<int>(std::thread::hardware_concurrency(), 1), n);
+  std::vector<std::vector<T>> chunk2results(nchunks);
+  ParallelRun(nchunks, nchunks, [&](int chunk) {
+    int first = (long long)n * chunk / nchunks;
+    int last = (long long)n * (chunk + 1) / nchunks;
+    for (int i = first; i < last; i++) {
+      emit(i, chunk2results[chunk]);
+    }
+  });
+  size_t nresults = 0;
+  for (auto &results : chunk2results) {
+    nresults += results.size();
+  }
+  std::vector<T> results;
+  results.reserve(nresults);
+  for (auto &rs : chunk2results) {
+    std::move(rs.begin(), rs.end(), std::back_inserter(results));
+  }
+  return results;
+}
+
+// fills ent2cons in constraint order by counting and prefix sums, a constraint
+// is registered only if both its entities exist
+void BuildEnt2Cons(PIConstraintGraph &cg) {
+  int nents = cg.entities.size();
+  std::vector<int> offsets(nents + 1, 0);
+  for (auto &c : cg.constraints) {
+    if (c.ent1 == -1 || c.ent2 == -1) {
+      continue;
+    }
+    offsets[c.ent1 + 1]++;
+    offsets[c.ent2 + 1]++;
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  std::vector<int> cons(offsets.back());
+  std::vector<int> cursors(offsets.begin(), offsets.end() - 1);
+  for (int con = 0; con < cg.constraints.size(); con++) {
+    auto &c = cg.constraints[con];
+    if (c.ent1 == -1 || c.ent2 == -1) {
+      continue;
+    }
+    cons[cursors[c.ent1]++] = con;
+    cons[cursors[c.ent2]++] = con;
+  }
+  cg.ent2cons.resize(nents);
+  for (int ent = 0; ent < nents; ent++) {
+    cg.ent2cons[ent].assign(cons.begin() + offsets[ent],
+                            cons.begin() + offsets[ent + 1]);
+  }
+}
+}
+
 PIConstraintGraph
 BuildPIConstraintGraph(const PIGraph<PanoramicCamera> &mg, double minAngleThresForAWideEdge,
                        double weightRatioForCoplanarityWithLines) {
@@ -180,188 +240,178 @@ BuildPIConstraintGraph(const PIGraph<PanoramicCamera> &mg, double minAngleThresF
   using Constraint = PIConstraintGraph::Constraint;
 
   // add entities
-  // add segs
+  // number the used segs and lines first
+  int nents = 0;
   for (int i = 0; i < mg.nsegs; i++) {
-    if (!mg.seg2control[i].used) {
-      continue;
+    if (mg.seg2control[i].used) {
+      seg2ent[i] = nents++;
     }
-
-    Entity e;
-    e.type = Entity::IsSeg;
-    e.id = i;
-    e.size = mg.seg2areaRatio[i] * 100;
-
-    auto &control = mg.seg2control[i];
-    e.supportingPlane = PIConstraintGraph::Entity::SupportingPlane(
-        control, mg.seg2center[i], mg.vps);
-    entities.push_back(e);
-
-    int ent = entities.size() - 1;
-    seg2ent[i] = ent;
   }
-  // add lines
   for (int i = 0; i < mg.nlines(); i++) {
-    if (!mg.line2used.empty() && !mg.line2used[i]) {
-      continue;
+    if (mg.line2used.empty() || mg.line2used[i]) {
+      line2ent[i] = nents++;
     }
-
-    Entity e;
-    e.type = Entity::IsLine;
-    e.id = i;
-    e.size = AngleBetweenDirected(mg.lines[i].component.first,
-                                    mg.lines[i].component.second);
-
-    e.supportingPlane =
-        PIConstraintGraph::Entity::SupportingPlane(mg.lines[i], mg.vps);
-    entities.push_back(e);
-
-    int ent = entities.size() - 1;
-    line2ent[i] = ent;
   }
+  entities.resize(nents);
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    // add segs
+    for (int i = t; i < mg.nsegs; i += concurrency) {
+      if (seg2ent[i] == -1) {
+        continue;
+      }
+      Entity &e = entities[seg2ent[i]];
+      e.type = Entity::IsSeg;
+      e.id = i;
+      e.size = mg.seg2areaRatio[i] * 100;
+
+      auto &control = mg.seg2control[i];
+      e.supportingPlane = PIConstraintGraph::Entity::SupportingPlane(
+          control, mg.seg2center[i], mg.vps);
+    }
+    // add lines
+    for (int i = t; i < mg.nlines(); i += concurrency) {
+      if (line2ent[i] == -1) {
+        continue;
+      }
+      Entity &e = entities[line2ent[i]];
+      e.type = Entity::IsLine;
+      e.id = i;
+      e.size = AngleBetweenDirected(mg.lines[i].component.first,
+                                    mg.lines[i].component.second);
 
-  auto &ent2cons = cg.ent2cons;
-  ent2cons.resize(entities.size()); // enttity -> constraints
+      e.supportingPlane =
+          PIConstraintGraph::Entity::SupportingPlane(mg.lines[i], mg.vps);
+    }
+  });
 
   // add constraints
   // bndpieces, seg-seg
-  for (int i = 0; i < mg.nbndPieces(); i++) {
-    if (mg.bndPiece2segRelation[i] != SegRelation::Connected) {
-      continue;
-    }
-    Constraint connect;
-    connect.type = Constraint::Connection;
-    auto &segPair = mg.bnd2segs[mg.bndPiece2bnd[i]];
-    connect.ent1 = seg2ent[segPair.first];
-    connect.ent2 = seg2ent[segPair.second];
-    double len = mg.bndPiece2length[i];
-    connect.weight = len;
-    if (len >= minAngleThresForAWideEdge) {
-      connect.anchors = {mg.bndPiece2dirs[i].front(),
-                         mg.bndPiece2dirs[i].back()};
-    } else {
-      connect.anchors = {
-          normalize(mg.bndPiece2dirs[i].front() + mg.bndPiece2dirs[i].back())};
-    }
-    constraints.push_back(connect);
-    int connectCon = constraints.size() - 1;
-    if (connect.ent1 == -1 || connect.ent2 == -1) {
-      continue;
-    }
-    ent2cons[connect.ent1].push_back(connectCon);
-    ent2cons[connect.ent2].push_back(connectCon);
+  auto bndPieceConstraints = EmitInParallel<Constraint>(
+      mg.nbndPieces(), [&](int i, std::vector<Constraint> &cs) {
+        if (mg.bndPiece2segRelation[i] != SegRelation::Connected) {
+          return;
+        }
+        Constraint connect;
+        connect.type = Constraint::Connection;
+        auto &segPair = mg.bnd2segs[mg.bndPiece2bnd[i]];
+        connect.ent1 = seg2ent[segPair.first];
+        connect.ent2 = seg2ent[segPair.second];
+        double len = mg.bndPiece2length[i];
+        connect.weight = len;
+        if (len >= minAngleThresForAWideEdge) {
+          connect.anchors = {mg.bndPiece2dirs[i].front(),
+                             mg.bndPiece2dirs[i].back()};
+        } else {
+          connect.anchors = {normalize(mg.bndPiece2dirs[i].front() +
+                                       mg.bndPiece2dirs[i].back())};
+        }
+        // a connection with a missing entity is kept in constraints but never
+        // registered in ent2cons
+        cs.push_back(connect);
+        if (connect.ent1 == -1 || connect.ent2 == -1) {
+          return;
+        }
 
-    // check whether this bp lies on a line
-    if (!mg.bndPiece2linePieces[i].empty() || len < minAngleThresForAWideEdge) {
-      // if so, no planarity will be assigned
-      continue;
-    }
+        // check whether this bp lies on a line
+        if (!mg.bndPiece2linePieces[i].empty() ||
+            len < minAngleThresForAWideEdge) {
+          // if so, no planarity will be assigned
+          return;
+        }
 
-    // the coplanarity constraint if there are no lines on the bndpiece
-    // if (mg.bndPiece2linePieces[i].empty())
-    {
-      Constraint coplanar;
-      coplanar.type = Constraint::Coplanarity;
-      coplanar.ent1 = connect.ent1;
-      coplanar.ent2 = connect.ent2;
-      coplanar.weight = len * (mg.bndPiece2linePieces[i].empty()
-                                   ? 1.0
-                                   : weightRatioForCoplanarityWithLines);
-      // coplanar.anchorOrientation = -1;
-      constraints.push_back(coplanar);
-      int coplanarCon = constraints.size() - 1;
-      ent2cons[coplanar.ent1].push_back(coplanarCon);
-      ent2cons[coplanar.ent2].push_back(coplanarCon);
-    }
-  }
+        // the coplanarity constraint if there are no lines on the bndpiece
+        // if (mg.bndPiece2linePieces[i].empty())
+        {
+          Constraint coplanar;
+          coplanar.type = Constraint::Coplanarity;
+          coplanar.ent1 = connect.ent1;
+          coplanar.ent2 = connect.ent2;
+          coplanar.weight = len * (mg.bndPiece2linePieces[i].empty()
+                                       ? 1.0
+                                       : weightRatioForCoplanarityWithLines);
+          // coplanar.anchorOrientation = -1;
+          cs.push_back(coplanar);
+        }
+      });
 
   // linepieces, seg-line
-  for (int i = 0; i < mg.nlinePieces(); i++) {
-    if (mg.linePiece2segLineRelation[i] == SegLineRelation::Detached) {
-      continue;
-    }
-    int bndPiece = mg.linePiece2bndPiece[i];
-    int line = mg.linePiece2line[i];
-    if (bndPiece == -1) {
-      int seg = mg.linePiece2seg[i];
-      assert(seg != -1);
-      Constraint c;
-      c.type = Constraint::Connection;
-      c.ent1 = seg2ent[seg];
-      c.ent2 = line2ent[line];
-      if (c.ent1 == -1 || c.ent2 == -1) {
-        continue;
-      }
-      double len = mg.linePiece2length[i];
-      c.weight = len;
-      if (len >= minAngleThresForAWideEdge) {
-        c.anchors = {mg.linePiece2samples[i].front(),
-                     mg.linePiece2samples[i].back()};
-      } else {
-        c.anchors = {normalize(mg.linePiece2samples[i].front() +
-                               mg.linePiece2samples[i].back())};
-      }
-      constraints.push_back(c);
-      int con = constraints.size() - 1;
-      ent2cons[c.ent1].push_back(con);
-      ent2cons[c.ent2].push_back(con);
-    } else {
-      int segPair[] = {-1, -1};
-      std::tie(segPair[0], segPair[1]) = mg.bnd2segs[mg.bndPiece2bnd[bndPiece]];
-      auto segRelation = mg.bndPiece2segRelation[bndPiece];
-      bool connected[] = {segRelation == SegRelation::Connected ||
-                              segRelation == SegRelation::LeftIsFront,
-                          segRelation == SegRelation::Connected ||
-                              segRelation == SegRelation::RightIsFront};
-      for (int k = 0; k < 2; k++) {
-        int seg = segPair[k];
-        if (!connected[k]) {
-          continue;
+  auto linePieceConstraints = EmitInParallel<Constraint>(
+      mg.nlinePieces(), [&](int i, std::vector<Constraint> &cs) {
+        if (mg.linePiece2segLineRelation[i] == SegLineRelation::Detached) {
+          return;
+        }
+        int bndPiece = mg.linePiece2bndPiece[i];
+        int line = mg.linePiece2line[i];
+        int segs[] = {-1, -1};
+        bool connected[] = {false, false};
+        if (bndPiece == -1) {
+          segs[0] = mg.linePiece2seg[i];
+          assert(segs[0] != -1);
+          connected[0] = true;
+        } else {
+          std::tie(segs[0], segs[1]) = mg.bnd2segs[mg.bndPiece2bnd[bndPiece]];
+          auto segRelation = mg.bndPiece2segRelation[bndPiece];
+          connected[0] = segRelation == SegRelation::Connected ||
+                         segRelation == SegRelation::LeftIsFront;
+          connected[1] = segRelation == SegRelation::Connected ||
+                         segRelation == SegRelation::RightIsFront;
+        }
+        for (int k = 0; k < 2; k++) {
+          int seg = segs[k];
+          if (!connected[k]) {
+            continue;
+          }
+          Constraint c;
+          c.type = Constraint::Connection;
+          c.ent1 = seg2ent[seg];
+          c.ent2 = line2ent[line];
+          if (c.ent1 == -1 || c.ent2 == -1) {
+            continue;
+          }
+          double len = mg.linePiece2length[i];
+          c.weight = len;
+          if (len >= minAngleThresForAWideEdge) {
+            c.anchors = {mg.linePiece2samples[i].front(),
+                         mg.linePiece2samples[i].back()};
+          } else {
+            c.anchors = {normalize(mg.linePiece2samples[i].front() +
+                                   mg.linePiece2samples[i].back())};
+          }
+          cs.push_back(c);
+        }
+      });
+
+  // linerelations, line-line
+  auto lineRelationConstraints = EmitInParallel<Constraint>(
+      mg.nlineRelations(), [&](int i, std::vector<Constraint> &cs) {
+        if (mg.lineRelations[i] == LineRelation::Detached) {
+          return;
         }
         Constraint c;
         c.type = Constraint::Connection;
-        c.ent1 = seg2ent[seg];
-        c.ent2 = line2ent[line];
+        auto &linePair = mg.lineRelation2lines[i];
+        c.ent1 = line2ent[linePair.first];
+        c.ent2 = line2ent[linePair.second];
         if (c.ent1 == -1 || c.ent2 == -1) {
-          continue;
-        }
-        double len = mg.linePiece2length[i];
-        c.weight = len;
-        if (len >= minAngleThresForAWideEdge) {
-          c.anchors = {mg.linePiece2samples[i].front(),
-                       mg.linePiece2samples[i].back()};
-        } else {
-          c.anchors = {normalize(mg.linePiece2samples[i].front() +
-                                 mg.linePiece2samples[i].back())};
+          return;
         }
-        constraints.push_back(c);
-        int con = constraints.size() - 1;
-        ent2cons[c.ent1].push_back(con);
-        ent2cons[c.ent2].push_back(con);
-      }
-    }
+        c.weight = mg.lineRelation2weight[i];
+        c.anchors = {mg.lineRelation2anchor[i]};
+        // c.anchorOrientation = -1;
+        cs.push_back(c);
+      });
+
+  constraints.reserve(bndPieceConstraints.size() +
+                      linePieceConstraints.size() +
+                      lineRelationConstraints.size());
+  for (auto *cs : {&bndPieceConstraints, &linePieceConstraints,
+                   &lineRelationConstraints}) {
+    std::move(cs->begin(), cs->end(), std::back_inserter(constraints));
   }
 
-  // linerelations, line-line
-  for (int i = 0; i < mg.nlineRelations(); i++) {
-    if (mg.lineRelations[i] == LineRelation::Detached) {
-      continue;
-    }
-    Constraint c;
-    c.type = Constraint::Connection;
-    auto &linePair = mg.lineRelation2lines[i];
-    c.ent1 = line2ent[linePair.first];
-    c.ent2 = line2ent[linePair.second];
-    if (c.ent1 == -1 || c.ent2 == -1) {
-      continue;
-    }
-    c.weight = mg.lineRelation2weight[i];
-    c.anchors = {mg.lineRelation2anchor[i]};
-    // c.anchorOrientation = -1;
-    constraints.push_back(c);
-    int con = constraints.size() - 1;
-    ent2cons[c.ent1].push_back(con);
-    ent2cons[c.ent2].push_back(con);
-  }
+  // enttity -> constraints
+  BuildEnt2Cons(cg);
 
   cg.cons2enabled.resize(constraints.size(), true);
 
@@ -754,110 +804,168 @@ PIConstraintGraph BuildPIConstraintGraph(
   return cg;
 }
 
-// the staibility info
+namespace {
+// the staibility info, a small value so that root trials can copy it on write
 struct Stability {
-  virtual int dof() const = 0;
-  virtual void addAnchor(const Vec3 &anchor, double angleThres) = 0;
-  virtual Stability *clone() const = 0;
-  virtual void stablize() = 0;
-};
-bool supportersAreValid(const std::vector<Vec3> &supporters,
-                        double angleThres) {
-  for (int i = 0; i < supporters.size(); i++) {
-    for (int j = i + 1; j < supporters.size(); j++) {
-      if (AngleBetweenDirected(supporters[i], supporters[j]) <= angleThres) {
-        return false;
-      }
-    }
+  int maxDof; // the dof of the supporting plane, 1, 2 or 3
+  Vec3 axis;  // the axis of a dof 2 plane
+  int nsupporters;
+  Vec3 supporters[3];
+
+  Stability() : maxDof(0), nsupporters(0) {}
+  explicit Stability(const PIConstraintGraph::Entity::SupportingPlane &sp)
+      : maxDof(sp.dof), axis(sp.along), nsupporters(0) {
+    assert(maxDof >= 1 && maxDof <= 3);
   }
-  return true;
-}
-struct Dof3Stability : Stability {
-  std::vector<Vec3> supporters;
-  Dof3Stability() {}
-  Dof3Stability(const Dof3Stability &s) = default;
-  virtual int dof() const override { return 3 - supporters.size(); }
-  virtual void addAnchor(const Vec3 &anchor, double angleThres) override {
-    assert(supporters.size() <= 3);
-    if (supporters.size() == 3) {
+
+  int dof() const { return maxDof - nsupporters; }
+  void addAnchor(const Vec3 &anchor, double angleThres) {
+    assert(nsupporters <= maxDof);
+    if (nsupporters == maxDof) {
       return;
     }
-    if (supporters.empty()) {
-      supporters.push_back(anchor);
-    } else if (supporters.size() == 1) {
-      if (AngleBetweenDirected(supporters[0], anchor) > angleThres) {
-        supporters.push_back(anchor);
+    if (maxDof == 1 || nsupporters == 0) {
+      supporters[nsupporters++] = anchor;
+    } else if (nsupporters == 1) {
+      double angle =
+          maxDof == 3
+              ? AngleBetweenDirected(supporters[0], anchor)
+              : AngleDistanceBetweenPointAndRay(anchor,
+                                                Ray3(supporters[0], axis));
+      if (angle > angleThres) {
+        supporters[nsupporters++] = anchor;
       }
-    } else if (supporters.size() == 2) {
+    } else if (nsupporters == 2) {
       if (AngleDistanceBetweenPointAndRay(
-              anchor, Line3(supporters[0], supporters[1]).ray()) > angleThres) {
-        supporters.push_back(anchor);
+              anchor, Line3(supporters[0], supporters[1]).ray()) >
+          angleThres) {
+        supporters[nsupporters++] = anchor;
       }
     }
-    assert(supportersAreValid(supporters, angleThres));
+    assert(maxDof == 1 || supportersAreValid(angleThres));
   }
-  virtual Stability *clone() const override { return new Dof3Stability(*this); }
-  virtual void stablize() override { supporters.resize(3); }
-};
-struct Dof2Stability : Stability {
-  Vec3 axis;
-  std::vector<Vec3> supporters;
-  explicit Dof2Stability(const Vec3 &a) : axis(a) {}
-  Dof2Stability(const Dof2Stability &s) = default;
-  virtual int dof() const override { return 2 - supporters.size(); }
-  virtual void addAnchor(const Vec3 &anchor, double angleThres) override {
-    assert(supporters.size() <= 2);
-    if (supporters.size() == 2) {
-      return;
+  void stablize() {
+    for (int i = nsupporters; i < maxDof; i++) {
+      supporters[i] = Vec3();
     }
-    if (supporters.empty()) {
-      supporters.push_back(anchor);
-    } else if (supporters.size() == 1) {
-      if (AngleDistanceBetweenPointAndRay(anchor, Ray3(supporters[0], axis)) >
-          angleThres) {
-        supporters.push_back(anchor);
+    nsupporters = maxDof;
+  }
+
+private:
+  bool supportersAreValid(double angleThres) const {
+    for (int i = 0; i < nsupporters; i++) {
+      for (int j = i + 1; j < nsupporters; j++) {
+        if (AngleBetweenDirected(supporters[i], supporters[j]) <= angleThres) {
+          return false;
+        }
       }
     }
-    assert(supportersAreValid(supporters, angleThres));
+    return true;
   }
-  virtual Stability *clone() const override { return new Dof2Stability(*this); }
-  virtual void stablize() override { supporters.resize(2); }
 };
-struct Dof1Stability : Stability {
-  bool stable;
-  Dof1Stability() : stable(false) {}
-  Dof1Stability(const Dof1Stability &s) = default;
-  virtual int dof() const override { return stable ? 0 : 1; }
-  virtual void addAnchor(const Vec3 &anchor, double angleThres) override {
-    stable = true;
+
+// the state of growing a determinable part from a root
+// stabilities are copied from the shared ones on write, both the copies and
+// the collected flags are invalidated by bumping the stamp
+struct DeterminablePartTrial {
+  std::vector<int> ent2stabStamp;
+  std::vector<Stability> ent2stab;
+  std::vector<int> ent2collectedStamp;
+  int stamp;
+  std::vector<int> entsCollected;
+
+  explicit DeterminablePartTrial(int nents)
+      : ent2stabStamp(nents, 0), ent2stab(nents), ent2collectedStamp(nents, 0),
+        stamp(0) {}
+
+  Stability &stab(const std::vector<Stability> &shared, int ent) {
+    if (ent2stabStamp[ent] != stamp) {
+      ent2stabStamp[ent] = stamp;
+      ent2stab[ent] = shared[ent];
+    }
+    return ent2stab[ent];
+  }
+  const Stability &stab(const std::vector<Stability> &shared, int ent) const {
+    return ent2stabStamp[ent] == stamp ? ent2stab[ent] : shared[ent];
   }
-  virtual Stability *clone() const override { return new Dof1Stability(*this); }
-  virtual void stablize() override { stable = true; }
+  bool collected(int ent) const { return ent2collectedStamp[ent] == stamp; }
 };
 
+// grows the determinable part from root through the usable constraints of
+// each entity, returns false if it is cancelled
+template <class CancelledT>
+bool GrowDeterminablePart(const PIConstraintGraph &cg,
+                          const CSRTable<int> &ent2usableCons,
+                          const std::vector<Stability> &ent2stab, int root,
+                          double angleThres, bool connectAll,
+                          DeterminablePartTrial &trial,
+                          CancelledT &&cancelled) {
+  trial.stamp++;
+  trial.entsCollected.clear();
+
+  trial.stab(ent2stab, root).stablize();
+  assert(trial.stab(ent2stab, root).dof() == 0);
+
+  MaxHeap<int, int, std::greater<int>> Q; // a min heap recording dofs
+  Q.set(root, trial.stab(ent2stab, root).dof());
+  while (!Q.empty()) {
+    if (cancelled()) {
+      return false;
+    }
+    int curEnt = Q.top();
+    int curEntDoF = trial.stab(ent2stab, curEnt).dof();
+    if (curEntDoF != 0) { // all remaining adjacent entities are not stable,
+                          // stop the search
+      break;
+    }
+    Q.pop();
+    trial.ent2collectedStamp[curEnt] = trial.stamp;
+    trial.entsCollected.push_back(curEnt);
+    for (int con : ent2usableCons[curEnt]) {
+      auto &c = cg.constraints[con];
+      int adjEnt = c.ent1 == curEnt ? c.ent2 : c.ent1;
+      if (trial.collected(adjEnt)) {
+        continue;
+      }
+
+      auto &adjStab = trial.stab(ent2stab, adjEnt);
+      if (connectAll) {
+        adjStab.stablize(); ///////// !!!!!
+      } else {
+        if (c.isConnection()) {
+          for (auto &anchor : c.anchors) {
+            adjStab.addAnchor(anchor, angleThres);
+          }
+        } else if (c.isCoplanarity()) {
+          assert(cg.entities[adjEnt].isSeg());
+          adjStab.stablize();
+        }
+      }
+      Q.set(adjEnt, adjStab.dof());
+    }
+  }
+  return true;
+}
+}
+
 PICGDeterminablePart LocateDeterminablePart(const PIConstraintGraph &cg,
                                             double angleThres,
                                             bool connectAll) {
   PICGDeterminablePart dp;
+  dp.rootEnt = -1;
+
+  int nents = cg.entities.size();
 
   // collect ent stabilities
-  std::vector<std::unique_ptr<Stability>> ent2stab(cg.entities.size());
-  for (int ent = 0; ent < cg.entities.size(); ent++) {
-    auto &e = cg.entities[ent];
-    if (e.supportingPlane.dof == 1) {
-      ent2stab[ent] = std::make_unique<Dof1Stability>();
-    } else if (e.supportingPlane.dof == 2) {
-      ent2stab[ent] = std::make_unique<Dof2Stability>(e.supportingPlane.along);
-    } else if (e.supportingPlane.dof == 3) {
-      ent2stab[ent] = std::make_unique<Dof3Stability>();
-    }
+  std::vector<Stability> ent2stab(nents);
+  for (int ent = 0; ent < nents; ent++) {
+    ent2stab[ent] = Stability(cg.entities[ent].supportingPlane);
   }
 
   // select the largest dof1 ent as the root!
   std::vector<int> rootCands;
-  for (int i = 0; i < cg.entities.size(); i++) {
-    int sz = cg.entities[i].size;
-    if (ent2stab[i]->dof() != 1) {
+  for (int i = 0; i < nents; i++) {
+    if (ent2stab[i].dof() != 1) {
       continue;
     }
     rootCands.push_back(i);
@@ -870,74 +978,106 @@ PICGDeterminablePart LocateDeterminablePart(const PIConstraintGraph &cg,
     return dp;
   }
 
-  for (int root : rootCands) {
-    std::cout << "root: " << root << std::endl;
-    std::set<int> entsCollected;
+  // the enabled constraints with nonzero weights of each entity, frozen once
+  // since every trial traverses them
+  CSRTable<int> ent2usableCons;
+  {
+    std::vector<std::vector<int>> usable(nents);
+    for (int ent = 0; ent < nents; ent++) {
+      for (int con : cg.ent2cons[ent]) {
+        if (cg.cons2enabled[con] && cg.constraints[con].weight != 0.0) {
+          usable[ent].push_back(con);
+        }
+      }
+    }
+    ent2usableCons = CSRTable<int>(usable);
+  }
 
-    // initialize stabilities of entities
-    std::vector<std::unique_ptr<Stability>> ent2stabHere(cg.entities.size());
-    for (int ent = 0; ent < cg.entities.size(); ent++) {
-      ent2stabHere[ent] = std::unique_ptr<Stability>(ent2stab[ent]->clone());
+  // a root can never collect more than its connected component through the
+  // usable constraints, skip those whose components are too small
+  std::vector<int> ent2cc(nents, -1);
+  std::vector<int> cc2size;
+  {
+    std::vector<int> ents(nents);
+    std::iota(ents.begin(), ents.end(), 0);
+    core::ConnectedComponents(
+        ents.begin(), ents.end(),
+        [&cg, &ent2usableCons](int ent) {
+          std::vector<int> adjEnts;
+          for (int con : ent2usableCons[ent]) {
+            auto &c = cg.constraints[con];
+            adjEnts.push_back(c.ent1 == ent ? c.ent2 : c.ent1);
+          }
+          return adjEnts;
+        },
+        [&ent2cc, &cc2size](int ent, int ccid) {
+          ent2cc[ent] = ccid;
+          if (cc2size.size() <= ccid) {
+            cc2size.resize(ccid + 1, 0);
+          }
+          cc2size[ccid]++;
+        });
+  }
+  std::vector<int> feasibleRootCands;
+  for (int root : rootCands) {
+    if (cc2size[ent2cc[root]] > nents / 2) {
+      feasibleRootCands.push_back(root);
     }
-    ent2stabHere[root]->stablize();
-    assert(ent2stabHere[root]->dof() == 0);
-
-    MaxHeap<int, int, std::greater<int>> Q; // a min heap recording dofs
-    Q.set(root, ent2stabHere[root]->dof());
-    while (!Q.empty()) {
-      int curEnt = Q.top();
-      int curEntDoF = ent2stabHere[curEnt]->dof();
-      if (curEntDoF != 0) { // all remaining adjacent entities are not stable,
-                            // stop the search
+  }
+
+  // try the roots concurrently in the order of candidates, the first success
+  // in this order wins and cancels the trials of the roots after it
+  int ncands = feasibleRootCands.size();
+  std::atomic<int> nextCand(0);
+  std::atomic<int> firstSuccess(ncands);
+  std::mutex resultMutex;
+  std::vector<int> firstSuccessEnts;
+  int concurrency = std::min<int>(
+      std::max<int>(std::thread::hardware_concurrency(), 1), ncands);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    DeterminablePartTrial trial(nents);
+    while (true) {
+      int i = nextCand++;
+      if (i >= ncands || i > firstSuccess.load()) {
         break;
       }
-      assert(std::all_of(Q.begin(), Q.end(),
-                         [curEntDoF](const Scored<int, int> &ent) {
-                           return ent.score >= curEntDoF;
-                         }));
-      Q.pop();
-      entsCollected.insert(curEnt);
-      for (int con : cg.ent2cons[curEnt]) {
-        if (!cg.cons2enabled[con]) {
-          continue;
-        }
-        auto &c = cg.constraints[con];
-        if (c.weight == 0.0) {
-          continue;
-        }
-        int adjEnt = c.ent1 == curEnt ? c.ent2 : c.ent1;
-        if (Contains(entsCollected, adjEnt)) {
-          continue;
-        }
-
-        if (connectAll) {
-          ent2stabHere[adjEnt]->stablize(); ///////// !!!!!
-        } else {
-          if (c.isConnection()) {
-            for (auto &anchor : c.anchors) {
-              ent2stabHere[adjEnt]->addAnchor(anchor, angleThres);
-            }
-          } else if (c.isCoplanarity()) {
-            assert(cg.entities[adjEnt].isSeg());
-            ent2stabHere[adjEnt]->stablize();
-          }
-        }
-        Q.set(adjEnt, ent2stabHere[adjEnt]->dof());
+      bool finished = GrowDeterminablePart(
+          cg, ent2usableCons, ent2stab, feasibleRootCands[i], angleThres,
+          connectAll, trial,
+          [&firstSuccess, i]() { return firstSuccess.load() < i; });
+      if (!finished || trial.entsCollected.size() <= nents / 2) {
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(resultMutex);
+      if (i < firstSuccess.load()) {
+        firstSuccess = i;
+        firstSuccessEnts = trial.entsCollected;
       }
     }
-    if (entsCollected.size() > cg.entities.size() / 2) {
-      dp.rootEnt = root;
-      dp.determinableEnts = std::move(entsCollected);
-      break;
-    }
+  });
+
+  if (firstSuccess < ncands) {
+    dp.rootEnt = feasibleRootCands[firstSuccess];
+    std::cout << "root: " << dp.rootEnt << std::endl;
+    std::sort(firstSuccessEnts.begin(), firstSuccessEnts.end());
+    dp.determinableEnts.insert(firstSuccessEnts.begin(),
+                               firstSuccessEnts.end());
   }
 
+  std::vector<bool> ent2determinable(nents, false);
+  for (int ent : dp.determinableEnts) {
+    ent2determinable[ent] = true;
+  }
   dp.consBetweenDeterminableEnts.clear();
   for (int i = 0; i < cg.constraints.size(); i++) {
     auto &c = cg.constraints[i];
-    if (Contains(dp.determinableEnts, c.ent1) &&
-        Contains(dp.determinableEnts, c.ent2)) {
-      dp.consBetweenDeterminableEnts.insert(i);
+    // connections to unused segs are kept with a missing entity
+    if (c.ent1 == -1 || c.ent2 == -1) {
+      continue;
+    }
+    if (ent2determinable[c.ent1] && ent2determinable[c.ent2]) {
+      auto &cons = dp.consBetweenDeterminableEnts;
+      cons.insert(cons.end(), i);
     }
   }
 
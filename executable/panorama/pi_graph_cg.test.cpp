@@ -0,0 +1,520 @@
+#include "containers.hpp"
+#include "pi_graph_cg.hpp"
+
+#include "panoramix.unittest.hpp"
+
+using namespace pano;
+using namespace pano::core;
+using namespace pano::experimental;
+
+namespace {
+// segs in clusters of the given sizes, joined by bnds, line pieces and line
+// relations only within their clusters, the segs of the first cluster are the
+// largest, some segs and lines are unused
+PIGraph<PanoramicCamera>
+MakeClusteredGraph(const std::vector<int> &cluster2nsegs) {
+  PIGraph<PanoramicCamera> mg;
+  mg.vps = {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)};
+  mg.verticalVPId = 2;
+
+  std::default_random_engine rng(0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  auto randomInt = [&rng](int n) {
+    return std::uniform_int_distribution<int>(0, n - 1)(rng);
+  };
+  auto randomDir = [&rng, &uniform]() {
+    double x = uniform(rng) * 2.0 - 1.0;
+    double y = uniform(rng) * 2.0 - 1.0;
+    double z = uniform(rng) * 2.0 - 1.0;
+    return normalize(Vec3(x, y, z));
+  };
+
+  int nclusters = cluster2nsegs.size();
+  std::vector<std::vector<int>> cluster2segs(nclusters);
+  for (int k = 0; k < nclusters; k++) {
+    for (int i = 0; i < cluster2nsegs[k]; i++) {
+      int kind = randomInt(7);
+      bool used = randomInt(10) != 0;
+      mg.seg2control.push_back(SegControl{kind < 3 ? kind : -1,
+                                          kind >= 3 && kind < 6 ? kind - 3 : -1,
+                                          used});
+      mg.seg2areaRatio.push_back((k == 0 ? 0.2 : 0.05) * uniform(rng));
+      mg.seg2center.push_back(randomDir());
+      cluster2segs[k].push_back(mg.seg2control.size() - 1);
+    }
+  }
+  mg.nsegs = mg.seg2control.size();
+
+  std::vector<std::vector<int>> cluster2lines(nclusters);
+  for (int k = 0; k < nclusters; k++) {
+    for (int i = 0; i < cluster2nsegs[k]; i++) {
+      int claz = randomInt(4) - 1;
+      Vec3 dir = claz == -1 ? randomDir() : mg.vps[claz];
+      Vec3 center, along;
+      do {
+        center = randomDir();
+        along = dir - center * center.dot(dir);
+      } while (norm(along) < 0.5);
+      along = normalize(along);
+      double halfSpan = 0.05 + 0.1 * uniform(rng);
+      mg.lines.push_back(Classified<Line3>{
+          claz, Line3(normalize(center - along * halfSpan),
+                      normalize(center + along * halfSpan))});
+      mg.line2used.push_back(randomInt(10) != 0);
+      mg.line2linePieces.emplace_back();
+      cluster2lines[k].push_back(mg.nlines() - 1);
+    }
+  }
+
+  std::vector<std::vector<int>> cluster2bndPieces(nclusters);
+  for (int k = 0; k < nclusters; k++) {
+    auto &segs = cluster2segs[k];
+    for (int i = 0; i < 2 * segs.size(); i++) {
+      int seg1 = segs[randomInt(segs.size())];
+      int seg2 = segs[randomInt(segs.size())];
+      if (seg1 == seg2) {
+        continue;
+      }
+      mg.bnd2segs.emplace_back(seg1, seg2);
+      mg.bnd2bndPieces.emplace_back();
+      int npieces = 1 + randomInt(2);
+      for (int j = 0; j < npieces; j++) {
+        Vec3 from = randomDir();
+        Vec3 to = randomDir();
+        mg.bndPiece2dirs.push_back({from, normalize(from + to), to});
+        mg.bndPiece2length.push_back(0.2 * uniform(rng));
+        mg.bndPiece2segRelation.push_back(randomInt(3) == 0
+                                              ? SegRelation(randomInt(4))
+                                              : SegRelation::Connected);
+        mg.bndPiece2bnd.push_back(mg.nbnds() - 1);
+        mg.bndPiece2linePieces.emplace_back();
+        mg.bnd2bndPieces.back().push_back(mg.nbndPieces() - 1);
+        cluster2bndPieces[k].push_back(mg.nbndPieces() - 1);
+      }
+    }
+  }
+
+  for (int k = 0; k < nclusters; k++) {
+    auto &bndPieces = cluster2bndPieces[k];
+    auto &segs = cluster2segs[k];
+    for (int line : cluster2lines[k]) {
+      int npieces = 1 + randomInt(2);
+      for (int j = 0; j < npieces; j++) {
+        int bndPiece = -1, seg = -1;
+        if (randomInt(3) == 0 && !bndPieces.empty()) {
+          bndPiece = bndPieces[randomInt(bndPieces.size())];
+        } else {
+          seg = segs[randomInt(segs.size())];
+        }
+        Vec3 from = randomDir();
+        Vec3 to = randomDir();
+        mg.linePiece2samples.push_back({from, to});
+        mg.linePiece2length.push_back(0.2 * uniform(rng));
+        mg.linePiece2line.push_back(line);
+        mg.linePiece2seg.push_back(seg);
+        mg.linePiece2bndPiece.push_back(bndPiece);
+        mg.linePiece2segLineRelation.push_back(
+            randomInt(4) == 0 ? SegLineRelation::Detached
+                              : SegLineRelation::Attached);
+        int linePiece = mg.nlinePieces() - 1;
+        mg.line2linePieces[line].push_back(linePiece);
+        if (bndPiece != -1) {
+          mg.bndPiece2linePieces[bndPiece].push_back(linePiece);
+        }
+      }
+    }
+  }
+
+  mg.line2lineRelations.resize(mg.nlines());
+  for (int k = 0; k < nclusters; k++) {
+    auto &lines = cluster2lines[k];
+    for (int i = 0; i < lines.size(); i++) {
+      int line1 = lines[randomInt(lines.size())];
+      int line2 = lines[randomInt(lines.size())];
+      if (line1 == line2) {
+        continue;
+      }
+      mg.lineRelation2lines.emplace_back(line1, line2);
+      mg.lineRelations.push_back(randomInt(4) == 0 ? LineRelation::Detached
+                                                   : LineRelation::Attached);
+      mg.lineRelation2weight.push_back(uniform(rng));
+      mg.lineRelation2anchor.push_back(randomDir());
+      mg.lineRelation2IsIncidence.push_back(false);
+      mg.line2lineRelations[line1].push_back(mg.nlineRelations() - 1);
+      mg.line2lineRelations[line2].push_back(mg.nlineRelations() - 1);
+    }
+  }
+  return mg;
+}
+
+// the former serial build, pushing each constraint into ent2cons as it is
+// added
+PIConstraintGraph BuildPIConstraintGraphSerially(
+    const PIGraph<PanoramicCamera> &mg, double minAngleThresForAWideEdge,
+    double weightRatioForCoplanarityWithLines) {
+  PIConstraintGraph cg;
+  cg.seg2ent.resize(mg.nsegs, -1);
+  cg.line2ent.resize(mg.nlines(), -1);
+  auto &entities = cg.entities;
+  auto &constraints = cg.constraints;
+  auto &ent2cons = cg.ent2cons;
+  using Entity = PIConstraintGraph::Entity;
+  using Constraint = PIConstraintGraph::Constraint;
+
+  for (int i = 0; i < mg.nsegs; i++) {
+    if (!mg.seg2control[i].used) {
+      continue;
+    }
+    Entity e;
+    e.type = Entity::IsSeg;
+    e.id = i;
+    e.size = mg.seg2areaRatio[i] * 100;
+    e.supportingPlane = Entity::SupportingPlane(mg.seg2control[i],
+                                                mg.seg2center[i], mg.vps);
+    entities.push_back(e);
+    cg.seg2ent[i] = entities.size() - 1;
+  }
+  for (int i = 0; i < mg.nlines(); i++) {
+    if (!mg.line2used.empty() && !mg.line2used[i]) {
+      continue;
+    }
+    Entity e;
+    e.type = Entity::IsLine;
+    e.id = i;
+    e.size = AngleBetweenDirected(mg.lines[i].component.first,
+                                  mg.lines[i].component.second);
+    e.supportingPlane = Entity::SupportingPlane(mg.lines[i], mg.vps);
+    entities.push_back(e);
+    cg.line2ent[i] = entities.size() - 1;
+  }
+  ent2cons.resize(entities.size());
+
+  auto addConstraint = [&constraints, &ent2cons](const Constraint &c) {
+    constraints.push_back(c);
+    ent2cons[c.ent1].push_back(constraints.size() - 1);
+    ent2cons[c.ent2].push_back(constraints.size() - 1);
+  };
+  auto anchorsOf = [minAngleThresForAWideEdge](const std::vector<Vec3> &dirs,
+                                               double len) {
+    return len >= minAngleThresForAWideEdge
+               ? std::vector<Vec3>{dirs.front(), dirs.back()}
+               : std::vector<Vec3>{normalize(dirs.front() + dirs.back())};
+  };
+
+  for (int i = 0; i < mg.nbndPieces(); i++) {
+    if (mg.bndPiece2segRelation[i] != SegRelation::Connected) {
+      continue;
+    }
+    Constraint connect;
+    connect.type = Constraint::Connection;
+    auto &segPair = mg.bnd2segs[mg.bndPiece2bnd[i]];
+    connect.ent1 = cg.seg2ent[segPair.first];
+    connect.ent2 = cg.seg2ent[segPair.second];
+    double len = mg.bndPiece2length[i];
+    connect.weight = len;
+    connect.anchors = anchorsOf(mg.bndPiece2dirs[i], len);
+    if (connect.ent1 == -1 || connect.ent2 == -1) {
+      constraints.push_back(connect);
+      continue;
+    }
+    addConstraint(connect);
+    if (!mg.bndPiece2linePieces[i].empty() ||
+        len < minAngleThresForAWideEdge) {
+      continue;
+    }
+    Constraint coplanar;
+    coplanar.type = Constraint::Coplanarity;
+    coplanar.ent1 = connect.ent1;
+    coplanar.ent2 = connect.ent2;
+    coplanar.weight = len * (mg.bndPiece2linePieces[i].empty()
+                                 ? 1.0
+                                 : weightRatioForCoplanarityWithLines);
+    addConstraint(coplanar);
+  }
+
+  for (int i = 0; i < mg.nlinePieces(); i++) {
+    if (mg.linePiece2segLineRelation[i] == SegLineRelation::Detached) {
+      continue;
+    }
+    int bndPiece = mg.linePiece2bndPiece[i];
+    int segs[] = {mg.linePiece2seg[i], -1};
+    bool connected[] = {true, false};
+    if (bndPiece != -1) {
+      std::tie(segs[0], segs[1]) = mg.bnd2segs[mg.bndPiece2bnd[bndPiece]];
+      auto segRelation = mg.bndPiece2segRelation[bndPiece];
+      connected[0] = segRelation == SegRelation::Connected ||
+                     segRelation == SegRelation::LeftIsFront;
+      connected[1] = segRelation == SegRelation::Connected ||
+                     segRelation == SegRelation::RightIsFront;
+    }
+    for (int k = 0; k < 2; k++) {
+      if (!connected[k]) {
+        continue;
+      }
+      Constraint c;
+      c.type = Constraint::Connection;
+      c.ent1 = cg.seg2ent[segs[k]];
+      c.ent2 = cg.line2ent[mg.linePiece2line[i]];
+      if (c.ent1 == -1 || c.ent2 == -1) {
+        continue;
+      }
+      c.weight = mg.linePiece2length[i];
+      c.anchors = anchorsOf(mg.linePiece2samples[i], c.weight);
+      addConstraint(c);
+    }
+  }
+
+  for (int i = 0; i < mg.nlineRelations(); i++) {
+    if (mg.lineRelations[i] == LineRelation::Detached) {
+      continue;
+    }
+    Constraint c;
+    c.type = Constraint::Connection;
+    c.ent1 = cg.line2ent[mg.lineRelation2lines[i].first];
+    c.ent2 = cg.line2ent[mg.lineRelation2lines[i].second];
+    if (c.ent1 == -1 || c.ent2 == -1) {
+      continue;
+    }
+    c.weight = mg.lineRelation2weight[i];
+    c.anchors = {mg.lineRelation2anchor[i]};
+    addConstraint(c);
+  }
+
+  cg.cons2enabled.resize(constraints.size(), true);
+  return cg;
+}
+
+// disables some constraints and zeros the weights of some others
+void DisableSomeConstraints(PIConstraintGraph &cg) {
+  std::default_random_engine rng(0);
+  std::uniform_int_distribution<int> pick(0, 19);
+  for (int i = 0; i < cg.constraints.size(); i++) {
+    int p = pick(rng);
+    if (p < 2) {
+      cg.cons2enabled[i] = false;
+    } else if (p == 2) {
+      cg.constraints[i].weight = 0.0;
+    }
+  }
+}
+
+// the former search, cloning a Stability per entity for every root tried one
+// after another, rootEnt is -1 if no root is found
+struct Stability {
+  virtual int dof() const = 0;
+  virtual void addAnchor(const Vec3 &anchor, double angleThres) = 0;
+  virtual Stability *clone() const = 0;
+  virtual void stablize() = 0;
+};
+double AngleDistanceBetweenPointAndRay(const Vec3 &p, const Ray3 &ray) {
+  auto normal = ray.anchor.cross(ray.direction);
+  double angle = M_PI_2 - AngleBetweenUndirected(p, normal);
+  double angleToAnchor = AngleBetweenDirected(p, ray.anchor);
+  return std::min(angle, angleToAnchor);
+}
+struct Dof3Stability : Stability {
+  std::vector<Vec3> supporters;
+  virtual int dof() const override { return 3 - supporters.size(); }
+  virtual void addAnchor(const Vec3 &anchor, double angleThres) override {
+    if (supporters.size() == 3) {
+      return;
+    }
+    if (supporters.empty()) {
+      supporters.push_back(anchor);
+    } else if (supporters.size() == 1) {
+      if (AngleBetweenDirected(supporters[0], anchor) > angleThres) {
+        supporters.push_back(anchor);
+      }
+    } else if (supporters.size() == 2) {
+      if (AngleDistanceBetweenPointAndRay(
+              anchor, Line3(supporters[0], supporters[1]).ray()) > angleThres) {
+        supporters.push_back(anchor);
+      }
+    }
+  }
+  virtual Stability *clone() const override { return new Dof3Stability(*this); }
+  virtual void stablize() override { supporters.resize(3); }
+};
+struct Dof2Stability : Stability {
+  Vec3 axis;
+  std::vector<Vec3> supporters;
+  explicit Dof2Stability(const Vec3 &a) : axis(a) {}
+  virtual int dof() const override { return 2 - supporters.size(); }
+  virtual void addAnchor(const Vec3 &anchor, double angleThres) override {
+    if (supporters.size() == 2) {
+      return;
+    }
+    if (supporters.empty()) {
+      supporters.push_back(anchor);
+    } else if (supporters.size() == 1) {
+      if (AngleDistanceBetweenPointAndRay(anchor, Ray3(supporters[0], axis)) >
+          angleThres) {
+        supporters.push_back(anchor);
+      }
+    }
+  }
+  virtual Stability *clone() const override { return new Dof2Stability(*this); }
+  virtual void stablize() override { supporters.resize(2); }
+};
+struct Dof1Stability : Stability {
+  bool stable = false;
+  virtual int dof() const override { return stable ? 0 : 1; }
+  virtual void addAnchor(const Vec3 &anchor, double angleThres) override {
+    stable = true;
+  }
+  virtual Stability *clone() const override { return new Dof1Stability(*this); }
+  virtual void stablize() override { stable = true; }
+};
+
+PICGDeterminablePart LocateDeterminablePartByCloning(
+    const PIConstraintGraph &cg, double angleThres, bool connectAll) {
+  PICGDeterminablePart dp;
+  dp.rootEnt = -1;
+
+  std::vector<std::unique_ptr<Stability>> ent2stab(cg.entities.size());
+  for (int ent = 0; ent < cg.entities.size(); ent++) {
+    auto &e = cg.entities[ent];
+    if (e.supportingPlane.dof == 1) {
+      ent2stab[ent] = std::make_unique<Dof1Stability>();
+    } else if (e.supportingPlane.dof == 2) {
+      ent2stab[ent] = std::make_unique<Dof2Stability>(e.supportingPlane.along);
+    } else if (e.supportingPlane.dof == 3) {
+      ent2stab[ent] = std::make_unique<Dof3Stability>();
+    }
+  }
+
+  std::vector<int> rootCands;
+  for (int i = 0; i < cg.entities.size(); i++) {
+    if (ent2stab[i]->dof() == 1) {
+      rootCands.push_back(i);
+    }
+  }
+  std::sort(rootCands.begin(), rootCands.end(), [&cg](int a, int b) {
+    return cg.entities[a].size > cg.entities[b].size;
+  });
+
+  for (int root : rootCands) {
+    std::set<int> entsCollected;
+    std::vector<std::unique_ptr<Stability>> ent2stabHere(cg.entities.size());
+    for (int ent = 0; ent < cg.entities.size(); ent++) {
+      ent2stabHere[ent] = std::unique_ptr<Stability>(ent2stab[ent]->clone());
+    }
+    ent2stabHere[root]->stablize();
+
+    MaxHeap<int, int, std::greater<int>> Q;
+    Q.set(root, ent2stabHere[root]->dof());
+    while (!Q.empty()) {
+      int curEnt = Q.top();
+      if (ent2stabHere[curEnt]->dof() != 0) {
+        break;
+      }
+      Q.pop();
+      entsCollected.insert(curEnt);
+      for (int con : cg.ent2cons[curEnt]) {
+        if (!cg.cons2enabled[con]) {
+          continue;
+        }
+        auto &c = cg.constraints[con];
+        if (c.weight == 0.0) {
+          continue;
+        }
+        int adjEnt = c.ent1 == curEnt ? c.ent2 : c.ent1;
+        if (Contains(entsCollected, adjEnt)) {
+          continue;
+        }
+        if (connectAll) {
+          ent2stabHere[adjEnt]->stablize();
+        } else if (c.isConnection()) {
+          for (auto &anchor : c.anchors) {
+            ent2stabHere[adjEnt]->addAnchor(anchor, angleThres);
+          }
+        } else if (c.isCoplanarity()) {
+          ent2stabHere[adjEnt]->stablize();
+        }
+        Q.set(adjEnt, ent2stabHere[adjEnt]->dof());
+      }
+    }
+    if (entsCollected.size() > cg.entities.size() / 2) {
+      dp.rootEnt = root;
+      dp.determinableEnts = std::move(entsCollected);
+      break;
+    }
+  }
+
+  for (int i = 0; i < cg.constraints.size(); i++) {
+    auto &c = cg.constraints[i];
+    if (Contains(dp.determinableEnts, c.ent1) &&
+        Contains(dp.determinableEnts, c.ent2)) {
+      dp.consBetweenDeterminableEnts.insert(i);
+    }
+  }
+  return dp;
+}
+
+void ExpectSameDeterminablePart(const PICGDeterminablePart &dp,
+                                const PICGDeterminablePart &expected) {
+  EXPECT_EQ(dp.rootEnt, expected.rootEnt);
+  EXPECT_TRUE(dp.determinableEnts == expected.determinableEnts);
+  EXPECT_TRUE(dp.consBetweenDeterminableEnts ==
+              expected.consBetweenDeterminableEnts);
+}
+}
+
+TEST(PIGraphCG, DeterminablePartSameAsCloning) {
+  // the largest segs are in the small first cluster, their trials fail
+  auto mg = MakeClusteredGraph({6, 60, 8, 10});
+  auto cg = BuildPIConstraintGraph(mg, 0.1);
+  DisableSomeConstraints(cg);
+  for (bool connectAll : {false, true}) {
+    auto dp = LocateDeterminablePart(cg, DegreesToRadians(3), connectAll);
+    auto expected =
+        LocateDeterminablePartByCloning(cg, DegreesToRadians(3), connectAll);
+    ASSERT_FALSE(expected.empty());
+    EXPECT_TRUE(cg.entities[expected.rootEnt].isSeg());
+    EXPECT_GE(cg.entities[expected.rootEnt].id, 6);
+    ExpectSameDeterminablePart(dp, expected);
+  }
+
+  // no cluster holds more than half of the entities
+  mg = MakeClusteredGraph({10, 10, 10, 10});
+  cg = BuildPIConstraintGraph(mg, 0.1);
+  auto dp = LocateDeterminablePart(cg, DegreesToRadians(3), false);
+  auto expected =
+      LocateDeterminablePartByCloning(cg, DegreesToRadians(3), false);
+  EXPECT_TRUE(expected.empty());
+  ExpectSameDeterminablePart(dp, expected);
+}
+
+TEST(PIGraphCG, ConstraintGraphSameAsSerial) {
+  auto mg = MakeClusteredGraph({6, 60, 8, 10});
+  for (double minAngleThresForAWideEdge : {0.0, 0.1}) {
+    auto cg = BuildPIConstraintGraph(mg, minAngleThresForAWideEdge, 0.5);
+    auto expected =
+        BuildPIConstraintGraphSerially(mg, minAngleThresForAWideEdge, 0.5);
+    EXPECT_TRUE(cg.seg2ent == expected.seg2ent);
+    EXPECT_TRUE(cg.line2ent == expected.line2ent);
+    ASSERT_EQ(cg.entities.size(), expected.entities.size());
+    for (int i = 0; i < cg.entities.size(); i++) {
+      auto &e = cg.entities[i];
+      auto &ee = expected.entities[i];
+      EXPECT_TRUE(e.type == ee.type && e.id == ee.id && e.size == ee.size)
+          << "entity " << i;
+      EXPECT_TRUE(e.supportingPlane.dof == ee.supportingPlane.dof &&
+                  e.supportingPlane.center == ee.supportingPlane.center &&
+                  e.supportingPlane.toward == ee.supportingPlane.toward &&
+                  e.supportingPlane.along == ee.supportingPlane.along)
+          << "entity " << i;
+    }
+    ASSERT_EQ(cg.constraints.size(), expected.constraints.size());
+    for (int i = 0; i < cg.constraints.size(); i++) {
+      auto &c = cg.constraints[i];
+      auto &ec = expected.constraints[i];
+      EXPECT_TRUE(c.type == ec.type && c.ent1 == ec.ent1 &&
+                  c.ent2 == ec.ent2 && c.weight == ec.weight &&
+                  c.anchors == ec.anchors)
+          << "constraint " << i;
+    }
+    EXPECT_TRUE(cg.ent2cons == expected.ent2cons);
+    EXPECT_TRUE(cg.cons2enabled == expected.cons2enabled);
+  }
+}
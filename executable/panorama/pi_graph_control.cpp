@@ -252,9 +252,9 @@ void DisableBottomSeg(PIGraph<PanoramicCamera> &mg) {
 }
 
 namespace {
-template <class CameraT>
+template <class CameraT, class T>
 void AttachGCConstraintsTemplated(PIGraph<PanoramicCamera> &mg,
-                                  const View<CameraT, Image5d> &gc,
+                                  const View<CameraT, Image_<Vec<T, 5>>> &gc,
                                   double clutterThres, double wallThres,
                                   bool onlyConsiderBottomHalf) {
 
@@ -323,5 +323,21 @@ void AttachGCConstraints(PIGraph<PanoramicCamera> &mg,
   AttachGCConstraintsTemplated(mg, gc, clutterThres, wallThres,
                                onlyConsiderBottomHalf);
 }
+
+void AttachGCConstraints(PIGraph<PanoramicCamera> &mg,
+                         const View<PanoramicCamera, Image5f> &gc,
+                         double clutterThres, double wallThres,
+                         bool onlyConsiderBottomHalf) {
+  AttachGCConstraintsTemplated(mg, gc, clutterThres, wallThres,
+                               onlyConsiderBottomHalf);
+}
+
+void AttachGCConstraints(PIGraph<PanoramicCamera> &mg,
+                         const View<PerspectiveCamera, Image5f> &gc,
+                         double clutterThres, double wallThres,
+                         bool onlyConsiderBottomHalf) {
+  AttachGCConstraintsTemplated(mg, gc, clutterThres, wallThres,
+                               onlyConsiderBottomHalf);
+}
 }
 }
\ No newline at end of file
@@ -20,6 +20,16 @@ void AttachGCConstraints(PIGraph<core::PanoramicCamera> &mg,
                          double clutterThres = 0.7, double wallThres = 0.5,
                          bool onlyConsiderBottomHalf = true);
 
+// gc in single precision
+void AttachGCConstraints(PIGraph<core::PanoramicCamera> &mg,
+                         const View<core::PanoramicCamera, Image5f> &gc,
+                         double clutterThres = 0.7, double wallThres = 0.5,
+                         bool onlyConsiderBottomHalf = true);
+void AttachGCConstraints(PIGraph<core::PanoramicCamera> &mg,
+                         const View<core::PerspectiveCamera, Image5f> &gc,
+                         double clutterThres = 0.7, double wallThres = 0.5,
+                         bool onlyConsiderBottomHalf = true);
+
 inline void AttachGCConstraints(PIGraph<core::PanoramicCamera> &mg, const Image5d &gc,
                          double clutterThres = 0.7, double wallThres = 0.5,
                          bool onlyConsiderBottomHalf = true) {
@@ -27,5 +37,13 @@ inline void AttachGCConstraints(PIGraph<core::PanoramicCamera> &mg, const Image5
   AttachGCConstraints(mg, MakeView(gc, mg.view.camera), clutterThres, wallThres,
                       onlyConsiderBottomHalf);
 }
+inline void AttachGCConstraints(PIGraph<core::PanoramicCamera> &mg,
+                                const Image5f &gc, double clutterThres = 0.7,
+                                double wallThres = 0.5,
+                                bool onlyConsiderBottomHalf = true) {
+  assert(mg.view.image.size() == gc.size());
+  AttachGCConstraints(mg, MakeView(gc, mg.view.camera), clutterThres, wallThres,
+                      onlyConsiderBottomHalf);
+}
 }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "factor_graph.hpp"
 #include "geo_context.hpp"
 #include "line_detection.hpp"
+#include "parallel.hpp"
 #include "segmentation.hpp"
 #include "utility.hpp"
 
@@ -25,6 +26,258 @@ inline bool AllAlong(const ContT &pts, const Vec3 &from, const Vec3 &to,
     return abs(M_PI_2 - AngleBetweenDirected(n, p)) < angleThres;
   });
 }
+
+inline int ConcurrencyNum() {
+  return std::max<int>(std::thread::hardware_concurrency(), 1);
+}
+
+// collect the panorama pixels lying in a band of angle radius around the line,
+// the windows of the arc samples overlap, so the pixels are sorted into row
+// major order and deduplicated, the memory is only that of the band
+void RasterizeBandAroundLine(const PanoramicCamera &cam, const Line3 &line,
+                             double radius, int width, int height,
+                             std::vector<Pixel> &pixels) {
+  pixels.clear();
+  const double pixelsPerRadianX = width / 2.0 / M_PI;
+  const double pixelsPerRadianY = height / M_PI;
+  // any direction within radius of the arc (or of its slightly extended line
+  // samples) lies within windowRadius of one of the arc samples below
+  const double sampleStep = radius;
+  const double windowRadius = radius * 2.0 + 2.0 / pixelsPerRadianY;
+  const int windowHalfHeight = std::ceil(windowRadius * pixelsPerRadianY) + 1;
+  double spanAngle = AngleBetweenDirected(line.first, line.second);
+  for (double a = 0.0; a < spanAngle + sampleStep; a += sampleStep) {
+    Vec3 dir = normalize(
+        RotateDirection(line.first, line.second, std::min(a, spanAngle)));
+    Point2 center = cam.toScreen(dir);
+    double cx = center[0], cy = center[1];
+    double latitude = cy / pixelsPerRadianY - M_PI_2;
+    int windowHalfWidth = width;
+    if (abs(latitude) + windowRadius < M_PI_2) {
+      double longitudeRadius =
+          asin(std::min(1.0, sin(windowRadius) / cos(latitude)));
+      windowHalfWidth = std::ceil(longitudeRadius * pixelsPerRadianX) + 1;
+    }
+    int y1 = std::max(0, int(cy) - windowHalfHeight);
+    int y2 = std::min(height - 1, int(cy) + windowHalfHeight);
+    int x1 = int(cx) - windowHalfWidth, x2 = int(cx) + windowHalfWidth;
+    if (x2 - x1 + 1 >= width) {
+      x1 = 0;
+      x2 = width - 1;
+    }
+    for (int y = y1; y <= y2; y++) {
+      for (int xx = x1; xx <= x2; xx++) {
+        pixels.emplace_back((xx % width + width) % width, y);
+      }
+    }
+  }
+  std::sort(pixels.begin(), pixels.end(), [](const Pixel &a, const Pixel &b) {
+    return std::tie(a.y, a.x) < std::tie(b.y, b.x);
+  });
+  pixels.erase(std::unique(pixels.begin(), pixels.end()), pixels.end());
+}
+}
+
+// collect the segs near each line
+// lines are processed in parallel, each thread rasterizes a narrow band around
+// its lines and accumulates seg evidences in dense per-thread buffers
+void CollectLinesNearbySegs(
+    const PIGraph<PanoramicCamera> &mg, double angleSizeForPixelsNearLines,
+    std::vector<std::map<int, Vec3>> &line2nearbySegsWithLocalCenterDir,
+    std::vector<std::map<int, double>> &line2nearbySegsWithWeight,
+    std::vector<std::set<Pixel>> *line2nearbyPixelsPtr) {
+
+  int width = mg.segs.cols;
+  int height = mg.segs.rows;
+
+  line2nearbySegsWithLocalCenterDir.assign(mg.nlines(), {});
+  line2nearbySegsWithWeight.assign(mg.nlines(), {});
+  if (line2nearbyPixelsPtr) {
+    line2nearbyPixelsPtr->assign(mg.nlines(), {});
+  }
+
+  const double sampleStep = angleSizeForPixelsNearLines / 3.0;
+  const int concurrency = ConcurrencyNum();
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    std::vector<Vec3> segCenterDirs(mg.nsegs, Vec3());
+    std::vector<double> segWeights(mg.nsegs, 0.0);
+    std::vector<bool> segTouched(mg.nsegs, false);
+    std::vector<int> touchedSegs;
+    std::vector<Pixel> pixels;
+    std::vector<Line3> samples;
+    std::vector<Vec3> sampleCenters;
+
+    for (int i = t; i < mg.nlines(); i += concurrency) {
+      auto &line = mg.lines[i].component;
+      auto nline = normalize(line);
+      // the same samples as those in the line samples tree
+      samples.clear();
+      sampleCenters.clear();
+      double spanAngle = AngleBetweenDirected(line.first, line.second);
+      for (double a = 0.0; a < spanAngle; a += sampleStep) {
+        Vec3 sample1 = normalize(RotateDirection(line.first, line.second, a));
+        Vec3 sample2 = normalize(
+            RotateDirection(line.first, line.second, a + sampleStep));
+        samples.emplace_back(sample1, sample2);
+        sampleCenters.push_back(normalize(sample1 + sample2));
+      }
+
+      RasterizeBandAroundLine(mg.view.camera, nline,
+                              angleSizeForPixelsNearLines, width, height,
+                              pixels);
+      for (auto &p : pixels) {
+        double weight = cos((p.y - (height - 1) / 2.0) / (height - 1) * M_PI);
+        Vec3 dir = normalize(mg.view.camera.toSpace(p));
+        int seg = mg.segs(p);
+        auto searchBox =
+            BoundingBox(dir).expand(angleSizeForPixelsNearLines * 3);
+        bool nearby = false;
+        for (int k = 0; k < samples.size(); k++) {
+          if (!searchBox.contains(sampleCenters[k])) {
+            continue;
+          }
+          auto dirOnLine =
+              DistanceFromPointToLine(dir, samples[k]).second.position;
+          double angleDist = AngleBetweenDirected(dir, dirOnLine);
+          double lambda = ProjectionOfPointOnLine(dir, nline)
+                              .ratio; // the projected position on line
+          if (angleDist < angleSizeForPixelsNearLines &&
+              IsBetween(lambda, 0.0, 1.0)) {
+            nearby = true;
+            if (!segTouched[seg]) {
+              segTouched[seg] = true;
+              touchedSegs.push_back(seg);
+            }
+            segCenterDirs[seg] += dir * weight;
+            segWeights[seg] +=
+                weight *
+                Gaussian(
+                    lambda - 0.5,
+                    0.1); // the closer to the center, the more important it is!
+          }
+        }
+        if (nearby && line2nearbyPixelsPtr) {
+          (*line2nearbyPixelsPtr)[i].insert(p);
+        }
+      }
+
+      // reduce into the line's own tables
+      auto &nearbySegsWithLocalCenterDir = line2nearbySegsWithLocalCenterDir[i];
+      auto &nearbySegsWithWeight = line2nearbySegsWithWeight[i];
+      for (int seg : touchedSegs) {
+        nearbySegsWithLocalCenterDir[seg] = segCenterDirs[seg];
+        nearbySegsWithWeight[seg] = segWeights[seg];
+        segCenterDirs[seg] = Vec3();
+        segWeights[seg] = 0.0;
+        segTouched[seg] = false;
+      }
+      touchedSegs.clear();
+    }
+  });
+}
+
+// collect the segs swept by each line toward the other vps
+// lines are processed in parallel, only the pixels inside the sweeping quad
+// are sampled from the panorama
+void CollectLinesSweptSegs(
+    const PIGraph<PanoramicCamera> &mg, double angleSizeForPixelsNearLines,
+    std::vector<std::map<int, double>> &line2leftSegsWithWeight,
+    std::vector<std::map<int, double>> &line2rightSegsWithWeight) {
+
+  line2leftSegsWithWeight.assign(mg.nlines(), {});
+  line2rightSegsWithWeight.assign(mg.nlines(), {});
+
+  const int concurrency = ConcurrencyNum();
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    // [left, right]
+    std::vector<double> segWeights[2] = {std::vector<double>(mg.nsegs, 0.0),
+                                         std::vector<double>(mg.nsegs, 0.0)};
+    std::vector<bool> segTouched[2] = {std::vector<bool>(mg.nsegs, false),
+                                       std::vector<bool>(mg.nsegs, false)};
+    std::vector<int> touchedSegs[2];
+
+    for (int line = t; line < mg.nlines(); line += concurrency) {
+      auto &l = mg.lines[line].component;
+      int claz = mg.lines[line].claz;
+      if (claz == -1) {
+        continue;
+      }
+      for (int vpid = 0; vpid < mg.vps.size(); vpid++) {
+        if (vpid == claz) {
+          continue;
+        }
+        Vec3 vp = mg.vps[vpid];
+        if (vp.dot(normalize(l.center())) < 0) {
+          vp = -vp;
+        }
+
+        Vec3 lineRight = l.first.cross(l.second);
+        bool onLeft = (vp - l.first).dot(lineRight) < 0;
+
+        double lineAngleToVP = std::min(AngleBetweenDirected(l.first, vp),
+                                        AngleBetweenDirected(l.second, vp));
+        double sweepAngle =
+            std::min(angleSizeForPixelsNearLines, lineAngleToVP - 1e-4);
+        std::vector<Vec3> sweepQuad = {
+            normalize(l.first), normalize(l.second),
+            RotateDirection(l.second, vp, sweepAngle),
+            RotateDirection(l.first, vp, sweepAngle)};
+        Vec3 z = normalize(l.center());
+        Vec3 y = normalize(normalize(l).direction());
+        const double focal = mg.view.camera.focal() * 1.2;
+        int w = std::ceil(tan(sweepAngle + 0.01) * focal * 2 * 1.5);
+        int h = std::ceil(
+            (2 * tan(AngleBetweenDirected(l.first, l.second) / 2.0) + 0.01) *
+            focal * 1.5);
+        PerspectiveCamera pc(w, h, Point2(w / 2.0, h / 2.0), focal, Origin(),
+                             z, y);
+
+        std::vector<Point2i> quadProjs(4);
+        for (int i = 0; i < 4; i++) {
+          quadProjs[i] = pc.toScreen(sweepQuad[i]);
+          quadProjs[i][0] = BoundBetween(quadProjs[i][0], 0, w);
+          quadProjs[i][1] = BoundBetween(quadProjs[i][1], 0, h);
+        }
+        Imageub mask(pc.screenSize(), false);
+        cv::fillConvexPoly(mask, quadProjs, true);
+
+        int side = onLeft ? 0 : 1;
+        for (auto it = mask.begin(); it != mask.end(); ++it) {
+          if (!*it) {
+            continue;
+          }
+          // sample the seg as the nearest camera sampler does
+          Pixel p = it.pos();
+          Point2 pp = mg.view.camera.toScreen(pc.toSpace(Point2(p.x, p.y)));
+          int px = BoundBetween(cvRound(static_cast<float>(pp[0])), 0,
+                                mg.segs.cols - 1);
+          int py = BoundBetween(cvRound(static_cast<float>(pp[1])), 0,
+                                mg.segs.rows - 1);
+          int seg = mg.segs(py, px);
+          double pixelDistToEyeSquared =
+              Square(Distance(ecast<double>(p), pc.principlePoint())) +
+              focal * focal;
+          if (!segTouched[side][seg]) {
+            segTouched[side][seg] = true;
+            touchedSegs[side].push_back(seg);
+          }
+          segWeights[side][seg] += 1.0 * focal * focal / pixelDistToEyeSquared;
+        }
+      }
+
+      // reduce into the line's own tables
+      for (int side = 0; side < 2; side++) {
+        auto &segsWithWeight = (side == 0 ? line2leftSegsWithWeight
+                                          : line2rightSegsWithWeight)[line];
+        for (int seg : touchedSegs[side]) {
+          segsWithWeight[seg] = segWeights[side][seg];
+          segWeights[side][seg] = 0.0;
+          segTouched[side][seg] = false;
+        }
+        touchedSegs[side].clear();
+      }
+    }
+  });
 }
 
 struct SegLabel {
@@ -906,64 +1159,15 @@ void DetectOcclusions(PIGraph<PanoramicCamera> &mg,
                       double lambdaShrinkForVLineDetectionInTJunction,
                       double angleSizeForPixelsNearLines) {
 
-  int width = mg.segs.cols;
-  int height = mg.segs.rows;
-
-  RTreeMap<Vec3, std::pair<Line3, int>> lineSamplesTree;
-  for (int i = 0; i < mg.nlines(); i++) {
-    auto &line = mg.lines[i].component;
-    double spanAngle = AngleBetweenDirected(line.first, line.second);
-    for (double a = 0.0; a < spanAngle;
-         a += angleSizeForPixelsNearLines / 3.0) {
-      Vec3 sample1 = normalize(RotateDirection(line.first, line.second, a));
-      Vec3 sample2 = normalize(RotateDirection(
-          line.first, line.second, a + angleSizeForPixelsNearLines / 3.0));
-      lineSamplesTree.emplace(normalize(sample1 + sample2),
-                              std::make_pair(Line3(sample1, sample2), i));
-    }
-  }
-
   // collect lines' nearby pixels and segs
-  std::vector<std::set<Pixel>> line2nearbyPixels(mg.nlines());
-  std::vector<std::map<int, Vec3>> line2nearbySegsWithLocalCenterDir(
+  std::vector<std::set<Pixel>> line2nearbyPixels;
+  std::vector<std::map<int, Vec3>> line2nearbySegsWithLocalCenterDir;
+  std::vector<std::map<int, bool>> line2nearbySegsWithOnLeftFlag(
       mg.nlines());
-  std::vector<std::map<int, bool>> line2nearbySegsWithOnLeftFlag(mg.nlines());
-  std::vector<std::map<int, double>> line2nearbySegsWithWeight(mg.nlines());
-
-  for (auto it = mg.segs.begin(); it != mg.segs.end(); ++it) {
-    Pixel p = it.pos();
-    double weight = cos((p.y - (height - 1) / 2.0) / (height - 1) * M_PI);
-    Vec3 dir = normalize(mg.view.camera.toSpace(p));
-    int seg = *it;
-    lineSamplesTree.search(
-        BoundingBox(dir).expand(angleSizeForPixelsNearLines * 3),
-        [&mg, &dir, &line2nearbyPixels, &line2nearbySegsWithLocalCenterDir,
-         &line2nearbySegsWithWeight, angleSizeForPixelsNearLines, p, seg,
-         weight](const std::pair<Vec3, std::pair<Line3, int>> &lineSample) {
-          auto line = normalize(mg.lines[lineSample.second.second].component);
-          auto dirOnLine = DistanceFromPointToLine(dir, lineSample.second.first)
-                               .second.position;
-          double angleDist = AngleBetweenDirected(dir, dirOnLine);
-          double lambda = ProjectionOfPointOnLine(dir, line)
-                              .ratio; // the projected position on line
-          if (angleDist < angleSizeForPixelsNearLines &&
-              IsBetween(lambda, 0.0, 1.0)) {
-            line2nearbyPixels[lineSample.second.second].insert(p);
-            auto &localCenterDir =
-                line2nearbySegsWithLocalCenterDir[lineSample.second.second]
-                                                 [seg];
-            localCenterDir += dir * weight;
-            double &segWeight =
-                line2nearbySegsWithWeight[lineSample.second.second][seg];
-            segWeight +=
-                weight *
-                Gaussian(
-                    lambda - 0.5,
-                    0.1); // the closer to the center, the more important it is!
-          }
-          return true;
-        });
-  }
+  std::vector<std::map<int, double>> line2nearbySegsWithWeight;
+  CollectLinesNearbySegs(mg, angleSizeForPixelsNearLines,
+                         line2nearbySegsWithLocalCenterDir,
+                         line2nearbySegsWithWeight, &line2nearbyPixels);
   for (int i = 0; i < mg.nlines(); i++) {
     auto &nearbySegsWithLocalCenterDir = line2nearbySegsWithLocalCenterDir[i];
     auto &line = mg.lines[i].component;
@@ -1680,77 +1884,10 @@ std::vector<LineSidingWeight> ComputeLinesSidingWeights(
     std::vector<std::map<int, double>> *line2leftSegsWithWeightPtr,
     std::vector<std::map<int, double>> *line2rightSegsWithWeightPtr) {
 
-  std::vector<std::map<int, double>> line2leftSegsWithWeight(mg.nlines());
-  std::vector<std::map<int, double>> line2rightSegsWithWeight(mg.nlines());
-
-  // todo
-  // use the sweep operation instead!!!!
-  // THERE_ARE_BUGS_HERE("Use the Sweep Operation to detect orientation
-  // violation between lines and segs!");
-
-  for (int line = 0; line < mg.nlines(); line++) {
-    auto &l = mg.lines[line].component;
-    int claz = mg.lines[line].claz;
-    if (claz == -1) {
-      continue;
-    }
-    for (int vpid = 0; vpid < mg.vps.size(); vpid++) {
-      if (vpid == claz) {
-        continue;
-      }
-      Vec3 vp = mg.vps[vpid];
-      if (vp.dot(normalize(l.center())) < 0) {
-        vp = -vp;
-      }
-
-      Vec3 lineRight = l.first.cross(l.second);
-      bool onLeft = (vp - l.first).dot(lineRight) < 0;
-
-      double lineAngleToVP = std::min(AngleBetweenDirected(l.first, vp),
-                                      AngleBetweenDirected(l.second, vp));
-      double sweepAngle =
-          std::min(angleSizeForPixelsNearLines, lineAngleToVP - 1e-4);
-      std::vector<Vec3> sweepQuad = {normalize(l.first), normalize(l.second),
-                                     RotateDirection(l.second, vp, sweepAngle),
-                                     RotateDirection(l.first, vp, sweepAngle)};
-      Vec3 z = normalize(l.center());
-      Vec3 y = normalize(normalize(l).direction());
-      Vec3 x = normalize(y.cross(z));
-      const double focal = mg.view.camera.focal() * 1.2;
-      int w = std::ceil(tan(sweepAngle + 0.01) * focal * 2 * 1.5);
-      int h = std::ceil(
-          (2 * tan(AngleBetweenDirected(l.first, l.second) / 2.0) + 0.01) *
-          focal * 1.5);
-      PerspectiveCamera pc(w, h, Point2(w / 2.0, h / 2.0), focal, Origin(), z,
-                           y);
-
-      Imagei sampledSegs = MakeCameraSampler(pc, mg.view.camera)(mg.segs);
-
-      std::vector<Point2i> quadProjs(4);
-      for (int i = 0; i < 4; i++) {
-        quadProjs[i] = pc.toScreen(sweepQuad[i]);
-        // assert(IsBetween(quadProjs[i][0], 0, w));
-        // assert(IsBetween(quadProjs[i][1], 0, h));
-        quadProjs[i][0] = BoundBetween(quadProjs[i][0], 0, w);
-        quadProjs[i][1] = BoundBetween(quadProjs[i][1], 0, h);
-      }
-      Imageub mask(pc.screenSize(), false);
-      cv::fillConvexPoly(mask, quadProjs, true);
-
-      for (auto it = sampledSegs.begin(); it != sampledSegs.end(); ++it) {
-        if (!mask(it.pos())) {
-          continue;
-        }
-        int seg = *it;
-        double pixelDistToEyeSquared =
-            Square(Distance(ecast<double>(it.pos()), pc.principlePoint())) +
-            focal * focal;
-        (onLeft ? line2leftSegsWithWeight
-                : line2rightSegsWithWeight)[line][seg] +=
-            1.0 * focal * focal / pixelDistToEyeSquared;
-      }
-    }
-  }
+  std::vector<std::map<int, double>> line2leftSegsWithWeight;
+  std::vector<std::map<int, double>> line2rightSegsWithWeight;
+  CollectLinesSweptSegs(mg, angleSizeForPixelsNearLines,
+                        line2leftSegsWithWeight, line2rightSegsWithWeight);
 
   if (line2leftSegsWithWeightPtr) {
     *line2leftSegsWithWeightPtr = line2leftSegsWithWeight;
@@ -2156,74 +2293,13 @@ std::vector<LineSidingWeight> ComputeLinesSidingWeights2(
     double lambdaShrinkForVLineDetectionInTJunction /*= 0.1*/,
     double angleSizeForPixelsNearLines /*= DegreesToRadians(2)*/,
     std::vector<std::map<int, double>> *line2leftSegsWithWeightPtr,
-    std::vector<std::map<int, double>> *line2rightSegsWithWeightPtr) {
-
-  std::vector<std::map<int, double>> line2leftSegsWithWeight(mg.nlines());
-  std::vector<std::map<int, double>> line2rightSegsWithWeight(mg.nlines());
-
-  for (int line = 0; line < mg.nlines(); line++) {
-    auto &l = mg.lines[line].component;
-    int claz = mg.lines[line].claz;
-    if (claz == -1) {
-      continue;
-    }
-    for (int vpid = 0; vpid < mg.vps.size(); vpid++) {
-      if (vpid == claz) {
-        continue;
-      }
-      Vec3 vp = mg.vps[vpid];
-      if (vp.dot(normalize(l.center())) < 0) {
-        vp = -vp;
-      }
+    std::vector<std::map<int, double>> *line2rightSegsWithWeightPtr,
+    const misc::Deadline &deadline) {
 
-      Vec3 lineRight = l.first.cross(l.second);
-      bool onLeft = (vp - l.first).dot(lineRight) < 0;
-
-      double lineAngleToVP = std::min(AngleBetweenDirected(l.first, vp),
-                                      AngleBetweenDirected(l.second, vp));
-      double sweepAngle =
-          std::min(angleSizeForPixelsNearLines, lineAngleToVP - 1e-4);
-      std::vector<Vec3> sweepQuad = {normalize(l.first), normalize(l.second),
-                                     RotateDirection(l.second, vp, sweepAngle),
-                                     RotateDirection(l.first, vp, sweepAngle)};
-      Vec3 z = normalize(l.center());
-      Vec3 y = normalize(normalize(l).direction());
-      Vec3 x = normalize(y.cross(z));
-      const double focal = mg.view.camera.focal() * 1.2;
-      int w = std::ceil(tan(sweepAngle + 0.01) * focal * 2 * 1.5);
-      int h = std::ceil(
-          (2 * tan(AngleBetweenDirected(l.first, l.second) / 2.0) + 0.01) *
-          focal * 1.5);
-      PerspectiveCamera pc(w, h, Point2(w / 2.0, h / 2.0), focal, Origin(), z,
-                           y);
-
-      Imagei sampledSegs = MakeCameraSampler(pc, mg.view.camera)(mg.segs);
-
-      std::vector<Point2i> quadProjs(4);
-      for (int i = 0; i < 4; i++) {
-        quadProjs[i] = pc.toScreen(sweepQuad[i]);
-        // assert(IsBetween(quadProjs[i][0], 0));
-        // assert(IsBetween(quadProjs[i][1], 0));
-        quadProjs[i][0] = BoundBetween(quadProjs[i][0], 0, w);
-        quadProjs[i][1] = BoundBetween(quadProjs[i][1], 0, h);
-      }
-      Imageub mask(pc.screenSize(), false);
-      cv::fillConvexPoly(mask, quadProjs, true);
-
-      for (auto it = sampledSegs.begin(); it != sampledSegs.end(); ++it) {
-        if (!mask(it.pos())) {
-          continue;
-        }
-        int seg = *it;
-        double pixelDistToEyeSquared =
-            Square(Distance(ecast<double>(it.pos()), pc.principlePoint())) +
-            focal * focal;
-        (onLeft ? line2leftSegsWithWeight
-                : line2rightSegsWithWeight)[line][seg] +=
-            1.0 * focal * focal / pixelDistToEyeSquared;
-      }
-    }
-  }
+  std::vector<std::map<int, double>> line2leftSegsWithWeight;
+  std::vector<std::map<int, double>> line2rightSegsWithWeight;
+  CollectLinesSweptSegs(mg, angleSizeForPixelsNearLines,
+                        line2leftSegsWithWeight, line2rightSegsWithWeight);
 
   if (line2leftSegsWithWeightPtr) {
     *line2leftSegsWithWeightPtr = line2leftSegsWithWeight;
@@ -2517,14 +2593,17 @@ std::vector<LineSidingWeight> ComputeLinesSidingWeights2(
 
   std::vector<int> bestLabels;
   double minEnergy = std::numeric_limits<double>::infinity();
-  fg.solve(5, 10, [&bestLabels,
-                   &minEnergy](int epoch, double energy, double denergy,
-                               const std::vector<int> &results) -> bool {
+  fg.solve(5, 10, [&bestLabels, &minEnergy,
+                   &deadline](int epoch, double energy, double denergy,
+                              const std::vector<int> &results) -> bool {
     std::cout << "epoch: " << epoch << "\t energy: " << energy << std::endl;
     if (energy < minEnergy) {
       bestLabels = results;
       minEnergy = energy;
     }
+    if (deadline.expired()) {
+      return false;
+    }
     if (denergy / std::max(energy, 1.0) >= 1e-3) {
       return false;
     }
@@ -2723,66 +2802,14 @@ std::vector<std::array<std::set<int>, 2>>
 CollectSegsNearLines(const PIGraph<PanoramicCamera> &mg,
                      double angleSizeForPixelsNearLines) {
 
-  int width = mg.segs.cols;
-  int height = mg.segs.rows;
-
-  RTreeMap<Vec3, std::pair<Line3, int>> lineSamplesTree;
-  for (int i = 0; i < mg.nlines(); i++) {
-    auto &line = mg.lines[i].component;
-    double spanAngle = AngleBetweenDirected(line.first, line.second);
-    for (double a = 0.0; a < spanAngle;
-         a += angleSizeForPixelsNearLines / 3.0) {
-      Vec3 sample1 = normalize(RotateDirection(line.first, line.second, a));
-      Vec3 sample2 = normalize(RotateDirection(
-          line.first, line.second, a + angleSizeForPixelsNearLines / 3.0));
-      lineSamplesTree.emplace(normalize(sample1 + sample2),
-                              std::make_pair(Line3(sample1, sample2), i));
-    }
-  }
-
-  // collect lines' nearby pixels and segs
-  std::vector<std::set<Pixel>> line2nearbyPixels(mg.nlines());
-  std::vector<std::map<int, Vec3>> line2nearbySegsWithLocalCenterDir(
+  // collect lines' nearby segs
+  std::vector<std::map<int, Vec3>> line2nearbySegsWithLocalCenterDir;
+  std::vector<std::map<int, bool>> line2nearbySegsWithOnLeftFlag(
       mg.nlines());
-  std::vector<std::map<int, bool>> line2nearbySegsWithOnLeftFlag(mg.nlines());
-  std::vector<std::map<int, double>> line2nearbySegsWithWeight(mg.nlines());
-
-  for (auto it = mg.segs.begin(); it != mg.segs.end(); ++it) {
-    Pixel p = it.pos();
-    double weight = cos((p.y - (height - 1) / 2.0) / (height - 1) * M_PI);
-    Vec3 dir = normalize(mg.view.camera.toSpace(p));
-    int seg = *it;
-    lineSamplesTree.search(
-        BoundingBox(dir).expand(angleSizeForPixelsNearLines * 3),
-        [&mg, &dir, &line2nearbyPixels, &line2nearbySegsWithLocalCenterDir,
-         &line2nearbySegsWithWeight, angleSizeForPixelsNearLines, p, seg,
-         weight](const std::pair<Vec3, std::pair<Line3, int>> &lineSample) {
-          auto line = normalize(mg.lines[lineSample.second.second].component);
-          // d(dir, line) < angleSizeForPixelsNearLines && lambda(dir, line) \in
-          // [0, 1]
-          auto dirOnLine = DistanceFromPointToLine(dir, lineSample.second.first)
-                               .second.position;
-          double angleDist = AngleBetweenDirected(dir, dirOnLine);
-          double lambda = ProjectionOfPointOnLine(dir, line)
-                              .ratio; // the projected position on line
-          if (angleDist < angleSizeForPixelsNearLines &&
-              IsBetween(lambda, 0.0, 1.0)) {
-            line2nearbyPixels[lineSample.second.second].insert(p);
-            auto &localCenterDir =
-                line2nearbySegsWithLocalCenterDir[lineSample.second.second]
-                                                 [seg];
-            localCenterDir += dir * weight;
-            double &segWeight =
-                line2nearbySegsWithWeight[lineSample.second.second][seg];
-            segWeight +=
-                weight *
-                Gaussian(
-                    lambda - 0.5,
-                    0.1); // the closer to the center, the more important it is!
-          }
-          return true;
-        });
-  }
+  std::vector<std::map<int, double>> line2nearbySegsWithWeight;
+  CollectLinesNearbySegs(mg, angleSizeForPixelsNearLines,
+                         line2nearbySegsWithLocalCenterDir,
+                         line2nearbySegsWithWeight);
   for (int i = 0; i < mg.nlines(); i++) {
     auto &nearbySegsWithLocalCenterDir = line2nearbySegsWithLocalCenterDir[i];
     auto &line = mg.lines[i].component;
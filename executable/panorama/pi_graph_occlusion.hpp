@@ -1,5 +1,6 @@
 #pragma once
 
+#include "clock.hpp"
 #include "pi_graph.hpp"
 
 namespace pano {
@@ -38,6 +39,21 @@ struct LineSidingWeight {
   }
 };
 
+// the segs near each line, with their weighted local center directions and
+// weights, and optionally the pixels near each line
+void CollectLinesNearbySegs(
+    const PIGraph<PanoramicCamera> &mg, double angleSizeForPixelsNearLines,
+    std::vector<std::map<int, Vec3>> &line2nearbySegsWithLocalCenterDir,
+    std::vector<std::map<int, double>> &line2nearbySegsWithWeight,
+    std::vector<std::set<Pixel>> *line2nearbyPixelsPtr = nullptr);
+
+// the segs swept by each line toward the other vps, on the left and the right
+// of the line, weighted by their pixels in the sweeping quads
+void CollectLinesSweptSegs(
+    const PIGraph<PanoramicCamera> &mg, double angleSizeForPixelsNearLines,
+    std::vector<std::map<int, double>> &line2leftSegsWithWeight,
+    std::vector<std::map<int, double>> &line2rightSegsWithWeight);
+
 std::vector<LineSidingWeight> ComputeLinesSidingWeights(
     const PIGraph<PanoramicCamera> &mg,
     double minAngleSizeOfLineInTJunction = DegreesToRadians(3),
@@ -47,6 +63,7 @@ std::vector<LineSidingWeight> ComputeLinesSidingWeights(
     std::vector<std::map<int, double>> *line2leftSegsWithWeightPtr = nullptr,
     std::vector<std::map<int, double>> *line2rightSegsWithWeightPtr = nullptr);
 
+// the factor graph keeps its best labels so far once the deadline expires
 std::vector<LineSidingWeight> ComputeLinesSidingWeights2(
     const PIGraph<PanoramicCamera> &mg,
     double minAngleSizeOfLineInTJunction = DegreesToRadians(3),
@@ -54,7 +71,8 @@ std::vector<LineSidingWeight> ComputeLinesSidingWeights2(
     double lambdaShrinkForVLineDetectionInTJunction = 0.1,
     double angleSizeForPixelsNearLines = DegreesToRadians(2),
     std::vector<std::map<int, double>> *line2leftSegsWithWeightPtr = nullptr,
-    std::vector<std::map<int, double>> *line2rightSegsWithWeightPtr = nullptr);
+    std::vector<std::map<int, double>> *line2rightSegsWithWeightPtr = nullptr,
+    const misc::Deadline &deadline = misc::Deadline());
 
 std::vector<LineSidingWeight> ComputeLinesSidingWeightsFromAnnotation(
     const PIGraph<PanoramicCamera> &mg, const PILayoutAnnotation &anno,
@@ -0,0 +1,192 @@
+#include "containers.hpp"
+#include "pi_graph_occlusion.hpp"
+
+#include "panoramix.unittest.hpp"
+
+using namespace pano;
+using namespace pano::core;
+using namespace pano::experimental;
+
+namespace {
+// segs in a grid of cells and lines along the vps scattered over the sphere
+PIGraph<PanoramicCamera> MakeGridGraph(int nlines) {
+  PIGraph<PanoramicCamera> mg;
+  mg.view.camera = PanoramicCamera(100);
+  mg.vps = {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)};
+  mg.verticalVPId = 2;
+  auto size = mg.view.camera.screenSize();
+  mg.segs = Imagei(size);
+  for (auto it = mg.segs.begin(); it != mg.segs.end(); ++it) {
+    auto p = it.pos();
+    *it = p.x * 12 / size.width + p.y * 6 / size.height * 12;
+  }
+  mg.nsegs = 12 * 6;
+
+  std::default_random_engine rng(0);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  while (mg.nlines() < nlines) {
+    int claz = mg.nlines() % 3;
+    auto &vp = mg.vps[claz];
+    Vec3 center = normalize(Vec3(uniform(rng), uniform(rng), uniform(rng)));
+    if (abs(center.dot(vp)) > 0.8) {
+      continue;
+    }
+    Vec3 along = normalize(vp - center * center.dot(vp));
+    double halfSpan = 0.1 + 0.15 * (uniform(rng) + 1.0);
+    Line3 line(normalize(center - along * halfSpan),
+               normalize(center + along * halfSpan));
+    mg.lines.push_back(Classified<Line3>{claz, line});
+  }
+  return mg;
+}
+
+// the former pixel scan against the line samples tree
+void CollectLinesNearbySegsByScan(
+    const PIGraph<PanoramicCamera> &mg, double angleSizeForPixelsNearLines,
+    std::vector<std::map<int, Vec3>> &line2nearbySegsWithLocalCenterDir,
+    std::vector<std::map<int, double>> &line2nearbySegsWithWeight,
+    std::vector<std::set<Pixel>> &line2nearbyPixels) {
+  int height = mg.segs.rows;
+  RTreeMap<Vec3, std::pair<Line3, int>> lineSamplesTree;
+  for (int i = 0; i < mg.nlines(); i++) {
+    auto &line = mg.lines[i].component;
+    double spanAngle = AngleBetweenDirected(line.first, line.second);
+    for (double a = 0.0; a < spanAngle;
+         a += angleSizeForPixelsNearLines / 3.0) {
+      Vec3 sample1 = normalize(RotateDirection(line.first, line.second, a));
+      Vec3 sample2 = normalize(RotateDirection(
+          line.first, line.second, a + angleSizeForPixelsNearLines / 3.0));
+      lineSamplesTree.emplace(normalize(sample1 + sample2),
+                              std::make_pair(Line3(sample1, sample2), i));
+    }
+  }
+
+  line2nearbyPixels.assign(mg.nlines(), {});
+  line2nearbySegsWithLocalCenterDir.assign(mg.nlines(), {});
+  line2nearbySegsWithWeight.assign(mg.nlines(), {});
+  for (auto it = mg.segs.begin(); it != mg.segs.end(); ++it) {
+    Pixel p = it.pos();
+    double weight = cos((p.y - (height - 1) / 2.0) / (height - 1) * M_PI);
+    Vec3 dir = normalize(mg.view.camera.toSpace(p));
+    int seg = *it;
+    lineSamplesTree.search(
+        BoundingBox(dir).expand(angleSizeForPixelsNearLines * 3),
+        [&](const std::pair<Vec3, std::pair<Line3, int>> &lineSample) {
+          int i = lineSample.second.second;
+          auto line = normalize(mg.lines[i].component);
+          auto dirOnLine = DistanceFromPointToLine(dir, lineSample.second.first)
+                               .second.position;
+          double angleDist = AngleBetweenDirected(dir, dirOnLine);
+          double lambda = ProjectionOfPointOnLine(dir, line).ratio;
+          if (angleDist < angleSizeForPixelsNearLines &&
+              IsBetween(lambda, 0.0, 1.0)) {
+            line2nearbyPixels[i].insert(p);
+            line2nearbySegsWithLocalCenterDir[i][seg] += dir * weight;
+            line2nearbySegsWithWeight[i][seg] +=
+                weight * Gaussian(lambda - 0.5, 0.1);
+          }
+          return true;
+        });
+  }
+}
+
+// the former sweep that resampled the whole perspective patch of each line
+void CollectLinesSweptSegsBySampler(
+    const PIGraph<PanoramicCamera> &mg, double angleSizeForPixelsNearLines,
+    std::vector<std::map<int, double>> &line2leftSegsWithWeight,
+    std::vector<std::map<int, double>> &line2rightSegsWithWeight) {
+  line2leftSegsWithWeight.assign(mg.nlines(), {});
+  line2rightSegsWithWeight.assign(mg.nlines(), {});
+  for (int line = 0; line < mg.nlines(); line++) {
+    auto &l = mg.lines[line].component;
+    int claz = mg.lines[line].claz;
+    for (int vpid = 0; vpid < mg.vps.size(); vpid++) {
+      if (vpid == claz) {
+        continue;
+      }
+      Vec3 vp = mg.vps[vpid];
+      if (vp.dot(normalize(l.center())) < 0) {
+        vp = -vp;
+      }
+      Vec3 lineRight = l.first.cross(l.second);
+      bool onLeft = (vp - l.first).dot(lineRight) < 0;
+      double lineAngleToVP = std::min(AngleBetweenDirected(l.first, vp),
+                                      AngleBetweenDirected(l.second, vp));
+      double sweepAngle =
+          std::min(angleSizeForPixelsNearLines, lineAngleToVP - 1e-4);
+      std::vector<Vec3> sweepQuad = {normalize(l.first), normalize(l.second),
+                                     RotateDirection(l.second, vp, sweepAngle),
+                                     RotateDirection(l.first, vp, sweepAngle)};
+      Vec3 z = normalize(l.center());
+      Vec3 y = normalize(normalize(l).direction());
+      const double focal = mg.view.camera.focal() * 1.2;
+      int w = std::ceil(tan(sweepAngle + 0.01) * focal * 2 * 1.5);
+      int h = std::ceil(
+          (2 * tan(AngleBetweenDirected(l.first, l.second) / 2.0) + 0.01) *
+          focal * 1.5);
+      PerspectiveCamera pc(w, h, Point2(w / 2.0, h / 2.0), focal, Origin(), z,
+                           y);
+      Imagei sampledSegs = MakeCameraSampler(pc, mg.view.camera)(mg.segs);
+
+      std::vector<Point2i> quadProjs(4);
+      for (int i = 0; i < 4; i++) {
+        quadProjs[i] = pc.toScreen(sweepQuad[i]);
+        quadProjs[i][0] = BoundBetween(quadProjs[i][0], 0, w);
+        quadProjs[i][1] = BoundBetween(quadProjs[i][1], 0, h);
+      }
+      Imageub mask(pc.screenSize(), false);
+      cv::fillConvexPoly(mask, quadProjs, true);
+      for (auto it = sampledSegs.begin(); it != sampledSegs.end(); ++it) {
+        if (!mask(it.pos())) {
+          continue;
+        }
+        double pixelDistToEyeSquared =
+            Square(Distance(ecast<double>(it.pos()), pc.principlePoint())) +
+            focal * focal;
+        (onLeft ? line2leftSegsWithWeight
+                : line2rightSegsWithWeight)[line][*it] +=
+            1.0 * focal * focal / pixelDistToEyeSquared;
+      }
+    }
+  }
+}
+
+template <class T>
+void ExpectSameTables(const std::vector<std::map<int, T>> &tables,
+                      const std::vector<std::map<int, T>> &expected) {
+  ASSERT_EQ(tables.size(), expected.size());
+  for (int i = 0; i < tables.size(); i++) {
+    ASSERT_EQ(tables[i].size(), expected[i].size()) << "line " << i;
+    for (auto &entry : expected[i]) {
+      ASSERT_TRUE(Contains(tables[i], entry.first)) << "line " << i;
+      EXPECT_LT(Distance(tables[i].at(entry.first), entry.second),
+                1e-9 * (1.0 + Distance(entry.second, T())))
+          << "line " << i << ", seg " << entry.first;
+    }
+  }
+}
+}
+
+TEST(PIGraphOcclusion, NearbySegsSameAsScan) {
+  auto mg = MakeGridGraph(30);
+  double angle = DegreesToRadians(2);
+  std::vector<std::map<int, Vec3>> centerDirs, expectedCenterDirs;
+  std::vector<std::map<int, double>> weights, expectedWeights;
+  std::vector<std::set<Pixel>> pixels, expectedPixels;
+  CollectLinesNearbySegs(mg, angle, centerDirs, weights, &pixels);
+  CollectLinesNearbySegsByScan(mg, angle, expectedCenterDirs,
+                               expectedWeights, expectedPixels);
+  EXPECT_TRUE(pixels == expectedPixels);
+  ExpectSameTables(centerDirs, expectedCenterDirs);
+  ExpectSameTables(weights, expectedWeights);
+}
+
+TEST(PIGraphOcclusion, SweptSegsSameAsSampler) {
+  auto mg = MakeGridGraph(30);
+  double angle = DegreesToRadians(2);
+  std::vector<std::map<int, double>> left, right, expectedLeft, expectedRight;
+  CollectLinesSweptSegs(mg, angle, left, right);
+  CollectLinesSweptSegsBySampler(mg, angle, expectedLeft, expectedRight);
+  ExpectSameTables(left, expectedLeft);
+  ExpectSameTables(right, expectedRight);
+}
@@ -51,12 +51,17 @@ std::vector<Vec3> ComputeSegNormals(const PICGDeterminablePart &dp,
                                     const PIConstraintGraph &cg,
                                     const PIGraph<PanoramicCamera> &mg, bool smoothed);
 
-template <class CameraT>
-Image3d SurfaceNormalMap(const CameraT &cam, const PICGDeterminablePart &dp,
-                         const PIConstraintGraph &cg, const PIGraph<PanoramicCamera> &mg,
-                         bool smoothed) {
+// SurfaceNormalMap
+// T is the scalar type of the normals, SurfaceNormalMap<float>(...) halves the
+// map
+template <class T = double, class CameraT>
+Image_<Vec<T, 3>> SurfaceNormalMap(const CameraT &cam,
+                                   const PICGDeterminablePart &dp,
+                                   const PIConstraintGraph &cg,
+                                   const PIGraph<PanoramicCamera> &mg,
+                                   bool smoothed) {
   auto seg2normal = ComputeSegNormals(dp, cg, mg, smoothed);
-  Image3d snm(cam.screenSize());
+  Image_<Vec<T, 3>> snm(cam.screenSize());
   for (auto it = snm.begin(); it != snm.end(); ++it) {
     auto p = it.pos();
     auto dir = normalize(cam.toSpace(p));
@@ -81,26 +86,34 @@ Imaged SurfaceDepthMap(const CameraT &cam, const PICGDeterminablePart &dp,
   Imaged depths(cam.screenSize(), 0.0);
   double minv = std::numeric_limits<double>::max();
   double maxv = 0.0;
-  for (auto it = depths.begin(); it != depths.end(); ++it) {
-    auto pos = it.pos();
-    int seg = mg.segs(pos);
-    if (!mg.seg2control[seg].used) {
-      *it = -1;
-      continue;
-    }
-    auto &plane = seg2plane[seg];
-    if (plane.normal == Origin()) {
-      continue;
+  std::vector<Point2> pixels(depths.cols);
+  std::vector<Point3> points(depths.cols);
+  for (int y = 0; y < depths.rows; y++) {
+    for (int x = 0; x < depths.cols; x++) {
+      pixels[x] = Point2(x, y);
     }
-    Vec3 dir = normalize(cam.toSpace(pos));
-    double depth = norm(Intersection(Ray3(Origin(), dir), plane));
-    if (depth < minv) {
-      minv = depth;
-    }
-    if (depth > maxv) {
-      maxv = depth;
+    cam.toSpaceBatch(pixels.data(), points.data(), depths.cols);
+    for (int x = 0; x < depths.cols; x++) {
+      Pixel pos(x, y);
+      int seg = mg.segs(pos);
+      if (!mg.seg2control[seg].used) {
+        depths(pos) = -1;
+        continue;
+      }
+      auto &plane = seg2plane[seg];
+      if (plane.normal == Origin()) {
+        continue;
+      }
+      Vec3 dir = normalize(points[x]);
+      double depth = norm(Intersection(Ray3(Origin(), dir), plane));
+      if (depth < minv) {
+        minv = depth;
+      }
+      if (depth > maxv) {
+        maxv = depth;
+      }
+      depths(pos) = depth;
     }
-    *it = depth;
   }
   // fill the holes
   std::vector<double> ordered(depths.begin(), depths.end());
@@ -196,17 +196,22 @@ Plane3 SegInstance(const std::vector<Vec3> &vps, const SegControl &control,
   return Plane3FromEquation(p(0, 0), p(1, 0), p(2, 0));
 }
 
-void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
-                                 misc::Matlab &matlab) {
-
-  if (anno.nfaces() == 0) {
-    return;
-  }
+namespace {
+// faces of an annotation grouped as planes by their coplanarities
+struct LayoutAnnotationPlanes {
+  std::vector<int> face2plane;
+  std::vector<std::set<int>> plane2faces;
+  std::vector<SegControl> plane2control;
+  std::vector<Vec3> plane2center;
+  std::vector<std::pair<int, int>> border2face; // left, right
+};
+
+LayoutAnnotationPlanes GroupLayoutAnnotationPlanes(
+    const PILayoutAnnotation &anno) {
+  LayoutAnnotationPlanes lp;
 
   // group faces as planes
-  std::vector<int> face2plane(anno.nfaces());
-  std::map<int, std::set<int>> plane2faces;
-
+  lp.face2plane.resize(anno.nfaces());
   std::vector<int> faces(anno.nfaces());
   std::iota(faces.begin(), faces.end(), 0);
   int nplanes = core::ConnectedComponents(
@@ -222,22 +227,22 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
         }
         return coplanarFaces;
       },
-      [&face2plane, &plane2faces](int face, int ccid) {
-        face2plane[face] = ccid;
-        plane2faces[ccid].insert(face);
+      [&lp](int face, int ccid) {
+        lp.face2plane[face] = ccid;
+        if (lp.plane2faces.size() <= ccid) {
+          lp.plane2faces.resize(ccid + 1);
+        }
+        lp.plane2faces[ccid].insert(face);
       });
+  lp.plane2faces.resize(nplanes);
 
   // get plane properties
-  std::vector<SegControl> plane2control(nplanes);
-  std::vector<Vec3> plane2center(nplanes);
-  std::vector<int> plane2varPosition(nplanes);
-  std::vector<int> plane2nvar(nplanes);
-
-  int nvars = 0;
+  lp.plane2control.resize(nplanes);
+  lp.plane2center.resize(nplanes);
   for (int i = 0; i < nplanes; i++) {
     SegControl control = {-1, -1, true};
     Vec3 center;
-    for (int face : plane2faces[i]) {
+    for (int face : lp.plane2faces[i]) {
       auto &ctrl = anno.face2control[face];
       if (ctrl.dof() < control.dof()) {
         control = ctrl;
@@ -247,12 +252,8 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
       }
     }
     center /= norm(center);
-    plane2control[i] = control;
-    plane2center[i] = center;
-    int nvar = control.dof();
-    plane2nvar[i] = nvar;
-    plane2varPosition[i] = nvars;
-    nvars += nvar;
+    lp.plane2control[i] = control;
+    lp.plane2center[i] = center;
   }
 
   // get corners2border and border2face
@@ -261,8 +262,7 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
     auto &cs = anno.border2corners[i];
     corners2border[cs] = i;
   }
-  std::vector<std::pair<int, int>> border2face(anno.nborders(),
-                                               std::make_pair(-1, -1));
+  lp.border2face.assign(anno.nborders(), std::make_pair(-1, -1));
   for (int i = 0; i < anno.nfaces(); i++) {
     auto &cs = anno.face2corners[i];
     for (int j = 0; j < cs.size(); j++) {
@@ -270,15 +270,35 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
       int c2 = cs[(j + 1) % cs.size()];
       if (Contains(corners2border, std::make_pair(c1, c2))) {
         int b = corners2border.at(std::make_pair(c1, c2));
-        border2face[b].first = i;
+        lp.border2face[b].first = i;
       } else if (Contains(corners2border, std::make_pair(c2, c1))) {
         int b = corners2border.at(std::make_pair(c2, c1));
-        border2face[b].second = i;
+        lp.border2face[b].second = i;
       } else {
         SHOULD_NEVER_BE_CALLED();
       }
     }
   }
+  return lp;
+}
+
+// solve the given planes using the connected borders between them, returns
+// the plane instances in the order of planes
+// if warmStart is given, its planes (in the order of planes) are used to
+// initialize the anchor depths
+std::vector<Plane3>
+SolveLayoutAnnotationPlanes(const PILayoutAnnotation &anno,
+                            const LayoutAnnotationPlanes &lp,
+                            const std::vector<int> &planes,
+                            const std::vector<Plane3> *warmStart,
+                            misc::Matlab &matlab) {
+
+  std::vector<int> plane2varPosition(lp.plane2faces.size(), -1);
+  int nvars = 0;
+  for (int plane : planes) {
+    plane2varPosition[plane] = nvars;
+    nvars += lp.plane2control[plane].dof();
+  }
 
   // the elements of sparse matrix A
   // inverse depths of vert1s on each anchor A1 * X
@@ -287,25 +307,28 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
   std::vector<SparseMatElementd> A1triplets, A2triplets;
   int eid = 0;
   for (int i = 0; i < anno.nborders(); i++) {
-    int plane1 = face2plane[border2face[i].first];
-    int plane2 = face2plane[border2face[i].second];
+    int plane1 = lp.face2plane[lp.border2face[i].first];
+    int plane2 = lp.face2plane[lp.border2face[i].second];
     assert(plane1 != -1 && plane2 != -1);
     if (!anno.border2connected[i]) {
       continue;
     }
     int varpos1 = plane2varPosition[plane1];
     int varpos2 = plane2varPosition[plane2];
+    if (varpos1 == -1 || varpos2 == -1) {
+      continue;
+    }
 
     Vec3 corners[] = {anno.corners[anno.border2corners[i].first],
                       anno.corners[anno.border2corners[i].second]};
     for (auto &anchor : corners) {
       auto coeffs1 = InverseDepthCoefficientsOfSegAtDirection(
-          anno.vps, plane2control[plane1], plane2center[plane1], anchor);
+          anno.vps, lp.plane2control[plane1], lp.plane2center[plane1], anchor);
       for (int k = 0; k < coeffs1.size(); k++) {
         A1triplets.emplace_back(eid, varpos1 + k, coeffs1[k]);
       }
       auto coeffs2 = InverseDepthCoefficientsOfSegAtDirection(
-          anno.vps, plane2control[plane2], plane2center[plane2], anchor);
+          anno.vps, lp.plane2control[plane2], lp.plane2center[plane2], anchor);
       for (int k = 0; k < coeffs2.size(); k++) {
         A2triplets.emplace_back(eid, varpos2 + k, coeffs2[k]);
       }
@@ -315,14 +338,35 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
 
   int neqs = eid;
 
+  // the initial variables fitted from the warm start planes
+  std::vector<double> X0;
+  if (warmStart) {
+    assert(warmStart->size() == planes.size());
+    X0.resize(nvars);
+    for (int i = 0; i < planes.size() && !X0.empty(); i++) {
+      int plane = planes[i];
+      Vec3 equation = Plane3ToEquation((*warmStart)[i]);
+      DenseMatd k = SegPlaneEquationCoefficients(
+          anno.vps, lp.plane2control[plane], lp.plane2center[plane]);
+      DenseMatd x;
+      cv::solve(k, DenseMatd(equation), x, cv::DECOMP_SVD);
+      for (int j = 0; j < k.cols; j++) {
+        X0[plane2varPosition[plane] + j] = x(j, 0);
+        if (IsInfOrNaN(x(j, 0))) {
+          X0.clear();
+          break;
+        }
+      }
+    }
+  }
+
   auto A1 = MakeSparseMatFromElements(neqs, nvars, A1triplets.begin(),
                                       A1triplets.end());
   auto A2 = MakeSparseMatFromElements(neqs, nvars, A2triplets.begin(),
                                       A2triplets.end());
 
   matlab << "clear;";
-  matlab.setVar("A1", A1);
-  matlab.setVar("A2", A2);
+  matlab.setVars("A1", A1, "A2", A2);
 
   matlab << "m = size(A1, 1);"; // number of equations
   matlab << "n = size(A1, 2);"; // number of variables
@@ -331,7 +375,14 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
 
   std::vector<double> X;
   for (int i = 0; i < 100; i++) {
-    matlab << "D1D2 = ones(m, 1);"; //  current depths of anchors
+    if (i == 0 && !X0.empty()) {
+      matlab.setVar("X0", DenseMatd(X0));
+      matlab << "D1D2 = 1./ (A1 * X0) ./ (A2 * X0);";
+      matlab << "D1D2 = abs(D1D2) / norm(D1D2);";
+      matlab << "if any(~isfinite(D1D2)), D1D2 = ones(m, 1); end";
+    } else {
+      matlab << "D1D2 = ones(m, 1);"; //  current depths of anchors
+    }
     while (true) {
       matlab << "K = (A1 - A2) .* repmat(D1D2, [1, n]);";
       matlab << "cvx_begin"
@@ -364,14 +415,325 @@ void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
     }
   }
 
+  std::vector<Plane3> insts(planes.size());
+  for (int i = 0; i < planes.size(); i++) {
+    int plane = planes[i];
+    insts[i] = SegInstance(anno.vps, lp.plane2control[plane],
+                           lp.plane2center[plane],
+                           X.data() + plane2varPosition[plane]);
+  }
+  return insts;
+}
+
+// planes connected by the connected borders form independent systems
+std::vector<std::vector<int>>
+ConnectedLayoutAnnotationParts(const PILayoutAnnotation &anno,
+                               const LayoutAnnotationPlanes &lp) {
+  int nplanes = lp.plane2faces.size();
+  std::vector<std::set<int>> plane2adjPlanes(nplanes);
+  for (int i = 0; i < anno.nborders(); i++) {
+    if (!anno.border2connected[i]) {
+      continue;
+    }
+    int plane1 = lp.face2plane[lp.border2face[i].first];
+    int plane2 = lp.face2plane[lp.border2face[i].second];
+    plane2adjPlanes[plane1].insert(plane2);
+    plane2adjPlanes[plane2].insert(plane1);
+  }
+  std::vector<int> planes(nplanes);
+  std::iota(planes.begin(), planes.end(), 0);
+  std::vector<std::vector<int>> cc2planes;
+  core::ConnectedComponents(
+      planes.begin(), planes.end(),
+      [&plane2adjPlanes](int plane) { return plane2adjPlanes[plane]; },
+      [&cc2planes](int plane, int ccid) {
+        if (cc2planes.size() <= ccid) {
+          cc2planes.resize(ccid + 1);
+        }
+        cc2planes[ccid].push_back(plane);
+      });
+  return cc2planes;
+}
+
+// a single plane has no borders to other planes to be solved with, it is
+// given the plane of its control closest to the one through its center facing
+// the origin
+Plane3 UnitLayoutAnnotationPlane(const PILayoutAnnotation &anno,
+                                 const LayoutAnnotationPlanes &lp, int plane) {
+  auto &center = lp.plane2center[plane];
+  DenseMatd k = SegPlaneEquationCoefficients(anno.vps, lp.plane2control[plane],
+                                             lp.plane2center[plane]);
+  DenseMatd x;
+  cv::solve(k, DenseMatd(center), x, cv::DECOMP_SVD);
+  DenseMatd p = k * x;
+  Vec3 equation(p(0, 0), p(1, 0), p(2, 0));
+  double invCenterDepth = equation.dot(center);
+  if (invCenterDepth > 0) {
+    equation /= invCenterDepth;
+  }
+  return Plane3FromEquation(equation);
+}
+
+// scales the planes of each part so that its nearest anchor has inverse depth
+// 1, where cvx leaves it, and then all planes so that the median of the summed
+// inverse depths of the anchors is 2, as the solve does, so that parts solved
+// separately are placed as if solved together
+void NormalizeLayoutAnnotationPlanes(
+    const PILayoutAnnotation &anno, const LayoutAnnotationPlanes &lp,
+    const std::vector<std::vector<int>> &cc2planes,
+    std::vector<Plane3> &plane2inst) {
+  int nplanes = lp.plane2faces.size();
+  std::vector<Vec3> plane2equation(nplanes);
+  for (int i = 0; i < nplanes; i++) {
+    plane2equation[i] = Plane3ToEquation(plane2inst[i]);
+  }
+  std::vector<int> plane2cc(nplanes, -1);
+  for (int i = 0; i < cc2planes.size(); i++) {
+    for (int plane : cc2planes[i]) {
+      plane2cc[plane] = i;
+    }
+  }
+
+  // the inverse depths of the anchors on the connected borders
+  std::vector<std::pair<int, int>> anchor2planes;
+  std::vector<Vec3> anchors;
+  for (int i = 0; i < anno.nborders(); i++) {
+    if (!anno.border2connected[i]) {
+      continue;
+    }
+    int plane1 = lp.face2plane[lp.border2face[i].first];
+    int plane2 = lp.face2plane[lp.border2face[i].second];
+    auto &cs = anno.border2corners[i];
+    for (int c : {cs.first, cs.second}) {
+      anchor2planes.emplace_back(plane1, plane2);
+      anchors.push_back(normalize(anno.corners[c]));
+    }
+  }
+  std::vector<double> cc2minInvDepth(cc2planes.size(),
+                                     std::numeric_limits<double>::infinity());
+  for (int i = 0; i < anchors.size(); i++) {
+    for (int plane : {anchor2planes[i].first, anchor2planes[i].second}) {
+      double &minInvDepth = cc2minInvDepth[plane2cc[plane]];
+      minInvDepth =
+          std::min(minInvDepth, plane2equation[plane].dot(anchors[i]));
+    }
+  }
+  for (int i = 0; i < nplanes; i++) {
+    double minInvDepth = cc2minInvDepth[plane2cc[i]];
+    if (minInvDepth > 0 && !IsInfOrNaN(minInvDepth)) {
+      plane2equation[i] /= minInvDepth;
+    }
+  }
+
+  std::vector<double> invDepthSums(anchors.size());
+  for (int i = 0; i < anchors.size(); i++) {
+    invDepthSums[i] = plane2equation[anchor2planes[i].first].dot(anchors[i]) +
+                      plane2equation[anchor2planes[i].second].dot(anchors[i]);
+  }
+  std::sort(invDepthSums.begin(), invDepthSums.end());
+  if (!invDepthSums.empty()) {
+    int k = invDepthSums.size() / 2;
+    double median = invDepthSums.size() % 2 == 1
+                        ? invDepthSums[k]
+                        : (invDepthSums[k - 1] + invDepthSums[k]) / 2.0;
+    if (median > 0 && !IsInfOrNaN(median)) {
+      for (auto &equation : plane2equation) {
+        equation *= 2.0 / median;
+      }
+    }
+  }
+
+  for (int i = 0; i < nplanes; i++) {
+    plane2inst[i] = Plane3FromEquation(plane2equation[i]);
+  }
+}
+}
+
+void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
+                                 misc::Matlab &matlab) {
+
+  if (anno.nfaces() == 0) {
+    return;
+  }
+
+  auto lp = GroupLayoutAnnotationPlanes(anno);
+  auto cc2planes = ConnectedLayoutAnnotationParts(anno, lp);
+
+  // solve each connected part on its own
+  std::vector<Plane3> plane2inst(lp.plane2faces.size());
+  for (auto &ccPlanes : cc2planes) {
+    if (ccPlanes.size() == 1) {
+      plane2inst[ccPlanes.front()] =
+          UnitLayoutAnnotationPlane(anno, lp, ccPlanes.front());
+      continue;
+    }
+    auto insts =
+        SolveLayoutAnnotationPlanes(anno, lp, ccPlanes, nullptr, matlab);
+    for (int j = 0; j < ccPlanes.size(); j++) {
+      plane2inst[ccPlanes[j]] = insts[j];
+    }
+  }
+  NormalizeLayoutAnnotationPlanes(anno, lp, cc2planes, plane2inst);
+
+  // install back as planes
+  for (int i = 0; i < plane2inst.size(); i++) {
+    for (int face : lp.plane2faces[i]) {
+      anno.face2plane[face] = plane2inst[i];
+    }
+  }
+}
+
+void ReconstructLayoutAnnotationIncrementally(
+    PILayoutAnnotation &anno, misc::Matlab &matlab,
+    LayoutAnnotationReconstructionCache &cache) {
+
+  if (anno.nfaces() == 0) {
+    cache = LayoutAnnotationReconstructionCache();
+    return;
+  }
+
+  // match faces to the last reconstructed ones by their corner loops
+  std::map<std::vector<int>, int> oldLoop2face;
+  for (int i = 0; i < cache.face2corners.size(); i++) {
+    oldLoop2face[CanonicalFaceLoop(cache.face2corners[i])] = i;
+  }
+  std::vector<int> face2oldFace(anno.nfaces(), -1);
+  std::vector<int> oldFace2face(cache.face2corners.size(), -1);
+  std::vector<bool> face2changed(anno.nfaces(), true);
+  for (int i = 0; i < anno.nfaces(); i++) {
+    auto it = oldLoop2face.find(CanonicalFaceLoop(anno.face2corners[i]));
+    if (it == oldLoop2face.end()) {
+      continue;
+    }
+    int oldFace = it->second;
+    face2oldFace[i] = oldFace;
+    oldFace2face[oldFace] = i;
+    bool changed = !(anno.face2control[i] == cache.face2control[oldFace]);
+    for (int c : anno.face2corners[i]) {
+      changed = changed || c >= cache.corners.size() ||
+                anno.corners[c] != cache.corners[c];
+    }
+    face2changed[i] = changed;
+  }
+
+  // faces whose coplanarities are added or removed
+  std::set<std::pair<int, int>> oldCoplanarPairs, coplanarPairs;
+  for (auto &fp : cache.coplanarFacePairs) {
+    int f1 = oldFace2face[fp.first];
+    int f2 = oldFace2face[fp.second];
+    if (f1 != -1 && f2 != -1) {
+      oldCoplanarPairs.insert(MakeOrderedPair(f1, f2));
+    }
+  }
+  for (auto &fp : anno.coplanarFacePairs) {
+    coplanarPairs.insert(MakeOrderedPair(fp.first, fp.second));
+  }
+  for (auto &fp : coplanarPairs) {
+    if (!Contains(oldCoplanarPairs, fp)) {
+      face2changed[fp.first] = face2changed[fp.second] = true;
+    }
+  }
+  for (auto &fp : oldCoplanarPairs) {
+    if (!Contains(coplanarPairs, fp)) {
+      face2changed[fp.first] = face2changed[fp.second] = true;
+    }
+  }
+
+  // borders whose connectivity is added or changed
+  std::map<std::pair<int, int>, bool> oldBorder2connected;
+  for (int i = 0; i < cache.border2corners.size(); i++) {
+    oldBorder2connected[MakeOrderedPair(cache.border2corners[i].first,
+                                        cache.border2corners[i].second)] =
+        cache.border2connected[i];
+  }
+  std::vector<bool> border2changed(anno.nborders(), true);
+  for (int i = 0; i < anno.nborders(); i++) {
+    auto it = oldBorder2connected.find(MakeOrderedPair(
+        anno.border2corners[i].first, anno.border2corners[i].second));
+    border2changed[i] = it == oldBorder2connected.end() ||
+                        it->second != anno.border2connected[i];
+  }
+
+  auto lp = GroupLayoutAnnotationPlanes(anno);
+  int nplanes = lp.plane2faces.size();
+  auto cc2planes = ConnectedLayoutAnnotationParts(anno, lp);
+  std::vector<bool> plane2changed(nplanes, false);
+  for (int i = 0; i < anno.nfaces(); i++) {
+    if (face2changed[i]) {
+      plane2changed[lp.face2plane[i]] = true;
+    }
+  }
+  for (int i = 0; i < anno.nborders(); i++) {
+    if (border2changed[i]) {
+      plane2changed[lp.face2plane[lp.border2face[i].first]] = true;
+      plane2changed[lp.face2plane[lp.border2face[i].second]] = true;
+    }
+  }
+
+  // the last solution of each plane, if any
+  std::vector<Plane3> plane2lastInst(nplanes);
+  std::vector<bool> plane2hasLastInst(nplanes, false);
+  for (int i = 0; i < anno.nfaces(); i++) {
+    int oldFace = face2oldFace[i];
+    int plane = lp.face2plane[i];
+    if (oldFace != -1 && !plane2hasLastInst[plane]) {
+      plane2lastInst[plane] = cache.face2plane[oldFace];
+      plane2hasLastInst[plane] = true;
+    }
+  }
+
+  // a part is re-solved if any of its planes changed or was never solved
+  std::vector<Plane3> plane2inst(nplanes);
+  int nsolved = 0;
+  for (auto &ccPlanes : cc2planes) {
+    bool changed = false;
+    for (int plane : ccPlanes) {
+      changed = changed || plane2changed[plane] || !plane2hasLastInst[plane];
+    }
+    if (ccPlanes.size() == 1) {
+      plane2inst[ccPlanes.front()] =
+          UnitLayoutAnnotationPlane(anno, lp, ccPlanes.front());
+    } else if (!changed) {
+      // keep the last solution
+      for (int plane : ccPlanes) {
+        plane2inst[plane] = plane2lastInst[plane];
+      }
+    } else {
+      // re-solve this part only, warm started from the last solution
+      // new planes start as the ones facing the origin at unit distance
+      std::vector<Plane3> warmStart;
+      for (int plane : ccPlanes) {
+        auto &center = lp.plane2center[plane];
+        warmStart.push_back(plane2hasLastInst[plane] ? plane2lastInst[plane]
+                                                     : Plane3(center, center));
+      }
+      auto insts =
+          SolveLayoutAnnotationPlanes(anno, lp, ccPlanes, &warmStart, matlab);
+      for (int j = 0; j < ccPlanes.size(); j++) {
+        plane2inst[ccPlanes[j]] = insts[j];
+      }
+      nsolved++;
+    }
+  }
+  std::cout << nsolved << " of " << cc2planes.size()
+            << " connected parts are re-solved" << std::endl;
+  // the kept parts are placed again among the re-solved ones
+  NormalizeLayoutAnnotationPlanes(anno, lp, cc2planes, plane2inst);
+
   // install back as planes
   for (int i = 0; i < nplanes; i++) {
-    Plane3 inst = SegInstance(anno.vps, plane2control[i], plane2center[i],
-                              X.data() + plane2varPosition[i]);
-    for (int face : plane2faces[i]) {
-      anno.face2plane[face] = inst;
+    for (int face : lp.plane2faces[i]) {
+      anno.face2plane[face] = plane2inst[i];
     }
   }
+
+  cache.corners = anno.corners;
+  cache.border2corners = anno.border2corners;
+  cache.border2connected = anno.border2connected;
+  cache.face2corners = anno.face2corners;
+  cache.face2control = anno.face2control;
+  cache.face2plane = anno.face2plane;
+  cache.coplanarFacePairs = anno.coplanarFacePairs;
 }
 
 void ReconstructLayoutAnnotation2(PILayoutAnnotation &anno,
@@ -404,7 +766,8 @@ void ReconstructLayoutAnnotation3(PILayoutAnnotation &anno,
 
 double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
              misc::Matlab &matlab, int maxIter,
-             double connectionWeightRatioOverCoplanarity, bool useCoplanarity) {
+             double connectionWeightRatioOverCoplanarity, bool useCoplanarity,
+             const misc::Deadline &deadline, int *niters) {
 
   auto &determinableEnts = dp.determinableEnts;
 
@@ -519,21 +882,25 @@ double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
   matlab << "clear;";
 
   int neqsA = eidA;
-  matlab.setVar("A1", MakeSparseMatFromElements(
-                          neqsA, nvars, A1triplets.begin(), A1triplets.end()));
-  matlab.setVar("A2", MakeSparseMatFromElements(
-                          neqsA, nvars, A2triplets.begin(), A2triplets.end()));
+  matlab.setVars(
+      "A1", MakeSparseMatFromElements(neqsA, nvars, A1triplets.begin(),
+                                      A1triplets.end()),
+      "A2", MakeSparseMatFromElements(neqsA, nvars, A2triplets.begin(),
+                                      A2triplets.end()),
+      "WA", misc::MXA::FromColumnMajor(WA.data(), {WA.size(), 1}, true),
+      "WC", misc::MXA::FromColumnMajor(WC.data(), {WC.size(), 1}, true),
+      "s", connectionWeightRatioOverCoplanarity);
   matlab << "A1(isnan(A1)) = 0;";
   matlab << "A2(isnan(A2)) = 0;";
 
   int neqsC = eidC;
   if (neqsC != 0) {
-    matlab.setVar("C1",
-                  MakeSparseMatFromElements(neqsC, nvars, C1triplets.begin(),
-                                            C1triplets.end()));
-    matlab.setVar("C2",
-                  MakeSparseMatFromElements(neqsC, nvars, C2triplets.begin(),
-                                            C2triplets.end()));
+    matlab.setVars("C1", MakeSparseMatFromElements(neqsC, nvars,
+                                                   C1triplets.begin(),
+                                                   C1triplets.end()),
+                   "C2", MakeSparseMatFromElements(neqsC, nvars,
+                                                   C2triplets.begin(),
+                                                   C2triplets.end()));
   } else {
     matlab << "C1 = zeros(0, size(A1, 2));";
     matlab << "C2 = zeros(0, size(A2, 2));";
@@ -541,15 +908,10 @@ double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
   matlab << "C1(isnan(C1)) = 0;";
   matlab << "C2(isnan(C2)) = 0;";
 
-  matlab.setVar("WA", cv::Mat(WA));
-  matlab.setVar("WC", cv::Mat(WC));
-
   matlab << "m = size(A1, 1);"; // number of connection equations
   matlab << "n = size(A1, 2);"; // number of variables
   matlab << "p = size(C1, 1);"; // number of coplanarity equations
 
-  matlab.setVar("s", connectionWeightRatioOverCoplanarity);
-
   double minE = std::numeric_limits<double>::infinity();
 
   std::vector<double> X;
@@ -557,7 +919,12 @@ double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
   {
     matlab << "D1D2 = ones(m, 1);"; //  current depths of anchors
 
+    int iterations = 0;
     for (int t = 0; t < maxIter; t++) {
+      if (iterations > 0 && deadline.expired()) {
+        std::cout << "reweighting stopped by the deadline" << std::endl;
+        break;
+      }
 
       matlab << "K = (A1 - A2) .* repmat(D1D2 .* WA, [1, n]);";
       matlab << "R = (C1 - C2) .* repmat(WC, [1, n]);";
@@ -573,6 +940,7 @@ double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
              << "    ones(m, 1) <= A1 * X;"
              << "    ones(m, 1) <= A2 * X;"
              << "cvx_end";
+      iterations++;
       matlab << "D1D2 = 1./ (A1 * X) ./ (A2 * X);";
       matlab << "D1D2 = abs(D1D2) / norm(D1D2);";
       matlab << "K = (A1 - A2) .* repmat(D1D2 .* WA, [1, n]);";
@@ -591,6 +959,9 @@ double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
         break;
       }
     }
+    if (niters) {
+      *niters = iterations;
+    }
   }
 
   if (IsInfOrNaN(minE)) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "clock.hpp"
 #include "matlab_api.hpp"
 #include "pi_graph.hpp"
 #include "pi_graph_annotation.hpp"
@@ -8,9 +9,31 @@
 namespace pano {
 namespace experimental {
 
+// solves each part of planes connected by connected borders on its own, a
+// part of a single plane gets the plane of its control through its center
 void ReconstructLayoutAnnotation(PILayoutAnnotation &anno,
                                  misc::Matlab &matlab);
 
+// the layout annotation solved last time, kept between incremental
+// reconstructions
+struct LayoutAnnotationReconstructionCache {
+  std::vector<Vec3> corners;
+  std::vector<std::pair<int, int>> border2corners;
+  std::vector<bool> border2connected;
+  std::vector<std::vector<int>> face2corners;
+  std::vector<SegControl> face2control;
+  std::vector<Plane3> face2plane;
+  std::vector<std::pair<int, int>> coplanarFacePairs;
+};
+
+// only re-solves the connected parts whose faces, corners, borders or
+// coplanarities changed since the last call, warm started from the last
+// solution, other parts keep their last planes. all parts are then scaled as
+// ReconstructLayoutAnnotation scales them
+void ReconstructLayoutAnnotationIncrementally(
+    PILayoutAnnotation &anno, misc::Matlab &matlab,
+    LayoutAnnotationReconstructionCache &cache);
+
 // use general plane representation method
 void ReconstructLayoutAnnotation2(PILayoutAnnotation &anno,
                                   misc::Matlab &matlab);
@@ -18,11 +41,15 @@ void ReconstructLayoutAnnotation3(PILayoutAnnotation &anno,
                                   misc::Matlab &matlab);
 
 
+// the reweighting stops after maxIter iterations, or once the deadline
+// expires after the first one, niters receives the iterations done
 double Solve(const PICGDeterminablePart &dp, PIConstraintGraph &cg,
              misc::Matlab &matlab,
              int maxIter = std::numeric_limits<int>::max(),
              double connectionWeightRatioOverCoplanarity = 1e7,
-             bool useCoplanarity = true);
+             bool useCoplanarity = true,
+             const misc::Deadline &deadline = misc::Deadline(),
+             int *niters = nullptr);
 
 int DisableUnsatisfiedConstraints(
     const PICGDeterminablePart &dp, PIConstraintGraph &cg,
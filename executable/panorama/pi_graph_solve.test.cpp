@@ -0,0 +1,299 @@
+#include "matlab_mock.hpp"
+#include "pi_graph_solve.hpp"
+
+#include "panoramix.unittest.hpp"
+
+using namespace pano;
+using namespace pano::core;
+using namespace pano::experimental;
+
+#ifndef PANORAMIX_USE_MATLAB
+namespace {
+cv::Mat DenseOf(const misc::MXA &a) {
+  auto mxa = static_cast<const mxArray *>(a.mxa());
+  cv::Mat m = cv::Mat::zeros(a.m(), a.n(), CV_64FC1);
+  auto ir = mxGetIr(mxa);
+  auto jc = mxGetJc(mxa);
+  auto pr = mxGetPr(mxa);
+  for (size_t j = 0; j < a.n(); j++) {
+    for (mwIndex k = jc[j]; k < jc[j + 1]; k++) {
+      m.at<double>(ir[k], j) = pr[k];
+    }
+  }
+  return m;
+}
+
+// solves the cvx program of SolveLayoutAnnotationPlanes on the mock engines,
+// each block of variables tied by equations gets the null vector of its
+// A1 - A2 scaled to A1 * X >= 1 and A2 * X >= 1, free variables are 1
+std::string SolveCVX(const std::smatch &, misc::MockMatlabWorkspace &ws) {
+  cv::Mat A1 = DenseOf(ws.at("A1")), A2 = DenseOf(ws.at("A2"));
+  int m = A1.rows, n = A1.cols;
+  std::vector<int> parent(n);
+  std::iota(parent.begin(), parent.end(), 0);
+  std::function<int(int)> root = [&parent, &root](int v) {
+    return parent[v] == v ? v : parent[v] = root(parent[v]);
+  };
+  std::vector<std::vector<int>> row2vars(m);
+  for (int r = 0; r < m; r++) {
+    for (int j = 0; j < n; j++) {
+      if (A1.at<double>(r, j) != 0 || A2.at<double>(r, j) != 0) {
+        row2vars[r].push_back(j);
+        parent[root(j)] = root(row2vars[r].front());
+      }
+    }
+  }
+  cv::Mat X(n, 1, CV_64FC1, cv::Scalar(1.0));
+  for (int b = 0; b < n; b++) {
+    if (root(b) != b) {
+      continue;
+    }
+    std::vector<int> vars, rows;
+    for (int j = 0; j < n; j++) {
+      if (root(j) == b) {
+        vars.push_back(j);
+      }
+    }
+    for (int r = 0; r < m; r++) {
+      if (!row2vars[r].empty() && root(row2vars[r].front()) == b) {
+        rows.push_back(r);
+      }
+    }
+    if (rows.empty()) {
+      continue;
+    }
+    cv::Mat A1b(rows.size(), vars.size(), CV_64FC1);
+    cv::Mat A2b(rows.size(), vars.size(), CV_64FC1);
+    for (int r = 0; r < rows.size(); r++) {
+      for (int j = 0; j < vars.size(); j++) {
+        A1b.at<double>(r, j) = A1.at<double>(rows[r], vars[j]);
+        A2b.at<double>(r, j) = A2.at<double>(rows[r], vars[j]);
+      }
+    }
+    cv::Mat z;
+    cv::SVD::solveZ(A1b - A2b, z);
+    if (cv::sum(A1b * z)[0] < 0) {
+      z = -z;
+    }
+    double minDepth = 0.0;
+    cv::minMaxLoc(cv::min(A1b * z, A2b * z), &minDepth);
+    if (minDepth > 0) {
+      z /= minDepth;
+    }
+    for (int j = 0; j < vars.size(); j++) {
+      X.at<double>(vars[j]) = z.at<double>(j);
+    }
+  }
+  ws["X"] = misc::MXA(X, true);
+  return std::string();
+}
+
+void RegisterMockCVX() {
+  static bool registered = false;
+  if (registered) {
+    return;
+  }
+  registered = true;
+  // the reweighting and the cvx declarations do not change the solution
+  misc::RegisterMockMatlabCommand(
+      "(m|n|K|D1D2|scale) = .*|cvx_begin|variable X\\(n\\)|minimize .*|"
+      "subject to|ones\\(m, 1\\) <= A[12] \\* X|if any\\(.*|end",
+      [](const std::smatch &, misc::MockMatlabWorkspace &) {
+        return std::string();
+      });
+  misc::RegisterMockMatlabCommand("cvx_end", SolveCVX);
+  misc::RegisterMockMatlabCommand(
+      "e = norm\\(K \\* X\\)",
+      [](const std::smatch &, misc::MockMatlabWorkspace &ws) {
+        cv::Mat A1 = DenseOf(ws.at("A1")), A2 = DenseOf(ws.at("A2"));
+        cv::Mat X = ws.at("X").toCVMat();
+        ws["e"] = misc::MXA(cv::norm(cv::Mat((A1 - A2) * X)), true);
+        return std::string();
+      });
+  misc::RegisterMockMatlabCommand(
+      "X = 2 \\* X \\./ median\\(\\(A1 \\+ A2\\) \\* X\\)",
+      [](const std::smatch &, misc::MockMatlabWorkspace &ws) {
+        cv::Mat A1 = DenseOf(ws.at("A1")), A2 = DenseOf(ws.at("A2"));
+        cv::Mat X = ws.at("X").toCVMat();
+        std::vector<double> depths = cv::Mat((A1 + A2) * X);
+        std::sort(depths.begin(), depths.end());
+        int k = depths.size() / 2;
+        double median = depths.size() % 2 == 1
+                            ? depths[k]
+                            : (depths[k - 1] + depths[k]) / 2.0;
+        ws["X"] = misc::MXA(cv::Mat(2.0 * X / median), true);
+        return std::string();
+      });
+}
+
+// the layout of a box room seen from inside, off its center
+PILayoutAnnotation MakeBoxAnnotation() {
+  PILayoutAnnotation anno;
+  anno.vps = {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)};
+  anno.vertVPId = 2;
+  for (int i = 0; i < 8; i++) {
+    anno.corners.push_back(normalize(Vec3(i & 1 ? 3.0 : -2.0,
+                                          i & 2 ? 1.5 : -2.5,
+                                          i & 4 ? 1.3 : -1.2)));
+  }
+  for (int i = 0; i < 8; i++) {
+    for (int bit : {1, 2, 4}) {
+      if (i < (i ^ bit)) {
+        anno.addBorder(i, i ^ bit);
+      }
+    }
+  }
+  anno.regenerateFaces();
+  // each face is orthogonal to the axis its corners agree on
+  for (int f = 0; f < anno.nfaces(); f++) {
+    for (int axis = 0; axis < 3; axis++) {
+      int agreed = 0;
+      for (int c : anno.face2corners[f]) {
+        agreed += anno.corners[c][axis] > 0 ? 1 : -1;
+      }
+      if (std::abs(agreed) == int(anno.face2corners[f].size())) {
+        anno.face2control[f] = SegControl{axis, -1, true};
+      }
+    }
+  }
+  return anno;
+}
+
+// the face whose corners all lie on the given side of an axis
+int FaceOnSide(const PILayoutAnnotation &anno, int axis, bool positive) {
+  for (int f = 0; f < anno.nfaces(); f++) {
+    bool onSide = true;
+    for (int c : anno.face2corners[f]) {
+      onSide = onSide && (anno.corners[c][axis] > 0) == positive;
+    }
+    if (onSide) {
+      return f;
+    }
+  }
+  return -1;
+}
+
+void DisconnectBordersOfFace(PILayoutAnnotation &anno, int face) {
+  for (int b = 0; b < anno.nborders(); b++) {
+    if (Contains(anno.face2corners[face], anno.border2corners[b].first) &&
+        Contains(anno.face2corners[face], anno.border2corners[b].second)) {
+      anno.border2connected[b] = false;
+    }
+  }
+}
+
+// re-solves anno incrementally and expects the planes of the full solve on
+// the same annotation
+void ExpectIncrementalSameAsFull(PILayoutAnnotation &anno,
+                                 misc::Matlab &matlab,
+                                 LayoutAnnotationReconstructionCache &cache) {
+  ReconstructLayoutAnnotationIncrementally(anno, matlab, cache);
+  auto full = anno;
+  ReconstructLayoutAnnotation(full, matlab);
+  for (int f = 0; f < anno.nfaces(); f++) {
+    Vec3 root = anno.face2plane[f].root();
+    Vec3 expectedRoot = full.face2plane[f].root();
+    EXPECT_LT(Distance(root, expectedRoot), 1e-6 * norm(expectedRoot))
+        << "face " << f;
+  }
+}
+}
+
+TEST(PIGraphSolve, IncrementalSameAsFull) {
+  RegisterMockCVX();
+  misc::Matlab matlab("", false, false);
+  ASSERT_TRUE(matlab.started());
+
+  auto anno = MakeBoxAnnotation();
+  ASSERT_EQ(anno.nfaces(), 6);
+  LayoutAnnotationReconstructionCache cache;
+
+  // all faces are new
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+
+  // nothing changed
+  auto last = anno.face2plane;
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+  for (int f = 0; f < anno.nfaces(); f++) {
+    EXPECT_LT(Distance(anno.face2plane[f].root(), last[f].root()),
+              1e-9 * norm(last[f].root()));
+  }
+
+  // a moved corner changes the faces around it
+  anno.corners[7] = normalize(anno.corners[7] + Vec3(0, 0, 0.05));
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+
+  // the front wall cut off from the others is a changed single plane
+  int front = FaceOnSide(anno, 0, true);
+  ASSERT_NE(front, -1);
+  DisconnectBordersOfFace(anno, front);
+  last = anno.face2plane;
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+  EXPECT_TRUE(anno.face2plane[front] != last[front]);
+}
+
+TEST(PIGraphSolve, IncrementalSameAsFullWithSeveralParts) {
+  RegisterMockCVX();
+  misc::Matlab matlab("", false, false);
+  ASSERT_TRUE(matlab.started());
+
+  // the front wall and the floor are cut off from the other faces
+  auto anno = MakeBoxAnnotation();
+  int front = FaceOnSide(anno, 0, true);
+  int floor = FaceOnSide(anno, 2, false);
+  int ceiling = FaceOnSide(anno, 2, true);
+  int back = FaceOnSide(anno, 0, false);
+  ASSERT_TRUE(front != -1 && floor != -1 && ceiling != -1 && back != -1);
+  DisconnectBordersOfFace(anno, front);
+  DisconnectBordersOfFace(anno, floor);
+  anno.border2connected[anno.getBorder(1, 3)] = true;
+  LayoutAnnotationReconstructionCache cache;
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+
+  // only the part of the ceiling changes
+  anno.face2control[ceiling] = SegControl{-1, -1, true};
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+
+  // the border between the ceiling and the back wall is split by a new corner,
+  // only the two faces along it are traced again
+  auto before = anno;
+  int b = anno.getBorder(4, 6);
+  ASSERT_NE(b, -1);
+  anno.corners.push_back(
+      normalize(anno.corners[4] + anno.corners[6] + Vec3(0, 0, 0.1)));
+  anno.splitBorderBy(b, anno.corners.size() - 1);
+  anno.updateFaces();
+  ASSERT_EQ(anno.nfaces(), 6);
+  auto regenerated = anno;
+  regenerated.regenerateFaces();
+  std::set<std::vector<int>> loops, regeneratedLoops;
+  for (int f = 0; f < anno.nfaces(); f++) {
+    loops.insert(CanonicalFaceLoop(anno.face2corners[f]));
+    regeneratedLoops.insert(CanonicalFaceLoop(regenerated.face2corners[f]));
+  }
+  EXPECT_TRUE(loops == regeneratedLoops);
+  std::map<std::vector<int>, int> loop2oldFace;
+  for (int f = 0; f < before.nfaces(); f++) {
+    loop2oldFace[CanonicalFaceLoop(before.face2corners[f])] = f;
+  }
+  int newBack = -1;
+  for (int f = 0; f < anno.nfaces(); f++) {
+    auto it = loop2oldFace.find(CanonicalFaceLoop(anno.face2corners[f]));
+    if (it == loop2oldFace.end()) {
+      // the ceiling or the back wall
+      EXPECT_TRUE(anno.face2control[f] == (SegControl{-1, -1, true}));
+      if (!Contains(anno.face2corners[f], 6) ||
+          !Contains(anno.face2corners[f], 0)) {
+        continue;
+      }
+      newBack = f;
+    } else {
+      EXPECT_TRUE(anno.face2control[f] == before.face2control[it->second]);
+      EXPECT_TRUE(anno.face2plane[f] == before.face2plane[it->second]);
+    }
+  }
+  ASSERT_NE(newBack, -1);
+  anno.face2control[newBack] = SegControl{0, -1, true};
+  ExpectIncrementalSameAsFull(anno, matlab, cache);
+}
+#endif
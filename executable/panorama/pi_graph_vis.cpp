@@ -371,7 +371,7 @@ void VisualizeLayoutAnnotation(const PILayoutAnnotation &anno,
   std::vector<core::Decorated<gui::Colored<Polygon3>, int>> spps;
   // std::vector<core::Decorated<gui::Colored<Polygon3>, int>> pps;
 
-  Image3ub reversedIm = anno.rectifiedImage.clone();
+  Image3ub reversedIm = anno.rectifiedImage.get().clone();
   ReverseRows(reversedIm);
   cv::cvtColor(reversedIm, reversedIm, CV_BGR2RGB);
   gui::ResourceStore::set("texture", reversedIm);
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <complex>
 #include <cstdint>
 #include <deque>
@@ -12,6 +13,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <ratio>
@@ -39,6 +41,10 @@
 #include <QtWidgets>
 #include <QApplication>
 
+#ifdef PANORAMIX_USE_MATLAB
 #include <engine.h>
 #include <mat.h>
-#include <mex.h>
\ No newline at end of file
+#include <mex.h>
+#else
+#include "src/matlab_mock.hpp"
+#endif
\ No newline at end of file
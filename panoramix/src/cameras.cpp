@@ -6,6 +6,100 @@
 namespace pano {
 namespace core {
 
+namespace {
+
+// the batch projections work on chunks of points transposed into structure of
+// arrays layout, so that their loops are plain arithmetic the compiler can
+// vectorize
+const int BatchChunkSize = 64;
+
+template <int N> struct BatchChunk {
+  double v[N][BatchChunkSize];
+  int count;
+
+  void load(const Vec<double, N> *in, size_t n) {
+    count = static_cast<int>(std::min<size_t>(n, BatchChunkSize));
+    for (int i = 0; i < count; i++) {
+      for (int k = 0; k < N; k++) {
+        v[k][i] = in[i][k];
+      }
+    }
+  }
+  void store(Vec<double, N> *out) const {
+    for (int i = 0; i < count; i++) {
+      for (int k = 0; k < N; k++) {
+        out[i][k] = v[k][i];
+      }
+    }
+  }
+};
+
+// branch free approximations of atan2, sin and cos for the batch projections,
+// their absolute errors are below 5e-16 (against std) for the angles cameras
+// produce, sin and cos reduce by pi/2 in two parts (Cody-Waite) and are only
+// accurate for |x| < 1e5
+
+// atan of t in [0, 1], the rational approximation of Cephes after reducing t
+// above 0.66 to (t - 1) / (t + 1)
+inline double BatchAtanUnit(double t) {
+  static const double P0 = -8.750608600031904122785e-1,
+                      P1 = -1.615753718733365076637e1,
+                      P2 = -7.500855792314704667340e1,
+                      P3 = -1.228866684490136173410e2,
+                      P4 = -6.485021904942025371773e1;
+  static const double Q0 = 2.485846490142306297962e1,
+                      Q1 = 1.650270098316988542046e2,
+                      Q2 = 4.328810604912902668951e2,
+                      Q3 = 4.853903996359136964868e2,
+                      Q4 = 1.945506571482613964425e2;
+  bool reduced = t > 0.66;
+  double base = reduced ? M_PI_4 : 0.0;
+  t = reduced ? (t - 1.0) / (t + 1.0) : t;
+  double z = t * t;
+  double p = (((P0 * z + P1) * z + P2) * z + P3) * z + P4;
+  double q = ((((z + Q0) * z + Q1) * z + Q2) * z + Q3) * z + Q4;
+  return base + t + t * z * p / q;
+}
+
+inline double BatchAtan2(double y, double x) {
+  double ax = std::abs(x), ay = std::abs(y);
+  double hi = std::max(ax, ay), lo = std::min(ax, ay);
+  double a = BatchAtanUnit(hi > 0 ? lo / hi : 0.0);
+  a = ay > ax ? M_PI_2 - a : a;
+  a = x < 0 ? M_PI - a : a;
+  return y < 0 ? -a : a;
+}
+
+inline void BatchSinCos(double x, double &s, double &c) {
+  static const double PiO2Hi = 1.57079632673412561417e+00,
+                      PiO2Lo = 6.07710050650619224932e-11;
+  static const double S1 = -1.66666666666666324348e-01,
+                      S2 = 8.33333333332248946124e-03,
+                      S3 = -1.98412698298579493134e-04,
+                      S4 = 2.75573137070700676789e-06,
+                      S5 = -2.50507602534068634195e-08,
+                      S6 = 1.58969099521155010221e-10;
+  static const double C1 = 4.16666666666666019037e-02,
+                      C2 = -1.38888888888741095749e-03,
+                      C3 = 2.48015872894767294178e-05,
+                      C4 = -2.75573143513906633035e-07,
+                      C5 = 2.08757232129817482790e-09,
+                      C6 = -1.13596475577881948265e-11;
+  double q = std::floor(x * M_2_PI + 0.5);
+  double r = (x - q * PiO2Hi) - q * PiO2Lo;
+  double z = r * r;
+  double sr =
+      r + r * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+  double cr = 1.0 - 0.5 * z +
+              z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+  int quadrant = static_cast<int>(q) & 3;
+  double ss = (quadrant & 1) ? cr : sr;
+  double cc = (quadrant & 1) ? sr : cr;
+  s = (quadrant & 2) ? -ss : ss;
+  c = ((quadrant + 1) & 2) ? -cc : cc;
+}
+}
+
 PerspectiveCamera::PerspectiveCamera()
     : _screenW(500), _screenH(500), _principlePoint(250, 250),
       _focalxy(250, 250), _eye(0, 0, 0), _center(1, 0, 0), _up(0, 0, -1),
@@ -98,6 +192,60 @@ Point3 PerspectiveCamera::toSpace(const Point2 &p2d) const {
               realPosition(2) / realPosition(3));
 }
 
+void PerspectiveCamera::toScreenBatch(const Point3 *in, Point2 *out, size_t n,
+                                      bool *visible) const {
+  const double *m = _viewProjectionMatrix.val;
+  double w = 2.0 * _principlePoint[0], h = 2.0 * _principlePoint[1];
+  BatchChunk<3> ps;
+  BatchChunk<2> qs;
+  for (size_t start = 0; start < n; start += BatchChunkSize) {
+    ps.load(in + start, n - start);
+    qs.count = ps.count;
+    const double *xs = ps.v[0], *ys = ps.v[1], *zs = ps.v[2];
+    for (int i = 0; i < ps.count; i++) {
+      double px = m[0] * xs[i] + m[1] * ys[i] + m[2] * zs[i] + m[3];
+      double py = m[4] * xs[i] + m[5] * ys[i] + m[6] * zs[i] + m[7];
+      double pw = m[12] * xs[i] + m[13] * ys[i] + m[14] * zs[i] + m[15];
+      qs.v[0][i] = (px / pw / 2 + 0.5) * w;
+      qs.v[1][i] = h - (py / pw / 2 + 0.5) * h;
+    }
+    if (visible) {
+      for (int i = 0; i < ps.count; i++) {
+        double pz = m[8] * xs[i] + m[9] * ys[i] + m[10] * zs[i] + m[11];
+        double pw = m[12] * xs[i] + m[13] * ys[i] + m[14] * zs[i] + m[15];
+        visible[start + i] = pw > 0 && pz > 0;
+      }
+    }
+    qs.store(out + start);
+  }
+}
+
+void PerspectiveCamera::toSpaceBatch(const Point2 *in, Point3 *out,
+                                     size_t n) const {
+  // one inversion instead of a solve per point
+  Mat4 inv = _viewProjectionMatrix.inv();
+  const double *m = inv.val;
+  double w = 2.0 * _principlePoint[0], h = 2.0 * _principlePoint[1];
+  BatchChunk<2> ps;
+  BatchChunk<3> qs;
+  for (size_t start = 0; start < n; start += BatchChunkSize) {
+    ps.load(in + start, n - start);
+    qs.count = ps.count;
+    for (int i = 0; i < ps.count; i++) {
+      double xratio = (ps.v[0][i] / w - 0.5) * 2;
+      double yratio = ((h - ps.v[1][i]) / h - 0.5) * 2;
+      double rx = m[0] * xratio + m[1] * yratio + m[2] + m[3];
+      double ry = m[4] * xratio + m[5] * yratio + m[6] + m[7];
+      double rz = m[8] * xratio + m[9] * yratio + m[10] + m[11];
+      double rw = m[12] * xratio + m[13] * yratio + m[14] + m[15];
+      qs.v[0][i] = rx / rw;
+      qs.v[1][i] = ry / rw;
+      qs.v[2][i] = rz / rw;
+    }
+    qs.store(out + start);
+  }
+}
+
 void PerspectiveCamera::resizeScreen(const Size &sz, bool updateMat) {
   if (_screenH == sz.height && _screenW == sz.width)
     return;
@@ -281,6 +429,55 @@ Vec3 PanoramicCamera::direction(const Point2 &p2d) const {
   return dd(0) * _xaxis + dd(1) * _yaxis + dd(2) * _zaxis;
 }
 
+void PanoramicCamera::toScreenBatch(const Point3 *in, Point2 *out, size_t n,
+                                    bool *visible) const {
+  auto sz = screenSize();
+  double xscale = sz.width / 2.0 / M_PI, yscale = sz.height / M_PI;
+  BatchChunk<3> ps;
+  BatchChunk<2> qs;
+  for (size_t start = 0; start < n; start += BatchChunkSize) {
+    ps.load(in + start, n - start);
+    qs.count = ps.count;
+    for (int i = 0; i < ps.count; i++) {
+      double dx = ps.v[0][i] - _eye[0], dy = ps.v[1][i] - _eye[1],
+             dz = ps.v[2][i] - _eye[2];
+      double xx = dx * _xaxis[0] + dy * _xaxis[1] + dz * _xaxis[2];
+      double yy = dx * _yaxis[0] + dy * _yaxis[1] + dz * _yaxis[2];
+      double zz = dx * _zaxis[0] + dy * _zaxis[1] + dz * _zaxis[2];
+      double longi = BatchAtan2(yy, xx);
+      double lati = BatchAtan2(zz, std::sqrt(xx * xx + yy * yy));
+      qs.v[0][i] = (longi + M_PI) * xscale;
+      qs.v[1][i] = (lati + M_PI_2) * yscale;
+    }
+    qs.store(out + start);
+  }
+  if (visible) {
+    std::fill(visible, visible + n, true);
+  }
+}
+
+void PanoramicCamera::toSpaceBatch(const Point2 *in, Point3 *out,
+                                   size_t n) const {
+  auto sz = screenSize();
+  double xscale = 2 * M_PI / sz.width, yscale = M_PI / sz.height;
+  BatchChunk<2> ps;
+  BatchChunk<3> qs;
+  for (size_t start = 0; start < n; start += BatchChunkSize) {
+    ps.load(in + start, n - start);
+    qs.count = ps.count;
+    for (int i = 0; i < ps.count; i++) {
+      double sinLongi, cosLongi, sinLati, cosLati;
+      BatchSinCos(ps.v[0][i] * xscale - M_PI, sinLongi, cosLongi);
+      BatchSinCos(ps.v[1][i] * yscale - M_PI_2, sinLati, cosLati);
+      double d0 = cosLongi * cosLati, d1 = sinLongi * cosLati, d2 = sinLati;
+      for (int k = 0; k < 3; k++) {
+        qs.v[k][i] = _eye[k] + d0 * _xaxis[k] + d1 * _yaxis[k] + d2 * _zaxis[k];
+      }
+    }
+    qs.store(out + start);
+  }
+}
+
 PartialPanoramicCamera::PartialPanoramicCamera(int w, int h, double focal,
                                                const Vec3 &eye,
                                                const Vec3 &center,
@@ -350,6 +547,60 @@ Vec3 PartialPanoramicCamera::direction(const Point2 &p2d) const {
   return dd(0) * _xaxis + dd(1) * _yaxis + dd(2) * _zaxis;
 }
 
+void PartialPanoramicCamera::toScreenBatch(const Point3 *in, Point2 *out,
+                                           size_t n, bool *visible) const {
+  double halfLongitudeAngleBound = _screenW / 2.0 / _focal;
+  double halfLatitudeAngleBound = _screenH / 2.0 / _focal;
+  BatchChunk<3> ps;
+  BatchChunk<2> qs;
+  for (size_t start = 0; start < n; start += BatchChunkSize) {
+    ps.load(in + start, n - start);
+    qs.count = ps.count;
+    for (int i = 0; i < ps.count; i++) {
+      double dx = ps.v[0][i] - _eye[0], dy = ps.v[1][i] - _eye[1],
+             dz = ps.v[2][i] - _eye[2];
+      double xx = dx * _xaxis[0] + dy * _xaxis[1] + dz * _xaxis[2];
+      double yy = dx * _yaxis[0] + dy * _yaxis[1] + dz * _yaxis[2];
+      double zz = dx * _zaxis[0] + dy * _zaxis[1] + dz * _zaxis[2];
+      double longi = BatchAtan2(yy, xx);
+      double lati = BatchAtan2(zz, std::sqrt(xx * xx + yy * yy));
+      qs.v[0][i] = (longi + halfLongitudeAngleBound) * _focal;
+      qs.v[1][i] = (lati + halfLatitudeAngleBound) * _focal;
+    }
+    if (visible) {
+      for (int i = 0; i < ps.count; i++) {
+        visible[start + i] = IsBetween(qs.v[0][i], 0, _screenW) &&
+                             IsBetween(qs.v[1][i], 0, _screenH);
+      }
+    }
+    qs.store(out + start);
+  }
+}
+
+void PartialPanoramicCamera::toSpaceBatch(const Point2 *in, Point3 *out,
+                                          size_t n) const {
+  double halfLongitudeAngleBound = _screenW / 2.0 / _focal;
+  double halfLatitudeAngleBound = _screenH / 2.0 / _focal;
+  BatchChunk<2> ps;
+  BatchChunk<3> qs;
+  for (size_t start = 0; start < n; start += BatchChunkSize) {
+    ps.load(in + start, n - start);
+    qs.count = ps.count;
+    for (int i = 0; i < ps.count; i++) {
+      double sinLongi, cosLongi, sinLati, cosLati;
+      BatchSinCos(ps.v[0][i] / _focal - halfLongitudeAngleBound, sinLongi,
+                  cosLongi);
+      BatchSinCos(ps.v[1][i] / _focal - halfLatitudeAngleBound, sinLati,
+                  cosLati);
+      double d0 = cosLongi * cosLati, d1 = sinLongi * cosLati, d2 = sinLati;
+      for (int k = 0; k < 3; k++) {
+        qs.v[k][i] = _eye[k] + d0 * _xaxis[k] + d1 * _yaxis[k] + d2 * _zaxis[k];
+      }
+    }
+    qs.store(out + start);
+  }
+}
+
 namespace {
 
 inline double UniformSphericalAngleToScreenLength(double angle, double focal) {
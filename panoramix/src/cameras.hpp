@@ -3,6 +3,7 @@
 #include "basic_types.hpp"
 #include "line_detection.hpp"
 #include "manhattan.hpp"
+#include "parallel.hpp"
 
 namespace pano {
 namespace core {
@@ -49,6 +50,12 @@ public:
   Vec3 direction(const Point2 &p2d) const { return toSpace(p2d) - _eye; }
   Vec3 direction(const Pixel &p) const { return direction(Point2(p.x, p.y)); }
 
+  // batch projections of n points, the same as calling toScreen (and
+  // isVisibleOnScreen if visible is not null) or toSpace on each of them
+  void toScreenBatch(const Point3 *in, Point2 *out, size_t n,
+                     bool *visible = nullptr) const;
+  void toSpaceBatch(const Point2 *in, Point3 *out, size_t n) const;
+
   const Mat4 &viewMatrix() const { return _viewMatrix; }
   const Mat4 &projectionMatrix() const { return _projectionMatrix; }
   const Mat4 &viewProjectionMatrix() const { return _viewProjectionMatrix; }
@@ -131,6 +138,10 @@ public:
   Vec3 direction(const Point2 &p2d) const;
   Vec3 direction(const Pixel &p) const { return direction(Point2(p.x, p.y)); }
 
+  void toScreenBatch(const Point3 *in, Point2 *out, size_t n,
+                     bool *visible = nullptr) const;
+  void toSpaceBatch(const Point2 *in, Point3 *out, size_t n) const;
+
 private:
   double _focal;
   Vec3 _eye, _center, _up;
@@ -174,6 +185,10 @@ public:
     return PanoramicCamera(_focal, _eye, _center, _up);
   }
 
+  void toScreenBatch(const Point3 *in, Point2 *out, size_t n,
+                     bool *visible = nullptr) const;
+  void toSpaceBatch(const Point2 *in, Point3 *out, size_t n) const;
+
 private:
   double _screenW, _screenH;
   double _focal;
@@ -228,20 +243,27 @@ public:
     auto outCamSize = _outCam.screenSize();
     _mapx = cv::Mat::zeros(outCamSize, CV_32FC1);
     _mapy = cv::Mat::zeros(outCamSize, CV_32FC1);
-    for (int j = 0; j < outCamSize.height; j++) {
-      for (int i = 0; i < outCamSize.width; i++) {
-        Vec2 screenp(i, j);
-        Vec3 p3 = _outCam.toSpace(screenp);
-        if (!_inCam.isVisibleOnScreen(p3)) {
-          _mapx.at<float>(j, i) = -1;
-          _mapy.at<float>(j, i) = -1;
-          continue;
+    int width = outCamSize.width, height = outCamSize.height;
+    int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+    ParallelRun(concurrency, concurrency, [&](int t) {
+      std::vector<Point2> screenps(width), screenpsOnInCam(width);
+      std::vector<Point3> p3s(width);
+      std::unique_ptr<bool[]> visible(new bool[width]);
+      for (int j = t; j < height; j += concurrency) {
+        for (int i = 0; i < width; i++) {
+          screenps[i] = Point2(i, j);
+        }
+        _outCam.toSpaceBatch(screenps.data(), p3s.data(), width);
+        _inCam.toScreenBatch(p3s.data(), screenpsOnInCam.data(), width,
+                             visible.get());
+        float *mapx = _mapx.ptr<float>(j);
+        float *mapy = _mapy.ptr<float>(j);
+        for (int i = 0; i < width; i++) {
+          mapx[i] = visible[i] ? static_cast<float>(screenpsOnInCam[i][0]) : -1;
+          mapy[i] = visible[i] ? static_cast<float>(screenpsOnInCam[i][1]) : -1;
         }
-        Vec2 screenpOnInCam = _inCam.toScreen(p3);
-        _mapx.at<float>(j, i) = static_cast<float>(screenpOnInCam(0));
-        _mapy.at<float>(j, i) = static_cast<float>(screenpOnInCam(1));
       }
-    }
+    });
   }
 
   Image operator()(const Image &inputIm, int borderMode = cv::BORDER_REPLICATE,
@@ -381,6 +403,109 @@ View<CameraT, Image_<T>> MakeView(const CameraT &c) {
   return View<CameraT, Image_<T>>(c);
 }
 
+// BlendViews
+// merges the views into the output camera in a single pass, the output is
+// split into tiles blended in parallel, the direction of each output pixel is
+// projected once into every view, which covers the pixel if its nearest pixel
+// is on its screen and then adds its value with weight * feather, the feather
+// rises linearly from 0 at the view border to 1 at featherWidth pixels inside
+// (0 disables feathering), the sums are divided by the total weight, or by
+// minTotalWeight if that is larger
+// - weights: one per view, empty for all 1
+template <class OutCameraT, class InCameraT, class T>
+View<OutCameraT, Image_<T>>
+BlendViews(const OutCameraT &camera,
+           const std::vector<View<InCameraT, Image_<T>>> &views,
+           const std::vector<double> &weights = std::vector<double>(),
+           double featherWidth = 0.0, double minTotalWeight = 1.0) {
+  static_assert(IsCamera<OutCameraT>::value && IsCamera<InCameraT>::value,
+                "OutCameraT and InCameraT should both be cameras!");
+  using channel_type = typename cv::DataType<T>::channel_type;
+  static const int channels = cv::DataType<T>::channels;
+  static const int tileSize = 32;
+  assert(weights.empty() || weights.size() == views.size());
+
+  View<OutCameraT, Image_<T>> v;
+  v.camera = camera;
+  v.image = Image_<T>::zeros(camera.screenSize());
+  int width = v.image.cols, height = v.image.rows;
+  int ntilesX = (width + tileSize - 1) / tileSize;
+  int ntiles = ntilesX * ((height + tileSize - 1) / tileSize);
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    std::vector<double> sums(tileSize * tileSize * channels);
+    std::vector<double> totalWeights(tileSize * tileSize);
+    std::vector<Point2> pixels(tileSize), qs(tileSize);
+    std::vector<Point3> ps(tileSize);
+    std::unique_ptr<bool[]> visible(new bool[tileSize]);
+    for (int tile = t; tile < ntiles; tile += concurrency) {
+      int x0 = (tile % ntilesX) * tileSize;
+      int y0 = (tile / ntilesX) * tileSize;
+      int x1 = std::min(x0 + tileSize, width);
+      int y1 = std::min(y0 + tileSize, height);
+      std::fill(sums.begin(), sums.end(), 0.0);
+      std::fill(totalWeights.begin(), totalWeights.end(), 0.0);
+      for (int y = y0; y < y1; y++) {
+        int count = x1 - x0;
+        for (int x = x0; x < x1; x++) {
+          pixels[x - x0] = Point2(x, y);
+        }
+        camera.toSpaceBatch(pixels.data(), ps.data(), count);
+        for (int i = 0; i < views.size(); i++) {
+          auto &view = views[i];
+          view.camera.toScreenBatch(ps.data(), qs.data(), count,
+                                    visible.get());
+          for (int x = x0; x < x1; x++) {
+            int k = (y - y0) * tileSize + (x - x0);
+            if (!visible[x - x0]) {
+              continue;
+            }
+            const Point2 &q = qs[x - x0];
+            int qx = cvRound(q[0]), qy = cvRound(q[1]);
+            if (qx < 0 || qx >= view.image.cols || qy < 0 ||
+                qy >= view.image.rows) {
+              continue;
+            }
+            double weight = weights.empty() ? 1.0 : weights[i];
+            if (featherWidth > 0) {
+              double border = std::min(
+                  std::min(q[0] + 0.5, view.image.cols - 0.5 - q[0]),
+                  std::min(q[1] + 0.5, view.image.rows - 0.5 - q[1]));
+              weight *= BoundBetween(border / featherWidth, 0.0, 1.0);
+            }
+            if (weight == 0) {
+              continue;
+            }
+            auto value =
+                reinterpret_cast<const channel_type *>(&view.image(qy, qx));
+            for (int c = 0; c < channels; c++) {
+              sums[k * channels + c] += weight * value[c];
+            }
+            totalWeights[k] += weight;
+          }
+        }
+      }
+      for (int y = y0; y < y1; y++) {
+        auto out = reinterpret_cast<channel_type *>(&v.image(y, 0));
+        for (int x = x0; x < x1; x++) {
+          int k = (y - y0) * tileSize + (x - x0);
+          double total = std::max(totalWeights[k], minTotalWeight);
+          if (total == 0) {
+            continue;
+          }
+          for (int c = 0; c < channels; c++) {
+            out[x * channels + c] =
+                cv::saturate_cast<channel_type>(sums[k * channels + c] / total);
+          }
+        }
+      }
+    }
+  });
+  return v;
+}
+
+// Combine
+// averages the views covering each pixel of the camera
 template <class OutCameraT, class InCameraT, class T,
           class = std::enable_if_t<IsCamera<std::decay_t<InCameraT>>::value &&
                                    IsCamera<std::decay_t<OutCameraT>>::value>>
@@ -390,23 +515,7 @@ Combine(const OutCameraT &camera,
   if (views.empty()) {
     return View<OutCameraT, Image_<T>>();
   }
-  Image_<T> converted = Image_<T>::zeros(camera.screenSize());
-  static const int channels = cv::DataType<T>::channels;
-  Imagef counts(camera.screenSize(), 0.0f);
-  for (int i = 0; i < views.size(); i++) {
-    auto sampler = MakeCameraSampler(camera, views[i].camera);
-    auto piece = sampler(views[i].image, cv::BORDER_CONSTANT);
-    converted += piece;
-    counts += sampler(Imagef::ones(views[i].image.size()), cv::BORDER_CONSTANT);
-  }
-  View<OutCameraT, Image_<T>> v;
-  v.camera = camera;
-  v.image = Image_<T>::zeros(camera.screenSize());
-  for (auto it = converted.begin(); it != converted.end(); ++it) {
-    float count = counts(it.pos());
-    v.image(it.pos()) = *it / std::max(count, 1.0f);
-  }
-  return v;
+  return BlendViews(camera, views);
 }
 
 template <class OutCameraT, class InCameraT, class T, class W,
@@ -418,28 +527,15 @@ Combine(const OutCameraT &camera,
   if (views.empty()) {
     return View<OutCameraT, Image_<T>>();
   }
-  static const int channels = cv::DataType<T>::channels;
-  using channel_type = typename cv::DataType<T>::channel_type;
-  Image_<T> converted = Image_<T>::zeros(camera.screenSize());
-  Imagef counts(camera.screenSize(), 0.0f);
-  for (int i = 0; i < views.size(); i++) {
-    auto sampler = MakeCameraSampler(camera, views[i].component.camera);
-    auto piece = sampler(views[i].component.image, cv::BORDER_CONSTANT);
-    for (auto it = converted.begin(); it != converted.end(); ++it) {
-      *it += (piece(it.pos()) * views[i].weight());
-    }
-    counts +=
-        sampler(Imagef(views[i].component.image.size(), views[i].weight()),
-                cv::BORDER_CONSTANT);
+  std::vector<View<InCameraT, Image_<T>>> pieces;
+  std::vector<double> weights;
+  pieces.reserve(views.size());
+  weights.reserve(views.size());
+  for (auto &v : views) {
+    pieces.push_back(v.component);
+    weights.push_back(v.weight());
   }
-  View<OutCameraT, Image_<T>> v;
-  v.camera = camera;
-  v.image = Image_<T>::zeros(camera.screenSize());
-  for (auto it = converted.begin(); it != converted.end(); ++it) {
-    float count = counts(it.pos());
-    v.image(it.pos()) = *it / std::max(count, 1.0f);
-  }
-  return v;
+  return BlendViews(camera, pieces, weights);
 }
 
 template <class CameraT, class InCameraT, class T>
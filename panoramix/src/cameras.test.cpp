@@ -1,5 +1,6 @@
 #include "cameras.hpp"
 #include "canvas.hpp"
+#include "clock.hpp"
 
 #include "../panoramix.unittest.hpp"
 
@@ -109,4 +110,242 @@ TEST(Camera, CameraSampler) {
 
   auto combined2 = core::Combine(panoView.camera, ppanoViews);
   gui::AsCanvas(combined2.image).show();
-}
\ No newline at end of file
+}
+
+TEST(Camera, CombineWeightedViews) {
+  core::PanoramicCamera panoCam(200);
+  auto cams = core::CreateHorizontalPerspectiveCameras(panoCam, 16, 300, 300,
+                                                       150.0);
+  using View5d = core::View<core::PerspectiveCamera, core::Image5d>;
+  std::vector<core::Weighted<View5d>> views;
+  for (int i = 0; i < cams.size(); i++) {
+    core::Image5d im(cams[i].screenSize());
+    for (auto it = im.begin(); it != im.end(); ++it) {
+      auto p = it.pos();
+      *it = core::Vec<double, 5>(i, p.x, p.y, 1, (i * p.x + p.y) % 7);
+    }
+    views.push_back(core::ScoreAs(core::MakeView(im, cams[i]), 0.5 + i % 3));
+  }
+
+  // two resampling passes per view, like Combine did before
+  core::Image5d expected;
+  auto separateTime = misc::TimeCost([&]() {
+    core::Image5d sums = core::Image5d::zeros(panoCam.screenSize());
+    core::Imagef counts(panoCam.screenSize(), 0.0f);
+    for (auto &v : views) {
+      auto sampler = core::MakeCameraSampler(panoCam, v.component.camera);
+      core::Image5d piece = sampler(v.component.image, cv::BORDER_CONSTANT);
+      sums += piece * v.weight();
+      counts += sampler(core::Imagef(v.component.image.size(), v.weight()),
+                        cv::BORDER_CONSTANT);
+    }
+    expected = core::Image5d::zeros(panoCam.screenSize());
+    for (auto it = sums.begin(); it != sums.end(); ++it) {
+      expected(it.pos()) = *it / std::max(counts(it.pos()), 1.0f);
+    }
+  });
+
+  core::Image5d combined;
+  auto fusedTime = misc::TimeCost(
+      [&]() { combined = core::Combine(panoCam, views).image; });
+  ASSERT_EQ(expected.size(), combined.size());
+  int ndiffs = 0;
+  for (auto it = expected.begin(); it != expected.end(); ++it) {
+    if (core::norm(*it - combined(it.pos())) > 1e-4) {
+      ndiffs++;
+    }
+  }
+  // pixels whose source position rounds differently
+  EXPECT_LT(ndiffs, expected.total() / 1000);
+  std::cout << "resampled separately: " << separateTime.count()
+            << "ms, fused: " << fusedTime.count() << "ms" << std::endl;
+
+  // feathered weights leave no seams on a constant image
+  std::vector<core::View<core::PerspectiveCamera, core::Imaged>> constViews;
+  for (auto &cam : cams) {
+    constViews.push_back(
+        core::MakeView(core::Imaged(cam.screenSize(), 3.0), cam));
+  }
+  auto feathered =
+      core::BlendViews(panoCam, constViews, std::vector<double>(), 20.0, 0.0);
+  for (auto it = feathered.image.begin(); it != feathered.image.end(); ++it) {
+    ASSERT_TRUE(*it == 0.0 || std::abs(*it - 3.0) < 1e-9);
+  }
+}
+
+namespace {
+// random points around the eye and random positions inside the screen
+template <class CameraT>
+void MakeBatchInputs(const CameraT &cam, int n,
+                     std::vector<core::Point3> &points,
+                     std::vector<core::Point2> &screenps) {
+  std::mt19937 rng(n);
+  std::uniform_real_distribution<double> coord(-10.0, 10.0);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  auto sz = cam.screenSize();
+  points.resize(n);
+  screenps.resize(n);
+  for (int i = 0; i < n; i++) {
+    points[i] = cam.eye() + core::Vec3(coord(rng), coord(rng), coord(rng));
+    screenps[i] = core::Point2(u(rng) * sz.width, u(rng) * sz.height);
+  }
+}
+
+template <class CameraT> void CheckBatchProjections(const CameraT &cam) {
+  std::vector<core::Point3> points;
+  std::vector<core::Point2> screenps;
+  MakeBatchInputs(cam, 10000, points, screenps);
+
+  std::vector<core::Point2> projected(points.size());
+  std::unique_ptr<bool[]> visible(new bool[points.size()]);
+  cam.toScreenBatch(points.data(), projected.data(), points.size(),
+                    visible.get());
+  for (int i = 0; i < points.size(); i++) {
+    ASSERT_EQ(cam.isVisibleOnScreen(points[i]), visible[i]);
+    if (visible[i]) {
+      auto q = cam.toScreen(points[i]);
+      ASSERT_LT(core::norm(q - projected[i]), 1e-6 * (1.0 + core::norm(q)));
+    }
+  }
+
+  std::vector<core::Point3> unprojected(screenps.size());
+  cam.toSpaceBatch(screenps.data(), unprojected.data(), screenps.size());
+  for (int i = 0; i < screenps.size(); i++) {
+    auto p = cam.toSpace(screenps[i]);
+    ASSERT_LT(core::norm(p - unprojected[i]), 1e-8 * core::norm(p - cam.eye()));
+  }
+}
+
+template <class CameraT>
+void BenchmarkBatchProjections(const CameraT &cam, const std::string &name) {
+  const int n = 1 << 20;
+  std::vector<core::Point3> points, results3(n);
+  std::vector<core::Point2> screenps, results2(n);
+  MakeBatchInputs(cam, n, points, screenps);
+  std::unique_ptr<bool[]> visible(new bool[n]);
+
+  auto scalarToScreen = misc::TimeCost([&]() {
+    for (int i = 0; i < n; i++) {
+      visible[i] = cam.isVisibleOnScreen(points[i]);
+      results2[i] = cam.toScreen(points[i]);
+    }
+  });
+  auto batchToScreen = misc::TimeCost([&]() {
+    cam.toScreenBatch(points.data(), results2.data(), n, visible.get());
+  });
+  auto scalarToSpace = misc::TimeCost([&]() {
+    for (int i = 0; i < n; i++) {
+      results3[i] = cam.toSpace(screenps[i]);
+    }
+  });
+  auto batchToSpace = misc::TimeCost(
+      [&]() { cam.toSpaceBatch(screenps.data(), results3.data(), n); });
+
+  auto pointsPerSecond = [n](std::chrono::milliseconds d) {
+    return n / std::max<double>(d.count(), 1.0) * 1000.0;
+  };
+  std::cout << name << " toScreen: " << pointsPerSecond(scalarToScreen)
+            << " -> " << pointsPerSecond(batchToScreen)
+            << " points/sec, toSpace: " << pointsPerSecond(scalarToSpace)
+            << " -> " << pointsPerSecond(batchToSpace) << " points/sec"
+            << std::endl;
+}
+}
+
+TEST(Camera, BatchProjections) {
+  for (int k = 0; k < 10; k++) {
+    int w = 100 + abs(rand()) % 500;
+    int h = 100 + abs(rand()) % 400;
+    core::Vec3 eye(rand() % 100, rand() % 100, rand() % 100);
+    core::Vec3 center = eye + core::Vec3(rand() % 10 + 1, rand() % 10,
+                                         rand() % 10);
+    double focal = 100 + abs(rand()) % 500;
+    CheckBatchProjections(core::PerspectiveCamera(
+        w, h, core::Point2(w, h) / 2.0, focal, eye, center));
+    CheckBatchProjections(
+        core::PanoramicCamera(focal, eye, center, core::Vec3(0, 0, 1)));
+    CheckBatchProjections(core::PartialPanoramicCamera(
+        w, h, focal, eye, center, core::Vec3(0, 0, -1)));
+  }
+}
+
+TEST(Camera, BatchProjectionsThroughput) {
+  BenchmarkBatchProjections(core::PerspectiveCamera(1000, 800), "perspective");
+  BenchmarkBatchProjections(core::PanoramicCamera(500), "panoramic");
+  BenchmarkBatchProjections(core::PartialPanoramicCamera(1000, 800, 500),
+                            "partial panoramic");
+}
+
+TEST(Camera, SinglePrecisionViews) {
+  // gc like views, smooth per pixel distributions over 5 labels
+  core::PanoramicCamera panoCam(700 / M_PI);
+  auto cams = core::CreateHorizontalPerspectiveCameras(panoCam, 16, 500, 500,
+                                                       200.0);
+  using View5d = core::View<core::PerspectiveCamera, core::Image5d>;
+  using View5f = core::View<core::PerspectiveCamera, core::Image5f>;
+  std::vector<core::Weighted<View5d>> views;
+  std::vector<core::Weighted<View5f>> viewsf;
+  size_t nbytes = 0, nbytesf = 0;
+  for (int i = 0; i < cams.size(); i++) {
+    core::Image5d im(cams[i].screenSize());
+    for (auto it = im.begin(); it != im.end(); ++it) {
+      auto p = it.pos();
+      core::Vec<double, 5> v;
+      for (int k = 0; k < 5; k++) {
+        v[k] = exp(sin(p.x * 0.01 * (k + 1) + i) + cos(p.y * 0.013 * (k + 2)));
+      }
+      *it = v / (v[0] + v[1] + v[2] + v[3] + v[4]);
+    }
+    double weight = 0.5 + i % 3;
+    views.push_back(core::ScoreAs(core::MakeView(im, cams[i]), weight));
+    core::Image5f imf = core::ecast<float>(im);
+    viewsf.push_back(core::ScoreAs(core::MakeView(imf, cams[i]), weight));
+    nbytes += im.total() * im.elemSize();
+    nbytesf += imf.total() * imf.elemSize();
+  }
+
+  core::Image5d combined;
+  core::Image5f combinedf;
+  auto combineTime = misc::TimeCost(
+      [&]() { combined = core::Combine(panoCam, views).image; });
+  auto combineTimef = misc::TimeCost(
+      [&]() { combinedf = core::Combine(panoCam, viewsf).image; });
+  nbytes += combined.total() * combined.elemSize();
+  nbytesf += combinedf.total() * combinedf.elemSize();
+
+  core::Image5d sampled;
+  core::Image5f sampledf;
+  auto sampler = core::MakeCameraSampler(cams[0], panoCam);
+  auto sampleTime = misc::TimeCost([&]() { sampled = sampler(combined); });
+  auto sampleTimef = misc::TimeCost([&]() { sampledf = sampler(combinedf); });
+
+  // per stage deviation of the float path and how often the label changes
+  auto compare = [](const core::Image5d &a, const core::Image5f &b,
+                    const std::string &stage) {
+    ASSERT_EQ(a.size(), b.size());
+    double maxError = 0.0;
+    int nflips = 0;
+    for (auto it = a.begin(); it != a.end(); ++it) {
+      auto &va = *it;
+      auto vb = core::ecast<double>(b(it.pos()));
+      maxError = std::max(maxError, cv::norm(va - vb, cv::NORM_INF));
+      if (std::max_element(va.val, va.val + 5) - va.val !=
+          std::max_element(vb.val, vb.val + 5) - vb.val) {
+        nflips++;
+      }
+    }
+    std::cout << stage << ": max error " << maxError << ", label changes "
+              << nflips << "/" << a.total() << std::endl;
+    EXPECT_LT(maxError, 1e-5);
+    EXPECT_LT(nflips, a.total() / 1000 + 1);
+  };
+  compare(combined, combinedf, "combine");
+  compare(sampled, sampledf, "sample");
+
+  EXPECT_EQ(nbytes, nbytesf * 2);
+  std::cout << "double: " << nbytes / 1e6 << "MB, combine "
+            << combineTime.count() << "ms, sample " << sampleTime.count()
+            << "ms; float: " << nbytesf / 1e6 << "MB, combine "
+            << combineTimef.count() << "ms, sample " << sampleTimef.count()
+            << "ms" << std::endl;
+}
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <string>
 
 namespace pano {
@@ -30,6 +34,57 @@ auto TimeCost(FunT &&fun) {
   return std::chrono::duration_cast<DurationT>(d);
 }
 
+// Deadline
+// a point in time and a cancellation flag shared by all its copies, long
+// loops poll expired() and stop or degrade once it is true
+class Deadline {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // never expires unless cancelled
+  Deadline()
+      : _time(clock::time_point::max()),
+        _cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+  // expires ms milliseconds from now, never if ms <= 0 or beyond a year
+  static Deadline In(double ms) { return Deadline().within(ms); }
+
+  // the earlier of this and ms milliseconds from now, cancelled together
+  // with this, ms is treated as by In()
+  Deadline within(double ms) const {
+    Deadline d = *this;
+    if (ms > 0 && ms < 365 * 24 * 3600 * 1e3) {
+      std::chrono::duration<double, std::milli> budget(ms);
+      auto t = clock::now() +
+               std::chrono::duration_cast<clock::duration>(budget);
+      d._time = std::min(_time, t);
+    }
+    return d;
+  }
+
+  // whether the two are cancelled together
+  bool sameAs(const Deadline &d) const { return _cancelled == d._cancelled; }
+
+  void cancel() const { _cancelled->store(true); }
+  bool cancelled() const { return _cancelled->load(); }
+  bool expired() const { return cancelled() || clock::now() >= _time; }
+
+  // milliseconds left, infinity if there is no time limit
+  double remaining() const {
+    if (cancelled()) {
+      return 0.0;
+    }
+    if (_time == clock::time_point::max()) {
+      return std::numeric_limits<double>::infinity();
+    }
+    std::chrono::duration<double, std::milli> left = _time - clock::now();
+    return std::max(left.count(), 0.0);
+  }
+
+private:
+  clock::time_point _time;
+  std::shared_ptr<std::atomic<bool>> _cancelled;
+};
+
 namespace {
 inline const char *period_str(const std::nano &) { return "nanoseconds"; }
 inline const char *period_str(const std::micro &) { return "microseconds"; }
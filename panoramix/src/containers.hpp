@@ -1,6 +1,13 @@
 #pragma once
 
 #include <memory>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PANO_FLAT_DICTIONARY_SSE2
+#endif
 
 #include "basic_types.hpp"
 #include "handle.hpp"
@@ -76,6 +83,66 @@ private:
   ptrdiff_t _offset_bytes;
 };
 
+// CSRTable
+// a frozen std::vector<std::vector<T>> stored as offsets into one contiguous
+// pool, rows can not be resized but their elements can be modified
+template <class T> class CSRTable {
+  static_assert(!std::is_same<T, bool>::value,
+                "std::vector<bool> has no contiguous storage");
+
+public:
+  CSRTable() : _offsets(1, 0) {}
+  // values are converted if U is not T
+  template <class U>
+  explicit CSRTable(const std::vector<std::vector<U>> &rows) {
+    _offsets.reserve(rows.size() + 1);
+    _offsets.push_back(0);
+    for (auto &row : rows) {
+      _offsets.push_back(_offsets.back() + row.size());
+    }
+    _values.reserve(_offsets.back());
+    for (auto &row : rows) {
+      _values.insert(_values.end(), row.begin(), row.end());
+    }
+  }
+
+  size_t size() const { return _offsets.size() - 1; }
+  bool empty() const { return size() == 0; }
+  size_t size(size_t i) const { return _offsets[i + 1] - _offsets[i]; }
+  size_t nvalues() const { return _values.size(); }
+
+  Range<const T *> operator[](size_t i) const {
+    assert(i < size());
+    return MakeRange(_values.data() + _offsets[i],
+                     _values.data() + _offsets[i + 1]);
+  }
+  Range<T *> operator[](size_t i) {
+    assert(i < size());
+    return MakeRange(_values.data() + _offsets[i],
+                     _values.data() + _offsets[i + 1]);
+  }
+
+  const std::vector<size_t> &offsets() const { return _offsets; }
+  const std::vector<T> &values() const { return _values; }
+
+  template <class U = T> std::vector<std::vector<U>> toNested() const {
+    std::vector<std::vector<U>> rows(size());
+    for (size_t i = 0; i < size(); i++) {
+      rows[i].assign(_values.begin() + _offsets[i],
+                     _values.begin() + _offsets[i + 1]);
+    }
+    return rows;
+  }
+
+  template <class Archiver> void serialize(Archiver &ar) {
+    ar(_offsets, _values);
+  }
+
+private:
+  std::vector<size_t> _offsets;
+  std::vector<T> _values;
+};
+
 // ElementBinaryRelations
 template <class T> class ElementBinaryRelations {
 public:
@@ -678,6 +745,29 @@ public:
 
   size_t size() const { return _size; }
 
+  // bytes allocated by the nodes and values
+  size_t nbytes() const {
+    size_t n = 0;
+    std::vector<const Node *> nodes;
+    if (_root) {
+      nodes.push_back(_root.get());
+    }
+    while (!nodes.empty()) {
+      const Node *node = nodes.back();
+      nodes.pop_back();
+      n += sizeof(Node) + node->children.capacity() * sizeof(node->children[0]);
+      if (node->val) {
+        n += sizeof(T);
+      }
+      for (auto &child : node->children) {
+        if (child) {
+          nodes.push_back(child.get());
+        }
+      }
+    }
+    return n;
+  }
+
   template <class Archive> void serialize(Archive &ar) {
     ar(_nchildren, _size, _root);
   }
@@ -727,6 +817,266 @@ private:
   std::unique_ptr<Node> _root;
 };
 
+// FlatDictionary
+// the Dictionary interface on a flat hash table: a key is packed into a
+// single KeyT code in mixed radix of the dimension sizes, the entries (code
+// and value) are stored contiguously in insertion order, and an open
+// addressing table of entry indices is probed 16 slots at a time by
+// comparing 7 bit hash tags (with SSE2 where available)
+template <class T, class KeyT = uint64_t> class FlatDictionary {
+  static_assert(std::is_integral<KeyT>::value &&
+                    std::is_unsigned<KeyT>::value,
+                "KeyT must be an unsigned integer");
+
+public:
+  struct Entry {
+    KeyT code;
+    T value;
+    template <class Archive> void serialize(Archive &ar) { ar(code, value); }
+  };
+  using iterator = typename std::vector<Entry>::iterator;
+  using const_iterator = typename std::vector<Entry>::const_iterator;
+
+public:
+  FlatDictionary() {}
+  explicit FlatDictionary(const std::vector<size_t> &ncs) : _nchildren(ncs) {
+    checkCodeRange();
+  }
+  explicit FlatDictionary(std::vector<size_t> &&ncs)
+      : _nchildren(std::move(ncs)) {
+    checkCodeRange();
+  }
+
+public:
+  template <class IndexT, class TT,
+            class = std::enable_if_t<std::is_integral<IndexT>::value>>
+  void insert(const IndexT *inds, TT &&val) {
+    KeyT code = encode(inds);
+    int id = find(code);
+    if (id >= 0) {
+      _entries[id].value = std::forward<TT>(val);
+      return;
+    }
+    if ((_entries.size() + 1) * 8 > capacity() * 7) {
+      rehash(std::max<size_t>(capacity() * 2, GroupSize));
+    }
+    _entries.push_back(Entry{code, std::forward<TT>(val)});
+    place(code, _entries.size() - 1);
+  }
+  template <class IndexT, class TT>
+  void insert(std::initializer_list<IndexT> inds, TT &&val) {
+    assert(inds.size() == _nchildren.size());
+    return insert(inds.begin(), std::forward<TT>(val));
+  }
+  template <class IndexT,
+            class = std::enable_if_t<std::is_integral<IndexT>::value>>
+  bool contains(const IndexT *inds) const {
+    return find(encode(inds)) >= 0;
+  }
+  template <class IndexT>
+  bool contains(std::initializer_list<IndexT> inds) const {
+    assert(inds.size() == _nchildren.size());
+    return contains(inds.begin());
+  }
+  template <class IndexT,
+            class = std::enable_if_t<std::is_integral<IndexT>::value>>
+  const T &at(const IndexT *inds) const {
+    int id = find(encode(inds));
+    if (id < 0) {
+      throw std::out_of_range("FlatDictionary::at: no such key");
+    }
+    return _entries[id].value;
+  }
+  template <class IndexT,
+            class = std::enable_if_t<std::is_integral<IndexT>::value>>
+  T &at(const IndexT *inds) {
+    int id = find(encode(inds));
+    if (id < 0) {
+      throw std::out_of_range("FlatDictionary::at: no such key");
+    }
+    return _entries[id].value;
+  }
+  template <class IndexT>
+  const T &at(std::initializer_list<IndexT> inds) const {
+    assert(inds.size() == _nchildren.size());
+    return at(inds.begin());
+  }
+  template <class IndexT> T &at(std::initializer_list<IndexT> inds) {
+    assert(inds.size() == _nchildren.size());
+    return at(inds.begin());
+  }
+
+  size_t size() const { return _entries.size(); }
+  bool empty() const { return _entries.empty(); }
+  void reserve(size_t n) {
+    _entries.reserve(n);
+    size_t cap = GroupSize;
+    while (cap * 7 < n * 8) {
+      cap *= 2;
+    }
+    if (cap > capacity()) {
+      rehash(cap);
+    }
+  }
+  void clear() {
+    _entries.clear();
+    _ctrl.clear();
+    _slots.clear();
+  }
+
+  // entries in insertion order
+  iterator begin() { return _entries.begin(); }
+  iterator end() { return _entries.end(); }
+  const_iterator begin() const { return _entries.begin(); }
+  const_iterator end() const { return _entries.end(); }
+
+  // the indices of a packed key
+  template <class IndexT> void decode(KeyT code, IndexT *inds) const {
+    for (int i = int(_nchildren.size()) - 1; i >= 0; i--) {
+      inds[i] = static_cast<IndexT>(code % _nchildren[i]);
+      code /= _nchildren[i];
+    }
+  }
+
+  // bytes allocated by the entries and the table
+  size_t nbytes() const {
+    return _entries.capacity() * sizeof(Entry) + _ctrl.capacity() +
+           _slots.capacity() * sizeof(uint32_t);
+  }
+
+  template <class Archive> void save(Archive &ar) const {
+    ar(_nchildren, _entries);
+  }
+  template <class Archive> void load(Archive &ar) {
+    ar(_nchildren, _entries);
+    _ctrl.clear();
+    _slots.clear();
+    size_t n = _entries.size();
+    reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      place(_entries[i].code, i);
+    }
+  }
+
+private:
+  static const size_t GroupSize = 16;
+  static const int8_t EmptyTag = -128;
+
+  void checkCodeRange() const {
+    KeyT range = 1;
+    for (size_t nc : _nchildren) {
+      assert(nc > 0 && range <= std::numeric_limits<KeyT>::max() / nc);
+      range *= static_cast<KeyT>(nc);
+    }
+  }
+  template <class IndexT> KeyT encode(const IndexT *inds) const {
+    KeyT code = 0;
+    for (size_t i = 0; i < _nchildren.size(); i++) {
+      assert(inds[i] >= 0 && inds[i] < _nchildren[i]);
+      code = code * static_cast<KeyT>(_nchildren[i]) +
+             static_cast<KeyT>(inds[i]);
+    }
+    return code;
+  }
+  static uint64_t hash(KeyT code) {
+    uint64_t k = static_cast<uint64_t>(code);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+  }
+  size_t capacity() const { return _slots.size(); }
+
+  // bit i is set if the tag of slot pos + i is tag
+  uint32_t matchGroup(size_t pos, int8_t tag) const {
+#ifdef PANO_FLAT_DICTIONARY_SSE2
+    __m128i group =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&_ctrl[pos]));
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GroupSize; i++) {
+      mask |= uint32_t(_ctrl[pos + i] == tag) << i;
+    }
+    return mask;
+#endif
+  }
+  static int lowestBit(uint32_t mask) {
+    int i = 0;
+    while (!(mask & 1)) {
+      mask >>= 1;
+      i++;
+    }
+    return i;
+  }
+
+  int find(KeyT code) const {
+    if (_slots.empty()) {
+      return -1;
+    }
+    uint64_t h = hash(code);
+    int8_t tag = static_cast<int8_t>(h & 0x7f);
+    size_t mask = capacity() - 1;
+    size_t pos = (h >> 7) & mask;
+    for (size_t step = GroupSize;; pos = (pos + step) & mask,
+                step += GroupSize) {
+      for (uint32_t m = matchGroup(pos, tag); m; m &= m - 1) {
+        uint32_t id = _slots[(pos + lowestBit(m)) & mask];
+        if (_entries[id].code == code) {
+          return id;
+        }
+      }
+      if (matchGroup(pos, EmptyTag)) {
+        return -1;
+      }
+    }
+  }
+  // the code must not be in the table yet
+  void place(KeyT code, size_t id) {
+    uint64_t h = hash(code);
+    size_t mask = capacity() - 1;
+    size_t pos = (h >> 7) & mask;
+    for (size_t step = GroupSize;; pos = (pos + step) & mask,
+                step += GroupSize) {
+      uint32_t m = matchGroup(pos, EmptyTag);
+      if (m) {
+        size_t slot = (pos + lowestBit(m)) & mask;
+        setTag(slot, static_cast<int8_t>(h & 0x7f));
+        _slots[slot] = static_cast<uint32_t>(id);
+        return;
+      }
+    }
+  }
+  // the first GroupSize tags are mirrored after the last so that a group can
+  // be loaded at any position
+  void setTag(size_t slot, int8_t tag) {
+    _ctrl[slot] = tag;
+    if (slot < GroupSize) {
+      _ctrl[capacity() + slot] = tag;
+    }
+  }
+  void rehash(size_t cap) {
+    _ctrl.assign(cap + GroupSize, EmptyTag);
+    _slots.assign(cap, 0);
+    for (size_t i = 0; i < _entries.size(); i++) {
+      place(_entries[i].code, i);
+    }
+  }
+
+private:
+  std::vector<size_t> _nchildren;
+  std::vector<Entry> _entries;
+  std::vector<int8_t> _ctrl;
+  std::vector<uint32_t> _slots;
+};
+template <class T, class KeyT>
+const size_t FlatDictionary<T, KeyT>::GroupSize;
+template <class T, class KeyT>
+const int8_t FlatDictionary<T, KeyT>::EmptyTag;
+
 // MergeFindSet
 template <class T> class MergeFindSet {
   struct Element {
@@ -2,6 +2,7 @@
 #include <list>
 #include <random>
 
+#include "clock.hpp"
 #include "containers.hpp"
 
 #include "../panoramix.unittest.hpp"
@@ -100,3 +101,154 @@ TEST(ContainerTest, Dictionary) {
   ASSERT_TRUE(dict3.at({1, 2, 3, 1}) == "1231");
   ASSERT_TRUE(dict3.at({1, 3, 2, 1}) == "1321");
 }
+
+TEST(ContainerTest, FlatDictionary) {
+  core::FlatDictionary<std::string> dict({3, 5, 4, 3});
+  dict.insert({1, 2, 3, 1}, "1231");
+  dict.insert({1, 3, 2, 1}, "1321");
+  dict.insert({2, 1, 3, 2}, "2132");
+
+  ASSERT_TRUE(dict.at({1, 2, 3, 1}) == "1231");
+  ASSERT_TRUE(dict.at({1, 3, 2, 1}) == "1321");
+  ASSERT_TRUE(dict.at({2, 1, 3, 2}) == "2132");
+
+  ASSERT_TRUE(!dict.contains({1, 1, 1, 1}));
+  ASSERT_THROW(dict.at({1, 1, 1, 1}), std::out_of_range);
+
+  dict.insert({2, 1, 3, 2}, "xxxx");
+  ASSERT_TRUE(dict.at({2, 1, 3, 2}) == "xxxx");
+  ASSERT_EQ(3, dict.size());
+
+  for (auto &entry : dict) {
+    int inds[4];
+    dict.decode(entry.code, inds);
+    std::string key;
+    for (int i : inds) {
+      key += std::to_string(i);
+    }
+    ASSERT_TRUE(entry.value == key || entry.value == "xxxx");
+  }
+
+  core::SaveToDisk("./flatdict.cereal", dict);
+  core::FlatDictionary<std::string> dict2;
+  core::LoadFromDisk("./flatdict.cereal", dict2);
+  ASSERT_TRUE(dict2.at({2, 1, 3, 2}) == "xxxx");
+  ASSERT_TRUE(dict2.at({1, 2, 3, 1}) == "1231");
+  ASSERT_TRUE(dict2.at({1, 3, 2, 1}) == "1321");
+  ASSERT_TRUE(!dict2.contains({1, 1, 1, 1}));
+}
+
+TEST(ContainerTest, FlatDictionaryVsDictionary) {
+  const std::vector<size_t> ncs(6, 16);
+  const int n = 20000;
+  std::default_random_engine rng(n);
+  std::vector<std::array<int, 6>> keys(n);
+  for (auto &key : keys) {
+    for (int &i : key) {
+      i = rng() % 4;
+    }
+  }
+
+  core::Dictionary<int> trie(ncs);
+  core::FlatDictionary<int> flat(ncs);
+  for (int i = 0; i < n; i++) {
+    trie.insert(keys[i].data(), i);
+    flat.insert(keys[i].data(), i);
+  }
+  ASSERT_EQ(trie.size(), flat.size());
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(trie.at(keys[i].data()), flat.at(keys[i].data()));
+  }
+  for (int i = 0; i < 1000; i++) {
+    std::array<int, 6> key;
+    for (int &k : key) {
+      k = rng() % 5;
+    }
+    ASSERT_EQ(trie.contains(key.data()), flat.contains(key.data()));
+  }
+}
+
+// timings, run with --gtest_also_run_disabled_tests
+TEST(ContainerTest, DISABLED_FlatDictionaryVsDictionaryTimings) {
+  const std::vector<size_t> ncs(6, 16);
+  for (int n : {100000, 1000000, 10000000}) {
+    std::default_random_engine rng(n);
+    std::vector<std::array<int, 6>> keys(n);
+    for (auto &key : keys) {
+      for (int &i : key) {
+        i = rng() % 16;
+      }
+    }
+
+    core::Dictionary<int> trie(ncs);
+    core::FlatDictionary<int> flat(ncs);
+    auto trieInsertTime = misc::TimeCost([&]() {
+      for (int i = 0; i < n; i++) {
+        trie.insert(keys[i].data(), i);
+      }
+    });
+    auto flatInsertTime = misc::TimeCost([&]() {
+      for (int i = 0; i < n; i++) {
+        flat.insert(keys[i].data(), i);
+      }
+    });
+    ASSERT_EQ(trie.size(), flat.size());
+
+    int64_t sum1 = 0, sum2 = 0;
+    auto trieLookupTime = misc::TimeCost([&]() {
+      for (int i = 0; i < n; i++) {
+        sum1 += trie.at(keys[i].data());
+      }
+    });
+    auto flatLookupTime = misc::TimeCost([&]() {
+      for (int i = 0; i < n; i++) {
+        sum2 += flat.at(keys[i].data());
+      }
+    });
+    ASSERT_EQ(sum1, sum2);
+    for (int i = 0; i < 1000; i++) {
+      std::array<int, 6> key;
+      for (int &k : key) {
+        k = rng() % 16;
+      }
+      ASSERT_EQ(trie.contains(key.data()), flat.contains(key.data()));
+    }
+
+    std::cout << n << " keys, insert: trie " << trieInsertTime.count()
+              << "ms, flat " << flatInsertTime.count()
+              << "ms, lookup: trie " << trieLookupTime.count() << "ms, flat "
+              << flatLookupTime.count() << "ms, memory: trie "
+              << trie.nbytes() / 1e6 << "MB, flat " << flat.nbytes() / 1e6
+              << "MB" << std::endl;
+  }
+}
+
+TEST(ContainerTest, CSRTable) {
+  std::vector<std::vector<int>> nested = {{1, 2, 3}, {}, {4}, {5, 6}};
+  core::CSRTable<int> table(nested);
+
+  ASSERT_EQ(table.size(), 4);
+  ASSERT_EQ(table.nvalues(), 6);
+  ASSERT_EQ(table.size(1), 0);
+  ASSERT_TRUE(table[1].empty());
+  ASSERT_EQ(table[0].front(), 1);
+  ASSERT_EQ(table[0].back(), 3);
+  ASSERT_EQ(table[3][1], 6);
+
+  int sum = 0;
+  for (int v : table[0]) {
+    sum += v;
+  }
+  ASSERT_EQ(sum, 6);
+
+  for (int &v : table[2]) {
+    v = 40;
+  }
+  nested[2][0] = 40;
+  ASSERT_TRUE(table.toNested() == nested);
+
+  core::SaveToDisk("./csrtable.cereal", table);
+  core::CSRTable<int> table2;
+  core::LoadFromDisk("./csrtable.cereal", table2);
+  ASSERT_TRUE(table2.toNested() == nested);
+}
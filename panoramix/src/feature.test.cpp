@@ -1,4 +1,5 @@
 #include "cameras.hpp"
+#include "clock.hpp"
 #include "line_detection.hpp"
 #include "segmentation.hpp"
 #include "utility.hpp"
@@ -9,6 +10,116 @@
 
 using namespace pano;
 
+namespace {
+// the set based gradient grouping that LineSegmentExtractor used before, kept
+// to check that the current one finds the same lines
+void ExtractLinesReference(const core::Image3ub &im,
+                           std::vector<core::Line2> &lines, int minlen,
+                           int xborderw, int yborderw, int numDir) {
+  cv::Mat gim;
+  cv::cvtColor(im, gim, CV_BGR2GRAY);
+  int h = gim.rows;
+  int w = gim.cols;
+
+  cv::Mat dx, dy;
+  cv::Mat ggim;
+  cv::GaussianBlur(gim, ggim, cv::Size(7, 7), 1.5);
+  cv::Sobel(ggim, dx, CV_64F, 1, 0);
+  cv::Sobel(ggim, dy, CV_64F, 0, 1);
+
+  cv::Mat imCanny;
+  cv::Canny(gim, imCanny, 5, 20);
+
+  std::vector<std::set<int>> pixelIdsSet(numDir);
+  for (int x = 0; x < w; x++) {
+    for (int y = 0; y < h; y++) {
+      if (imCanny.at<uchar>(y, x) == 0) {
+        continue;
+      }
+      double a = atan(dy.at<double>(y, x) / dx.at<double>(y, x));
+      if (std::isnan(a)) {
+        continue;
+      }
+      int binId = int((a / M_PI + 0.5) * numDir);
+      if (binId == -1)
+        binId = 0;
+      if (binId == numDir)
+        binId = numDir - 1;
+      int pixelId = y + h * x;
+      pixelIdsSet[(binId + numDir - 1) % numDir].insert(pixelId);
+      pixelIdsSet[binId].insert(pixelId);
+      pixelIdsSet[(binId + 1) % numDir].insert(pixelId);
+    }
+  }
+
+  std::vector<int> xs, ys, ids;
+  for (int binId = 0; binId < numDir; binId++) {
+    auto notSearched = pixelIdsSet[binId];
+    while (!notSearched.empty()) {
+      int rootId = *notSearched.begin();
+      xs = {rootId / h};
+      ys = {rootId % h};
+      ids = {rootId};
+      notSearched.erase(rootId);
+
+      static const int xdirs[] = {1, 1, 0, -1, -1, -1, 0, 1};
+      static const int ydirs[] = {0, 1, 1, 1, 0, -1, -1, -1};
+      for (int head = 0; head < xs.size(); head++) {
+        int x = xs[head], y = ys[head];
+        for (int k = 0; k < 8; k++) {
+          int nx = x + xdirs[k];
+          int ny = y + ydirs[k];
+          int npixelId = ny + h * nx;
+          if (notSearched.count(npixelId)) {
+            xs.push_back(nx);
+            ys.push_back(ny);
+            ids.push_back(npixelId);
+            notSearched.erase(npixelId);
+          }
+        }
+      }
+      if (xs.size() < minlen)
+        continue;
+
+      cv::Mat xsmat(xs), ysmat(ys);
+      double meanx = cv::mean(xsmat).val[0], meany = cv::mean(ysmat).val[0];
+      cv::Mat zmx = xsmat - meanx, zmy = ysmat - meany;
+      cv::Mat v, lambda;
+      core::Mat<double, 2, 2> D;
+      D(0, 0) = cv::sum(zmx.mul(zmx)).val[0];
+      D(0, 1) = D(1, 0) = cv::sum(zmx.mul(zmy)).val[0];
+      D(1, 1) = cv::sum(zmy.mul(zmy)).val[0];
+      cv::eigen(D, lambda, v);
+
+      double theta = atan2(v.at<double>(0, 1), v.at<double>(0, 0));
+      double confidence = std::numeric_limits<double>::max();
+      if (lambda.at<double>(1) > 0) {
+        confidence = lambda.at<double>(0) / lambda.at<double>(1);
+      }
+      if (confidence < 200)
+        continue;
+      for (int pid : ids) {
+        pixelIdsSet[binId].erase(pid);
+        pixelIdsSet[(binId - 1 + numDir) % numDir].erase(pid);
+        pixelIdsSet[(binId + 1) % numDir].erase(pid);
+      }
+      auto xends = std::minmax_element(xs.begin(), xs.end());
+      auto yends = std::minmax_element(ys.begin(), ys.end());
+      double minx = *xends.first, maxx = *xends.second;
+      double miny = *yends.first, maxy = *yends.second;
+      if (maxx <= xborderw || minx >= w - xborderw || maxy <= yborderw ||
+          miny >= h - yborderw)
+        continue;
+      double len =
+          sqrt((maxx - minx) * (maxx - minx) + (maxy - miny) * (maxy - miny));
+      lines.push_back({core::Vec2(meanx - cos(theta) * len / 2,
+                                  meany - sin(theta) * len / 2),
+                       core::Vec2(meanx + cos(theta) * len / 2,
+                                  meany + sin(theta) * len / 2)});
+    }
+  }
+}
+}
 
 TEST(Feature, LineSegmentExtractor) {
   core::LineSegmentExtractor lineseg;
@@ -27,6 +138,60 @@ TEST(Feature, LineSegmentExtractor) {
       .show();
 }
 
+TEST(Feature, GradientGroupingSameAsReference) {
+  core::LineSegmentExtractor lineseg;
+  auto &params = lineseg.params();
+  params.algorithm = core::LineSegmentExtractor::GradientGrouping;
+  for (std::string name : {"building.jpg", "indoor_pano1.jpg",
+                           "indoor_persp1.jpg", "indoor_persp2.jpg"}) {
+    core::Image3ub im =
+        core::ImageRead(PANORAMIX_TEST_DATA_DIR_STR "/" + name);
+    ASSERT_FALSE(im.empty()) << name;
+    std::vector<core::Line2> lines, reference;
+    auto t = misc::TimeCost([&] { lines = lineseg(im); });
+    auto tref = misc::TimeCost([&] {
+      ExtractLinesReference(im, reference, params.minLength,
+                            params.xBorderWidth, params.yBorderWidth,
+                            params.numDirs);
+    });
+    std::cout << name << ": " << lines.size() << " lines in " << t.count()
+              << "ms, the reference takes " << tref.count() << "ms"
+              << std::endl;
+
+    ASSERT_EQ(lines.size(), reference.size());
+    for (int i = 0; i < lines.size(); i++) {
+      EXPECT_LT(core::Distance(lines[i].first, reference[i].first), 1e-9);
+      EXPECT_LT(core::Distance(lines[i].second, reference[i].second), 1e-9);
+    }
+  }
+}
+
+TEST(Feature, LineIntersectionsStopAtDeadline) {
+  std::default_random_engine rng(0);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  std::vector<core::Line3> lines(50);
+  for (auto &line : lines) {
+    line.first = core::normalize(core::Vec3(dist(rng), dist(rng), dist(rng)));
+    line.second = core::normalize(core::Vec3(dist(rng), dist(rng), dist(rng)));
+  }
+  std::vector<std::pair<int, int>> all;
+  auto intersections = core::ComputeLineIntersections(lines, &all);
+  ASSERT_EQ(lines.size() * (lines.size() - 1) / 2, all.size());
+
+  // cancelled, the loop stops after its first line
+  misc::Deadline deadline;
+  deadline.cancel();
+  std::vector<std::pair<int, int>> done;
+  auto partial =
+      core::ComputeLineIntersections(lines, &done, M_PI, deadline);
+  ASSERT_EQ(lines.size() - 1, done.size());
+  ASSERT_EQ(done.size(), partial.size());
+  for (int i = 0; i < done.size(); i++) {
+    EXPECT_EQ(all[i], done[i]);
+    EXPECT_EQ(0.0, core::Distance(intersections[i], partial[i]));
+  }
+}
+
 TEST(Feature, FeatureExtractor) {
   core::SegmentationExtractor segmenter;
   core::LineSegmentExtractor::Params params;
@@ -11,6 +11,9 @@
 #include "cameras.hpp"
 #include "containers.hpp"
 #include "geo_context.hpp"
+#include "line_detection.hpp"
+#include "parallel.hpp"
+#include "segmentation.hpp"
 #include "utility.hpp"
 
 #include "clock.hpp"
@@ -23,7 +26,7 @@ namespace core {
 Image_<Vec<double, 7>>
 ComputeRawIndoorGeometricContextHedau(misc::Matlab &matlab, const Image &im) {
   matlab << "clear;";
-  matlab.setVar("im", im);
+  matlab.setVars("im", im);
 
   matlab << "[~, ~, slabelConfMap] = gc(im);";
 
@@ -54,8 +57,11 @@ Image5d MergeGeometricContextLabelsHoiem(const Image7d &rawgc) {
   return result;
 }
 
-Image5d MergeGeometricContextLabelsHedau(const Image7d &rawgc) {
-  Image5d result(rawgc.size(), Vec<double, 5>());
+namespace {
+// the merged labels in scalar type T, the raw gc of the estimators is double
+template <class T>
+Image_<Vec<T, 5>> MergeGeometricContextLabelsHedauAs(const Image7d &rawgc) {
+  Image_<Vec<T, 5>> result(rawgc.size(), Vec<T, 5>());
   for (auto it = result.begin(); it != result.end(); ++it) {
     auto &p = rawgc(it.pos());
     auto &resultv = *it;
@@ -73,6 +79,11 @@ Image5d MergeGeometricContextLabelsHedau(const Image7d &rawgc) {
   }
   return result;
 }
+}
+
+Image5d MergeGeometricContextLabelsHedau(const Image7d &rawgc) {
+  return MergeGeometricContextLabelsHedauAs<double>(rawgc);
+}
 
 Image5d ComputeIndoorGeometricContextHedau(misc::Matlab &matlab,
                                            const Image &im) {
@@ -156,6 +167,293 @@ Image6d ComputeIndoorGeometricContextHedau(misc::Matlab &matlab, const Image &im
   return MergeGeometricContextLabelsHedau(rawgc, forward, hvp1);
 }
 
+Image7d
+MatlabGeometricContextEstimator::computeRaw(const PerspectiveView &view,
+                                            const std::vector<Vec3> &vps,
+                                            int verticalVPId) const {
+  if (_pool) {
+    const Image &im = view.image;
+    return _pool
+        ->submit([&im](misc::Matlab &matlab) {
+          return ComputeRawIndoorGeometricContextHedau(matlab, im);
+        })
+        .get();
+  }
+  return ComputeRawIndoorGeometricContextHedau(*_matlab, view.image);
+}
+
+namespace {
+// segment features used by the native gc estimator
+enum NativeGCFeature {
+  NGCBias = 0,
+  NGCHorizontalPlane, // orientation map says the normal is vertical
+  NGCFrontWall,       // ... says the normal faces the camera
+  NGCLeftWall,        // ... says the normal is horizontal and seg is on left
+  NGCRightWall,       // ... says the normal is horizontal and seg is on right
+  NGCUnknownOrientation,
+  NGCBelowHorizon, // mean sine of the depression angle
+  NGCAboveHorizon, // mean sine of the elevation angle
+  NGCTexture,      // mean gradient magnitude
+  NGCSaturation,   // mean saturation
+  NGCFeatureNum
+};
+
+// the embedded linear model, rows are the raw gc labels. the weights are hand
+// set priors (floors are below the horizon and lie on horizontal orientation
+// maps, clutter is textured...), not trained ones
+// 0: front, 1: left, 2: right, 3: floor, 4: ceiling, 5: clutter, 6: unknown
+const double NativeGCWeights[7][NGCFeatureNum] = {
+    // bias, hplane, front, left, right, unknown, below, above, texture, sat
+    {0.0, -2.0, 4.0, -1.0, -1.0, 0.5, -0.5, -0.5, -1.0, 0.0},
+    {0.0, -2.0, -1.0, 4.0, -1.0, 0.3, -0.5, -0.5, -1.0, 0.0},
+    {0.0, -2.0, -1.0, -1.0, 4.0, 0.3, -0.5, -0.5, -1.0, 0.0},
+    {-0.5, 2.0, -1.0, -1.0, -1.0, 0.0, 5.0, -5.0, -0.5, 0.0},
+    {-0.5, 2.0, -1.0, -1.0, -1.0, 0.0, -5.0, 5.0, -1.0, -0.5},
+    {-0.5, -1.0, -0.5, -0.5, -0.5, 1.0, 1.0, -1.0, 3.0, 1.0},
+    {-3.0, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0, 0.0}};
+}
+
+Image7d
+NativeGeometricContextEstimator::computeRaw(const PerspectiveView &view,
+                                            const std::vector<Vec3> &vps,
+                                            int verticalVPId) const {
+  auto &cam = view.camera;
+  Image im = view.image;
+  if (im.channels() == 1) {
+    cv::cvtColor(im, im, CV_GRAY2BGR);
+  }
+  if (im.depth() != CV_8U) {
+    im.convertTo(im, CV_8U, im.depth() == CV_32F || im.depth() == CV_64F
+                                ? 255.0
+                                : 1.0);
+  }
+  const Sizei imSize = im.size();
+
+  // the vertical direction pointing upward on screen
+  assert(verticalVPId >= 0 && verticalVPId < vps.size());
+  Vec3 up = normalize(vps[verticalVPId]);
+  if (cam.toScreen(cam.eye() + cam.forward() + up * 0.1)[1] >
+      cam.toScreen(cam.eye() + cam.forward())[1]) {
+    up = -up;
+  }
+
+  // orientation maps using [vertical, horizontal1, horizontal2] vps
+  std::vector<Vec3> orderedVPs = {up};
+  for (int i = 0; i < vps.size() && orderedVPs.size() < 3; i++) {
+    if (i != verticalVPId) {
+      orderedVPs.push_back(normalize(vps[i]));
+    }
+  }
+  LineSegmentExtractor lineExtractor;
+  lineExtractor.params().algorithm = LineSegmentExtractor::LSD;
+  auto line2s = lineExtractor(im);
+  Imagei omap = Imagei(imSize, -1);
+  if (orderedVPs.size() == 3) {
+    std::vector<HPoint2> vp2s(3);
+    for (int i = 0; i < 3; i++) {
+      vp2s[i] = cam.toScreenInHPoint(cam.eye() + orderedVPs[i]);
+    }
+    auto classifiedLine2s = ClassifyEachAs(line2s, -1);
+    ClassifyLines(classifiedLine2s, vp2s);
+    omap = ComputeOrientationMaps(classifiedLine2s, vp2s, imSize);
+  }
+  // whether walls facing horizontal vp 1/2 face the camera
+  bool wallFacesFront[3] = {false, false, false};
+  for (int i = 1; i < orderedVPs.size(); i++) {
+    wallFacesFront[i] = abs(orderedVPs[i].dot(cam.forward())) > cos(M_PI / 4.0);
+  }
+
+  // segments bounded by lines
+  SegmentationExtractor segmenter;
+  segmenter.params().algorithm = SegmentationExtractor::GraphCut;
+  segmenter.params().sigma = _params.segmentationSigma;
+  segmenter.params().c = _params.segmentationC;
+  segmenter.params().minSize = _params.segmentationMinSize;
+  Imagei segs;
+  int nsegs = 0;
+  std::tie(segs, nsegs) = segmenter(im, line2s, _params.lineExtensionLength);
+
+  // color and texture
+  Image gray, hsv, gx, gy;
+  cv::cvtColor(im, gray, CV_BGR2GRAY);
+  gray.convertTo(gray, CV_32F, 1.0 / 255.0);
+  cv::Sobel(gray, gx, CV_32F, 1, 0);
+  cv::Sobel(gray, gy, CV_32F, 0, 1);
+  cv::cvtColor(im, hsv, CV_BGR2HSV);
+
+  // accumulate features on segs
+  std::vector<Vec<double, NGCFeatureNum>> segFeatures(nsegs);
+  std::vector<int> segAreas(nsegs, 0);
+  for (auto it = segs.begin(); it != segs.end(); ++it) {
+    Pixel p = it.pos();
+    int seg = *it;
+    auto &f = segFeatures[seg];
+    segAreas[seg]++;
+    f[NGCBias] += 1.0;
+    int orientation = omap(p);
+    if (orientation == 0) {
+      f[NGCHorizontalPlane] += 1.0;
+    } else if (orientation > 0 && wallFacesFront[orientation]) {
+      f[NGCFrontWall] += 1.0;
+    } else if (orientation > 0) {
+      f[p.x < cam.principlePoint()[0] ? NGCLeftWall : NGCRightWall] += 1.0;
+    } else {
+      f[NGCUnknownOrientation] += 1.0;
+    }
+    double sinElevation = normalize(cam.direction(p)).dot(up);
+    f[sinElevation < 0 ? NGCBelowHorizon : NGCAboveHorizon] +=
+        abs(sinElevation);
+    double gradient = sqrt(Square<double>(gx.at<float>(p)) +
+                           Square<double>(gy.at<float>(p)));
+    f[NGCTexture] += std::min(1.0, gradient);
+    f[NGCSaturation] += hsv.at<cv::Vec3b>(p)[1] / 255.0;
+  }
+
+  // classify segs with softmax over the linear scores
+  std::vector<Vec<double, 7>> segProbs(nsegs);
+  for (int seg = 0; seg < nsegs; seg++) {
+    if (segAreas[seg] == 0) {
+      continue;
+    }
+    Vec<double, NGCFeatureNum> f = segFeatures[seg] / double(segAreas[seg]);
+    Vec<double, 7> scores;
+    for (int label = 0; label < 7; label++) {
+      for (int k = 0; k < NGCFeatureNum; k++) {
+        scores[label] += NativeGCWeights[label][k] * f[k];
+      }
+    }
+    double maxScore = *std::max_element(scores.val, scores.val + 7);
+    double expSum = 0.0;
+    for (int label = 0; label < 7; label++) {
+      segProbs[seg][label] = exp(scores[label] - maxScore);
+      expSum += segProbs[seg][label];
+    }
+    segProbs[seg] /= expSum;
+  }
+
+  Image7d rawgc(imSize);
+  for (auto it = rawgc.begin(); it != rawgc.end(); ++it) {
+    *it = segProbs[segs(it.pos())];
+  }
+  return rawgc;
+}
+
+template <class T>
+Image_<Vec<T, 5>> ComputeIndoorGeometricContextHedau(
+    const GeometricContextEstimator &estimator, const PerspectiveView &view,
+    const std::vector<Vec3> &vps, int verticalVPId) {
+  auto rawgc = estimator.computeRaw(view, vps, verticalVPId);
+  return MergeGeometricContextLabelsHedauAs<T>(rawgc);
+}
+
+template Image5d ComputeIndoorGeometricContextHedau<double>(
+    const GeometricContextEstimator &estimator, const PerspectiveView &view,
+    const std::vector<Vec3> &vps, int verticalVPId);
+template Image5f ComputeIndoorGeometricContextHedau<float>(
+    const GeometricContextEstimator &estimator, const PerspectiveView &view,
+    const std::vector<Vec3> &vps, int verticalVPId);
+
+Image6d ComputeIndoorGeometricContextHedau(
+    const GeometricContextEstimator &estimator, const PerspectiveView &view,
+    const std::vector<Vec3> &vps, int verticalVPId, const Vec3 &hvp1) {
+  auto rawgc = estimator.computeRaw(view, vps, verticalVPId);
+  return MergeGeometricContextLabelsHedau(rawgc, view.camera.forward(), hvp1);
+}
+
+namespace {
+template <class T, class FunT>
+std::vector<Weighted<View<PerspectiveCamera, Image_<T>>>>
+ComputeGeometricContextOfViews(const GeometricContextEstimator &estimator,
+                               const PanoramicView &view,
+                               const std::vector<PerspectiveCamera> &cams,
+                               FunT computeGC) {
+  std::vector<Weighted<View<PerspectiveCamera, Image_<T>>>> gcs(cams.size());
+  auto computeView = [&](int i) {
+    auto pview = view.sampled(cams[i]);
+    gcs[i].component.camera = cams[i];
+    gcs[i].component.image = computeGC(pview);
+    gcs[i].score = abs(
+        1.0 - normalize(cams[i].forward()).dot(normalize(view.camera.up())));
+  };
+  if (estimator.isThreadSafe()) {
+    ParallelRun(cams.size(),
+                std::max<int>(std::thread::hardware_concurrency(), 1),
+                computeView);
+  } else {
+    for (int i = 0; i < cams.size(); i++) {
+      computeView(i);
+    }
+  }
+  return gcs;
+}
+}
+
+template <class T>
+std::vector<Weighted<View<PerspectiveCamera, Image_<Vec<T, 5>>>>>
+ComputeIndoorGeometricContextOfViews(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId) {
+  return ComputeGeometricContextOfViews<Vec<T, 5>>(
+      estimator, view, cams, [&](const PerspectiveView &pview) {
+        return ComputeIndoorGeometricContextHedau<T>(estimator, pview, vps,
+                                                     verticalVPId);
+      });
+}
+
+template std::vector<Weighted<View<PerspectiveCamera, Image5d>>>
+ComputeIndoorGeometricContextOfViews<double>(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId);
+template std::vector<Weighted<View<PerspectiveCamera, Image5f>>>
+ComputeIndoorGeometricContextOfViews<float>(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId);
+
+std::vector<Weighted<View<PerspectiveCamera, Image6d>>>
+ComputeIndoorGeometricContextOfViews(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId, const Vec3 &hvp1) {
+  return ComputeGeometricContextOfViews<Vec<double, 6>>(
+      estimator, view, cams, [&](const PerspectiveView &pview) {
+        return ComputeIndoorGeometricContextHedau(estimator, pview, vps,
+                                                  verticalVPId, hvp1);
+      });
+}
+
+template <class T>
+Image_<Vec<T, 5>> ComputePanoramicIndoorGeometricContext(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId) {
+  return Combine(view.camera,
+                 ComputeIndoorGeometricContextOfViews<T>(estimator, view, cams,
+                                                         vps, verticalVPId))
+      .image;
+}
+
+template Image5d ComputePanoramicIndoorGeometricContext<double>(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId);
+template Image5f ComputePanoramicIndoorGeometricContext<float>(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId);
+
+Image6d ComputePanoramicIndoorGeometricContext(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId, const Vec3 &hvp1) {
+  return Combine(view.camera,
+                 ComputeIndoorGeometricContextOfViews(estimator, view, cams,
+                                                      vps, verticalVPId, hvp1))
+      .image;
+}
+
 Image3d ConvertToImage3d(const Image5d &gc) {
   Image3d vv(gc.size());
   std::vector<Vec3> colors = {Vec3(0, 0, 1), Vec3(0, 1, 0), Vec3(1, 0, 0),
@@ -3,6 +3,7 @@
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/stitching/detail/matchers.hpp>
 
+#include "cameras.hpp"
 #include "matlab_api.hpp"
 
 namespace pano {
@@ -29,7 +30,8 @@ Image5d MergeGeometricContextLabelsHedau(const Image7d &rawgc);
 Image5d ComputeIndoorGeometricContextHedau(misc::Matlab &matlab,
                                            const Image &im);
 
-inline GeometricContextIndex MaxGeometricIndex(const Vec5 &gcv) {
+template <class T>
+inline GeometricContextIndex MaxGeometricIndex(const Vec<T, 5> &gcv) {
   return (GeometricContextIndex)(std::max_element(gcv.val, gcv.val + 5) -
                                  gcv.val);
 }
@@ -54,5 +56,117 @@ Image6d MergeGeometricContextLabelsHoiem(const Image7d &rawgc,
 Image6d ComputeIndoorGeometricContextHedau(misc::Matlab &matlab,
                                            const Image &im, const Vec3 &forward,
                                            const Vec3 &hvp1);
+
+// GeometricContextEstimator
+// estimates the raw indoor geometric context of a perspective view in Hedau's
+// 7 channel layout:
+// 0: front, 1: left, 2: right, 3: floor, 4: ceiling, 5: clutter, 6: unknown
+class GeometricContextEstimator {
+public:
+  virtual ~GeometricContextEstimator() {}
+  // vps are the 3d vanishing directions of the scene, verticalVPId indexes the
+  // vertical one
+  virtual Image7d computeRaw(const PerspectiveView &view,
+                             const std::vector<Vec3> &vps,
+                             int verticalVPId) const = 0;
+  // whether computeRaw can be called concurrently
+  virtual bool isThreadSafe() const = 0;
+};
+
+// MatlabGeometricContextEstimator
+// calls gc(im) in the matlab engine, or in the first free engine of a pool
+// which makes it thread safe, vps are ignored
+class MatlabGeometricContextEstimator : public GeometricContextEstimator {
+public:
+  explicit MatlabGeometricContextEstimator(misc::Matlab &matlab)
+      : _matlab(&matlab), _pool(nullptr) {}
+  explicit MatlabGeometricContextEstimator(misc::MatlabPool &pool)
+      : _matlab(nullptr), _pool(&pool) {}
+  virtual Image7d computeRaw(const PerspectiveView &view,
+                             const std::vector<Vec3> &vps,
+                             int verticalVPId) const override;
+  virtual bool isThreadSafe() const override { return _pool != nullptr; }
+
+private:
+  misc::Matlab *_matlab;
+  misc::MatlabPool *_pool;
+};
+
+// NativeGeometricContextEstimator
+// classifies line-bounded segments with an embedded linear model on
+// orientation map, elevation, color and texture statistics.
+// experimental: the weights of the model are hand set priors, untrained, it
+// was never fitted to labeled rooms. its output only has Hedau's layout, it
+// is not known to be comparable to Hedau's gc and does not replace it
+class NativeGeometricContextEstimator : public GeometricContextEstimator {
+public:
+  struct Params {
+    inline Params()
+        : segmentationSigma(0.8f), segmentationC(100.0f),
+          segmentationMinSize(100), lineExtensionLength(5.0) {}
+    float segmentationSigma;
+    float segmentationC;
+    int segmentationMinSize;
+    double lineExtensionLength;
+    template <class Archive> inline void serialize(Archive &ar) {
+      ar(segmentationSigma, segmentationC, segmentationMinSize,
+         lineExtensionLength);
+    }
+  };
+
+public:
+  inline explicit NativeGeometricContextEstimator(
+      const Params &params = Params())
+      : _params(params) {}
+  const Params &params() const { return _params; }
+  Params &params() { return _params; }
+  virtual Image7d computeRaw(const PerspectiveView &view,
+                             const std::vector<Vec3> &vps,
+                             int verticalVPId) const override;
+  virtual bool isThreadSafe() const override { return true; }
+
+private:
+  Params _params;
+};
+
+// ComputeGeometricContext using an estimator
+// T is the scalar type of the merged gc, float halves the memory of the views
+// and of the panoramic merge, the raw gc of the estimator is always double and
+// is merged into T directly
+template <class T = double>
+Image_<Vec<T, 5>> ComputeIndoorGeometricContextHedau(
+    const GeometricContextEstimator &estimator, const PerspectiveView &view,
+    const std::vector<Vec3> &vps, int verticalVPId);
+Image6d ComputeIndoorGeometricContextHedau(
+    const GeometricContextEstimator &estimator, const PerspectiveView &view,
+    const std::vector<Vec3> &vps, int verticalVPId, const Vec3 &hvp1);
+
+// ComputeIndoorGeometricContextOfViews
+// estimates gc on the perspective views of a panorama, views are processed in
+// parallel if the estimator is thread safe, each view is weighted by how
+// horizontal it looks
+template <class T = double>
+std::vector<Weighted<View<PerspectiveCamera, Image_<Vec<T, 5>>>>>
+ComputeIndoorGeometricContextOfViews(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId);
+std::vector<Weighted<View<PerspectiveCamera, Image6d>>>
+ComputeIndoorGeometricContextOfViews(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId, const Vec3 &hvp1);
+
+// ComputePanoramicIndoorGeometricContext
+// merges the view gcs in the panorama
+template <class T = double>
+Image_<Vec<T, 5>> ComputePanoramicIndoorGeometricContext(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId);
+Image6d ComputePanoramicIndoorGeometricContext(
+    const GeometricContextEstimator &estimator, const PanoramicView &view,
+    const std::vector<PerspectiveCamera> &cams, const std::vector<Vec3> &vps,
+    int verticalVPId, const Vec3 &hvp1);
 }
 }
@@ -0,0 +1,98 @@
+#include "geo_context.hpp"
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+using namespace pano::core;
+
+namespace {
+enum RoomSurface { Floor, Ceiling, FrontWall, SideWall };
+
+// a view of a box room from its middle, each surface has its own color and
+// the surface seen by each pixel is put in surfaces
+PerspectiveView MakeRoomView(Imagei &surfaces) {
+  PerspectiveCamera cam(400, 300, Point2(200, 150), 200, Origin(),
+                        Point3(1, 0, 0));
+  const double floorZ = -1.2, ceilingZ = 1.3, frontX = 3.0, sideY = 2.5;
+  Image3ub im(cam.screenSize());
+  surfaces = Imagei(cam.screenSize());
+  for (auto it = im.begin(); it != im.end(); ++it) {
+    Vec3 d = normalize(cam.direction(it.pos()));
+    double t = std::numeric_limits<double>::max();
+    int surface = FrontWall;
+    auto hit = [&](double plane, double dcomponent, int s) {
+      if (dcomponent != 0 && plane / dcomponent > 0 &&
+          plane / dcomponent < t) {
+        t = plane / dcomponent;
+        surface = s;
+      }
+    };
+    hit(floorZ, d[2], Floor);
+    hit(ceilingZ, d[2], Ceiling);
+    hit(frontX, d[0], FrontWall);
+    hit(sideY, d[1], SideWall);
+    hit(-sideY, d[1], SideWall);
+    static const Vec3ub colors[] = {Vec3ub(60, 90, 140), Vec3ub(235, 235, 235),
+                                    Vec3ub(120, 180, 200),
+                                    Vec3ub(80, 130, 150)};
+    *it = colors[surface];
+    surfaces(it.pos()) = surface;
+  }
+  return PerspectiveView(im, cam);
+}
+}
+
+TEST(GeoContext, NativeEstimatorOutputIsNormalized) {
+  Imagei surfaces;
+  auto view = MakeRoomView(surfaces);
+  NativeGeometricContextEstimator estimator;
+  std::vector<Vec3> vps = {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)};
+  auto rawgc = estimator.computeRaw(view, vps, 2);
+  ASSERT_EQ(rawgc.size(), view.image.size());
+  for (auto it = rawgc.begin(); it != rawgc.end(); ++it) {
+    double sum = 0.0;
+    for (int k = 0; k < 7; k++) {
+      ASSERT_GE((*it)[k], 0.0);
+      ASSERT_LE((*it)[k], 1.0);
+      sum += (*it)[k];
+    }
+    ASSERT_NEAR(sum, 1.0, 1e-9);
+  }
+
+  auto gc = ComputeIndoorGeometricContextHedau(estimator, view, vps, 2);
+  ASSERT_EQ(gc.size(), view.image.size());
+  auto gc6 = ComputeIndoorGeometricContextHedau(estimator, view, vps, 2,
+                                                Vec3(1, 0, 0));
+  ASSERT_EQ(gc6.size(), view.image.size());
+}
+
+TEST(GeoContext, NativeEstimatorOnSyntheticRoom) {
+  Imagei surfaces;
+  auto view = MakeRoomView(surfaces);
+  auto &cam = view.camera;
+  ASSERT_LT(cam.toScreen(Vec3(3, 0, 1))[1], cam.toScreen(Vec3(3, 0, -1))[1]);
+
+  NativeGeometricContextEstimator estimator;
+  std::vector<Vec3> vps = {Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1)};
+  auto gc = ComputeIndoorGeometricContextHedau(estimator, view, vps, 2);
+
+  // the mean gc of each surface
+  Vec<double, 5> means[4];
+  int areas[4] = {0, 0, 0, 0};
+  for (auto it = gc.begin(); it != gc.end(); ++it) {
+    int surface = surfaces(it.pos());
+    means[surface] += *it;
+    areas[surface]++;
+  }
+  for (int s = 0; s < 4; s++) {
+    ASSERT_GT(areas[s], 0);
+    means[s] /= double(areas[s]);
+  }
+  auto floorId = size_t(GeometricContextIndex::FloorOrGround);
+  auto ceilingId = size_t(GeometricContextIndex::CeilingOrSky);
+  auto verticalId = size_t(GeometricContextIndex::Vertical);
+  EXPECT_GT(means[Floor][floorId], means[Floor][ceilingId]);
+  EXPECT_GT(means[Ceiling][ceilingId], means[Ceiling][floorId]);
+  EXPECT_GT(means[FrontWall][verticalId],
+            means[FrontWall][floorId] + means[FrontWall][ceilingId]);
+}
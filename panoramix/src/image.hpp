@@ -28,6 +28,9 @@ using Image3d = Image_<Vec<double, 3>>;
 using Image5d = Image_<Vec<double, 5>>;
 using Image6d = Image_<Vec<double, 6>>;
 using Image7d = Image_<Vec<double, 7>>;
+using Image5f = Image_<Vec<float, 5>>;
+using Image6f = Image_<Vec<float, 6>>;
+using Image7f = Image_<Vec<float, 7>>;
 
 template <> struct MarkedAsNonContainer<Image> : yes {};
 template <class T> struct MarkedAsNonContainer<Image_<T>> : yes {};
@@ -55,6 +55,11 @@ template <class IterT> struct Range {
   IterT cbegin() const { return b; }
   IterT cend() const { return e; }
 
+  size_t size() const { return std::distance(b, e); }
+  bool empty() const { return b == e; }
+  decltype(auto) front() const { return *b; }
+  decltype(auto) back() const { return *std::prev(e); }
+
   decltype(auto) operator[](size_t i) const { return *(b + i); }
   decltype(auto) operator()(size_t i) const { return *(b + i); }
 
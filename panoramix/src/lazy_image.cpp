@@ -0,0 +1,231 @@
+#include "pch.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include "lazy_image.hpp"
+
+namespace pano {
+namespace core {
+
+namespace {
+std::vector<uint8_t> ReadFileBytes(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    throw std::runtime_error("cannot read image file \"" + path + "\"");
+  }
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs),
+                              std::istreambuf_iterator<char>());
+}
+
+// FNV-1a
+uint64_t HashBytes(const std::vector<uint8_t> &bytes) {
+  uint64_t hash = 14695981039346656037ull;
+  for (uint8_t b : bytes) {
+    hash = (hash ^ b) * 1099511628211ull;
+  }
+  return hash;
+}
+
+bool Encodable(LazyImage::Encoding encoding, int type) {
+  int depth = CV_MAT_DEPTH(type);
+  int channels = CV_MAT_CN(type);
+  if (encoding == LazyImage::PNG) {
+    return (depth == CV_8U || depth == CV_16U) &&
+           (channels == 1 || channels == 3 || channels == 4);
+  }
+  if (encoding == LazyImage::JPEG) {
+    return depth == CV_8U && (channels == 1 || channels == 3);
+  }
+  return true;
+}
+
+// the imdecode flags that give back an encoded image of the type
+int DecodeFlags(int type) {
+  int channels = CV_MAT_CN(type);
+  int flags = channels == 1 ? cv::IMREAD_GRAYSCALE
+                            : channels == 3 ? cv::IMREAD_COLOR
+                                            : cv::IMREAD_UNCHANGED;
+  if (CV_MAT_DEPTH(type) != CV_8U) {
+    flags |= cv::IMREAD_ANYDEPTH;
+  }
+  return flags;
+}
+}
+
+LazyImage::LazyImage() : LazyImage(Image()) {}
+
+LazyImage::LazyImage(const Image &im, Encoding encoding, int jpegQuality)
+    : _state(std::make_shared<State>()) {
+  _state->encoding = encoding;
+  _state->jpegQuality = jpegQuality;
+  _state->size = im.size();
+  _state->type = im.type();
+  _state->decoded = true;
+  _state->image = im;
+  _state->hash = 0;
+}
+
+LazyImage &LazyImage::operator=(const Image &im) {
+  auto encoding = this->encoding();
+  *this = LazyImage(im, encoding == Reference ? PNG : encoding,
+                    _state->jpegQuality);
+  return *this;
+}
+
+LazyImage LazyImage::Referencing(const std::string &path) {
+  LazyImage im;
+  im._state->encoding = Reference;
+  im._state->decoded = false;
+  im._state->path = path;
+  return im;
+}
+
+void LazyImage::decode(State &state) const {
+  if (state.decoded) {
+    return;
+  }
+  if (state.encoding == Reference) {
+    auto bytes = ReadFileBytes(state.path);
+    uint64_t hash = HashBytes(bytes);
+    if (state.hash != 0 && hash != state.hash) {
+      throw std::runtime_error("image file \"" + state.path +
+                               "\" changed since it was referenced");
+    }
+    // as cv::imread reads the images everywhere else
+    state.image = cv::imdecode(bytes, cv::IMREAD_COLOR);
+    state.hash = hash;
+    if (state.image.empty()) {
+      throw std::runtime_error("cannot decode image file \"" + state.path +
+                               "\"");
+    }
+    state.size = state.image.size();
+    state.type = state.image.type();
+  } else {
+    state.image = cv::imdecode(state.bytes, DecodeFlags(state.type));
+    if (state.image.empty() != (state.size.area() == 0) ||
+        (!state.image.empty() && state.image.type() != state.type)) {
+      throw std::runtime_error("cannot decode the encoded image");
+    }
+  }
+  state.decoded = true;
+}
+
+const Image &LazyImage::get() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  decode(*_state);
+  return _state->image;
+}
+
+Image &LazyImage::edit() {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  decode(*_state);
+  _state->bytes.clear();
+  if (_state->encoding == Reference) {
+    _state->encoding = PNG;
+    _state->path.clear();
+    _state->hash = 0;
+  }
+  return _state->image;
+}
+
+bool LazyImage::decoded() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->decoded;
+}
+
+bool LazyImage::empty() const { return size().area() == 0; }
+
+Sizei LazyImage::size() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  if (!_state->decoded && _state->encoding == Reference &&
+      _state->size.area() == 0) {
+    decode(*_state); // referenced but never saved, the size is not known yet
+  }
+  return _state->decoded ? _state->image.size() : _state->size;
+}
+
+int LazyImage::type() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  if (!_state->decoded && _state->encoding == Reference &&
+      _state->size.area() == 0) {
+    decode(*_state);
+  }
+  return _state->decoded ? _state->image.type() : _state->type;
+}
+
+LazyImage::Encoding LazyImage::encoding() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->encoding;
+}
+
+void LazyImage::setEncoding(Encoding encoding, int jpegQuality) {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  if (encoding == _state->encoding && jpegQuality == _state->jpegQuality) {
+    return;
+  }
+  if (encoding == Reference && _state->path.empty()) {
+    return; // only images made by Referencing have a file
+  }
+  decode(*_state);
+  _state->encoding = encoding;
+  _state->jpegQuality = jpegQuality;
+  _state->bytes.clear();
+  if (encoding != Reference) {
+    _state->path.clear();
+    _state->hash = 0;
+  }
+}
+
+const std::string &LazyImage::path() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->path;
+}
+
+LazyImage::Header LazyImage::encodedHeader() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  auto &state = *_state;
+  if (state.encoding == Reference) {
+    if (state.hash == 0 || state.size.area() == 0) {
+      decode(state); // hashes the file
+    }
+    return Header{Reference, state.size, state.type};
+  }
+  if (!state.bytes.empty()) {
+    return Header{state.encoding, state.size, state.type};
+  }
+  decode(state);
+  state.size = state.image.size();
+  state.type = state.image.type();
+  if (state.image.empty() || !Encodable(state.encoding, state.type)) {
+    return Header{Raw, state.size, state.type};
+  }
+  if (state.encoding == PNG) {
+    cv::imencode(".png", state.image, state.bytes);
+  } else if (state.encoding == JPEG) {
+    cv::imencode(".jpg", state.image, state.bytes,
+                 {cv::IMWRITE_JPEG_QUALITY, state.jpegQuality});
+  }
+  return Header{state.bytes.empty() ? Raw : state.encoding, state.size,
+                state.type};
+}
+
+const std::vector<uint8_t> &LazyImage::encodedBytes() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->bytes;
+}
+
+void LazyImage::setEncoded(const Header &header, std::string &&path,
+                           uint64_t hash, std::vector<uint8_t> &&bytes) {
+  *this = LazyImage();
+  auto &state = *_state;
+  state.encoding = Encoding(header.encoding);
+  state.size = header.size;
+  state.type = header.type;
+  state.decoded = header.size.area() == 0 && header.encoding != Reference;
+  state.path = std::move(path);
+  state.hash = hash;
+  state.bytes = std::move(bytes);
+}
+}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <mutex>
+
+#include "image.hpp"
+#include "serialization.hpp"
+
+namespace pano {
+namespace core {
+
+// LazyImage
+// an image serialized png or jpeg encoded, raw, or as a reference to the file
+// it was read from plus a hash of the file. a loaded one keeps the encoded
+// bytes and decodes them on first access, saving it again writes the bytes as
+// they are. copies share the image as cv::Mat does
+class LazyImage {
+public:
+  enum Encoding : int32_t { Raw = 0, PNG = 1, JPEG = 2, Reference = 3 };
+
+  LazyImage();
+  LazyImage(const Image &im, Encoding encoding = PNG, int jpegQuality = 95);
+  // keeps the encoding
+  LazyImage &operator=(const Image &im);
+
+  // refers to the image file, which is read on first access as a 3 channel
+  // 8 bit image like cv::imread does
+  static LazyImage Referencing(const std::string &path);
+
+  // decodes on first access, throws std::runtime_error if the encoded image
+  // or the referenced file is broken or the file changed since
+  const Image &get() const;
+  // the image to change, it is encoded again on saving and a reference
+  // becomes png
+  Image &edit();
+
+  bool decoded() const;
+  // known without decoding
+  bool empty() const;
+  Sizei size() const;
+  int type() const;
+
+  Encoding encoding() const;
+  // png and jpeg fall back to raw for images they cannot hold, a reference
+  // only to the file the image was made from by Referencing
+  void setEncoding(Encoding encoding, int jpegQuality = 95);
+  // the referenced file, empty if not a reference
+  const std::string &path() const;
+
+  template <class Archiver> void save(Archiver &ar) const {
+    auto header = encodedHeader();
+    ar(header.encoding, header.size, header.type);
+    if (header.encoding == Raw) {
+      ar(get());
+    } else if (header.encoding == Reference) {
+      ar(_state->path, _state->hash);
+    } else {
+      ar(encodedBytes());
+    }
+  }
+
+  template <class Archiver> void load(Archiver &ar) {
+    Header header;
+    ar(header.encoding, header.size, header.type);
+    if (header.encoding == Raw) {
+      Image im;
+      ar(im);
+      *this = LazyImage(im, Raw);
+      return;
+    }
+    std::string path;
+    uint64_t hash = 0;
+    std::vector<uint8_t> bytes;
+    if (header.encoding == Reference) {
+      ar(path, hash);
+    } else {
+      ar(bytes);
+    }
+    setEncoded(header, std::move(path), hash, std::move(bytes));
+  }
+
+private:
+  struct Header {
+    int32_t encoding;
+    Sizei size;
+    int type;
+  };
+  struct State {
+    std::mutex mutex;
+    Encoding encoding;
+    int jpegQuality;
+    Sizei size;
+    int type;
+    bool decoded;
+    Image image;
+    // the encoded image, empty if it is not encoded yet or stale
+    std::vector<uint8_t> bytes;
+    std::string path;
+    uint64_t hash;
+  };
+
+  // decodes if needed, the state is locked
+  void decode(State &state) const;
+  // the encoding to write, encodes the image or hashes the referenced file
+  Header encodedHeader() const;
+  const std::vector<uint8_t> &encodedBytes() const;
+  void setEncoded(const Header &header, std::string &&path, uint64_t hash,
+                  std::vector<uint8_t> &&bytes);
+
+private:
+  std::shared_ptr<State> _state;
+};
+}
+}
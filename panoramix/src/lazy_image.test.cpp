@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <sstream>
+
+#include "lazy_image.hpp"
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+namespace {
+core::Image3ub MakeGradientImage(int rows, int cols) {
+  core::Image3ub im(rows, cols);
+  for (auto it = im.begin(); it != im.end(); ++it) {
+    auto p = it.pos();
+    *it = core::Vec3ub(p.x % 256, p.y % 256, (p.x + p.y) % 256);
+  }
+  return im;
+}
+
+core::LazyImage RoundTrip(const core::LazyImage &im) {
+  std::stringstream ss;
+  {
+    core::BinaryOutputArchive archive(ss);
+    archive(im);
+  }
+  core::LazyImage loaded;
+  {
+    core::BinaryInputArchive archive(ss);
+    archive(loaded);
+  }
+  return loaded;
+}
+}
+
+TEST(LazyImage, PNGIsLosslessAndLazy) {
+  auto im = MakeGradientImage(300, 600);
+  auto loaded = RoundTrip(core::LazyImage(im));
+  EXPECT_FALSE(loaded.decoded());
+  EXPECT_EQ(loaded.size(), im.size());
+  EXPECT_EQ(loaded.type(), im.type());
+  EXPECT_FALSE(loaded.decoded());
+  EXPECT_EQ(cv::norm(loaded.get(), im, cv::NORM_INF), 0);
+  EXPECT_TRUE(loaded.decoded());
+}
+
+TEST(LazyImage, SavedAgainWithoutDecoding) {
+  auto im = MakeGradientImage(200, 400);
+  auto loaded = RoundTrip(core::LazyImage(im, core::LazyImage::JPEG, 90));
+  auto again = RoundTrip(loaded);
+  EXPECT_FALSE(loaded.decoded());
+  EXPECT_EQ(again.encoding(), core::LazyImage::JPEG);
+  EXPECT_LT(cv::norm(again.get(), im, cv::NORM_L1) / im.total(), 10.0);
+}
+
+TEST(LazyImage, RawWhenNotEncodable) {
+  core::Image3d im(50, 80, core::Vec3(0.25, 0.5, 0.75));
+  auto loaded = RoundTrip(core::LazyImage(im));
+  EXPECT_EQ(loaded.encoding(), core::LazyImage::Raw);
+  EXPECT_EQ(cv::norm(loaded.get(), im, cv::NORM_INF), 0);
+
+  auto empty = RoundTrip(core::LazyImage());
+  EXPECT_TRUE(empty.empty());
+  EXPECT_TRUE(empty.get().empty());
+}
+
+TEST(LazyImage, Reference) {
+  std::string path = "lazy_image.png";
+  auto im = MakeGradientImage(100, 200);
+  cv::imwrite(path, im);
+
+  auto loaded = RoundTrip(core::LazyImage::Referencing(path));
+  EXPECT_EQ(loaded.encoding(), core::LazyImage::Reference);
+  EXPECT_EQ(loaded.path(), path);
+  EXPECT_EQ(loaded.size(), im.size());
+  EXPECT_FALSE(loaded.decoded());
+  EXPECT_EQ(cv::norm(loaded.get(), im, cv::NORM_INF), 0);
+
+  // the file changes
+  auto stale = RoundTrip(core::LazyImage::Referencing(path));
+  cv::imwrite(path, MakeGradientImage(100, 100));
+  EXPECT_THROW(stale.get(), std::runtime_error);
+
+  // an edited reference is kept as png
+  auto edited = core::LazyImage::Referencing(path);
+  edited.edit() *= 0.5;
+  EXPECT_EQ(edited.encoding(), core::LazyImage::PNG);
+  EXPECT_TRUE(RoundTrip(edited).path().empty());
+  std::remove(path.c_str());
+}
+
+TEST(LazyImage, TypesOfOtherSources) {
+  core::Image im4(60, 80, CV_8UC4, cv::Scalar(10, 20, 30, 40));
+  core::Image im16(60, 80, CV_16UC1, cv::Scalar(1000));
+
+  // png keeps the type
+  for (auto &im : {im4, im16}) {
+    auto loaded = RoundTrip(core::LazyImage(im));
+    EXPECT_EQ(loaded.encoding(), core::LazyImage::PNG);
+    EXPECT_EQ(loaded.type(), im.type());
+    EXPECT_EQ(loaded.get().type(), im.type());
+    EXPECT_EQ(cv::norm(loaded.get(), im, cv::NORM_INF), 0);
+  }
+
+  // a reference reads the file as cv::imread does
+  std::string path = "lazy_image_types.png";
+  for (auto &im : {im4, im16}) {
+    cv::imwrite(path, im);
+    auto loaded = RoundTrip(core::LazyImage::Referencing(path));
+    EXPECT_EQ(loaded.type(), CV_8UC3);
+    EXPECT_EQ(loaded.get().type(), CV_8UC3);
+    EXPECT_EQ(cv::norm(loaded.get(), cv::imread(path), cv::NORM_INF), 0);
+  }
+  std::remove(path.c_str());
+}
@@ -7,6 +7,7 @@ extern "C" {
 #include "clock.hpp"
 #include "containers.hpp"
 #include "line_detection.hpp"
+#include "parallel.hpp"
 #include "utility.hpp"
 
 namespace pano {
@@ -16,160 +17,343 @@ namespace core {
 
 namespace {
 
-void ExtractLines(const cv::Mat &im, std::vector<Line2> &lines, int minlen,
-                  int xborderw, int yborderw, int numDir) {
+// gradient grouping
+// the canny edge pixels of each gradient direction bin and its two neighboring
+// bins form the set of the bin. the 8-connected regions of a set that are
+// straight enough become lines and leave the sets of the neighboring bins, so
+// each bin sees the set left by the bin before it. sets are row bitmaps, each
+// bin finds its regions in parallel as if nothing had left it, then in bin
+// order only the regions that lost pixels are split again
+
+// a row major bitmap, rows are padded to words so that they can be written
+// in parallel
+struct EdgeBitmap {
+  int rowWords;
+  std::vector<uint64_t> words;
+  EdgeBitmap(int w, int h) : rowWords((w + 63) / 64), words(h * rowWords) {}
+  bool test(int x, int y) const {
+    return (words[y * rowWords + x / 64] >> (x % 64)) & 1;
+  }
+  void set(int x, int y) { words[y * rowWords + x / 64] |= 1ull << (x % 64); }
+  void reset(int x, int y) {
+    words[y * rowWords + x / 64] &= ~(1ull << (x % 64));
+  }
+};
+
+// the neighbor of (x, y) toward (dx, dy). the grouping used to walk column
+// major pixel ids, which wrap from the bottom row of a column to the top row
+// of the next, this keeps its regions the same
+inline bool EdgeNeighbor(int x, int y, int dx, int dy, int w, int h, int &nx,
+                         int &ny) {
+  nx = x + dx;
+  ny = y + dy;
+  if (ny == h) {
+    ny = 0;
+    nx++;
+  } else if (ny == -1) {
+    ny = h - 1;
+    nx--;
+  }
+  return nx >= 0 && nx < w;
+}
+
+static const int EdgeXDirs[] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int EdgeYDirs[] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+// pixels y * w + x of a region of a bin set
+struct EdgeRegion {
+  int begin, end;
+  // the smallest column major id, regions are visited in its order
+  int64_t key;
+  // has pixels on both the top and the bottom rows, so may wrap
+  bool wraps;
+  // straight enough to make a line, which is dropped on the borders
+  bool straight;
+  bool onBorder;
+  Line2 line;
+};
+
+// takes the region grown from the pixel at pixels[begin] out of the bitmap
+EdgeRegion GrowEdgeRegion(EdgeBitmap &bits, std::vector<int> &pixels,
+                          int begin, int w, int h) {
+  EdgeRegion region;
+  region.begin = begin;
+  region.key = std::numeric_limits<int64_t>::max();
+  bool top = false, bottom = false;
+  for (int head = begin; head < pixels.size(); head++) {
+    int x = pixels[head] % w, y = pixels[head] / w;
+    region.key = std::min(region.key, int64_t(x) * h + y);
+    top |= y == 0;
+    bottom |= y == h - 1;
+    for (int k = 0; k < 8; k++) {
+      int nx, ny;
+      if (EdgeNeighbor(x, y, EdgeXDirs[k], EdgeYDirs[k], w, h, nx, ny) &&
+          bits.test(nx, ny)) {
+        bits.reset(nx, ny);
+        pixels.push_back(ny * w + nx);
+      }
+    }
+  }
+  region.end = pixels.size();
+  region.wraps = top && bottom;
+  region.straight = false;
+  region.onBorder = false;
+  return region;
+}
+
+// the coordinates the line of a region is fitted to. the former grouping kept
+// the coordinates of its walk from the smallest column major id, which leave
+// the image where the walk wraps, so wrapping regions walk the same way again
+void WalkEdgeRegion(const std::vector<int> &pixels, const EdgeRegion &region,
+                    int w, int h, EdgeBitmap &scratch,
+                    std::vector<Pixel> &coords) {
+  coords.clear();
+  if (!region.wraps) {
+    for (int i = region.begin; i < region.end; i++) {
+      coords.emplace_back(pixels[i] % w, pixels[i] / w);
+    }
+    return;
+  }
+  if (scratch.words.empty()) {
+    scratch = EdgeBitmap(w, h);
+  }
+  for (int i = region.begin; i < region.end; i++) {
+    scratch.set(pixels[i] % w, pixels[i] / w);
+  }
+  int rootx = int(region.key / h), rooty = int(region.key % h);
+  scratch.reset(rootx, rooty);
+  coords.emplace_back(rootx, rooty);
+  for (int head = 0; head < coords.size(); head++) {
+    for (int k = 0; k < 8; k++) {
+      int nx = coords[head].x + EdgeXDirs[k];
+      int ny = coords[head].y + EdgeYDirs[k];
+      int64_t id = int64_t(nx) * h + ny;
+      if (id < 0 || id >= int64_t(w) * h) {
+        continue;
+      }
+      int x = int(id / h), y = int(id % h);
+      if (scratch.test(x, y)) {
+        scratch.reset(x, y);
+        coords.emplace_back(nx, ny);
+      }
+    }
+  }
+}
 
-  std::cout << "image processing..." << std::endl;
+// fits the line by the principal direction of the coordinates. deviations are
+// taken from the mean rounded to an integer, as subtracting a scalar from the
+// cv::Mat_<int> of the former fit did, so the integer moments give the same
+// lines
+void FitEdgeRegion(const std::vector<Pixel> &coords, EdgeRegion &region, int w,
+                   int h, int xborderw, int yborderw) {
+  int n = coords.size();
+  int64_t sumx = 0, sumy = 0;
+  int minx = std::numeric_limits<int>::max(), maxx = -minx;
+  int miny = minx, maxy = maxx;
+  for (auto &p : coords) {
+    sumx += p.x;
+    sumy += p.y;
+    minx = std::min(minx, p.x);
+    maxx = std::max(maxx, p.x);
+    miny = std::min(miny, p.y);
+    maxy = std::max(maxy, p.y);
+  }
+  double scale = 1.0 / n;
+  double meanx = sumx * scale, meany = sumy * scale;
+  int roundx = cvRound(meanx), roundy = cvRound(meany);
+  int64_t sxx = 0, sxy = 0, syy = 0;
+  for (auto &p : coords) {
+    int64_t zx = p.x - roundx;
+    int64_t zy = p.y - roundy;
+    sxx += zx * zx;
+    sxy += zx * zy;
+    syy += zy * zy;
+  }
+
+  cv::Mat v, lambda;
+  Mat<double, 2, 2> D;
+  D(0, 0) = double(sxx);
+  D(0, 1) = D(1, 0) = double(sxy);
+  D(1, 1) = double(syy);
+  cv::eigen(D, lambda, v);
+
+  double theta = atan2(v.at<double>(0, 1), v.at<double>(0, 0));
+  double confidence = std::numeric_limits<double>::max();
+  if (lambda.at<double>(1) > 0) {
+    confidence = lambda.at<double>(0) / lambda.at<double>(1);
+  }
+  region.straight = confidence >= 200;
+  if (!region.straight) {
+    return;
+  }
+  region.onBorder = maxx <= xborderw || minx >= w - xborderw ||
+                    maxy <= yborderw || miny >= h - yborderw;
+  double len = sqrt(double(maxx - minx) * (maxx - minx) +
+                    double(maxy - miny) * (maxy - miny));
+  double x1 = meanx - cos(theta) * len / 2;
+  double x2 = meanx + cos(theta) * len / 2;
+  double y1 = meany - sin(theta) * len / 2;
+  double y2 = meany + sin(theta) * len / 2;
+  region.line = {Vec2(x1, y1), Vec2(x2, y2)};
+}
 
+void ExtractLines(const cv::Mat &im, std::vector<Line2> &lines, int minlen,
+                  int xborderw, int yborderw, int numDir) {
   cv::Mat gim;
   cv::cvtColor(im, gim, CV_BGR2GRAY);
   int h = gim.rows;
   int w = gim.cols;
 
+  // the sobel responses of 8 bit images are exact in 16 bits
   cv::Mat dx, dy;
   cv::Mat ggim;
   cv::GaussianBlur(gim, ggim, cv::Size(7, 7), 1.5);
-  cv::Sobel(ggim, dx, CV_64F, 1, 0);
-  cv::Sobel(ggim, dy, CV_64F, 0, 1);
+  cv::Sobel(ggim, dx, CV_16S, 1, 0);
+  cv::Sobel(ggim, dy, CV_16S, 0, 1);
 
   cv::Mat imCanny;
   cv::Canny(gim, imCanny, 5, 20);
 
-  std::cout << "gradient binning..." << std::endl;
-
-  cv::Mat imBinIds(im.size(), CV_32SC1); // int32_t
-  std::vector<std::set<int>> pixelIdsSet(numDir);
-
-  for (int x = 0; x < imCanny.cols; x++) {
-    for (int y = 0; y < imCanny.rows; y++) {
-      if (imCanny.at<uchar>(y, x) > 0) {
-        double a = atan(dy.at<double>(y, x) / dx.at<double>(y, x));
-        if (isnan(a)) { // NaN
+  // bin the edge pixels row by row
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  std::vector<EdgeBitmap> sets(numDir, EdgeBitmap(w, h));
+  std::vector<std::vector<int>> setSizes(concurrency,
+                                         std::vector<int>(numDir, 0));
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    for (int y = t; y < h; y += concurrency) {
+      const uchar *canny = imCanny.ptr<uchar>(y);
+      const int16_t *dxs = dx.ptr<int16_t>(y);
+      const int16_t *dys = dy.ptr<int16_t>(y);
+      for (int x = 0; x < w; x++) {
+        if (canny[x] == 0) {
+          continue;
+        }
+        double a = atan(double(dys[x]) / double(dxs[x]));
+        if (std::isnan(a)) {
           continue;
         }
-        // compute bin id
         int binId = int((a / M_PI + 0.5) * numDir);
         if (binId == -1)
           binId = 0;
         if (binId == numDir)
           binId = numDir - 1;
-
-        int pixelId = y + imCanny.rows * x;
-
-        imBinIds.at<int32_t>(y, x) = binId;
-
-        pixelIdsSet[(binId + numDir - 1) % numDir].insert(pixelId);
-        pixelIdsSet[binId].insert(pixelId);
-        pixelIdsSet[(binId + 1) % numDir].insert(pixelId);
-      } else {
-        imBinIds.at<int32_t>(y, x) = -1;
+        for (int d = -1; d <= 1; d++) {
+          int s = (binId + d + numDir) % numDir;
+          if (!sets[s].test(x, y)) {
+            sets[s].set(x, y);
+            setSizes[t][s]++;
+          }
+        }
       }
     }
-  }
-
-  std::vector<int> xs, ys, ids;
-  xs.reserve(512);
-  ys.reserve(512);
-  ids.reserve(512);
-
-  std::cout << "collecting pixels.." << std::endl;
-
-  for (int binId = 0; binId < numDir; binId++) {
-    // search in bins
-    auto pixelIdNotSearchedYet = pixelIdsSet[binId];
-
-    while (true) {
-      if (pixelIdNotSearchedYet.empty())
-        break;
-      int rootId = *pixelIdNotSearchedYet.begin();
-
-      // BFS
-      xs.clear();
-      ys.clear();
-      ids.clear();
-      int x = rootId / imCanny.rows;
-      int y = rootId - imCanny.rows * x;
-      xs.push_back(x);
-      ys.push_back(y);
-      ids.push_back(rootId);
-
-      // used for search only
-      pixelIdNotSearchedYet.erase(rootId);
-      int head = 0;
-
-      static const int xdirs[] = {1, 1, 0, -1, -1, -1, 0, 1};
-      static const int ydirs[] = {0, 1, 1, 1, 0, -1, -1, -1};
-      while (true) {
-        if (head == xs.size())
-          break;
-        x = xs[head];
-        y = ys[head];
-        for (int k = 0; k < 8; k++) {
-          int nx = x + xdirs[k];
-          int ny = y + ydirs[k];
-          int npixelId = ny + imCanny.rows * nx;
-          if (pixelIdNotSearchedYet.find(npixelId) !=
-              pixelIdNotSearchedYet.end()) {
-            xs.push_back(nx);
-            ys.push_back(ny);
-            ids.push_back(npixelId);
-            pixelIdNotSearchedYet.erase(npixelId);
+  });
+
+  // the regions of each whole set
+  std::vector<std::vector<int>> pixels(numDir);
+  std::vector<std::vector<EdgeRegion>> regions(numDir);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    EdgeBitmap scratch(0, 0);
+    std::vector<Pixel> coords;
+    for (int b = t; b < numDir; b += concurrency) {
+      int size = 0;
+      for (int i = 0; i < concurrency; i++) {
+        size += setSizes[i][b];
+      }
+      pixels[b].reserve(size);
+      auto &bits = sets[b];
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          uint64_t word = bits.words[y * bits.rowWords + x / 64];
+          if (word == 0) {
+            x += 63 - x % 64; // the next word
+            continue;
+          }
+          if (!((word >> (x % 64)) & 1)) {
+            continue;
+          }
+          bits.reset(x, y);
+          int begin = pixels[b].size();
+          pixels[b].push_back(y * w + x);
+          regions[b].push_back(GrowEdgeRegion(bits, pixels[b], begin, w, h));
+          auto &region = regions[b].back();
+          if (region.end - region.begin >= minlen) {
+            WalkEdgeRegion(pixels[b], region, w, h, scratch, coords);
+            FitEdgeRegion(coords, region, w, h, xborderw, yborderw);
           }
         }
-        head++;
       }
-
-      int edgeSize = (int)xs.size();
-      if (edgeSize < minlen)
+    }
+  });
+
+  // in bin order, the pixels of straight regions leave the sets of the
+  // neighboring bins not visited yet
+  std::vector<EdgeBitmap> left(numDir, EdgeBitmap(0, 0));
+  EdgeBitmap pending(w, h), scratch(0, 0);
+  std::vector<Pixel> coords;
+  std::vector<EdgeRegion> visited;
+  for (int b = 0; b < numDir; b++) {
+    visited.clear();
+    for (auto &region : regions[b]) {
+      bool intact = true;
+      for (int i = region.begin; i < region.end && !left[b].words.empty();
+           i++) {
+        if (left[b].test(pixels[b][i] % w, pixels[b][i] / w)) {
+          intact = false;
+          break;
+        }
+      }
+      if (intact) {
+        visited.push_back(region);
         continue;
-
-      cv::Mat xsmat(xs), ysmat(ys);
-      double meanx = cv::mean(xsmat).val[0], meany = cv::mean(ysmat).val[0];
-      cv::Mat zmx = xsmat - meanx, zmy = ysmat - meany;
-
-      cv::Mat v, lambda;
-      Mat<double, 2, 2> D;
-      D(0, 0) = cv::sum(zmx.mul(zmx)).val[0];
-      D(0, 1) = D(1, 0) = cv::sum(zmx.mul(zmy)).val[0];
-      D(1, 1) = cv::sum(zmy.mul(zmy)).val[0];
-      cv::eigen(D, lambda, v);
-
-      double theta = atan2(v.at<double>(0, 1), v.at<double>(0, 0));
-      double confidence = std::numeric_limits<double>::max();
-      if (lambda.at<double>(1) > 0) {
-        confidence = lambda.at<double>(0) / lambda.at<double>(1);
       }
-
-      // build line
-      if (confidence >= 200) { ////
-        for (int pid : ids) {
-          pixelIdsSet[binId].erase(pid);
-          pixelIdsSet[(binId - 1 + numDir) % numDir].erase(pid);
-          pixelIdsSet[(binId + 1) % numDir].erase(pid);
+      // split what is left of the region
+      for (int i = region.begin; i < region.end; i++) {
+        int x = pixels[b][i] % w, y = pixels[b][i] / w;
+        if (!left[b].test(x, y)) {
+          pending.set(x, y);
         }
-
-        auto xends = std::minmax_element(xs.begin(), xs.end());
-        auto yends = std::minmax_element(ys.begin(), ys.end());
-        double minx = *xends.first, maxx = *xends.second;
-        double miny = *yends.first, maxy = *yends.second;
-
-        if (maxx <= xborderw || minx >= w - xborderw || maxy <= yborderw ||
-            miny >= h - yborderw)
+      }
+      for (int i = region.begin; i < region.end; i++) {
+        int p = pixels[b][i];
+        if (!pending.test(p % w, p / w)) {
           continue;
+        }
+        pending.reset(p % w, p / w);
+        int begin = pixels[b].size();
+        pixels[b].push_back(p);
+        visited.push_back(GrowEdgeRegion(pending, pixels[b], begin, w, h));
+        auto &part = visited.back();
+        if (part.end - part.begin >= minlen) {
+          WalkEdgeRegion(pixels[b], part, w, h, scratch, coords);
+          FitEdgeRegion(coords, part, w, h, xborderw, yborderw);
+        }
+      }
+    }
 
-        double len =
-            sqrt((maxx - minx) * (maxx - minx) + (maxy - miny) * (maxy - miny));
-        double x1 = meanx - cos(theta) * len / 2;
-        double x2 = meanx + cos(theta) * len / 2;
-        double y1 = meany - sin(theta) * len / 2;
-        double y2 = meany + sin(theta) * len / 2;
-
-        lines.push_back({Vec2(x1, y1), Vec2(x2, y2)});
+    std::sort(visited.begin(), visited.end(),
+              [](const EdgeRegion &r1, const EdgeRegion &r2) {
+                return r1.key < r2.key;
+              });
+    for (auto &region : visited) {
+      if (!region.straight) {
+        continue;
+      }
+      for (int s : {(b + numDir - 1) % numDir, (b + 1) % numDir}) {
+        if (s <= b) {
+          continue;
+        }
+        if (left[s].words.empty()) {
+          left[s] = EdgeBitmap(w, h);
+        }
+        for (int i = region.begin; i < region.end; i++) {
+          left[s].set(pixels[b][i] % w, pixels[b][i] / w);
+        }
+      }
+      if (!region.onBorder) {
+        lines.push_back(region.line);
       }
     }
   }
-
-  std::cout << "done" << std::endl;
 }
 
 void ExtractLinesUsingLSD(const cv::Mat &im, std::vector<Line2> &lines,
@@ -328,12 +512,17 @@ ComputeLineIntersections(const std::vector<Line2> &lines,
 std::vector<Vec3>
 ComputeLineIntersections(const std::vector<Line3> &lines,
                          std::vector<std::pair<int, int>> *lineids,
-                         double minAngleDistanceBetweenLinePairs) {
+                         double minAngleDistanceBetweenLinePairs,
+                         const misc::Deadline &deadline) {
   SetClock();
 
   std::vector<Vec3> interps;
   size_t lnum = lines.size();
   for (int i = 0; i < lnum; i++) {
+    // the first line is always done
+    if (i > 0 && deadline.expired()) {
+      break;
+    }
     Vec3 ni = normalize(lines[i].first.cross(lines[i].second));
 
     for (int j = i + 1; j < lnum; j++) {
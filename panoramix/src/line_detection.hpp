@@ -1,6 +1,7 @@
 #pragma once
 
 #include "basic_types.hpp"
+#include "clock.hpp"
 
 namespace pano {
 namespace core {
@@ -44,10 +45,13 @@ std::vector<HPoint2> ComputeLineIntersections(
     bool suppresscross = true,
     double minDistanceBetweenLinePairs = std::numeric_limits<double>::max());
 
+// pairs are visited line by line, once the deadline expires no further line is
+// started and only the intersections of the lines done so far are returned
 std::vector<Vec3>
 ComputeLineIntersections(const std::vector<Line3> &lines,
                          std::vector<std::pair<int, int>> *lineids = nullptr,
-                         double minAngleDistanceBetweenLinePairs = M_PI);
+                         double minAngleDistanceBetweenLinePairs = M_PI,
+                         const misc::Deadline &deadline = misc::Deadline());
 
 // classify lines in 2d
 DenseMatd ClassifyLines(std::vector<Classified<Line2>> &lines,
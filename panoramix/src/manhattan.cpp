@@ -13,6 +13,7 @@
 #include "clock.hpp"
 #include "eigen.hpp"
 #include "matlab_api.hpp"
+#include "parallel.hpp"
 
 namespace pano {
 namespace core {
@@ -339,17 +340,23 @@ std::vector<Vec3> EstimateVanishingPointsAndClassifyLines(
 std::vector<Vec3>
 EstimateVanishingPointsAndClassifyLines(std::vector<Classified<Line3>> &lines,
                                         DenseMatd *lineVPScores,
-                                        bool dontClassifyUmbiguiousLines) {
+                                        bool dontClassifyUmbiguiousLines,
+                                        const misc::Deadline &deadline) {
   std::vector<Vec3> lineIntersections;
 
   std::vector<Line3> pureLines(lines.size());
   for (int i = 0; i < lines.size(); i++) {
     pureLines[i] = lines[i].component;
   }
-  auto inters = ComputeLineIntersections(pureLines, nullptr);
+  auto inters = ComputeLineIntersections(pureLines, nullptr, M_PI, deadline);
+  auto found = FindOrthogonalPrinicipleDirections(inters, 1000, 500, true);
+  if (found.failed() && deadline.expired()) {
+    // too few intersections were found before the deadline, use all
+    inters = ComputeLineIntersections(pureLines, nullptr);
+    found = FindOrthogonalPrinicipleDirections(inters, 1000, 500, true);
+  }
 
-  auto vanishingPoints =
-      FindOrthogonalPrinicipleDirections(inters, 1000, 500, true).unwrap();
+  auto vanishingPoints = found.unwrap();
   OrderVanishingPoints(vanishingPoints);
 
   auto scores =
@@ -1434,10 +1441,51 @@ Point2 move_line_towards_vp(Point2 curp1, Point2 curp2, Point2 vp, int amount,
   return newp1;
 };
 
-std::vector<cv::Point2f> getpoly(const Line2 &line,
-                                 const Point2 &vanishingPoints, int to_away,
-                                 const cv::Size &imageSize,
-                                 std::vector<Point2> sample) {
+namespace {
+// samples of one orientation, indexed by their positions
+struct LineSamples {
+  std::vector<Point2> samples;
+  RTreeMap<Point2, int> index;
+};
+
+// tests whether any sample blocks the sweep from (p1, p2) to (newp1, newp2)
+// the polygon tested against the i-th sample is the one the original sweep
+// grows by appending (newp2, newp1, p1) for each visited sample, so only
+// three distinct vertex lists (the first, odd and even ones) are possible
+bool AnySampleInSweep(const cv::Point2f &p1, const cv::Point2f &p2,
+                      const cv::Point2f &newp1, const cv::Point2f &newp2,
+                      const LineSamples &ls) {
+  const std::vector<cv::Point2f> firstPoly = {p1, p2, newp2, newp1, p1};
+  const std::vector<cv::Point2f> oddPoly = {p1,    p2,    newp2, newp1,
+                                            p1,    newp2, newp1, p1};
+  const std::vector<cv::Point2f> evenPoly = {
+      p1, p2, newp2, newp1, p1, newp2, newp1, p1, newp2, newp1, p1};
+
+  // samples outside the bounding box are never strictly inside
+  auto box = BoundingBoxOfContainer(
+      {Point2(p1.x, p1.y), Point2(p2.x, p2.y), Point2(newp1.x, newp1.y),
+       Point2(newp2.x, newp2.y)});
+  box.expand(1.0);
+
+  bool blocked = false;
+  ls.index.search(box, [&](const std::pair<Point2, int> &s) {
+    int i = s.second;
+    cv::Point2f pt(ls.samples[i][0], ls.samples[i][1]);
+    auto &poly = i == 0 ? firstPoly : (i % 2 == 1 ? oddPoly : evenPoly);
+    if (cv::pointPolygonTest(poly, pt, false) > 0) {
+      blocked = true;
+      return false;
+    }
+    return true;
+  });
+  return blocked;
+}
+}
+
+std::vector<Point<int32_t, 2>> getpoly(const Line2 &line,
+                                       const Point2 &vanishingPoints,
+                                       int to_away, const cv::Size &imageSize,
+                                       const LineSamples &ls) {
   cv::Point2f p1;
   p1.x = line.first[0];
   p1.y = line.first[1];
@@ -1449,10 +1497,6 @@ std::vector<cv::Point2f> getpoly(const Line2 &line,
   cv::Point2f curp2 = p2;
   int moveAmount = 64;
 
-  std::vector<cv::Point2f> result;
-
-  //	Imagei oo = Imagei::ones(imageSize) * -1;;
-
   while (moveAmount >= 1) {
     bool atvp = 0;
     Point2 hcurp1;
@@ -1475,65 +1519,31 @@ std::vector<cv::Point2f> getpoly(const Line2 &line,
 
     bool failed = 0;
     if (atvp == 1) {
-
       failed = 1;
     } else if ((hnewp1[0] > imageSize.width || hnewp1[0] < 1 ||
                 hnewp1[1] > imageSize.height || hnewp1[1] < 1) ||
                (hnewp2[0] > imageSize.width || hnewp2[0] < 1 ||
                 hnewp2[1] > imageSize.height || hnewp2[1] < 1)) {
-
       failed = 1;
     } else {
-      std::vector<cv::Point2f> poly;
-      poly.push_back(p1);
-      poly.push_back(p2);
-      cv::Point2f pt;
-      for (int i = 0; i < sample.size(); i++) {
-        pt.x = (sample[i])[0];
-        pt.y = (sample[i])[1];
-        poly.push_back(newp2);
-        poly.push_back(newp1);
-        poly.push_back(p1);
-        double isstop = cv::pointPolygonTest(poly, pt, false);
-
-        if (isstop > 0) {
-          failed = 1;
-          break;
-        }
-      }
+      failed = AnySampleInSweep(p1, p2, newp1, newp2, ls);
     }
 
     if (failed == 1) {
-
       moveAmount = moveAmount / 2;
     } else {
       curp1 = newp1;
       curp2 = newp2;
     }
   }
-  // cv::Point** pts;
-  // int* npts;
-  // int ncontours;
-  // cv::Mat IMG = cv::Mat::zeros(imageSize, CV_32SC1);
-  //
-  // cv::Point offset = cv::Point();
-  ///*cv::fillPoly(IMG, pts, npts, ncontours, 225, 8, 0, offset);
-  // cv::fillPoly()*/
 
-  result.push_back(p1);
-  result.push_back(p2);
-
-  result.push_back(curp2);
-  result.push_back(curp1);
-
-  return result;
-}
-
-void myfillPoly(cv::Mat &img, std::vector<std::vector<Point<int32_t, 2>>> &pts,
-                int label) {
-  for (auto &ps : pts) {
-    cv::fillConvexPoly(img, ps, label);
+  std::vector<Point<int32_t, 2>> result(4);
+  for (auto &p : {std::make_pair(0, p1), std::make_pair(1, p2),
+                  std::make_pair(2, curp2), std::make_pair(3, curp1)}) {
+    result[p.first][0] = p.second.x;
+    result[p.first][1] = p.second.y;
   }
+  return result;
 }
 
 Imagei ExtractOrientationMaps(const cv::Size &imageSize,
@@ -1541,207 +1551,76 @@ Imagei ExtractOrientationMaps(const cv::Size &imageSize,
                               const std::array<HPoint2, 3> &vanishingPoints,
                               const std::vector<int> &lineClasses) {
 
-  // fill with -1 as default
-  Imagei omap = Imagei::ones(imageSize) * -1;
-  std::vector<std::vector<Point<int32_t, 2>>> lineextimg[3][3][2];
-
-  std::vector<Point2> ls[3];
-  std::vector<int> lsclass;
-  int lsSize;
-
-  std::tie(ls[0], ls[1], ls[2], lsclass, lsSize) =
-      sample_line(lines, lineClasses);
-
-  size_t lnum = lines.size();
-  // size_t lnum = 40;
-  for (int i = 0; i < lnum; i++) {
-    int lclass = lineClasses[i];
-    if (lclass == -1)
-      continue;
-    for (int j = 0; j < 3; j++) {
-      if (j == lclass) {
-        ;
-      } else {
-        Point2 Vp = vanishingPoints[j].value();
-        // Vp[0];
-        int orient;
-        for (int k = 0; k < 3; k++) {
-          if (k != lclass && k != j)
-            orient = k;
-        }
-
-        std::vector<cv::Point2f> poly1 =
-            getpoly(lines[i], Vp, -1, imageSize, ls[orient]);
-        std::vector<Point<int32_t, 2>> ppoly1;
-        std::vector<Point<int32_t, 2>> ppoly2;
-        for (int ii = 0; ii < poly1.size(); ii++) {
-          Point<int32_t, 2> temppoint;
-          temppoint[0] = poly1.at(ii).x;
-          temppoint[1] = poly1.at(ii).y;
-          ppoly1.push_back(temppoint);
-        }
-        lineextimg[lclass][j][0].push_back(ppoly1);
-        std::vector<cv::Point2f> poly2 =
-            getpoly(lines[i], Vp, 1, imageSize, ls[orient]);
-        for (int ii = 0; ii < poly1.size(); ii++) {
-          Point<int32_t, 2> temppoint;
-          temppoint[0] = poly2.at(ii).x;
-          temppoint[1] = poly2.at(ii).y;
-          ppoly2.push_back(temppoint);
-        }
-        lineextimg[lclass][j][1].push_back(ppoly2);
-        // std::cout << "i =  " << i << "," << j << std::endl;
-        /*if (i == 4 && j == 0)
-        int ass = 0;*/
+  LineSamples ls[3];
+  {
+    std::vector<int> lsclass;
+    int lsSize;
+    std::tie(ls[0].samples, ls[1].samples, ls[2].samples, lsclass, lsSize) =
+        sample_line(lines, lineClasses);
+    for (int k = 0; k < 3; k++) {
+      for (int i = 0; i < ls[k].samples.size(); i++) {
+        ls[k].index.emplace(ls[k].samples[i], i);
       }
     }
   }
 
-  Imagei omap1 = Imagei::ones(imageSize) * -1;
-  Imagei omap2 = Imagei::ones(imageSize) * -1;
-  Imagei omap3 = Imagei::ones(imageSize) * -1;
-  Imagei omap12 = Imagei::ones(imageSize) * -1;
-  Imagei omap21 = Imagei::ones(imageSize) * -1;
-  Imagei omap10 = Imagei::ones(imageSize) * -1;
-  Imagei omap01 = Imagei::ones(imageSize) * -1;
-  Imagei omap02 = Imagei::ones(imageSize) * -1;
-  Imagei omap20 = Imagei::ones(imageSize) * -1;
-  myfillPoly(omap12, lineextimg[1][2][0], 0);
-  myfillPoly(omap12, lineextimg[1][2][1], 0);
-  myfillPoly(omap21, lineextimg[2][1][0], 0);
-  myfillPoly(omap21, lineextimg[2][1][1], 0);
-  myfillPoly(omap10, lineextimg[1][0][0], 2);
-  myfillPoly(omap10, lineextimg[1][0][1], 2);
-  myfillPoly(omap01, lineextimg[0][1][0], 2);
-  myfillPoly(omap01, lineextimg[0][1][1], 2);
-  myfillPoly(omap20, lineextimg[2][0][0], 1);
-  myfillPoly(omap20, lineextimg[2][0][1], 1);
-  myfillPoly(omap02, lineextimg[0][2][0], 1);
-  myfillPoly(omap02, lineextimg[0][2][1], 1);
-
-  for (int j = 0; j < imageSize.height; j++) {
-    for (int i = 0; i < imageSize.width; i++) {
-      if (omap12[j][i] == 0 && omap21[j][i] == 0) {
-        omap1[j][i] = 0;
-      }
-    }
-  }
-  for (int j = 0; j < imageSize.height; j++) {
-    for (int i = 0; i < imageSize.width; i++) {
-      if (omap02[j][i] == 1 && omap20[j][i] == 1) {
-        omap3[j][i] = 1;
+  // sweep polygons of line i towards/away from vp j are stored in
+  // linePolys[i][j][0/1], lines are swept in parallel
+  size_t lnum = lines.size();
+  std::vector<std::array<std::array<std::vector<Point<int32_t, 2>>, 2>, 3>>
+      linePolys(lnum);
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    for (int i = t; i < lnum; i += concurrency) {
+      int lclass = lineClasses[i];
+      if (lclass == -1)
+        continue;
+      for (int j = 0; j < 3; j++) {
+        if (j == lclass)
+          continue;
+        Point2 Vp = vanishingPoints[j].value();
+        int orient = 3 - lclass - j;
+        linePolys[i][j][0] = getpoly(lines[i], Vp, -1, imageSize, ls[orient]);
+        linePolys[i][j][1] = getpoly(lines[i], Vp, 1, imageSize, ls[orient]);
       }
     }
-  }
-  for (int j = 0; j < imageSize.height; j++) {
-    for (int i = 0; i < imageSize.width; i++) {
-      if (omap10[j][i] == 2 && omap01[j][i] == 2) {
-        omap2[j][i] = 2;
-      }
+  });
+
+  // masks[lclass][j] covers pixels swept by lines of lclass along vp j
+  Imageub masks[3][3];
+  std::vector<std::pair<int, int>> maskIds = {{1, 2}, {2, 1}, {1, 0},
+                                              {0, 1}, {2, 0}, {0, 2}};
+  ParallelRun(maskIds.size(), maskIds.size(), [&](int m) {
+    int lclass = maskIds[m].first, j = maskIds[m].second;
+    Imageub &mask = masks[lclass][j];
+    mask = Imageub::zeros(imageSize);
+    for (int i = 0; i < lnum; i++) {
+      if (lineClasses[i] != lclass)
+        continue;
+      cv::fillConvexPoly(mask, linePolys[i][j][0], 1);
+      cv::fillConvexPoly(mask, linePolys[i][j][1], 1);
     }
-  }
+  });
 
-  Image3d omapImage1 = Image3d::zeros(omap.size());
-  Image3d omapImage2 = Image3d::zeros(omap.size());
-  Image3d omapImage3 = Image3d::zeros(omap.size());
-
-  for (int x = 0; x < omap.cols; x++) {
-    for (int y = 0; y < omap.rows; y++) {
-      Vec3 color(0, 0, 0);
-      int omapValue = omap1(y, x);
-      if (omapValue >= 0 && omapValue < 3)
-        color[omapValue] = 255;
-      omapImage1(y, x) = color;
-    }
-  }
-  for (int x = 0; x < omap.cols; x++) {
-    for (int y = 0; y < omap.rows; y++) {
-      Vec3 color(0, 0, 0);
-      int omapValue = omap2(y, x);
-      if (omapValue >= 0 && omapValue < 3)
-        color[omapValue] = 255;
-      omapImage2(y, x) = color;
-    }
-  }
-  for (int x = 0; x < omap.cols; x++) {
-    for (int y = 0; y < omap.rows; y++) {
-      Vec3 color(0, 0, 0);
-      int omapValue = omap3(y, x);
-      if (omapValue >= 0 && omapValue < 3)
-        color[omapValue] = 255;
-      omapImage3(y, x) = color;
-    }
-  }
-  // cv::imshow("Orientation Map1", omapImage1);
-  // cv::imshow("Orientation Map2", omapImage2);
-  // cv::imshow("Orientation Map3", omapImage3);
-  // cv::waitKey();
-  for (int j = 0; j < imageSize.height; j++) {
-    for (int i = 0; i < imageSize.width; i++) {
-      if (omap1[j][i] == 0 && omap2[j][i] == -1 && omap3[j][i] == -1) {
-        omap[j][i] = 0;
-      }
-      if (omap1[j][i] == -1 && omap2[j][i] == 2 && omap3[j][i] == -1) {
-        omap[j][i] = 2;
-      }
-      if (omap1[j][i] == -1 && omap2[j][i] == -1 && omap3[j][i] == 1) {
-        omap[j][i] = 1;
+  // a pixel gets a label iff it is swept by exactly one pair of orientations
+  // fill with -1 as default
+  Imagei omap = Imagei::ones(imageSize) * -1;
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    for (int y = t; y < imageSize.height; y += concurrency) {
+      for (int x = 0; x < imageSize.width; x++) {
+        bool a0 = masks[1][2](y, x) && masks[2][1](y, x);
+        bool a1 = masks[0][2](y, x) && masks[2][0](y, x);
+        bool a2 = masks[1][0](y, x) && masks[0][1](y, x);
+        if (a0 && !a1 && !a2) {
+          omap(y, x) = 0;
+        } else if (!a0 && a1 && !a2) {
+          omap(y, x) = 1;
+        } else if (!a0 && !a1 && a2) {
+          omap(y, x) = 2;
+        }
       }
     }
-  }
-
-  // Imagei ao23 = (lineextimg[1][2][0] | lineextimg[1][2][1]);
-  // Imagei ao32 = (lineextimg[2][1][0] | lineextimg[2][1][1]);
-  // Imagei ao13 = (lineextimg[0][2][0] | lineextimg[0][2][1]);
-  // Imagei ao31 = (lineextimg[2][0][0] | lineextimg[2][0][1]);
-  // Imagei ao12 = (lineextimg[0][1][0] | lineextimg[0][1][1]);
-  // Imagei ao21 = (lineextimg[1][0][0] | lineextimg[1][0][1]);
-  // Imagei aa23 = (lineextimg[1][2][0] & lineextimg[1][2][1]);
-  // Imagei aa32 = (lineextimg[2][1][0] & lineextimg[2][1][1]);
-  // Imagei aa13 = (lineextimg[0][2][0] & lineextimg[0][2][1]);
-  // Imagei aa31 = (lineextimg[2][0][0] & lineextimg[2][0][1]);
-  // Imagei aa12 = (lineextimg[0][1][0] & lineextimg[0][1][1]);
-  // Imagei aa21 = (lineextimg[1][0][0] & lineextimg[1][0][1]);
-  //
-  //
-  //
-  // Imagei Aa1  = ao23 & ao32;
-  // Imagei Aa2 = ao13 & ao31;
-  // Imagei Aa3  = ao12 & ao21;
-
-  // Imagei b1  = Aa1 &~Aa2 &~Aa3;
-  // Imagei b2 = ~Aa1 &Aa2 &~Aa3;
-  // Imagei b3 = ~Aa1 &~Aa2 &Aa3;
-
-  ////omap = cat(3, b{ 1 }, b{ 2 }, b{ 3 });
-
-  // Imagei testmap = Imagei::ones(imageSize) * -1;
-  // std::vector<std::vector<Point<int32_t, 2>>> polys = {
-  //	{
-  //	{ 0, 0 },
-  //	{ 20, 100 },
-  //	{ 50, 100 },
-  //	{ 150, 20 }
-  //},
-  //{
-  //	{ 0, 15 },
-  //	{ 20, 100 },
-  //	{ 50, 100 },
-  //	{ 150, 20 }
-  //} };
-  //// fill with 1
-  // myfillPoly(testmap, polys, 1);
-  // Image3d testmapImage = Image3d::zeros(omap.size());
-  // for (int x = 0; x < omap.cols; x++) {
-  //	for (int y = 0; y < omap.rows; y++) {
-  //		Vec3 color(0, 0, 0);
-  //		int omapValue = testmap(y, x);
-  //		if (omapValue >= 0 && omapValue < 3)
-  //			color[omapValue] = 255;
-  //		testmapImage(y, x) = color;
-  //	}
-  //}
-  // cv::imshow("Orientation Map test", testmapImage);
+  });
 
   return omap;
 }
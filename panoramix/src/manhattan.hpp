@@ -1,6 +1,7 @@
 #pragma once
 
 #include "basic_types.hpp"
+#include "clock.hpp"
 
 namespace pano {
 namespace core {
@@ -26,9 +27,12 @@ std::vector<Vec3> EstimateVanishingPointsAndClassifyLines(
     std::vector<std::vector<Classified<Line2>>> &lineSegments,
     std::vector<DenseMatd> *lineVPScores = nullptr);
 
+// the vps are voted by the line intersections found before the deadline, or
+// by all of them if those are too few to give orthogonal vps
 std::vector<Vec3> EstimateVanishingPointsAndClassifyLines(
     std::vector<Classified<Line3>> &lines, DenseMatd *lineVPScores = nullptr,
-    bool dontClassifyUmbiguiousLines = false);
+    bool dontClassifyUmbiguiousLines = false,
+    const misc::Deadline &deadline = misc::Deadline());
 
 // [vert, horiz1, horiz2, other]
 std::vector<int> OrderVanishingPoints(std::vector<Vec3> &vps,
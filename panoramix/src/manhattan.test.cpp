@@ -8,6 +8,155 @@
 
 using namespace pano;
 
+namespace {
+// the former orientation map extraction, which sweeps each line against every
+// sample of the orthogonal lines with a polygon growing by the samples
+using core::Point2;
+using core::Line2;
+
+std::vector<Point2> SampleLinesOfClass(const std::vector<Line2> &lines,
+                                       const std::vector<int> &lineClasses,
+                                       int claz) {
+  std::vector<Point2> samples;
+  for (int i = 0; i < lines.size(); i++) {
+    if (lineClasses[i] != claz)
+      continue;
+    int n = ceil(cv::norm(lines[i].first - lines[i].second) / 10);
+    Point2 eps = (lines[i].first - lines[i].second) / double(n);
+    Point2 curr = lines[i].second;
+    for (int j = 0; j < n; j++) {
+      samples.push_back(curr);
+      curr = curr + eps;
+    }
+  }
+  return samples;
+}
+
+Point2 MoveTowardsVP(Point2 curp1, Point2 curp2, Point2 vp, int amount,
+                     bool &atvp, Point2 &newp2) {
+  Point2 vec1 = curp1 - vp, vec2 = curp2 - vp;
+  double len1 = sqrt(vec1[0] * vec1[0] + vec1[1] * vec1[1]);
+  double len2 = sqrt(vec2[0] * vec2[0] + vec2[1] * vec2[1]);
+  Point2 norm1(vec1[0] / len1 * amount, vec1[1] / len1 * amount);
+  double ratio21 = len2 / len1;
+  Point2 norm2(vec2[0] / len2 * amount * ratio21,
+               vec2[1] / len2 * amount * ratio21);
+  if (len1 < abs(amount)) {
+    atvp = true;
+    newp2 = curp2;
+    return curp1;
+  }
+  atvp = false;
+  newp2 = curp2 + norm2;
+  return curp1 + norm1;
+}
+
+std::vector<core::Point<int32_t, 2>>
+SweepPolygon(const Line2 &line, const Point2 &vp, int toAway,
+             const cv::Size &imageSize, const std::vector<Point2> &samples) {
+  cv::Point2f p1(line.first[0], line.first[1]);
+  cv::Point2f p2(line.second[0], line.second[1]);
+  cv::Point2f curp1 = p1, curp2 = p2;
+  int moveAmount = 64;
+  while (moveAmount >= 1) {
+    bool atvp = false;
+    Point2 hnewp2;
+    Point2 hnewp1 = MoveTowardsVP(Point2(curp1.x, curp1.y),
+                                  Point2(curp2.x, curp2.y), vp,
+                                  toAway * moveAmount, atvp, hnewp2);
+    cv::Point2f newp1(hnewp1[0], hnewp1[1]), newp2(hnewp2[0], hnewp2[1]);
+    bool failed = false;
+    if (atvp) {
+      failed = true;
+    } else if (hnewp1[0] > imageSize.width || hnewp1[0] < 1 ||
+               hnewp1[1] > imageSize.height || hnewp1[1] < 1 ||
+               hnewp2[0] > imageSize.width || hnewp2[0] < 1 ||
+               hnewp2[1] > imageSize.height || hnewp2[1] < 1) {
+      failed = true;
+    } else {
+      std::vector<cv::Point2f> poly = {p1, p2};
+      for (auto &s : samples) {
+        poly.push_back(newp2);
+        poly.push_back(newp1);
+        poly.push_back(p1);
+        if (cv::pointPolygonTest(poly, cv::Point2f(s[0], s[1]), false) > 0) {
+          failed = true;
+          break;
+        }
+      }
+    }
+    if (failed) {
+      moveAmount = moveAmount / 2;
+    } else {
+      curp1 = newp1;
+      curp2 = newp2;
+    }
+  }
+  std::vector<core::Point<int32_t, 2>> result(4);
+  cv::Point2f corners[] = {p1, p2, curp2, curp1};
+  for (int i = 0; i < 4; i++) {
+    result[i][0] = corners[i].x;
+    result[i][1] = corners[i].y;
+  }
+  return result;
+}
+
+core::Imagei ComputeOrientationMapsBySweep(
+    const std::vector<core::Classified<Line2>> &classifiedLines,
+    const std::vector<core::HPoint2> &vps, const core::Sizei &imageSize) {
+  std::vector<Line2> lines;
+  std::vector<int> lineClasses;
+  for (auto &l : classifiedLines) {
+    if (l.claz == -1 || l.claz >= 3)
+      continue;
+    lines.push_back(l.component);
+    lineClasses.push_back(l.claz);
+  }
+  std::vector<Point2> samples[3];
+  for (int k = 0; k < 3; k++) {
+    samples[k] = SampleLinesOfClass(lines, lineClasses, k);
+  }
+  // swept[lclass][j] is 1 where a line of lclass swept towards or away from
+  // vp j
+  core::Imagei swept[3][3];
+  for (int lclass = 0; lclass < 3; lclass++) {
+    for (int j = 0; j < 3; j++) {
+      swept[lclass][j] = core::Imagei::zeros(imageSize);
+    }
+  }
+  for (int i = 0; i < lines.size(); i++) {
+    int lclass = lineClasses[i];
+    for (int j = 0; j < 3; j++) {
+      if (j == lclass)
+        continue;
+      int orient = 3 - lclass - j;
+      for (int toAway : {-1, 1}) {
+        cv::fillConvexPoly(swept[lclass][j],
+                           SweepPolygon(lines[i], vps[j].value(), toAway,
+                                        imageSize, samples[orient]),
+                           1);
+      }
+    }
+  }
+  core::Imagei omap = core::Imagei::ones(imageSize) * -1;
+  for (int y = 0; y < imageSize.height; y++) {
+    for (int x = 0; x < imageSize.width; x++) {
+      bool a0 = swept[1][2](y, x) && swept[2][1](y, x);
+      bool a1 = swept[0][2](y, x) && swept[2][0](y, x);
+      bool a2 = swept[1][0](y, x) && swept[0][1](y, x);
+      if (a0 && !a1 && !a2) {
+        omap(y, x) = 0;
+      } else if (!a0 && a1 && !a2) {
+        omap(y, x) = 1;
+      } else if (!a0 && !a1 && a2) {
+        omap(y, x) = 2;
+      }
+    }
+  }
+  return omap;
+}
+}
+
 TEST(ManhattanTest, VanishingPointsDetector) {
   auto imNames = {PANORAMIX_TEST_DATA_DIR_STR "/indoor_persp1.jpg",
                   PANORAMIX_TEST_DATA_DIR_STR "/indoor_persp2.jpg"};
@@ -152,4 +301,35 @@ TEST(ManhattanTest, LocalManhattanVanishingPointDetector) {
   }
 
   viz.show();
-}
\ No newline at end of file
+}
+TEST(ManhattanTest, OrientationMapsSameAsSweep) {
+  // lines towards the vps of a perspective room at random positions
+  core::Sizei size(640, 480);
+  std::vector<core::HPoint2> vps = {
+      core::HPoint2(core::Point2(1900, 260), 1.0),
+      core::HPoint2(core::Point2(-1300, 220), 1.0),
+      core::HPoint2(core::Point2(300, 4200), 1.0)};
+  std::default_random_engine rng(0);
+  std::uniform_real_distribution<double> ux(0, size.width), uy(0, size.height),
+      ulen(15, 90);
+  std::vector<core::Classified<core::Line2>> lines;
+  for (int i = 0; i < 150; i++) {
+    int claz = i % 3;
+    double x = ux(rng);
+    double y = uy(rng);
+    core::Point2 p(x, y);
+    core::Vec2 dir = core::normalize(vps[claz].value() - p);
+    lines.push_back(
+        core::ClassifyAs(core::Line2(p, p + dir * ulen(rng)), claz));
+  }
+  lines.push_back(core::ClassifyAs(
+      core::Line2(core::Point2(10, 10), core::Point2(60, 30)), -1));
+
+  core::Imagei omap = core::ComputeOrientationMaps(lines, vps, size);
+  core::Imagei expected = ComputeOrientationMapsBySweep(lines, vps, size);
+  ASSERT_EQ(omap.size(), expected.size());
+  EXPECT_EQ(cv::countNonZero(omap != expected), 0);
+  for (int label = 0; label < 3; label++) {
+    EXPECT_GT(cv::countNonZero(expected == label), 0) << label;
+  }
+}
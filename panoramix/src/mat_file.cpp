@@ -0,0 +1,762 @@
+#include "pch.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "mat_file.hpp"
+
+namespace pano {
+namespace misc {
+
+namespace {
+
+inline bool IsLittleEndianHost() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+}
+
+size_t ElementSizeOfType(MatArray::Type type) {
+  switch (type) {
+  case MatArray::Double:
+  case MatArray::Int64:
+  case MatArray::UInt64:
+    return 8;
+  case MatArray::Single:
+  case MatArray::Int32:
+  case MatArray::UInt32:
+    return 4;
+  case MatArray::Int16:
+  case MatArray::UInt16:
+  case MatArray::Char:
+    return 2;
+  case MatArray::Int8:
+  case MatArray::UInt8:
+  case MatArray::Logical:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+MatArray::Type TypeOfCVDepth(int depth) {
+  switch (depth) {
+  case CV_8U:
+    return MatArray::UInt8;
+  case CV_8S:
+    return MatArray::Int8;
+  case CV_16U:
+    return MatArray::UInt16;
+  case CV_16S:
+    return MatArray::Int16;
+  case CV_32S:
+    return MatArray::Int32;
+  case CV_32F:
+    return MatArray::Single;
+  case CV_64F:
+    return MatArray::Double;
+  default:
+    throw std::invalid_argument("this cv depth type has no matlab class");
+  }
+}
+
+void AppendBytes(std::vector<uint8_t> &out, const void *data, size_t n) {
+  auto p = static_cast<const uint8_t *>(data);
+  out.insert(out.end(), p, p + n);
+}
+
+template <class T> void AppendLE(std::vector<uint8_t> &out, T v) {
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+  }
+}
+
+//// checksums and deflate
+
+uint32_t Crc32(const uint8_t *data, size_t n) {
+  static const auto table = []() {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < n; i++) {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+uint32_t Adler32(const uint8_t *data, size_t n) {
+  const uint32_t mod = 65521;
+  uint32_t a = 1, b = 0;
+  while (n > 0) {
+    // 5552 is the largest block that cannot overflow b
+    size_t block = std::min<size_t>(n, 5552);
+    n -= block;
+    while (block--) {
+      a += *data++;
+      b += a;
+    }
+    a %= mod;
+    b %= mod;
+  }
+  return (b << 16) | a;
+}
+
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<uint8_t> &out)
+      : _out(out), _bits(0), _nbits(0) {}
+  void put(uint32_t bits, int n) {
+    _bits |= bits << _nbits;
+    _nbits += n;
+    while (_nbits >= 8) {
+      _out.push_back(static_cast<uint8_t>(_bits));
+      _bits >>= 8;
+      _nbits -= 8;
+    }
+  }
+  // huffman codes are packed starting from their most significant bit
+  void putCode(uint32_t code, int n) {
+    uint32_t r = 0;
+    for (int i = 0; i < n; i++) {
+      r = (r << 1) | ((code >> i) & 1);
+    }
+    put(r, n);
+  }
+  void flush() {
+    if (_nbits > 0) {
+      _out.push_back(static_cast<uint8_t>(_bits));
+    }
+    _bits = 0;
+    _nbits = 0;
+  }
+
+private:
+  std::vector<uint8_t> &_out;
+  uint32_t _bits;
+  int _nbits;
+};
+
+// the fixed literal/length code of RFC 1951
+void PutFixedSymbol(BitWriter &w, int sym) {
+  if (sym < 144) {
+    w.putCode(0x30 + sym, 8);
+  } else if (sym < 256) {
+    w.putCode(0x190 + sym - 144, 9);
+  } else if (sym < 280) {
+    w.putCode(sym - 256, 7);
+  } else {
+    w.putCode(0xC0 + sym - 280, 8);
+  }
+}
+
+void PutMatch(BitWriter &w, int length, int distance) {
+  static const int lengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                     11, 13, 15, 17,  19,  23,  27,  31,
+                                     35, 43, 51, 59,  67,  83,  99,  115,
+                                     131, 163, 195, 227, 258};
+  static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                      1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                      4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static const int distBase[30] = {
+      1,    2,    3,    4,    5,    7,     9,     13,    17,   25,
+      33,   49,   65,   97,   129,  193,   257,   385,   513,  769,
+      1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+  static const int distExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+  int l = static_cast<int>(std::upper_bound(lengthBase, lengthBase + 29,
+                                            length) -
+                           lengthBase) -
+          1;
+  PutFixedSymbol(w, 257 + l);
+  w.put(length - lengthBase[l], lengthExtra[l]);
+  int d = static_cast<int>(std::upper_bound(distBase, distBase + 30,
+                                            distance) -
+                           distBase) -
+          1;
+  w.putCode(d, 5);
+  w.put(distance - distBase[d], distExtra[d]);
+}
+
+// a single fixed huffman block with greedy hash chain matching, the ratio
+// is below zlib's but the large constant regions of our maps compress well
+void Deflate(const uint8_t *data, size_t n, std::vector<uint8_t> &out) {
+  const int windowSize = 1 << 15;
+  const int hashBits = 15;
+  const int minMatch = 3;
+  const int maxMatch = 258;
+  const int maxChain = 32;
+
+  BitWriter w(out);
+  w.put(1, 1); // final block
+  w.put(1, 2); // fixed huffman codes
+
+  std::vector<int64_t> head(1 << hashBits, -1);
+  std::vector<int64_t> prev(windowSize, -1);
+  auto hash = [data](size_t i) {
+    uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+    return (v * 2654435761u) >> (32 - hashBits);
+  };
+  auto insert = [&](size_t i) {
+    if (i + minMatch <= n) {
+      auto h = hash(i);
+      prev[i & (windowSize - 1)] = head[h];
+      head[h] = i;
+    }
+  };
+
+  size_t i = 0;
+  while (i < n) {
+    int bestLength = 0;
+    int64_t bestDistance = 0;
+    if (i + minMatch <= n) {
+      int limit = static_cast<int>(std::min<size_t>(maxMatch, n - i));
+      int64_t j = head[hash(i)];
+      for (int chain = 0; chain < maxChain && j >= 0 &&
+                          static_cast<int64_t>(i) - j < windowSize;
+           chain++) {
+        if (data[j + bestLength] == data[i + bestLength]) {
+          int len = 0;
+          while (len < limit && data[j + len] == data[i + len]) {
+            len++;
+          }
+          if (len > bestLength) {
+            bestLength = len;
+            bestDistance = i - j;
+            if (len == limit) {
+              break;
+            }
+          }
+        }
+        j = prev[j & (windowSize - 1)];
+      }
+    }
+    if (bestLength >= minMatch) {
+      PutMatch(w, bestLength, static_cast<int>(bestDistance));
+      for (int k = 0; k < bestLength; k++) {
+        insert(i + k);
+      }
+      i += bestLength;
+    } else {
+      PutFixedSymbol(w, data[i]);
+      insert(i);
+      i++;
+    }
+  }
+  PutFixedSymbol(w, 256);
+  w.flush();
+}
+
+void ZlibCompress(const std::vector<uint8_t> &data, std::vector<uint8_t> &out) {
+  out.push_back(0x78);
+  out.push_back(0x01);
+  Deflate(data.data(), data.size(), out);
+  uint32_t adler = Adler32(data.data(), data.size());
+  for (int i = 3; i >= 0; i--) {
+    out.push_back(static_cast<uint8_t>(adler >> (8 * i)));
+  }
+}
+
+//// MAT v5
+
+enum MatDataType : uint32_t {
+  miINT8 = 1,
+  miUINT8 = 2,
+  miINT16 = 3,
+  miUINT16 = 4,
+  miINT32 = 5,
+  miUINT32 = 6,
+  miSINGLE = 7,
+  miDOUBLE = 9,
+  miINT64 = 12,
+  miUINT64 = 13,
+  miMATRIX = 14,
+  miCOMPRESSED = 15
+};
+
+enum MatClass : uint8_t {
+  mxCELL = 1,
+  mxSTRUCT = 2,
+  mxCHAR = 4,
+  mxSPARSE = 5,
+  mxDOUBLE = 6,
+  mxSINGLE = 7,
+  mxINT8 = 8,
+  mxUINT8 = 9,
+  mxINT16 = 10,
+  mxUINT16 = 11,
+  mxINT32 = 12,
+  mxUINT32 = 13,
+  mxINT64 = 14,
+  mxUINT64 = 15
+};
+
+// numbers are written in host order, the header tells readers which it is
+template <class T> void AppendNative(std::vector<uint8_t> &out, T v) {
+  AppendBytes(out, &v, sizeof(T));
+}
+
+void AppendElement(std::vector<uint8_t> &out, MatDataType type,
+                   const void *data, size_t n) {
+  AppendNative<uint32_t>(out, type);
+  AppendNative<uint32_t>(out, static_cast<uint32_t>(n));
+  AppendBytes(out, data, n);
+  out.resize((out.size() + 7) / 8 * 8, 0);
+}
+
+void AppendMatrix(std::vector<uint8_t> &out, const std::string &name,
+                  const MatArray &a) {
+  static const MatDataType dataTypes[] = {
+      miDOUBLE, miSINGLE, miINT8,  miUINT8,  miINT16, miUINT16,
+      miINT32,  miUINT32, miINT64, miUINT64, miUINT8, miUINT16};
+  static const MatClass classes[] = {
+      mxDOUBLE, mxSINGLE, mxINT8,  mxUINT8,  mxINT16, mxUINT16,
+      mxINT32,  mxUINT32, mxINT64, mxUINT64, mxUINT8, mxCHAR,
+      mxSPARSE, mxCELL,   mxSTRUCT};
+
+  size_t tagPos = out.size();
+  AppendNative<uint32_t>(out, miMATRIX);
+  AppendNative<uint32_t>(out, 0); // patched below
+
+  uint32_t flags[2] = {classes[a.type()], 0};
+  if (a.isLogical()) {
+    flags[0] |= 0x02 << 8;
+  }
+  if (a.isSparse()) {
+    flags[1] = static_cast<uint32_t>(std::max<size_t>(a.nzmax(), 1));
+  }
+  AppendElement(out, miUINT32, flags, sizeof(flags));
+
+  std::vector<int32_t> dims(a.dims().begin(), a.dims().end());
+  AppendElement(out, miINT32, dims.data(), dims.size() * sizeof(int32_t));
+  AppendElement(out, miINT8, name.data(), name.size());
+
+  if (a.isNumeric() || a.isLogical() || a.isChar()) {
+    AppendElement(out, dataTypes[a.type()], a.data(), a.nbytes());
+  } else if (a.isSparse()) {
+    AppendElement(out, miINT32, a.rowIndices().data(),
+                  a.rowIndices().size() * sizeof(int32_t));
+    AppendElement(out, miINT32, a.colStarts().data(),
+                  a.colStarts().size() * sizeof(int32_t));
+    AppendElement(out, miDOUBLE, a.sparseValues().data(),
+                  a.sparseValues().size() * sizeof(double));
+  } else if (a.isCell()) {
+    for (size_t i = 0; i < a.nelements(); i++) {
+      AppendMatrix(out, std::string(), a.cell(i));
+    }
+  } else if (a.isStruct()) {
+    size_t nameLength = 1;
+    for (auto &f : a.fieldNames()) {
+      nameLength = std::max(nameLength, f.size() + 1);
+    }
+    int32_t len = static_cast<int32_t>(nameLength);
+    AppendElement(out, miINT32, &len, sizeof(len));
+    std::vector<char> names(nameLength * a.fieldNames().size(), 0);
+    for (int f = 0; f < a.fieldNames().size(); f++) {
+      std::copy(a.fieldNames()[f].begin(), a.fieldNames()[f].end(),
+                names.begin() + f * nameLength);
+    }
+    AppendElement(out, miINT8, names.data(), names.size());
+    for (size_t i = 0; i < a.nelements(); i++) {
+      for (auto &f : a.fieldNames()) {
+        AppendMatrix(out, std::string(), a.field(f, i));
+      }
+    }
+  }
+
+  uint32_t nbytes = static_cast<uint32_t>(out.size() - tagPos - 8);
+  std::memcpy(out.data() + tagPos + 4, &nbytes, sizeof(nbytes));
+}
+
+//// NPY
+
+std::string NpyDescr(const MatArray &a) {
+  std::string order = IsLittleEndianHost() ? "<" : ">";
+  switch (a.type()) {
+  case MatArray::Double:
+    return order + "f8";
+  case MatArray::Single:
+    return order + "f4";
+  case MatArray::Int8:
+    return "|i1";
+  case MatArray::UInt8:
+    return "|u1";
+  case MatArray::Int16:
+    return order + "i2";
+  case MatArray::UInt16:
+  case MatArray::Char:
+    return order + "u2";
+  case MatArray::Int32:
+    return order + "i4";
+  case MatArray::UInt32:
+    return order + "u4";
+  case MatArray::Int64:
+    return order + "i8";
+  case MatArray::UInt64:
+    return order + "u8";
+  case MatArray::Logical:
+    return "|b1";
+  default:
+    return std::string();
+  }
+}
+
+bool MakeNpy(const MatArray &a, std::vector<uint8_t> &npy) {
+  if (!a.isNumeric() && !a.isLogical() && !a.isChar()) {
+    return false;
+  }
+  std::ostringstream dict;
+  dict << "{'descr': '" << NpyDescr(a) << "', 'fortran_order': True, "
+       << "'shape': (";
+  for (int i = 0; i < a.dims().size(); i++) {
+    dict << (i == 0 ? "" : ", ") << a.dims()[i];
+  }
+  dict << (a.dims().size() == 1 ? ",), }" : "), }");
+  std::string header = dict.str();
+  // magic, version and length take 10 bytes, keep the data 64 aligned
+  size_t total = (10 + header.size() + 1 + 63) / 64 * 64;
+  header.resize(total - 10 - 1, ' ');
+  header.push_back('\n');
+
+  npy.clear();
+  npy.reserve(total + a.nbytes());
+  AppendBytes(npy, "\x93NUMPY\x01\x00", 8);
+  AppendLE<uint16_t>(npy, static_cast<uint16_t>(header.size()));
+  AppendBytes(npy, header.data(), header.size());
+  AppendBytes(npy, a.data(), a.nbytes());
+  return true;
+}
+}
+
+//// MatArray
+
+MatArray::MatArray(double scalar)
+    : _type(Double), _dims({1, 1}), _data(sizeof(double)) {
+  std::memcpy(_data.data(), &scalar, sizeof(double));
+}
+
+MatArray::MatArray(int scalar) : MatArray(static_cast<double>(scalar)) {}
+
+MatArray::MatArray(bool scalar)
+    : _type(Logical), _dims({1, 1}), _data(1, scalar ? 1 : 0) {}
+
+MatArray::MatArray(const std::string &str)
+    : _type(Char), _dims({str.empty() ? 0u : 1u, str.size()}),
+      _data(str.size() * sizeof(uint16_t)) {
+  auto d = reinterpret_cast<uint16_t *>(_data.data());
+  for (size_t i = 0; i < str.size(); i++) {
+    d[i] = static_cast<uint8_t>(str[i]);
+  }
+}
+
+MatArray::MatArray(const cv::Mat &m) : _type(TypeOfCVDepth(m.depth())) {
+  int channels = m.channels();
+  for (int i = 0; i < m.dims; i++) {
+    _dims.push_back(m.size[i]);
+  }
+  _dims.push_back(channels);
+  while (_dims.size() > 2 && _dims.back() == 1) {
+    _dims.pop_back();
+  }
+
+  size_t esz = m.elemSize1();
+  _data.resize(m.total() * channels * esz);
+
+  // walk the mat in row major order and scatter into column major order
+  std::vector<size_t> colMajorSteps(m.dims + 1);
+  size_t step = 1;
+  for (int i = 0; i < m.dims; i++) {
+    colMajorSteps[i] = step;
+    step *= m.size[i];
+  }
+  colMajorSteps[m.dims] = step;
+
+  std::vector<int> idx(m.dims, 0);
+  const size_t total = m.total();
+  for (size_t k = 0; k < total; k++) {
+    const uint8_t *src = m.ptr(idx.data());
+    size_t offset = 0;
+    for (int i = 0; i < m.dims; i++) {
+      offset += idx[i] * colMajorSteps[i];
+    }
+    for (int c = 0; c < channels; c++) {
+      std::memcpy(_data.data() + (offset + c * colMajorSteps[m.dims]) * esz,
+                  src + c * esz, esz);
+    }
+    for (int i = m.dims - 1; i >= 0; i--) {
+      if (++idx[i] < m.size[i]) {
+        break;
+      }
+      idx[i] = 0;
+    }
+  }
+}
+
+MatArray MatArray::createNumeric(Type type, const std::vector<size_t> &dims) {
+  assert(type <= Char);
+  MatArray a;
+  a._type = type;
+  a._dims = dims;
+  a._data.resize(a.nelements() * ElementSizeOfType(type), 0);
+  return a;
+}
+
+MatArray MatArray::createCellMatrix(size_t m, size_t n) {
+  MatArray a;
+  a._type = Cell;
+  a._dims = {m, n};
+  a._elements.resize(m * n);
+  return a;
+}
+
+MatArray
+MatArray::createStructMatrix(size_t m, size_t n,
+                             const std::vector<std::string> &fieldNames) {
+  MatArray a;
+  a._type = Struct;
+  a._dims = {m, n};
+  a._fieldNames = fieldNames;
+  a._elements.resize(m * n * fieldNames.size());
+  return a;
+}
+
+size_t MatArray::nelements() const {
+  size_t n = 1;
+  for (size_t d : _dims) {
+    n *= d;
+  }
+  return n;
+}
+
+size_t MatArray::elementSize() const { return ElementSizeOfType(_type); }
+
+void MatArray::setCell(size_t i, MatArray a) {
+  assert(isCell());
+  _elements.at(i) = std::move(a);
+}
+
+int MatArray::fieldNumber(const std::string &name) const {
+  auto it = std::find(_fieldNames.begin(), _fieldNames.end(), name);
+  return it == _fieldNames.end() ? -1 : int(it - _fieldNames.begin());
+}
+
+const MatArray &MatArray::field(const std::string &name, size_t i) const {
+  int f = fieldNumber(name);
+  if (f == -1) {
+    throw std::invalid_argument("no such field: " + name);
+  }
+  return _elements.at(i * _fieldNames.size() + f);
+}
+
+void MatArray::setField(const std::string &name, size_t i, MatArray a) {
+  assert(isStruct());
+  int f = fieldNumber(name);
+  if (f == -1) {
+    throw std::invalid_argument("no such field: " + name);
+  }
+  _elements.at(i * _fieldNames.size() + f) = std::move(a);
+}
+
+//// MatWriter
+
+MatWriter::MatWriter(const std::string &fileName, bool compressed)
+    : _ofs(std::make_unique<std::ofstream>(fileName, std::ios::binary)),
+      _compressed(compressed) {
+  if (!*_ofs) {
+    _ofs.reset();
+    return;
+  }
+  std::time_t now = std::time(nullptr);
+  char text[116];
+  std::memset(text, ' ', sizeof(text));
+  std::string desc = "MATLAB 5.0 MAT-file, Created by: panoramix, "
+                     "Created on: " +
+                     std::string(std::ctime(&now));
+  desc.pop_back(); // ctime ends with a newline
+  std::memcpy(text, desc.data(), std::min(desc.size(), sizeof(text)));
+
+  std::vector<uint8_t> header;
+  AppendBytes(header, text, sizeof(text));
+  header.resize(124, 0); // no subsystem data
+  AppendNative<uint16_t>(header, 0x0100);
+  AppendNative<uint16_t>(header, ('M' << 8) | 'I');
+  _ofs->write(reinterpret_cast<const char *>(header.data()), header.size());
+}
+
+MatWriter::~MatWriter() {}
+
+bool MatWriter::null() const { return !_ofs || !*_ofs; }
+
+bool MatWriter::setVar(const std::string &name, const MatArray &a) {
+  if (null()) {
+    return false;
+  }
+  std::vector<uint8_t> matrix;
+  AppendMatrix(matrix, name, a);
+  if (!_compressed) {
+    _ofs->write(reinterpret_cast<const char *>(matrix.data()), matrix.size());
+  } else {
+    std::vector<uint8_t> element;
+    AppendNative<uint32_t>(element, miCOMPRESSED);
+    AppendNative<uint32_t>(element, 0);
+    ZlibCompress(matrix, element);
+    uint32_t nbytes = static_cast<uint32_t>(element.size() - 8);
+    std::memcpy(element.data() + 4, &nbytes, sizeof(nbytes));
+    _ofs->write(reinterpret_cast<const char *>(element.data()),
+                element.size());
+  }
+  return !!*_ofs;
+}
+
+//// NpzWriter
+
+NpzWriter::NpzWriter(const std::string &fileName, bool compressed)
+    : _ofs(std::make_unique<std::ofstream>(fileName, std::ios::binary)),
+      _compressed(compressed) {
+  if (!*_ofs) {
+    _ofs.reset();
+  }
+}
+
+NpzWriter::~NpzWriter() {
+  if (null()) {
+    return;
+  }
+  // central directory
+  std::vector<uint8_t> cd;
+  uint32_t cdOffset = static_cast<uint32_t>(_ofs->tellp());
+  for (auto &e : _entries) {
+    AppendLE<uint32_t>(cd, 0x02014b50);
+    AppendLE<uint16_t>(cd, 20); // made by
+    AppendLE<uint16_t>(cd, 20); // needed to extract
+    AppendLE<uint16_t>(cd, 0);
+    AppendLE<uint16_t>(cd, e.method);
+    AppendLE<uint16_t>(cd, 0);      // time
+    AppendLE<uint16_t>(cd, 0x0021); // date, 1980-01-01
+    AppendLE<uint32_t>(cd, e.crc);
+    AppendLE<uint32_t>(cd, e.compressedSize);
+    AppendLE<uint32_t>(cd, e.size);
+    AppendLE<uint16_t>(cd, static_cast<uint16_t>(e.name.size()));
+    AppendLE<uint16_t>(cd, 0); // extra
+    AppendLE<uint16_t>(cd, 0); // comment
+    AppendLE<uint16_t>(cd, 0); // disk
+    AppendLE<uint16_t>(cd, 0); // internal attributes
+    AppendLE<uint32_t>(cd, 0); // external attributes
+    AppendLE<uint32_t>(cd, e.offset);
+    AppendBytes(cd, e.name.data(), e.name.size());
+  }
+  uint32_t cdSize = static_cast<uint32_t>(cd.size());
+  AppendLE<uint32_t>(cd, 0x06054b50);
+  AppendLE<uint16_t>(cd, 0);
+  AppendLE<uint16_t>(cd, 0);
+  AppendLE<uint16_t>(cd, static_cast<uint16_t>(_entries.size()));
+  AppendLE<uint16_t>(cd, static_cast<uint16_t>(_entries.size()));
+  AppendLE<uint32_t>(cd, cdSize);
+  AppendLE<uint32_t>(cd, cdOffset);
+  AppendLE<uint16_t>(cd, 0);
+  _ofs->write(reinterpret_cast<const char *>(cd.data()), cd.size());
+}
+
+bool NpzWriter::null() const { return !_ofs || !*_ofs; }
+
+bool NpzWriter::addEntry(const std::string &name,
+                         const std::vector<uint8_t> &npy) {
+  // no zip64, entries and offsets must fit in 32 bits
+  uint64_t offset = static_cast<uint64_t>(_ofs->tellp());
+  if (npy.size() > 0xFFFFFFFFu || offset > 0xFFFFFFFFu ||
+      _entries.size() >= 0xFFFF) {
+    return false;
+  }
+
+  Entry e;
+  e.name = name + ".npy";
+  e.crc = Crc32(npy.data(), npy.size());
+  e.size = static_cast<uint32_t>(npy.size());
+  e.offset = static_cast<uint32_t>(offset);
+  e.method = _compressed ? 8 : 0;
+  std::vector<uint8_t> deflated;
+  if (_compressed) {
+    Deflate(npy.data(), npy.size(), deflated);
+  }
+  const std::vector<uint8_t> &payload = _compressed ? deflated : npy;
+  e.compressedSize = static_cast<uint32_t>(payload.size());
+
+  std::vector<uint8_t> local;
+  AppendLE<uint32_t>(local, 0x04034b50);
+  AppendLE<uint16_t>(local, 20);
+  AppendLE<uint16_t>(local, 0);
+  AppendLE<uint16_t>(local, e.method);
+  AppendLE<uint16_t>(local, 0);
+  AppendLE<uint16_t>(local, 0x0021);
+  AppendLE<uint32_t>(local, e.crc);
+  AppendLE<uint32_t>(local, e.compressedSize);
+  AppendLE<uint32_t>(local, e.size);
+  AppendLE<uint16_t>(local, static_cast<uint16_t>(e.name.size()));
+  AppendLE<uint16_t>(local, 0);
+  AppendBytes(local, e.name.data(), e.name.size());
+  _ofs->write(reinterpret_cast<const char *>(local.data()), local.size());
+  _ofs->write(reinterpret_cast<const char *>(payload.data()), payload.size());
+  _entries.push_back(std::move(e));
+  return !!*_ofs;
+}
+
+bool NpzWriter::setVar(const std::string &name, const MatArray &a) {
+  if (null()) {
+    return false;
+  }
+  if (a.isCell()) {
+    bool ok = true;
+    for (size_t i = 0; i < a.nelements(); i++) {
+      ok = setVar(name + "/" + std::to_string(i), a.cell(i)) && ok;
+    }
+    return ok;
+  }
+  if (a.isStruct()) {
+    bool ok = true;
+    for (size_t i = 0; i < a.nelements(); i++) {
+      std::string prefix =
+          a.nelements() == 1 ? name : name + "/" + std::to_string(i);
+      for (auto &f : a.fieldNames()) {
+        ok = setVar(prefix + "/" + f, a.field(f, i)) && ok;
+      }
+    }
+    return ok;
+  }
+  if (a.isSparse()) {
+    auto toArray = [](const auto &v) {
+      using T = typename std::decay_t<decltype(v)>::value_type;
+      auto arr = MatArray::createNumeric(MatArray::TypeOf<T>::value,
+                                         {v.size(), 1});
+      std::memcpy(arr.data(), v.data(), v.size() * sizeof(T));
+      return arr;
+    };
+    std::vector<int64_t> shape(a.dims().begin(), a.dims().end());
+    return setVar(name + "/data", toArray(a.sparseValues())) &&
+           setVar(name + "/indices", toArray(a.rowIndices())) &&
+           setVar(name + "/indptr", toArray(a.colStarts())) &&
+           setVar(name + "/shape", toArray(shape));
+  }
+  std::vector<uint8_t> npy;
+  return MakeNpy(a, npy) && addEntry(name, npy);
+}
+
+bool SaveToNpy(const std::string &fileName, const MatArray &a) {
+  std::vector<uint8_t> npy;
+  if (!MakeNpy(a, npy)) {
+    return false;
+  }
+  std::ofstream ofs(fileName, std::ios::binary);
+  ofs.write(reinterpret_cast<const char *>(npy.data()), npy.size());
+  return !!ofs;
+}
+}
+}
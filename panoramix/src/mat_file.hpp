@@ -0,0 +1,219 @@
+#pragma once
+
+#include "basic_types.hpp"
+
+#include "eigen.hpp"
+
+namespace pano {
+namespace misc {
+
+// MatArray
+// an in-memory MATLAB value for the native file writers, numeric, logical and
+// char data are stored in column major order, sparse matrices are double
+// valued compressed columns
+class MatArray {
+public:
+  enum Type : uint8_t {
+    Double,
+    Single,
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Int64,
+    UInt64,
+    Logical,
+    Char,
+    Sparse,
+    Cell,
+    Struct
+  };
+
+  template <class T> struct TypeOf {};
+
+public:
+  MatArray() : _type(Double), _dims({0, 0}) {}
+  MatArray(double scalar);
+  MatArray(int scalar); // stored as double like MXA
+  MatArray(bool scalar);
+  MatArray(const char *str) : MatArray(std::string(str)) {}
+  MatArray(const std::string &str);
+  // rows x cols x channels, trailing singleton dimensions are dropped
+  MatArray(const cv::Mat &m);
+  template <class T, int N>
+  MatArray(const cv::Vec<T, N> &v) : MatArray(cv::Mat(v, true)) {}
+  template <class T, int M, int N, int O, int MaxM, int MaxN>
+  MatArray(const Eigen::Matrix<T, M, N, O, MaxM, MaxN> &m);
+  template <class T, int O, class IndexT>
+  MatArray(const Eigen::SparseMatrix<T, O, IndexT> &m);
+
+  static MatArray createNumeric(Type type, const std::vector<size_t> &dims);
+  static MatArray createCellMatrix(size_t m, size_t n);
+  static MatArray
+  createStructMatrix(size_t m, size_t n,
+                     const std::vector<std::string> &fieldNames);
+
+public:
+  Type type() const { return _type; }
+  bool isNumeric() const { return _type <= UInt64; }
+  bool isLogical() const { return _type == Logical; }
+  bool isChar() const { return _type == Char; }
+  bool isSparse() const { return _type == Sparse; }
+  bool isCell() const { return _type == Cell; }
+  bool isStruct() const { return _type == Struct; }
+
+  const std::vector<size_t> &dims() const { return _dims; }
+  size_t nelements() const;
+  // bytes of one element of numeric, logical and char arrays
+  size_t elementSize() const;
+
+  const uint8_t *data() const { return _data.data(); }
+  uint8_t *data() { return _data.data(); }
+  size_t nbytes() const { return _data.size(); }
+
+  // cells, column major
+  const MatArray &cell(size_t i) const { return _elements.at(i); }
+  void setCell(size_t i, MatArray a);
+
+  // structs
+  const std::vector<std::string> &fieldNames() const { return _fieldNames; }
+  int fieldNumber(const std::string &name) const;
+  const MatArray &field(const std::string &name, size_t i = 0) const;
+  void setField(const std::string &name, size_t i, MatArray a);
+
+  // sparse
+  size_t nzmax() const { return _sparseValues.size(); }
+  const std::vector<int32_t> &rowIndices() const { return _rowIndices; }
+  const std::vector<int32_t> &colStarts() const { return _colStarts; }
+  const std::vector<double> &sparseValues() const { return _sparseValues; }
+
+private:
+  Type _type;
+  std::vector<size_t> _dims;
+  std::vector<uint8_t> _data;
+  std::vector<MatArray> _elements;
+  std::vector<std::string> _fieldNames;
+  std::vector<int32_t> _rowIndices;
+  std::vector<int32_t> _colStarts;
+  std::vector<double> _sparseValues;
+};
+
+template <> struct MatArray::TypeOf<double> {
+  static constexpr Type value = Double;
+};
+template <> struct MatArray::TypeOf<float> {
+  static constexpr Type value = Single;
+};
+template <> struct MatArray::TypeOf<int8_t> {
+  static constexpr Type value = Int8;
+};
+template <> struct MatArray::TypeOf<uint8_t> {
+  static constexpr Type value = UInt8;
+};
+template <> struct MatArray::TypeOf<int16_t> {
+  static constexpr Type value = Int16;
+};
+template <> struct MatArray::TypeOf<uint16_t> {
+  static constexpr Type value = UInt16;
+};
+template <> struct MatArray::TypeOf<int32_t> {
+  static constexpr Type value = Int32;
+};
+template <> struct MatArray::TypeOf<uint32_t> {
+  static constexpr Type value = UInt32;
+};
+template <> struct MatArray::TypeOf<int64_t> {
+  static constexpr Type value = Int64;
+};
+template <> struct MatArray::TypeOf<uint64_t> {
+  static constexpr Type value = UInt64;
+};
+template <> struct MatArray::TypeOf<bool> {
+  static constexpr Type value = Logical;
+};
+
+template <class T, int M, int N, int O, int MaxM, int MaxN>
+MatArray::MatArray(const Eigen::Matrix<T, M, N, O, MaxM, MaxN> &m)
+    : _type(TypeOf<T>::value),
+      _dims({static_cast<size_t>(m.rows()), static_cast<size_t>(m.cols())}),
+      _data(m.size() * sizeof(T)) {
+  T *d = reinterpret_cast<T *>(_data.data());
+  for (int j = 0; j < m.cols(); j++) {
+    for (int i = 0; i < m.rows(); i++) {
+      *d++ = m(i, j);
+    }
+  }
+}
+
+template <class T, int O, class IndexT>
+MatArray::MatArray(const Eigen::SparseMatrix<T, O, IndexT> &m)
+    : _type(Sparse),
+      _dims({static_cast<size_t>(m.rows()), static_cast<size_t>(m.cols())}) {
+  Eigen::SparseMatrix<double, Eigen::ColMajor, int32_t> cm =
+      m.template cast<double>();
+  cm.makeCompressed();
+  _rowIndices.assign(cm.innerIndexPtr(), cm.innerIndexPtr() + cm.nonZeros());
+  _colStarts.assign(cm.outerIndexPtr(), cm.outerIndexPtr() + cm.cols() + 1);
+  _sparseValues.assign(cm.valuePtr(), cm.valuePtr() + cm.nonZeros());
+}
+
+// MatWriter
+// writes MAT-file version 5 without MATLAB, each variable is written when it
+// is set, compressed variables are zlib streams as MATLAB 7 writes them
+class MatWriter {
+public:
+  explicit MatWriter(const std::string &fileName, bool compressed = true);
+  ~MatWriter();
+
+  MatWriter(const MatWriter &) = delete;
+  MatWriter &operator=(const MatWriter &) = delete;
+
+  bool null() const;
+  bool setVar(const std::string &name, const MatArray &a);
+
+private:
+  std::unique_ptr<std::ofstream> _ofs;
+  bool _compressed;
+};
+
+// NpzWriter
+// writes numpy .npz archives, dense arrays become fortran ordered .npy
+// entries, other values are flattened into several entries:
+//  cell c           -> c/0, c/1, ...
+//  struct s         -> s/field (1x1) or s/0/field, s/1/field, ...
+//  sparse a         -> a/data, a/indices, a/indptr, a/shape (scipy csc)
+class NpzWriter {
+public:
+  explicit NpzWriter(const std::string &fileName, bool compressed = false);
+  ~NpzWriter();
+
+  NpzWriter(const NpzWriter &) = delete;
+  NpzWriter &operator=(const NpzWriter &) = delete;
+
+  bool null() const;
+  bool setVar(const std::string &name, const MatArray &a);
+
+private:
+  bool addEntry(const std::string &name, const std::vector<uint8_t> &npy);
+
+private:
+  struct Entry {
+    std::string name;
+    uint32_t crc;
+    uint32_t compressedSize;
+    uint32_t size;
+    uint32_t offset;
+    uint16_t method;
+  };
+  std::unique_ptr<std::ofstream> _ofs;
+  std::vector<Entry> _entries;
+  bool _compressed;
+};
+
+// SaveToNpy
+// only numeric, logical and char arrays can be saved as a single .npy
+bool SaveToNpy(const std::string &fileName, const MatArray &a);
+}
+}
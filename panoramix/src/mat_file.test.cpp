@@ -0,0 +1,214 @@
+#include "mat_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+namespace {
+std::string ReadAll(const std::string &fileName) {
+  std::ifstream ifs(fileName, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(ifs),
+                     std::istreambuf_iterator<char>());
+}
+
+// inflates deflate streams made of fixed huffman blocks, which is all the
+// writers emit, other blocks fail
+bool InflateFixedHuffman(const uint8_t *in, size_t n,
+                         std::vector<uint8_t> &out) {
+  static const int lengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                     11, 13, 15, 17,  19,  23,  27,  31,
+                                     35, 43, 51, 59,  67,  83,  99,  115,
+                                     131, 163, 195, 227, 258};
+  static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                      1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                      4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static const int distBase[30] = {
+      1,    2,    3,    4,    5,    7,     9,     13,    17,   25,
+      33,   49,   65,   97,   129,  193,   257,   385,   513,  769,
+      1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+  static const int distExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+  size_t pos = 0;
+  int bit = 0;
+  bool overrun = false;
+  // extra bits come least significant bit first
+  auto get = [&](int count) {
+    int v = 0;
+    for (int i = 0; i < count; i++) {
+      if (pos >= n) {
+        overrun = true;
+        return 0;
+      }
+      v |= ((in[pos] >> bit) & 1) << i;
+      if (++bit == 8) {
+        bit = 0;
+        pos++;
+      }
+    }
+    return v;
+  };
+  // huffman codes come most significant bit first
+  auto getCode = [&](int code, int count) {
+    for (int i = 0; i < count; i++) {
+      code = (code << 1) | get(1);
+    }
+    return code;
+  };
+  bool final = false;
+  while (!final && !overrun) {
+    final = get(1) == 1;
+    if (get(2) != 1) {
+      return false;
+    }
+    while (!overrun) {
+      int code = getCode(0, 7);
+      int sym;
+      if (code <= 0x17) {
+        sym = 256 + code;
+      } else {
+        code = getCode(code, 1);
+        if (code >= 0x30 && code <= 0xBF) {
+          sym = code - 0x30;
+        } else if (code >= 0xC0 && code <= 0xC7) {
+          sym = 280 + code - 0xC0;
+        } else {
+          sym = 144 + getCode(code, 1) - 0x190;
+        }
+      }
+      if (sym < 256) {
+        out.push_back(static_cast<uint8_t>(sym));
+        continue;
+      }
+      if (sym == 256) {
+        break;
+      }
+      if (sym > 285) {
+        return false;
+      }
+      int length = lengthBase[sym - 257] + get(lengthExtra[sym - 257]);
+      int d = getCode(0, 5);
+      if (d >= 30) {
+        return false;
+      }
+      size_t distance = distBase[d] + get(distExtra[d]);
+      if (distance > out.size()) {
+        return false;
+      }
+      for (int k = 0; k < length; k++) {
+        out.push_back(out[out.size() - distance]);
+      }
+    }
+  }
+  return !overrun;
+}
+}
+
+TEST(MatFile, MatArray) {
+  core::DenseMatd m(2, 3);
+  for (int i = 0; i < 6; i++) {
+    m(i / 3, i % 3) = i;
+  }
+  misc::MatArray a(m);
+  ASSERT_EQ(misc::MatArray::Double, a.type());
+  ASSERT_EQ(std::vector<size_t>({2, 3}), a.dims());
+  auto d = reinterpret_cast<const double *>(a.data());
+  // column major
+  EXPECT_EQ(std::vector<double>({0, 3, 1, 4, 2, 5}),
+            std::vector<double>(d, d + 6));
+
+  Eigen::SparseMatrix<float> sp(3, 3);
+  sp.insert(2, 1) = 1.5f;
+  misc::MatArray b(sp);
+  ASSERT_TRUE(b.isSparse());
+  EXPECT_EQ(std::vector<int32_t>({2}), b.rowIndices());
+  EXPECT_EQ(std::vector<int32_t>({0, 0, 1, 1}), b.colStarts());
+
+  auto s = misc::MatArray::createStructMatrix(1, 2, {"x", "y"});
+  s.setField("y", 1, std::string("abc"));
+  EXPECT_TRUE(s.field("y", 1).isChar());
+  EXPECT_TRUE(s.field("x", 1).dims() == std::vector<size_t>({0, 0}));
+}
+
+TEST(MatFile, Headers) {
+  Eigen::MatrixXd e = Eigen::MatrixXd::Random(20, 30);
+  {
+    misc::MatWriter mat("mat_file_test.mat", true);
+    ASSERT_FALSE(mat.null());
+    EXPECT_TRUE(mat.setVar("e", e));
+  }
+  auto mat = ReadAll("mat_file_test.mat");
+  ASSERT_GT(mat.size(), 128 + 8);
+  EXPECT_EQ(0, mat.compare(0, 10, "MATLAB 5.0"));
+  EXPECT_EQ("IM", mat.substr(126, 2));
+  EXPECT_EQ(15, static_cast<uint8_t>(mat[128])); // miCOMPRESSED
+  EXPECT_EQ(0x78, static_cast<uint8_t>(mat[136]));
+
+  ASSERT_TRUE(misc::SaveToNpy("mat_file_test.npy", e));
+  auto npy = ReadAll("mat_file_test.npy");
+  EXPECT_EQ(0, npy.compare(0, 6, "\x93NUMPY"));
+  size_t headerLength = static_cast<uint8_t>(npy[8]) |
+                        static_cast<uint8_t>(npy[9]) << 8;
+  EXPECT_EQ(0, (10 + headerLength) % 64);
+  EXPECT_NE(std::string::npos, npy.find("'shape': (20, 30)"));
+  EXPECT_EQ(10 + headerLength + e.size() * sizeof(double), npy.size());
+  EXPECT_EQ(0, std::memcmp(npy.data() + 10 + headerLength, e.data(),
+                           e.size() * sizeof(double)));
+
+  std::remove("mat_file_test.mat");
+  std::remove("mat_file_test.npy");
+}
+
+TEST(MatFile, CompressedRoundTrip) {
+  // constant runs and random values take both the match and literal paths
+  Eigen::MatrixXd e = Eigen::MatrixXd::Random(50, 40);
+  e.block(10, 5, 30, 30).setConstant(0.25);
+  core::DenseMatd m(7, 9, 1.5);
+  {
+    misc::MatWriter mat("mat_file_test.mat", false);
+    ASSERT_TRUE(mat.setVar("e", e));
+    ASSERT_TRUE(mat.setVar("m", misc::MatArray(m)));
+  }
+  auto plain = ReadAll("mat_file_test.mat");
+  {
+    misc::MatWriter mat("mat_file_test.mat", true);
+    ASSERT_TRUE(mat.setVar("e", e));
+    ASSERT_TRUE(mat.setVar("m", misc::MatArray(m)));
+  }
+  auto packed = ReadAll("mat_file_test.mat");
+  std::remove("mat_file_test.mat");
+
+  // each compressed element inflates to the uncompressed element
+  std::string inflated;
+  size_t pos = 128;
+  while (pos + 8 <= packed.size()) {
+    uint32_t tag[2];
+    std::memcpy(tag, packed.data() + pos, sizeof(tag));
+    ASSERT_EQ(15u, tag[0]); // miCOMPRESSED
+    ASSERT_LE(pos + 8 + tag[1], packed.size());
+    auto zlib = reinterpret_cast<const uint8_t *>(packed.data() + pos + 8);
+    ASSERT_GE(tag[1], 6u);
+    EXPECT_EQ(0x78, zlib[0]);
+    EXPECT_EQ(0, ((zlib[0] << 8) | zlib[1]) % 31);
+    std::vector<uint8_t> element;
+    ASSERT_TRUE(InflateFixedHuffman(zlib + 2, tag[1] - 6, element));
+    uint32_t a = 1, b = 0;
+    for (uint8_t c : element) {
+      a = (a + c) % 65521;
+      b = (b + a) % 65521;
+    }
+    const uint8_t *adler = zlib + tag[1] - 4;
+    EXPECT_EQ((b << 16) | a, uint32_t(adler[0]) << 24 | adler[1] << 16 |
+                                 adler[2] << 8 | adler[3]);
+    inflated.append(element.begin(), element.end());
+    pos += 8 + tag[1];
+  }
+  EXPECT_EQ(packed.size(), pos);
+  ASSERT_GT(plain.size(), 128);
+  EXPECT_TRUE(inflated == plain.substr(128));
+}
@@ -1,6 +1,7 @@
 #include "pch.hpp"
 
 #include "matlab_api.hpp"
+#include "memory.hpp"
 
 namespace pano {
 namespace misc {
@@ -89,6 +90,70 @@ inline int MxClassIDToCVDepth(mxClassID id) {
   }
 }
 
+// copies the channels of a 2d mat to the column major planes of an array and
+// back, elements are moved as bits of the same size
+template <class T>
+void CopyToColumnMajorPlanes(const cv::Mat &im, uint8_t *planes) {
+  const int rows = im.rows, cols = im.cols, cn = im.channels();
+  const size_t step = im.step[0];
+  T *out = reinterpret_cast<T *>(planes);
+  for (int k = 0; k < cn; k++) {
+    for (int j = 0; j < cols; j++) {
+      const uint8_t *in = im.data + (j * cn + k) * sizeof(T);
+      for (int i = 0; i < rows; i++, in += step) {
+        *out++ = *reinterpret_cast<const T *>(in);
+      }
+    }
+  }
+}
+
+template <class T>
+void CopyFromColumnMajorPlanes(const uint8_t *planes, cv::Mat &im) {
+  const int rows = im.rows, cols = im.cols, cn = im.channels();
+  const size_t step = im.step[0];
+  const T *in = reinterpret_cast<const T *>(planes);
+  for (int k = 0; k < cn; k++) {
+    for (int j = 0; j < cols; j++) {
+      uint8_t *out = im.data + (j * cn + k) * sizeof(T);
+      for (int i = 0; i < rows; i++, out += step) {
+        *reinterpret_cast<T *>(out) = *in++;
+      }
+    }
+  }
+}
+
+inline void CopyToColumnMajorPlanes(const cv::Mat &im, uint8_t *planes) {
+  switch (im.elemSize1()) {
+  case 1:
+    return CopyToColumnMajorPlanes<uint8_t>(im, planes);
+  case 2:
+    return CopyToColumnMajorPlanes<uint16_t>(im, planes);
+  case 4:
+    return CopyToColumnMajorPlanes<uint32_t>(im, planes);
+  default:
+    return CopyToColumnMajorPlanes<uint64_t>(im, planes);
+  }
+}
+
+inline void CopyFromColumnMajorPlanes(const uint8_t *planes, cv::Mat &im) {
+  switch (im.elemSize1()) {
+  case 1:
+    return CopyFromColumnMajorPlanes<uint8_t>(planes, im);
+  case 2:
+    return CopyFromColumnMajorPlanes<uint16_t>(planes, im);
+  case 4:
+    return CopyFromColumnMajorPlanes<uint32_t>(planes, im);
+  default:
+    return CopyFromColumnMajorPlanes<uint64_t>(planes, im);
+  }
+}
+
+template <class T> double SparseValue(const uchar *data) {
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
 MXA::MXA() : _mxa(0), _destroyWhenOutofScope(false) {}
 MXA::MXA(void *mxa, bool dos) : _mxa(mxa), _destroyWhenOutofScope(dos) {}
 MXA::MXA(MXA &&a) {
@@ -102,46 +167,45 @@ MXA::MXA(const cv::Mat &im, bool dos /*= false*/)
     : _mxa(0), _destroyWhenOutofScope(false) {
   // collect all dimensions of im
   int channelNum = im.channels();
-  mwSize *dimSizes = new mwSize[im.dims + 1];
+  std::vector<mwSize> dimSizes(im.dims + 1);
   for (int i = 0; i < im.dims; i++)
     dimSizes[i] = im.size[i];
   dimSizes[im.dims] = channelNum;
 
   // create mxArray
-  mxArray *ma = mxCreateNumericArray(im.dims + 1, dimSizes,
+  mxArray *ma = mxCreateNumericArray(im.dims + 1, dimSizes.data(),
                                      CVDepthToMxClassID(im.depth()), mxREAL);
-  delete[] dimSizes;
-
   if (!ma)
     return;
 
   uint8_t *mad = (uint8_t *)mxGetData(ma);
+  _mxa = static_cast<void *>(ma);
+  _destroyWhenOutofScope = dos;
+  if (im.dims == 2) {
+    CopyToColumnMajorPlanes(im, mad);
+    return;
+  }
+
   const size_t szForEachElem = im.elemSize1();
-  mwIndex *mxIndices = new mwIndex[im.dims + 1];
-  int *cvIndices = new int[im.dims];
+  std::vector<mwIndex> mxIndices(im.dims + 1);
+  std::vector<int> cvIndices(im.dims);
 
   cv::MatConstIterator iter(&im);
   int imTotal = im.total();
   for (int i = 0; i < imTotal; i++, ++iter) {
     // get indices in cv::Mat
-    iter.pos(cvIndices);
+    iter.pos(cvIndices.data());
     // copy indices to mxIndices
-    std::copy(cvIndices, cvIndices + im.dims, mxIndices);
+    std::copy(cvIndices.begin(), cvIndices.end(), mxIndices.begin());
     for (mwIndex k = 0; k < channelNum; k++) {
       const uint8_t *fromDataHead = (*iter) + k * szForEachElem;
       mxIndices[im.dims] = k; // set the last indices
       uint8_t *toDataHead =
-          mad +
-          mxCalcSingleSubscript(ma, im.dims + 1, mxIndices) * szForEachElem;
+          mad + mxCalcSingleSubscript(ma, im.dims + 1, mxIndices.data()) *
+                    szForEachElem;
       std::memcpy(toDataHead, fromDataHead, szForEachElem);
     }
   }
-
-  delete[] mxIndices;
-  delete[] cvIndices;
-
-  _mxa = static_cast<void *>(ma);
-  _destroyWhenOutofScope = dos;
 }
 
 MXA::MXA(double scalar, bool dos /*= false*/)
@@ -195,121 +259,87 @@ MXA::MXA(const cv::SparseMat &mat, bool dos /*= false*/)
   int channelNum = mat.channels();
   assert(channelNum == 1);
 
-  // create mxArray
-  int nzc = mat.nzcount();
-  mxArray *ma = mxCreateSparse(mat.size(0), mat.size(1), nzc, mxREAL);
-
-  if (!ma)
+  double (*value)(const uchar *) = nullptr;
+  switch (mat.type()) {
+  case CV_32FC1:
+    value = SparseValue<float>;
+    break;
+  case CV_64FC1:
+    value = SparseValue<double>;
+    break;
+  case CV_32SC1:
+    value = SparseValue<int32_t>;
+    break;
+  case CV_8UC1:
+    value = SparseValue<uint8_t>;
+    break;
+  default:
+    assert(false && "element type is not supported here!");
     return;
+  }
 
-  std::vector<std::tuple<int, int, double>> triplets; // col - row - val
-  triplets.reserve(nzc);
-
-  THERE_ARE_BOTTLENECKS_HERE(); // we should only iterate non zero elements
+  // count the nonzeros of each column, matlab wants them column by column
+  const int ncols = mat.size(1);
+  std::vector<mwIndex> colStarts(ncols + 1, 0);
   for (auto iter = mat.begin(); iter != mat.end(); ++iter) {
-    int ii = iter.node()->idx[0];
-    int jj = iter.node()->idx[1];
-    uchar *data = iter.ptr;
-    double v = 0.0;
-    if (mat.type() == CV_32FC1) {
-      float value = 0.0f;
-      std::memcpy(&value, data, sizeof(value));
-      v = value;
-    } else if (mat.type() == CV_64FC1) {
-      double value = 0.0f;
-      std::memcpy(&value, data, sizeof(value));
-      v = value;
-    } else if (mat.type() == CV_32SC1) {
-      int32_t value = 0;
-      std::memcpy(&value, data, sizeof(value));
-      v = value;
-    } else if (mat.type() == CV_64FC1) {
-      int64_t value = 0;
-      std::memcpy(&value, data, sizeof(value));
-      v = value;
-    } else if (mat.type() == CV_8UC1) {
-      uint8_t value = 0;
-      std::memcpy(&value, data, sizeof(value));
-      v = value;
-    } else {
-      assert(false && "element type is not supported here!");
-    }
-    if (v != 0.0)
-      triplets.emplace_back(jj, ii, v); // col - row - val
+    if (value(iter.ptr) != 0.0)
+      colStarts[iter.node()->idx[1] + 1]++;
   }
+  std::partial_sum(colStarts.begin(), colStarts.end(), colStarts.begin());
 
-  // make triplets ordered in column indices to satisfy matlab interface
-  std::sort(triplets.begin(), triplets.end());
+  // create mxArray
+  mxArray *ma = mxCreateSparse(mat.size(0), ncols,
+                               std::max<mwIndex>(colStarts.back(), 1), mxREAL);
+  if (!ma)
+    return;
 
   // fill in matlab data
   auto sr = mxGetPr(ma);
-  // auto si = mxGetPi(ma);
   auto irs = mxGetIr(ma);
   auto jcs = mxGetJc(ma);
-  jcs = (mwIndex *)mxRealloc(jcs, (mat.size(1) + 1) * sizeof(mwIndex));
-  std::fill(jcs, jcs + (mat.size(1) + 1), 0);
-  mxSetJc(ma, jcs);
-
-  for (int i = 0; i < triplets.size(); i++) {
-    sr[i] = std::get<2>(triplets[i]);
-    int ii = std::get<1>(triplets[i]) + 1;
-    int jj = std::get<0>(triplets[i]) + 1;
-    irs[i] = ii - 1;
-    jcs[jj]++;
+  std::copy(colStarts.begin(), colStarts.end(), jcs);
+  colStarts.pop_back(); // now the next place in each column
+  for (auto iter = mat.begin(); iter != mat.end(); ++iter) {
+    double v = value(iter.ptr);
+    if (v == 0.0)
+      continue;
+    mwIndex k = colStarts[iter.node()->idx[1]]++;
+    irs[k] = iter.node()->idx[0];
+    sr[k] = v;
   }
 
-  for (int j = 1; j < (mat.size(1) + 1); j++) {
-    jcs[j] += jcs[j - 1];
+  // the nodes come in hash order, sort the rows in each column
+  std::vector<std::pair<mwIndex, double>> column;
+  for (int j = 0; j < ncols; j++) {
+    if (std::is_sorted(irs + jcs[j], irs + jcs[j + 1]))
+      continue;
+    column.clear();
+    for (mwIndex k = jcs[j]; k < jcs[j + 1]; k++)
+      column.emplace_back(irs[k], sr[k]);
+    std::sort(column.begin(), column.end());
+    for (mwIndex k = jcs[j]; k < jcs[j + 1]; k++) {
+      irs[k] = column[k - jcs[j]].first;
+      sr[k] = column[k - jcs[j]].second;
+    }
   }
 
   _mxa = ma;
   _destroyWhenOutofScope = dos;
 }
 
-MXA::MXA(cv::InputArray m, bool dos /*= false*/) {
-  cv::Mat im = m.getMat();
-  // collect all dimensions of im
-  int channelNum = im.channels();
-  mwSize *dimSizes = new mwSize[im.dims + 1];
-  for (int i = 0; i < im.dims; i++)
-    dimSizes[i] = im.size[i];
-  dimSizes[im.dims] = channelNum;
-
-  // create mxArray
-  mxArray *ma = mxCreateNumericArray(im.dims + 1, dimSizes,
-                                     CVDepthToMxClassID(im.depth()), mxREAL);
-  delete[] dimSizes;
+MXA::MXA(cv::InputArray m, bool dos /*= false*/) : MXA(m.getMat(), dos) {}
 
+MXA MXA::FromColumnMajor(const void *data, int cvDepth,
+                         const std::vector<size_t> &dims, bool dos) {
+  std::vector<mwSize> dimSizes(dims.begin(), dims.end());
+  mxArray *ma = mxCreateNumericArray(dimSizes.size(), dimSizes.data(),
+                                     CVDepthToMxClassID(cvDepth), mxREAL);
   if (!ma)
-    return;
-
-  uint8_t *mad = (uint8_t *)mxGetData(ma);
-  const size_t szForEachElem = im.elemSize1();
-  mwIndex *mxIndices = new mwIndex[im.dims + 1];
-  int *cvIndices = new int[im.dims];
-
-  cv::MatConstIterator iter(&im);
-  int imTotal = im.total();
-  for (int i = 0; i < imTotal; i++, ++iter) {
-    // get indices in cv::Mat
-    iter.pos(cvIndices);
-    // copy indices to mxIndices
-    std::copy(cvIndices, cvIndices + im.dims, mxIndices);
-    for (mwIndex k = 0; k < channelNum; k++) {
-      const uint8_t *fromDataHead = (*iter) + k * szForEachElem;
-      mxIndices[im.dims] = k; // set the last indices
-      uint8_t *toDataHead =
-          mad +
-          mxCalcSingleSubscript(ma, im.dims + 1, mxIndices) * szForEachElem;
-      std::memcpy(toDataHead, fromDataHead, szForEachElem);
-    }
-  }
-
-  delete[] mxIndices;
-  delete[] cvIndices;
-
-  _mxa = ma;
-  _destroyWhenOutofScope = dos;
+    return MXA();
+  size_t n = mxGetNumberOfElements(ma);
+  if (n > 0)
+    std::memcpy(mxGetData(ma), data, n * mxGetElementSize(ma));
+  return MXA(ma, dos);
 }
 
 MXA &MXA::operator=(MXA &&a) {
@@ -400,6 +430,11 @@ bool MXA::toCVOutputArray(cv::OutputArray mat,
   // create Mat
   mat.create(cvDims, cvDimSizes, CV_MAKETYPE(depth, channels));
   cv::Mat im = mat.getMat();
+  delete[] cvDimSizes;
+  if (cvDims == 2) {
+    CopyFromColumnMajorPlanes(mad, im);
+    return true;
+  }
 
   mwIndex *mxIndices = new mwIndex[im.dims + 1];
   int *cvIndices = new int[im.dims];
@@ -421,7 +456,6 @@ bool MXA::toCVOutputArray(cv::OutputArray mat,
     }
   }
 
-  delete[] cvDimSizes;
   delete[] mxIndices;
   delete[] cvIndices;
   return true;
@@ -710,6 +744,15 @@ bool Matlab::setVar(const std::string &name, const MXA &mxa) {
                         static_cast<mxArray *>(mxa.mxa())) == 0;
 }
 
+std::vector<MXA> Matlab::vars(const std::vector<std::string> &names) const {
+  std::vector<MXA> result;
+  result.reserve(names.size());
+  for (auto &name : names) {
+    result.push_back(var(name));
+  }
+  return result;
+}
+
 const Matlab &Matlab::operator<<(const std::string &cmd) const {
   run(cmd);
   return *this;
@@ -718,5 +761,61 @@ const Matlab &Matlab::operator<<(const std::string &cmd) const {
 bool Matlab::cdAndAddAllSubfolders(const std::string &dir) {
   return run("cd " + dir) && run("addpath(genpath('.'));");
 }
+
+MatlabPool::MatlabPool(int nengines, const std::string &defaultDir,
+                       bool printMsg)
+    : _stopping(false) {
+  for (int i = 0; i < std::max(nengines, 1); i++) {
+    _workers.emplace_back(
+        [this, defaultDir, printMsg]() { work(defaultDir, printMsg); });
+  }
+}
+
+MatlabPool::~MatlabPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _jobsChanged.notify_all();
+  for (auto &w : _workers) {
+    w.join();
+  }
+}
+
+size_t MatlabPool::pending() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _jobs.size();
+}
+
+void MatlabPool::enqueue(std::function<void(Matlab &)> job) {
+  // counts to the memory scope of the submitter as ParallelRun does
+  int scope = MemoryScope::CurrentId();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _jobs.push_back([job = std::move(job), scope](Matlab &matlab) {
+      MemoryScope::Attach attach(scope);
+      job(matlab);
+    });
+  }
+  _jobsChanged.notify_one();
+}
+
+void MatlabPool::work(const std::string &defaultDir, bool printMsg) {
+  // a session of its own, engOpen may share one between the engines
+  Matlab matlab(defaultDir, true, printMsg);
+  while (true) {
+    std::function<void(Matlab &)> job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _jobsChanged.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+      if (_jobs.empty()) {
+        return;
+      }
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    job(matlab);
+  }
+}
 }
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <regex>
+
 #include "basic_types.hpp"
 
 #include "eigen.hpp"
@@ -85,9 +90,22 @@ public:
   MXA(const cv::SparseMat &m, bool dos = false);
   MXA(cv::InputArray m, bool dos = false);
 
+  // column major matrices are copied directly
   template <class T, int M, int N, int O, int MaxM, int MaxN>
   MXA(const Eigen::Matrix<T, M, N, O, MaxM, MaxN> &m, bool dos = false)
-      : MXA(ToCVMat(m), dos) {}
+      : MXA(FromEigen(m, dos)) {}
+
+  // FromColumnMajor
+  // a numeric array of the dims filled from a contiguous column major buffer
+  // by a single copy
+  static MXA FromColumnMajor(const void *data, int cvDepth,
+                             const std::vector<size_t> &dims,
+                             bool dos = false);
+  template <class T>
+  static MXA FromColumnMajor(const T *data, const std::vector<size_t> &dims,
+                             bool dos = false) {
+    return FromColumnMajor(data, cv::DataType<T>::depth, dims, dos);
+  }
 
   double scalar() const;
   std::string toString() const;
@@ -170,6 +188,19 @@ public:
     return static_cast<T *>(data())[offset(subs...)];
   }
 
+private:
+  template <class T, int M, int N, int O, int MaxM, int MaxN>
+  static MXA FromEigen(const Eigen::Matrix<T, M, N, O, MaxM, MaxN> &m,
+                       bool dos) {
+    if ((O & Eigen::RowMajor) && m.rows() > 1 && m.cols() > 1) {
+      Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> cm = m;
+      return FromColumnMajor(cm.data(), {size_t(cm.rows()), size_t(cm.cols())},
+                             dos);
+    }
+    return FromColumnMajor(m.data(), {size_t(m.rows()), size_t(m.cols())},
+                           dos);
+  }
+
 protected:
   void *_mxa;
   bool _destroyWhenOutofScope;
@@ -237,14 +268,90 @@ public:
   MXA var(const std::string &name) const;
   bool setVar(const std::string &name, const MXA &mxa);
 
+  // setVars
+  // puts the name value pairs, values other than MXA are converted to arrays
+  // freed once put, stops at the first failure
+  template <class T, class... Ts>
+  bool setVars(const std::string &name, const T &value, const Ts &... rest) {
+    return setVar(name, ToMXA(value)) && setVars(rest...);
+  }
+  bool setVars() { return true; }
+  // null arrays for the missing ones
+  std::vector<MXA> vars(const std::vector<std::string> &names) const;
+
   const Matlab &operator<<(const std::string &cmd) const;
 
   bool cdAndAddAllSubfolders(const std::string &dir);
 
+private:
+  static const MXA &ToMXA(const MXA &a) { return a; }
+  template <class T> static MXA ToMXA(const T &value) {
+    return MXA(value, true);
+  }
+
 private:
   char *_buffer;
   void *_eng;
   bool _printMessage;
 };
+
+// MatlabPool
+// engines owned by worker threads, each started on its own thread, a
+// submitted job runs on the first free engine. one engine serializes all jobs
+class MatlabPool {
+public:
+  explicit MatlabPool(int nengines,
+                      const std::string &defaultDir = std::string(),
+                      bool printMsg = false);
+  // runs the queued jobs before closing the engines
+  ~MatlabPool();
+
+  MatlabPool(const MatlabPool &) = delete;
+  MatlabPool &operator=(const MatlabPool &) = delete;
+
+  int size() const { return _workers.size(); }
+  // the jobs not started yet
+  size_t pending() const;
+
+  // submit
+  // runs fun(Matlab &) on an engine, exceptions are passed by the future
+  template <class FunT>
+  std::future<std::result_of_t<std::decay_t<FunT> &(Matlab &)>>
+  submit(FunT &&fun) {
+    using ResultT = std::result_of_t<std::decay_t<FunT> &(Matlab &)>;
+    auto task = std::make_shared<std::packaged_task<ResultT(Matlab &)>>(
+        std::forward<FunT>(fun));
+    auto result = task->get_future();
+    enqueue([task](Matlab &matlab) { (*task)(matlab); });
+    return result;
+  }
+
+private:
+  void enqueue(std::function<void(Matlab &)> job);
+  void work(const std::string &defaultDir, bool printMsg);
+
+private:
+  std::vector<std::thread> _workers;
+  mutable std::mutex _mutex;
+  std::condition_variable _jobsChanged;
+  std::deque<std::function<void(Matlab &)>> _jobs;
+  bool _stopping;
+};
+
+#ifndef PANORAMIX_USE_MATLAB
+// MockMatlabCommand
+// runs a statement on a mock engine given the submatches of its pattern,
+// returns the error message or an empty string
+using MockMatlabWorkspace = std::map<std::string, MXA>;
+using MockMatlabCommand =
+    std::function<std::string(const std::smatch &, MockMatlabWorkspace &)>;
+
+// RegisterMockMatlabCommand
+// statements matching the pattern as a whole run the command on the mock
+// engines, later registrations win. clear, cd, addpath, startup and pwd are
+// built in, other statements fail with an "Error" message as in matlab
+void RegisterMockMatlabCommand(const std::string &pattern,
+                               MockMatlabCommand command);
+#endif
 }
 }
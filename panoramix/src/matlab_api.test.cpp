@@ -0,0 +1,143 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "image.hpp"
+#include "matlab_api.hpp"
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+TEST(MatlabTest, MatRoundTrip) {
+  core::Image3d im(30, 40);
+  for (auto it = im.begin(); it != im.end(); ++it) {
+    auto p = it.pos();
+    *it = core::Vec3(p.y, p.x, p.x * 100 + p.y);
+  }
+  misc::MXA mxa(im, true);
+  EXPECT_EQ(mxa.dims(), (std::vector<size_t>{30, 40, 3}));
+  EXPECT_EQ(mxa.at(4, 7, 2), 704);
+  EXPECT_EQ(cv::norm(mxa.toCVMat(), im, cv::NORM_INF), 0);
+
+  core::Image3ub sub = core::Image3ub(50, 60, core::Vec3ub(1, 2, 3))(
+      cv::Rect(10, 5, 20, 30));
+  misc::MXA submxa(sub, true);
+  EXPECT_EQ(submxa.at<uint8_t>(29, 19, 1), 2);
+  EXPECT_EQ(cv::norm(submxa.toCVMat(), sub, cv::NORM_INF), 0);
+}
+
+TEST(MatlabTest, FromColumnMajor) {
+  Eigen::Matrix<double, 3, 2, Eigen::RowMajor> rm;
+  rm << 1, 2, 3, 4, 5, 6;
+  Eigen::MatrixXf cm = rm.cast<float>();
+  misc::MXA a(rm, true), b(cm, true);
+  EXPECT_TRUE(a.isDouble());
+  EXPECT_TRUE(b.isSingle());
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 2; j++) {
+      EXPECT_EQ(a.at(i, j), rm(i, j));
+      EXPECT_EQ(b.at<float>(i, j), cm(i, j));
+    }
+  }
+
+  std::vector<int32_t> data = {1, 2, 3, 4, 5, 6, 7, 8};
+  auto c = misc::MXA::FromColumnMajor(data.data(), {2, 2, 2}, true);
+  EXPECT_TRUE(c.isInt32());
+  EXPECT_EQ(c.at<int32_t>(1, 0, 1), 6);
+}
+
+TEST(MatlabTest, SparseMat) {
+  int dims[] = {50, 40};
+  cv::SparseMat s(2, dims, CV_64FC1);
+  std::vector<std::pair<int, int>> positions;
+  for (int i = 0; i < 50; i += 3) {
+    for (int j = 39; j >= 0; j -= 7) {
+      s.ref<double>(i, j) = j * 100 + i + 1;
+      positions.emplace_back(j, i);
+    }
+  }
+  s.ref<double>(1, 1) = 0.0; // stored zeros are dropped
+  std::sort(positions.begin(), positions.end());
+
+  misc::MXA mxa(s, true);
+  EXPECT_TRUE(mxa.isSparse());
+  EXPECT_EQ(mxa.m(), 50);
+  EXPECT_EQ(mxa.n(), 40);
+  auto values = static_cast<const double *>(mxa.data());
+  for (int k = 0; k < positions.size(); k++) {
+    EXPECT_EQ(values[k], positions[k].first * 100 + positions[k].second + 1);
+  }
+}
+
+#ifndef PANORAMIX_USE_MATLAB
+TEST(MatlabTest, MockEngine) {
+  misc::RegisterMockMatlabCommand(
+      "(\\w+) = twice\\((\\w+)\\)",
+      [](const std::smatch &match, misc::MockMatlabWorkspace &workspace) {
+        auto it = workspace.find(match[2].str());
+        if (it == workspace.end()) {
+          return "Error: undefined " + match[2].str();
+        }
+        cv::Mat m = it->second.toCVMat();
+        workspace[match[1].str()] = misc::MXA(cv::Mat(m * 2), true);
+        return std::string();
+      });
+
+  misc::Matlab matlab("", false, false);
+  ASSERT_TRUE(matlab.started());
+  EXPECT_TRUE(matlab.setVars("a", core::Image3d(2, 3, core::Vec3(1, 2, 3)),
+                             "b", 4.0));
+  matlab << "clear b; c = twice(a)";
+  EXPECT_FALSE(matlab.errorLastRun());
+  auto vars = matlab.vars({"a", "b", "c"});
+  EXPECT_FALSE(vars[0].null());
+  EXPECT_TRUE(vars[1].null());
+  EXPECT_EQ(vars[2].at(1, 2, 1), 4.0);
+
+  matlab << "d = twice(b)";
+  EXPECT_TRUE(matlab.errorLastRun());
+  matlab << "gc(im)";
+  EXPECT_TRUE(matlab.errorLastRun());
+}
+
+TEST(MatlabTest, Pool) {
+  // the command stays registered after the test, so it owns the counters
+  struct Counters {
+    std::atomic<int> running{0}, maxRunning{0};
+  };
+  auto counters = std::make_shared<Counters>();
+  misc::RegisterMockMatlabCommand(
+      "hold",
+      [counters](const std::smatch &, misc::MockMatlabWorkspace &) {
+        int r = ++counters->running;
+        int m = counters->maxRunning;
+        while (r > m && !counters->maxRunning.compare_exchange_weak(m, r)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        --counters->running;
+        return std::string();
+      });
+
+  std::vector<std::future<double>> results;
+  {
+    misc::MatlabPool pool(4);
+    EXPECT_EQ(pool.size(), 4);
+    for (int i = 0; i < 8; i++) {
+      results.push_back(pool.submit([i](misc::Matlab &matlab) {
+        matlab.setVars("x", double(i));
+        matlab << "hold";
+        return matlab.var("x").scalar();
+      }));
+    }
+    auto failed = pool.submit([](misc::Matlab &) -> int {
+      throw std::runtime_error("failed");
+    });
+    EXPECT_THROW(failed.get(), std::runtime_error);
+  }
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(results[i].get(), i);
+  }
+  EXPECT_GT(counters->maxRunning, 1);
+}
+#endif
@@ -0,0 +1,526 @@
+#include "pch.hpp"
+
+#include "matlab_api.hpp"
+
+#ifndef PANORAMIX_USE_MATLAB
+
+struct mxArray_tag {
+  mxClassID classID;
+  bool sparse;
+  bool global;
+  std::vector<mwSize> dims;
+  // numeric, logical and char elements, the values of a sparse matrix
+  void *data;
+  mwIndex *ir, *jc;
+  mwSize nzmax;
+  // cells, or the fields of each struct element one after another
+  std::vector<mxArray *> elements;
+  std::vector<std::string> fieldNames;
+};
+
+struct engine {
+  pano::misc::MockMatlabWorkspace workspace;
+  char *buffer;
+  int bufferSize;
+};
+
+namespace {
+
+size_t ClassElementSize(mxClassID id) {
+  switch (id) {
+  case mxLOGICAL_CLASS:
+  case mxINT8_CLASS:
+  case mxUINT8_CLASS:
+    return 1;
+  case mxCHAR_CLASS:
+  case mxINT16_CLASS:
+  case mxUINT16_CLASS:
+    return 2;
+  case mxSINGLE_CLASS:
+  case mxINT32_CLASS:
+  case mxUINT32_CLASS:
+    return 4;
+  case mxDOUBLE_CLASS:
+  case mxINT64_CLASS:
+  case mxUINT64_CLASS:
+    return 8;
+  case mxCELL_CLASS:
+  case mxSTRUCT_CLASS:
+    return sizeof(mxArray *);
+  default:
+    return 0;
+  }
+}
+
+// at least two dims, no trailing singletons after the second
+std::vector<mwSize> NormalizedDims(mwSize ndim, const mwSize *dims) {
+  std::vector<mwSize> ds(dims, dims + ndim);
+  while (ds.size() > 2 && ds.back() == 1) {
+    ds.pop_back();
+  }
+  while (ds.size() < 2) {
+    ds.push_back(ds.empty() ? 0 : 1);
+  }
+  return ds;
+}
+
+size_t NumElements(const std::vector<mwSize> &dims) {
+  return std::accumulate(dims.begin(), dims.end(), size_t(1),
+                         std::multiplies<size_t>());
+}
+
+mxArray *CreateArray(mxClassID id, std::vector<mwSize> dims) {
+  auto pa = new mxArray_tag;
+  pa->classID = id;
+  pa->sparse = false;
+  pa->global = false;
+  pa->dims = std::move(dims);
+  pa->data = nullptr;
+  pa->ir = pa->jc = nullptr;
+  pa->nzmax = 0;
+  if (ClassElementSize(id) != 0 && id != mxCELL_CLASS &&
+      id != mxSTRUCT_CLASS) {
+    pa->data = std::calloc(std::max<size_t>(NumElements(pa->dims), 1),
+                           ClassElementSize(id));
+  }
+  return pa;
+}
+
+template <class T> double FirstElement(const mxArray *pa) {
+  return static_cast<const T *>(pa->data)[0];
+}
+
+const char *ClassName(mxClassID id) {
+  static const char *names[] = {
+      "unknown", "cell",   "struct", "logical", "char",     "void",
+      "double",  "single", "int8",   "uint8",   "int16",    "uint16",
+      "int32",   "uint32", "int64",  "uint64",  "function_handle",
+      "opaque",  "object"};
+  return names[id];
+}
+
+std::mutex MockCommandsMutex;
+std::vector<std::pair<std::regex, pano::misc::MockMatlabCommand>> MockCommands;
+
+// statements end at ; or new lines out of brackets and strings
+std::vector<std::string> SplitStatements(const std::string &cmd) {
+  std::vector<std::string> statements;
+  std::string current;
+  int depth = 0;
+  bool quoted = false;
+  auto flush = [&statements, &current]() {
+    auto first = current.find_first_not_of(" \t\r,");
+    auto last = current.find_last_not_of(" \t\r,");
+    if (first != std::string::npos) {
+      statements.push_back(current.substr(first, last - first + 1));
+    }
+    current.clear();
+  };
+  for (char c : cmd) {
+    if (c == '\'') {
+      quoted = !quoted;
+    } else if (!quoted && (c == '(' || c == '[' || c == '{')) {
+      depth++;
+    } else if (!quoted && (c == ')' || c == ']' || c == '}')) {
+      depth--;
+    } else if (!quoted && depth == 0 && (c == ';' || c == '\n')) {
+      flush();
+      continue;
+    }
+    current.push_back(c);
+  }
+  flush();
+  return statements;
+}
+
+std::string RunBuiltin(const std::string &statement,
+                       pano::misc::MockMatlabWorkspace &workspace) {
+  static const std::regex clear("clear(\\s+.*)?");
+  static const std::regex noop("(cd(\\s+.*|\\(.*\\))|addpath\\(.*\\)|startup|"
+                               "pwd|close\\s+all|clc)");
+  std::smatch match;
+  if (std::regex_match(statement, match, clear)) {
+    std::istringstream names(match[1].str());
+    std::string name;
+    bool any = false;
+    while (names >> name) {
+      any = true;
+      if (name == "all") {
+        workspace.clear();
+      } else {
+        workspace.erase(name);
+      }
+    }
+    if (!any) {
+      workspace.clear();
+    }
+    return std::string();
+  }
+  if (std::regex_match(statement, noop)) {
+    return std::string();
+  }
+  return "Error: the mock matlab engine cannot run '" + statement + "'";
+}
+}
+
+namespace pano {
+namespace misc {
+void RegisterMockMatlabCommand(const std::string &pattern,
+                               MockMatlabCommand command) {
+  std::lock_guard<std::mutex> lock(MockCommandsMutex);
+  MockCommands.emplace_back(std::regex(pattern), std::move(command));
+}
+}
+}
+
+// arrays
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid,
+                               mxComplexity flag) {
+  mwSize dims[] = {m, n};
+  return mxCreateNumericArray(2, dims, classid, flag);
+}
+
+mxArray *mxCreateNumericArray(mwSize ndim, const mwSize *dims,
+                              mxClassID classid, mxComplexity flag) {
+  if (flag != mxREAL || ClassElementSize(classid) == 0 ||
+      classid == mxCELL_CLASS || classid == mxSTRUCT_CLASS ||
+      classid == mxCHAR_CLASS) {
+    return nullptr;
+  }
+  return CreateArray(classid, NormalizedDims(ndim, dims));
+}
+
+mxArray *mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag) {
+  if (flag != mxREAL) {
+    return nullptr;
+  }
+  auto pa = CreateArray(mxUNKNOWN_CLASS, {m, n});
+  pa->classID = mxDOUBLE_CLASS;
+  pa->sparse = true;
+  pa->nzmax = std::max<mwSize>(nzmax, 1);
+  pa->data = std::calloc(pa->nzmax, sizeof(double));
+  pa->ir = static_cast<mwIndex *>(std::calloc(pa->nzmax, sizeof(mwIndex)));
+  pa->jc = static_cast<mwIndex *>(std::calloc(n + 1, sizeof(mwIndex)));
+  return pa;
+}
+
+mxArray *mxCreateString(const char *str) {
+  return mxCreateStringFromNChars(str, std::strlen(str));
+}
+
+mxArray *mxCreateStringFromNChars(const char *str, mwSize n) {
+  auto pa = CreateArray(mxCHAR_CLASS, {mwSize(n == 0 ? 0 : 1), n});
+  auto chars = static_cast<mxChar *>(pa->data);
+  for (mwSize i = 0; i < n; i++) {
+    chars[i] = static_cast<unsigned char>(str[i]);
+  }
+  return pa;
+}
+
+mxArray *mxCreateCellMatrix(mwSize m, mwSize n) {
+  auto pa = CreateArray(mxCELL_CLASS, {m, n});
+  pa->elements.resize(m * n, nullptr);
+  return pa;
+}
+
+mxArray *mxCreateStructMatrix(mwSize m, mwSize n, int nfields,
+                              const char **fieldnames) {
+  auto pa = CreateArray(mxSTRUCT_CLASS, {m, n});
+  pa->fieldNames.assign(fieldnames, fieldnames + nfields);
+  pa->elements.resize(m * n * nfields, nullptr);
+  return pa;
+}
+
+mxArray *mxDuplicateArray(const mxArray *in) {
+  if (!in) {
+    return nullptr;
+  }
+  auto pa = new mxArray_tag(*in);
+  size_t n = in->sparse ? in->nzmax : NumElements(in->dims);
+  if (in->data) {
+    size_t bytes = std::max<size_t>(n, 1) * ClassElementSize(in->classID);
+    pa->data = std::malloc(bytes);
+    std::memcpy(pa->data, in->data, bytes);
+  }
+  if (in->sparse) {
+    pa->ir = static_cast<mwIndex *>(std::malloc(n * sizeof(mwIndex)));
+    std::memcpy(pa->ir, in->ir, n * sizeof(mwIndex));
+    size_t ncols = in->dims[1] + 1;
+    pa->jc = static_cast<mwIndex *>(std::malloc(ncols * sizeof(mwIndex)));
+    std::memcpy(pa->jc, in->jc, ncols * sizeof(mwIndex));
+  }
+  for (auto &e : pa->elements) {
+    e = mxDuplicateArray(e);
+  }
+  return pa;
+}
+
+void mxDestroyArray(mxArray *pa) {
+  if (!pa) {
+    return;
+  }
+  std::free(pa->data);
+  std::free(pa->ir);
+  std::free(pa->jc);
+  for (auto e : pa->elements) {
+    mxDestroyArray(e);
+  }
+  delete pa;
+}
+
+void *mxGetData(const mxArray *pa) { return pa->data; }
+void mxSetData(mxArray *pa, void *newdata) { pa->data = newdata; }
+double *mxGetPr(const mxArray *pa) {
+  return pa->classID == mxDOUBLE_CLASS ? static_cast<double *>(pa->data)
+                                       : nullptr;
+}
+double *mxGetPi(const mxArray *pa) { return nullptr; }
+mwIndex *mxGetIr(const mxArray *pa) { return pa->ir; }
+mwIndex *mxGetJc(const mxArray *pa) { return pa->jc; }
+void mxSetJc(mxArray *pa, mwIndex *newjc) { pa->jc = newjc; }
+mwSize mxGetNzmax(const mxArray *pa) {
+  return pa->sparse ? pa->nzmax : NumElements(pa->dims);
+}
+
+void *mxRealloc(void *ptr, size_t size) { return std::realloc(ptr, size); }
+void mxFree(void *ptr) { std::free(ptr); }
+
+bool mxIsNumeric(const mxArray *pa) {
+  return pa->classID >= mxDOUBLE_CLASS && pa->classID <= mxUINT64_CLASS;
+}
+bool mxIsCell(const mxArray *pa) { return pa->classID == mxCELL_CLASS; }
+bool mxIsLogical(const mxArray *pa) { return pa->classID == mxLOGICAL_CLASS; }
+bool mxIsChar(const mxArray *pa) { return pa->classID == mxCHAR_CLASS; }
+bool mxIsStruct(const mxArray *pa) { return pa->classID == mxSTRUCT_CLASS; }
+bool mxIsOpaque(const mxArray *pa) { return pa->classID == mxOPAQUE_CLASS; }
+bool mxIsFunctionHandle(const mxArray *pa) {
+  return pa->classID == mxFUNCTION_CLASS;
+}
+bool mxIsObject(const mxArray *pa) { return pa->classID == mxOBJECT_CLASS; }
+bool mxIsComplex(const mxArray *pa) { return false; }
+bool mxIsSparse(const mxArray *pa) { return pa->sparse; }
+bool mxIsDouble(const mxArray *pa) { return pa->classID == mxDOUBLE_CLASS; }
+bool mxIsSingle(const mxArray *pa) { return pa->classID == mxSINGLE_CLASS; }
+bool mxIsInt8(const mxArray *pa) { return pa->classID == mxINT8_CLASS; }
+bool mxIsUint8(const mxArray *pa) { return pa->classID == mxUINT8_CLASS; }
+bool mxIsInt16(const mxArray *pa) { return pa->classID == mxINT16_CLASS; }
+bool mxIsUint16(const mxArray *pa) { return pa->classID == mxUINT16_CLASS; }
+bool mxIsInt32(const mxArray *pa) { return pa->classID == mxINT32_CLASS; }
+bool mxIsUint32(const mxArray *pa) { return pa->classID == mxUINT32_CLASS; }
+bool mxIsInt64(const mxArray *pa) { return pa->classID == mxINT64_CLASS; }
+bool mxIsUint64(const mxArray *pa) { return pa->classID == mxUINT64_CLASS; }
+bool mxIsEmpty(const mxArray *pa) { return NumElements(pa->dims) == 0; }
+bool mxIsFromGlobalWS(const mxArray *pa) { return pa->global; }
+void mxSetFromGlobalWS(mxArray *pa, bool global) { pa->global = global; }
+
+mxClassID mxGetClassID(const mxArray *pa) { return pa->classID; }
+const char *mxGetClassName(const mxArray *pa) {
+  return ClassName(pa->classID);
+}
+size_t mxGetElementSize(const mxArray *pa) {
+  return ClassElementSize(pa->classID);
+}
+mwSize mxGetNumberOfDimensions(const mxArray *pa) { return pa->dims.size(); }
+const mwSize *mxGetDimensions(const mxArray *pa) { return pa->dims.data(); }
+size_t mxGetNumberOfElements(const mxArray *pa) {
+  return NumElements(pa->dims);
+}
+size_t mxGetM(const mxArray *pa) { return pa->dims[0]; }
+size_t mxGetN(const mxArray *pa) {
+  return std::accumulate(pa->dims.begin() + 1, pa->dims.end(), size_t(1),
+                         std::multiplies<size_t>());
+}
+void mxSetM(mxArray *pa, mwSize m) { pa->dims = {m, mxGetN(pa)}; }
+void mxSetN(mxArray *pa, mwSize n) { pa->dims = {pa->dims[0], n}; }
+mwIndex mxCalcSingleSubscript(const mxArray *pa, mwSize nsubs,
+                              const mwIndex *subs) {
+  mwIndex index = 0, stride = 1;
+  for (mwSize i = 0; i < nsubs && i < pa->dims.size(); i++) {
+    index += subs[i] * stride;
+    stride *= pa->dims[i];
+  }
+  return index;
+}
+
+double mxGetScalar(const mxArray *pa) {
+  if (!pa->data || NumElements(pa->dims) == 0 ||
+      (pa->sparse && pa->jc[pa->dims[1]] == 0)) {
+    return 0.0;
+  }
+  switch (pa->classID) {
+  case mxLOGICAL_CLASS:
+    return FirstElement<mxLogical>(pa);
+  case mxCHAR_CLASS:
+    return FirstElement<mxChar>(pa);
+  case mxDOUBLE_CLASS:
+    return FirstElement<double>(pa);
+  case mxSINGLE_CLASS:
+    return FirstElement<float>(pa);
+  case mxINT8_CLASS:
+    return FirstElement<int8_t>(pa);
+  case mxUINT8_CLASS:
+    return FirstElement<uint8_t>(pa);
+  case mxINT16_CLASS:
+    return FirstElement<int16_t>(pa);
+  case mxUINT16_CLASS:
+    return FirstElement<uint16_t>(pa);
+  case mxINT32_CLASS:
+    return FirstElement<int32_t>(pa);
+  case mxUINT32_CLASS:
+    return FirstElement<uint32_t>(pa);
+  case mxINT64_CLASS:
+    return FirstElement<int64_t>(pa);
+  case mxUINT64_CLASS:
+    return FirstElement<uint64_t>(pa);
+  default:
+    return 0.0;
+  }
+}
+
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen) {
+  if (pa->classID != mxCHAR_CLASS || buflen == 0) {
+    return 1;
+  }
+  size_t n = NumElements(pa->dims);
+  size_t copied = std::min<size_t>(n, buflen - 1);
+  auto chars = static_cast<const mxChar *>(pa->data);
+  for (size_t i = 0; i < copied; i++) {
+    buf[i] = static_cast<char>(chars[i]);
+  }
+  buf[copied] = '\0';
+  return copied == n ? 0 : 1;
+}
+
+mxArray *mxGetCell(const mxArray *pa, mwIndex i) {
+  return pa->classID == mxCELL_CLASS && i < pa->elements.size()
+             ? pa->elements[i]
+             : nullptr;
+}
+void mxSetCell(mxArray *pa, mwIndex i, mxArray *value) {
+  if (pa->classID == mxCELL_CLASS && i < pa->elements.size()) {
+    pa->elements[i] = value;
+  }
+}
+int mxGetNumberOfFields(const mxArray *pa) { return pa->fieldNames.size(); }
+const char *mxGetFieldNameByNumber(const mxArray *pa, int n) {
+  if (n < 0 || n >= int(pa->fieldNames.size())) {
+    return nullptr;
+  }
+  return pa->fieldNames[n].c_str();
+}
+int mxGetFieldNumber(const mxArray *pa, const char *name) {
+  auto it = std::find(pa->fieldNames.begin(), pa->fieldNames.end(), name);
+  return it == pa->fieldNames.end() ? -1 : int(it - pa->fieldNames.begin());
+}
+mxArray *mxGetField(const mxArray *pa, mwIndex i, const char *fieldname) {
+  int f = mxGetFieldNumber(pa, fieldname);
+  size_t k = i * pa->fieldNames.size() + f;
+  return f >= 0 && k < pa->elements.size() ? pa->elements[k] : nullptr;
+}
+void mxSetField(mxArray *pa, mwIndex i, const char *fieldname, mxArray *value) {
+  int f = mxGetFieldNumber(pa, fieldname);
+  size_t k = i * pa->fieldNames.size() + f;
+  if (f >= 0 && k < pa->elements.size()) {
+    pa->elements[k] = value;
+  }
+}
+mxArray *mxGetProperty(const mxArray *pa, const mwIndex i,
+                       const char *propname) {
+  return nullptr; // there are no objects
+}
+void mxSetProperty(mxArray *pa, mwIndex i, const char *propname,
+                   const mxArray *value) {}
+
+// mat files
+MATFile *matOpen(const char *filename, const char *mode) { return nullptr; }
+int matClose(MATFile *pMF) { return 0; }
+char **matGetDir(MATFile *pMF, int *num) {
+  *num = 0;
+  return nullptr;
+}
+mxArray *matGetVariable(MATFile *pMF, const char *name) { return nullptr; }
+int matPutVariable(MATFile *pMF, const char *name, const mxArray *pA) {
+  return 1;
+}
+int matPutVariableAsGlobal(MATFile *pMF, const char *name, const mxArray *pA) {
+  return 1;
+}
+int matDeleteVariable(MATFile *pMF, const char *name) { return 1; }
+
+// engines
+Engine *engOpen(const char *startcmd) {
+  auto ep = new engine;
+  ep->buffer = nullptr;
+  ep->bufferSize = 0;
+  return ep;
+}
+
+Engine *engOpenSingleUse(const char *startcmd, void *reserved,
+                         int *retstatus) {
+  if (retstatus) {
+    *retstatus = 0;
+  }
+  return engOpen(startcmd);
+}
+
+int engSetVisible(Engine *ep, bool newVal) { return 0; }
+
+int engOutputBuffer(Engine *ep, char *buffer, int buflen) {
+  ep->buffer = buffer;
+  ep->bufferSize = buflen;
+  return 0;
+}
+
+int engEvalString(Engine *ep, const char *string) {
+  if (!ep) {
+    return 1;
+  }
+  decltype(MockCommands) commands;
+  {
+    std::lock_guard<std::mutex> lock(MockCommandsMutex);
+    commands = MockCommands;
+  }
+  std::string message;
+  for (auto &statement : SplitStatements(string)) {
+    std::smatch match;
+    auto command = commands.rbegin();
+    while (command != commands.rend() &&
+           !std::regex_match(statement, match, command->first)) {
+      ++command;
+    }
+    message = command != commands.rend()
+                  ? command->second(match, ep->workspace)
+                  : RunBuiltin(statement, ep->workspace);
+    if (!message.empty()) {
+      break;
+    }
+  }
+  if (ep->buffer && ep->bufferSize > 0) {
+    std::strncpy(ep->buffer, message.c_str(), ep->bufferSize - 1);
+    ep->buffer[ep->bufferSize - 1] = '\0';
+  }
+  return 0;
+}
+
+int engClose(Engine *ep) {
+  delete ep;
+  return 0;
+}
+
+mxArray *engGetVariable(Engine *ep, const char *name) {
+  auto it = ep->workspace.find(name);
+  if (it == ep->workspace.end()) {
+    return nullptr;
+  }
+  return mxDuplicateArray(static_cast<mxArray *>(it->second.mxa()));
+}
+
+int engPutVariable(Engine *ep, const char *var_name, const mxArray *ap) {
+  if (!ap) {
+    return 1;
+  }
+  ep->workspace[var_name] = pano::misc::MXA(mxDuplicateArray(ap), true);
+  return 0;
+}
+
+#endif
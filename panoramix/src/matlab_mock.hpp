@@ -0,0 +1,142 @@
+#pragma once
+
+// the subset of the matlab c api (matrix.h, engine.h, mat.h) used by
+// matlab_api.cpp, implemented in process for builds without matlab. arrays
+// behave as in matlab, the engine keeps a workspace and runs the commands
+// registered by misc::RegisterMockMatlabCommand, mat files cannot be opened
+#ifndef PANORAMIX_USE_MATLAB
+
+#include <cstddef>
+#include <cstdint>
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef bool mxLogical;
+typedef char16_t mxChar;
+
+typedef enum {
+  mxUNKNOWN_CLASS = 0,
+  mxCELL_CLASS,
+  mxSTRUCT_CLASS,
+  mxLOGICAL_CLASS,
+  mxCHAR_CLASS,
+  mxVOID_CLASS,
+  mxDOUBLE_CLASS,
+  mxSINGLE_CLASS,
+  mxINT8_CLASS,
+  mxUINT8_CLASS,
+  mxINT16_CLASS,
+  mxUINT16_CLASS,
+  mxINT32_CLASS,
+  mxUINT32_CLASS,
+  mxINT64_CLASS,
+  mxUINT64_CLASS,
+  mxFUNCTION_CLASS,
+  mxOPAQUE_CLASS,
+  mxOBJECT_CLASS
+} mxClassID;
+
+typedef enum { mxREAL, mxCOMPLEX } mxComplexity;
+
+typedef struct mxArray_tag mxArray;
+typedef struct engine Engine;
+typedef struct MatFile_tag MATFile;
+
+// arrays
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid,
+                               mxComplexity flag);
+mxArray *mxCreateNumericArray(mwSize ndim, const mwSize *dims,
+                              mxClassID classid, mxComplexity flag);
+mxArray *mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag);
+mxArray *mxCreateString(const char *str);
+mxArray *mxCreateStringFromNChars(const char *str, mwSize n);
+mxArray *mxCreateCellMatrix(mwSize m, mwSize n);
+mxArray *mxCreateStructMatrix(mwSize m, mwSize n, int nfields,
+                              const char **fieldnames);
+mxArray *mxDuplicateArray(const mxArray *in);
+void mxDestroyArray(mxArray *pa);
+
+void *mxGetData(const mxArray *pa);
+void mxSetData(mxArray *pa, void *newdata);
+double *mxGetPr(const mxArray *pa);
+double *mxGetPi(const mxArray *pa);
+mwIndex *mxGetIr(const mxArray *pa);
+mwIndex *mxGetJc(const mxArray *pa);
+void mxSetJc(mxArray *pa, mwIndex *newjc);
+mwSize mxGetNzmax(const mxArray *pa);
+
+void *mxRealloc(void *ptr, size_t size);
+void mxFree(void *ptr);
+
+bool mxIsNumeric(const mxArray *pa);
+bool mxIsCell(const mxArray *pa);
+bool mxIsLogical(const mxArray *pa);
+bool mxIsChar(const mxArray *pa);
+bool mxIsStruct(const mxArray *pa);
+bool mxIsOpaque(const mxArray *pa);
+bool mxIsFunctionHandle(const mxArray *pa);
+bool mxIsObject(const mxArray *pa);
+bool mxIsComplex(const mxArray *pa);
+bool mxIsSparse(const mxArray *pa);
+bool mxIsDouble(const mxArray *pa);
+bool mxIsSingle(const mxArray *pa);
+bool mxIsInt8(const mxArray *pa);
+bool mxIsUint8(const mxArray *pa);
+bool mxIsInt16(const mxArray *pa);
+bool mxIsUint16(const mxArray *pa);
+bool mxIsInt32(const mxArray *pa);
+bool mxIsUint32(const mxArray *pa);
+bool mxIsInt64(const mxArray *pa);
+bool mxIsUint64(const mxArray *pa);
+bool mxIsEmpty(const mxArray *pa);
+bool mxIsFromGlobalWS(const mxArray *pa);
+void mxSetFromGlobalWS(mxArray *pa, bool global);
+
+mxClassID mxGetClassID(const mxArray *pa);
+const char *mxGetClassName(const mxArray *pa);
+size_t mxGetElementSize(const mxArray *pa);
+mwSize mxGetNumberOfDimensions(const mxArray *pa);
+const mwSize *mxGetDimensions(const mxArray *pa);
+size_t mxGetNumberOfElements(const mxArray *pa);
+size_t mxGetM(const mxArray *pa);
+size_t mxGetN(const mxArray *pa);
+void mxSetM(mxArray *pa, mwSize m);
+void mxSetN(mxArray *pa, mwSize n);
+mwIndex mxCalcSingleSubscript(const mxArray *pa, mwSize nsubs,
+                              const mwIndex *subs);
+
+double mxGetScalar(const mxArray *pa);
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen);
+
+mxArray *mxGetCell(const mxArray *pa, mwIndex i);
+void mxSetCell(mxArray *pa, mwIndex i, mxArray *value);
+int mxGetNumberOfFields(const mxArray *pa);
+const char *mxGetFieldNameByNumber(const mxArray *pa, int n);
+int mxGetFieldNumber(const mxArray *pa, const char *name);
+mxArray *mxGetField(const mxArray *pa, mwIndex i, const char *fieldname);
+void mxSetField(mxArray *pa, mwIndex i, const char *fieldname, mxArray *value);
+mxArray *mxGetProperty(const mxArray *pa, const mwIndex i,
+                       const char *propname);
+void mxSetProperty(mxArray *pa, mwIndex i, const char *propname,
+                   const mxArray *value);
+
+// mat files
+MATFile *matOpen(const char *filename, const char *mode);
+int matClose(MATFile *pMF);
+char **matGetDir(MATFile *pMF, int *num);
+mxArray *matGetVariable(MATFile *pMF, const char *name);
+int matPutVariable(MATFile *pMF, const char *name, const mxArray *pA);
+int matPutVariableAsGlobal(MATFile *pMF, const char *name, const mxArray *pA);
+int matDeleteVariable(MATFile *pMF, const char *name);
+
+// engines
+Engine *engOpen(const char *startcmd);
+Engine *engOpenSingleUse(const char *startcmd, void *reserved, int *retstatus);
+int engSetVisible(Engine *ep, bool newVal);
+int engOutputBuffer(Engine *ep, char *buffer, int buflen);
+int engEvalString(Engine *ep, const char *string);
+int engClose(Engine *ep);
+mxArray *engGetVariable(Engine *ep, const char *name);
+int engPutVariable(Engine *ep, const char *var_name, const mxArray *ap);
+
+#endif
@@ -0,0 +1,241 @@
+#include "pch.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <new>
+
+#include "memory.hpp"
+
+namespace pano {
+namespace misc {
+
+namespace {
+
+// the counters of a scope, a slot is reused by later scopes with a new
+// generation so that frees of memory from an ended scope are not counted
+struct MemorySlot {
+  std::atomic<bool> used;
+  std::atomic<uint32_t> generation;
+  std::atomic<int64_t> nallocs, nfrees, bytes, liveBytes, peakBytes;
+  // the most live since the current MemoryInterval started
+  std::atomic<int64_t> intervalPeakBytes;
+};
+
+// zero initialized before any allocation can happen
+const int NumMemorySlots = 256;
+MemorySlot MemorySlots[NumMemorySlots];
+thread_local int CurrentMemorySlot = -1;
+
+const uint32_t NoMemorySlot = 0xffffffff;
+
+inline void RaisePeak(std::atomic<int64_t> &peakBytes, int64_t live) {
+  int64_t peak = peakBytes.load(std::memory_order_relaxed);
+  while (live > peak && !peakBytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+inline void CountAllocation(int slot, size_t size) {
+  auto &s = MemorySlots[slot];
+  s.nallocs.fetch_add(1, std::memory_order_relaxed);
+  s.bytes.fetch_add(size, std::memory_order_relaxed);
+  int64_t live = s.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+  RaisePeak(s.peakBytes, live);
+  RaisePeak(s.intervalPeakBytes, live);
+}
+
+inline void CountFree(uint32_t slot, uint32_t generation, size_t size) {
+  if (slot == NoMemorySlot) {
+    return;
+  }
+  auto &s = MemorySlots[slot];
+  if (s.generation.load(std::memory_order_relaxed) != generation) {
+    return;
+  }
+  s.nfrees.fetch_add(1, std::memory_order_relaxed);
+  s.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+// put before each block from TrackedAllocate, keeps the 16 byte alignment
+struct AllocationHeader {
+  uint32_t slot;
+  uint32_t generation;
+  uint64_t size;
+};
+static_assert(sizeof(AllocationHeader) == 16, "");
+
+// counts the data of cv::Mat, the slot and generation of each allocation ride
+// in its userdata, the slot is stored plus one so that no tag is null
+class TrackedMatAllocator : public cv::MatAllocator {
+public:
+  cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+                         size_t *step, int flags,
+                         cv::UMatUsageFlags usageFlags) const override {
+    auto u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data,
+                                                  step, flags, usageFlags);
+    if (!u) {
+      return u;
+    }
+    u->currAllocator = this;
+    u->userdata = nullptr;
+    int slot = CurrentMemorySlot;
+    if (!data && slot >= 0) {
+      uint64_t generation =
+          MemorySlots[slot].generation.load(std::memory_order_relaxed);
+      u->userdata = reinterpret_cast<void *>(
+          static_cast<uintptr_t>((generation << 32) | uint32_t(slot + 1)));
+      CountAllocation(slot, u->size);
+    }
+    return u;
+  }
+  bool allocate(cv::UMatData *u, int accessFlags,
+                cv::UMatUsageFlags usageFlags) const override {
+    return cv::Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+  }
+  void deallocate(cv::UMatData *u) const override {
+    if (!u) {
+      return;
+    }
+    if (u->userdata) {
+      auto tag =
+          static_cast<uint64_t>(reinterpret_cast<uintptr_t>(u->userdata));
+      CountFree(uint32_t(tag) - 1, uint32_t(tag >> 32), u->size);
+      u->userdata = nullptr;
+    }
+    cv::Mat::getStdAllocator()->deallocate(u);
+  }
+};
+
+int64_t ReadStatusBytes(const char *key) {
+#ifdef __linux__
+  std::ifstream ifs("/proc/self/status");
+  std::string name;
+  while (ifs >> name) {
+    if (name == key) {
+      int64_t kb = 0;
+      ifs >> kb;
+      return kb * 1024;
+    }
+    ifs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+#endif
+  return -1;
+}
+}
+
+void *TrackedAllocate(size_t size) {
+  auto header = static_cast<AllocationHeader *>(
+      std::malloc(size + sizeof(AllocationHeader)));
+  if (!header) {
+    return nullptr;
+  }
+  int slot = CurrentMemorySlot;
+  header->size = size;
+  header->slot = NoMemorySlot;
+  if (slot >= 0) {
+    header->slot = slot;
+    header->generation =
+        MemorySlots[slot].generation.load(std::memory_order_relaxed);
+    CountAllocation(slot, size);
+  }
+  return header + 1;
+}
+
+void TrackedFree(void *p) {
+  if (!p) {
+    return;
+  }
+  auto header = static_cast<AllocationHeader *>(p) - 1;
+  CountFree(header->slot, header->generation, header->size);
+  std::free(header);
+}
+
+MemoryScope::MemoryScope() : _id(-1), _previous(CurrentMemorySlot) {
+  // never destroyed, mats may outlive the static objects
+  static std::once_flag matAllocatorInstalled;
+  std::call_once(matAllocatorInstalled, []() {
+    cv::Mat::setDefaultAllocator(new TrackedMatAllocator);
+  });
+
+  for (int i = 0; i < NumMemorySlots; i++) {
+    bool unused = false;
+    if (MemorySlots[i].used.compare_exchange_strong(unused, true)) {
+      _id = i;
+      break;
+    }
+  }
+  if (_id == -1) {
+    return; // too many scopes at once, this one counts nothing
+  }
+  auto &s = MemorySlots[_id];
+  s.nallocs = 0;
+  s.nfrees = 0;
+  s.bytes = 0;
+  s.liveBytes = 0;
+  s.peakBytes = 0;
+  s.intervalPeakBytes = 0;
+  CurrentMemorySlot = _id;
+}
+
+MemoryScope::~MemoryScope() {
+  if (_id == -1) {
+    return;
+  }
+  CurrentMemorySlot = _previous;
+  MemorySlots[_id].generation++;
+  MemorySlots[_id].used = false;
+}
+
+MemoryStats MemoryScope::stats() const {
+  MemoryStats stats;
+  if (_id == -1) {
+    return stats;
+  }
+  auto &s = MemorySlots[_id];
+  stats.nallocs = s.nallocs;
+  stats.nfrees = s.nfrees;
+  stats.bytes = s.bytes;
+  stats.liveBytes = s.liveBytes;
+  stats.peakBytes = s.peakBytes;
+  return stats;
+}
+
+int MemoryScope::CurrentId() { return CurrentMemorySlot; }
+
+MemoryInterval::MemoryInterval() : _id(CurrentMemorySlot), _generation(0) {
+  if (_id == -1) {
+    return;
+  }
+  auto &s = MemorySlots[_id];
+  _generation = s.generation;
+  _start.nallocs = s.nallocs;
+  _start.nfrees = s.nfrees;
+  _start.bytes = s.bytes;
+  _start.liveBytes = s.liveBytes;
+  s.intervalPeakBytes = _start.liveBytes;
+}
+
+MemoryStats MemoryInterval::stats() const {
+  MemoryStats stats;
+  if (_id == -1 || MemorySlots[_id].generation != _generation) {
+    return stats;
+  }
+  auto &s = MemorySlots[_id];
+  stats.nallocs = s.nallocs - _start.nallocs;
+  stats.nfrees = s.nfrees - _start.nfrees;
+  stats.bytes = s.bytes - _start.bytes;
+  stats.liveBytes = s.liveBytes - _start.liveBytes;
+  stats.peakBytes = s.intervalPeakBytes - _start.liveBytes;
+  return stats;
+}
+
+MemoryScope::Attach::Attach(int id) : _previous(CurrentMemorySlot) {
+  CurrentMemorySlot = id;
+}
+
+MemoryScope::Attach::~Attach() { CurrentMemorySlot = _previous; }
+
+int64_t ResidentBytes() { return ReadStatusBytes("VmRSS:"); }
+int64_t PeakResidentBytes() { return ReadStatusBytes("VmHWM:"); }
+}
+}
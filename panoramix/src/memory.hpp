@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pano {
+namespace misc {
+
+// MemoryStats
+// heap usage of a MemoryScope, through cv::Mat, and through operator new in
+// the executables built with PANORAMIX_TRACK_OPERATOR_NEW
+struct MemoryStats {
+  int64_t nallocs = 0;
+  int64_t nfrees = 0;
+  int64_t bytes = 0;     // allocated in total
+  int64_t liveBytes = 0; // allocated and not freed yet
+  int64_t peakBytes = 0; // the most live at once
+  template <class Archiver> void serialize(Archiver &ar) {
+    ar(nallocs, nfrees, bytes, liveBytes, peakBytes);
+  }
+};
+
+// MemoryScope
+// counts the allocations made on this thread while it is alive, and on the
+// threads of the ParallelRun calls it makes, the innermost scope of a thread
+// counts them. memory allocated in the scope and freed after it is not
+// counted as freed by it
+class MemoryScope {
+public:
+  MemoryScope();
+  ~MemoryScope();
+  MemoryScope(const MemoryScope &) = delete;
+  MemoryScope &operator=(const MemoryScope &) = delete;
+
+  MemoryStats stats() const;
+
+  // the id of the innermost scope of this thread, -1 if none
+  static int CurrentId();
+
+  // Attach
+  // makes the scope of the id current on this thread while it is alive
+  class Attach {
+  public:
+    explicit Attach(int id);
+    ~Attach();
+    Attach(const Attach &) = delete;
+    Attach &operator=(const Attach &) = delete;
+
+  private:
+    int _previous;
+  };
+
+private:
+  int _id;
+  int _previous;
+};
+
+// MemoryInterval
+// the usage of the scope current on this thread since the interval was made,
+// its liveBytes and peakBytes are above the live bytes of the scope at the
+// start, so allocations of nested scopes are not in it either. the intervals
+// of a scope are measured one at a time
+class MemoryInterval {
+public:
+  MemoryInterval();
+  MemoryInterval(const MemoryInterval &) = delete;
+  MemoryInterval &operator=(const MemoryInterval &) = delete;
+
+  MemoryStats stats() const;
+
+private:
+  int _id;
+  uint32_t _generation;
+  MemoryStats _start;
+};
+
+// malloc with a header that counts the block to the current scope, blocks
+// from TrackedAllocate must be freed by TrackedFree. tracked_new.cpp replaces
+// the global operator new and delete with them
+void *TrackedAllocate(size_t size);
+void TrackedFree(void *p);
+
+// resident memory of the process in bytes, -1 where unknown
+int64_t ResidentBytes();
+int64_t PeakResidentBytes();
+}
+}
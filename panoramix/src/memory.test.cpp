@@ -0,0 +1,149 @@
+#include <memory>
+#include <vector>
+
+#include "image.hpp"
+#include "memory.hpp"
+#include "parallel.hpp"
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+namespace {
+// the first scope of the process, made before main so that it gets slot 0 in
+// generation 0 before any test made a scope
+struct FirstScope {
+  int id;
+  misc::MemoryStats stats;
+  FirstScope() {
+    misc::MemoryScope scope;
+    id = misc::MemoryScope::CurrentId();
+    { core::Image3d im(100, 100); }
+    stats = scope.stats();
+  }
+} TheFirstScope;
+}
+
+TEST(MemoryTest, FirstScopeCountsMatFrees) {
+  EXPECT_EQ(TheFirstScope.id, 0);
+  EXPECT_GE(TheFirstScope.stats.bytes, int64_t(100 * 100 * 3 * sizeof(double)));
+  EXPECT_EQ(TheFirstScope.stats.nfrees, TheFirstScope.stats.nallocs);
+  EXPECT_EQ(TheFirstScope.stats.liveBytes, 0);
+}
+
+TEST(MemoryTest, TrackedAllocate) {
+  misc::MemoryScope scope;
+  void *p = misc::TrackedAllocate(1000);
+  ASSERT_NE(p, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 16, 0);
+  EXPECT_EQ(scope.stats().nallocs, 1);
+  EXPECT_EQ(scope.stats().liveBytes, 1000);
+  misc::TrackedFree(p);
+  auto stats = scope.stats();
+  EXPECT_EQ(stats.nfrees, 1);
+  EXPECT_EQ(stats.liveBytes, 0);
+  EXPECT_EQ(stats.peakBytes, 1000);
+}
+
+// the vectors below only count with the operator new of tracked_new.cpp
+#ifdef PANORAMIX_TRACK_OPERATOR_NEW
+TEST(MemoryTest, ScopeCountsAllocations) {
+  misc::MemoryScope scope;
+  {
+    std::vector<double> data(1000);
+    auto stats = scope.stats();
+    EXPECT_EQ(stats.nallocs, 1);
+    EXPECT_EQ(stats.liveBytes, int64_t(1000 * sizeof(double)));
+  }
+  auto stats = scope.stats();
+  EXPECT_EQ(stats.nfrees, 1);
+  EXPECT_EQ(stats.liveBytes, 0);
+  EXPECT_EQ(stats.bytes, int64_t(1000 * sizeof(double)));
+  EXPECT_EQ(stats.peakBytes, int64_t(1000 * sizeof(double)));
+}
+
+TEST(MemoryTest, InnermostScopeCounts) {
+  misc::MemoryScope outer;
+  std::unique_ptr<int> a(new int(1));
+  misc::MemoryStats innerStats;
+  {
+    misc::MemoryScope inner;
+    std::unique_ptr<double> b(new double(2));
+    innerStats = inner.stats();
+  }
+  EXPECT_EQ(innerStats.nallocs, 1);
+  EXPECT_EQ(innerStats.bytes, int64_t(sizeof(double)));
+  EXPECT_EQ(outer.stats().nallocs, 1);
+  EXPECT_EQ(outer.stats().nfrees, 0);
+}
+
+TEST(MemoryTest, FreesAfterScopeAreNotCounted) {
+  std::unique_ptr<std::vector<char>> data;
+  {
+    misc::MemoryScope scope;
+    data.reset(new std::vector<char>(1 << 20));
+  }
+  misc::MemoryScope scope;
+  data.reset();
+  EXPECT_EQ(scope.stats().nfrees, 0);
+  EXPECT_EQ(scope.stats().liveBytes, 0);
+}
+
+TEST(MemoryTest, ParallelRunCountsToCaller) {
+  misc::MemoryScope scope;
+  core::ParallelRun(8, 4, [](int i) {
+    std::vector<char> data(1 << 20);
+    data[i] = 1;
+  });
+  auto stats = scope.stats();
+  EXPECT_GE(stats.bytes, 8 * (1 << 20));
+  EXPECT_GE(stats.peakBytes, 1 << 20);
+  EXPECT_LE(stats.peakBytes, stats.bytes);
+  EXPECT_EQ(stats.liveBytes, 0);
+}
+
+#endif
+
+TEST(MemoryTest, MatData) {
+  const int64_t bytes = 1000 * 1000 * 3 * sizeof(double);
+  misc::MemoryScope scope;
+  {
+    core::Image3d im(1000, 1000);
+    EXPECT_GE(scope.stats().liveBytes, bytes);
+  }
+  EXPECT_GE(scope.stats().peakBytes, bytes);
+  EXPECT_EQ(scope.stats().liveBytes, 0);
+}
+
+#ifdef PANORAMIX_TRACK_OPERATOR_NEW
+TEST(MemoryTest, IntervalOfScope) {
+  misc::MemoryScope scope;
+  std::vector<char> before(1 << 20);
+  misc::MemoryStats stats;
+  {
+    misc::MemoryInterval interval;
+    { std::vector<char> data(1 << 16); }
+    std::vector<char> kept(1 << 10);
+    stats = interval.stats();
+  }
+  EXPECT_EQ(stats.nallocs, 2);
+  EXPECT_EQ(stats.nfrees, 1);
+  EXPECT_EQ(stats.bytes, (1 << 16) + (1 << 10));
+  EXPECT_EQ(stats.liveBytes, 1 << 10);
+  EXPECT_EQ(stats.peakBytes, 1 << 16);
+  EXPECT_GE(scope.stats().peakBytes, (1 << 20) + (1 << 16));
+}
+
+#endif
+
+TEST(MemoryTest, ResidentBytes) {
+  auto resident = misc::ResidentBytes();
+  auto peak = misc::PeakResidentBytes();
+#ifdef __linux__
+  EXPECT_GT(resident, 0);
+  EXPECT_GE(peak, resident);
+#else
+  EXPECT_EQ(resident, -1);
+  EXPECT_EQ(peak, -1);
+#endif
+}
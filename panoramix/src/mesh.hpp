@@ -6,6 +6,151 @@
 
 namespace pano {
 namespace core {
+
+// HalfEdgeIndex
+// an open addressing table from (from, to) vertex ids to half edge ids, with
+// linear probing, erased keys leave tombstones until the next rehash
+class HalfEdgeIndex {
+public:
+  HalfEdgeIndex() : _size(0), _tombstones(0) {}
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  void clear() {
+    _slots.clear();
+    _size = _tombstones = 0;
+  }
+  void reserve(size_t n) {
+    if ((n + _tombstones) * 2 > _slots.size()) {
+      rehash(n);
+    }
+  }
+
+  // returns -1 if not found
+  int find(int from, int to) const {
+    if (_slots.empty()) {
+      return -1;
+    }
+    uint64_t key = Key(from, to);
+    size_t mask = _slots.size() - 1;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+      const Slot &slot = _slots[i];
+      if (slot.key == key) {
+        return slot.value;
+      }
+      if (slot.key == EmptyKey()) {
+        return -1;
+      }
+    }
+  }
+
+  // overwrites the existing value
+  void insert(int from, int to, int half) {
+    reserve(_size + 1);
+    uint64_t key = Key(from, to);
+    size_t mask = _slots.size() - 1;
+    Slot *tomb = nullptr;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+      Slot &slot = _slots[i];
+      if (slot.key == key) {
+        slot.value = half;
+        return;
+      }
+      if (slot.key == TombKey() && !tomb) {
+        tomb = &slot;
+      } else if (slot.key == EmptyKey()) {
+        if (tomb) {
+          _tombstones--;
+        }
+        Slot &target = tomb ? *tomb : slot;
+        target.key = key;
+        target.value = half;
+        _size++;
+        return;
+      }
+    }
+  }
+
+  bool erase(int from, int to) {
+    if (_slots.empty()) {
+      return false;
+    }
+    uint64_t key = Key(from, to);
+    size_t mask = _slots.size() - 1;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+      Slot &slot = _slots[i];
+      if (slot.key == key) {
+        slot.key = TombKey();
+        _size--;
+        _tombstones++;
+        return true;
+      }
+      if (slot.key == EmptyKey()) {
+        return false;
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    uint64_t key;
+    int value;
+  };
+  static uint64_t EmptyKey() { return ~uint64_t(0); }
+  static uint64_t TombKey() { return ~uint64_t(0) - 1; }
+  static uint64_t Key(int from, int to) {
+    return (uint64_t(uint32_t(from)) << 32) | uint32_t(to);
+  }
+  static size_t Hash(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return static_cast<size_t>(k);
+  }
+  // keeps the load including tombstones under one half
+  void rehash(size_t n) {
+    size_t capacity = 16;
+    while (capacity < n * 2) {
+      capacity *= 2;
+    }
+    std::vector<Slot> old(capacity, Slot{EmptyKey(), -1});
+    std::swap(old, _slots);
+    _size = _tombstones = 0;
+    size_t mask = _slots.size() - 1;
+    for (auto &slot : old) {
+      if (slot.key == EmptyKey() || slot.key == TombKey()) {
+        continue;
+      }
+      size_t i = Hash(slot.key) & mask;
+      while (_slots[i].key != EmptyKey()) {
+        i = (i + 1) & mask;
+      }
+      _slots[i] = slot;
+      _size++;
+    }
+  }
+
+private:
+  std::vector<Slot> _slots;
+  size_t _size, _tombstones;
+};
+
+// MeshTopologyArrays
+// a structure of arrays snapshot of the mesh topology indexed by handle ids,
+// the half edges around vertices and faces are stored as offset tables, ids
+// of removed elements (and handles to them) are -1
+struct MeshTopologyArrays {
+  std::vector<int> halfFrom, halfTo, halfOpposite, halfFace;
+  std::vector<int> vertHalfOffsets, vertHalfs; // vert i: [offsets[i], [i+1])
+  std::vector<int> faceHalfOffsets, faceHalfs; // face i: [offsets[i], [i+1])
+
+  size_t nvertices() const { return vertHalfOffsets.size() - 1; }
+  size_t nhalfedges() const { return halfFrom.size(); }
+  size_t nfaces() const { return faceHalfOffsets.size() - 1; }
+};
+
 // the mesh class
 // the half edge mesh representing a manifold
 template <class VertDataT, class HalfDataT = Dummy, class FaceDataT = Dummy>
@@ -124,6 +269,7 @@ public:
       ht.data = std::forward<HDT>(hd);
       _halfs.push_back(ht);
       _verts[from.id].topo.halfedges.push_back(hh1);
+      indexOutgoingEdge(from, hh1);
     }
     if (hh2.invalid()) {
       hh2 = HalfHandle(_halfs.size());
@@ -135,6 +281,7 @@ public:
       ht.data = std::forward<HDRevT>(hdrev);
       _halfs.push_back(ht);
       _verts[to.id].topo.halfedges.push_back(hh2);
+      indexOutgoingEdge(to, hh2);
     }
 
     _halfs[hh1.id].topo.opposite = hh2;
@@ -233,7 +380,13 @@ public:
   }
 
   HalfHandle findEdge(VertHandle from, VertHandle to) const {
+    if (indexed(from)) {
+      return HalfHandle(_edgeIndex.find(from.id, to.id));
+    }
     for (HalfHandle hh : _verts[from.id].topo.halfedges) {
+      if (!_halfs[hh.id].exists) {
+        continue;
+      }
       assert(_halfs[hh.id].topo.endVertices[0] == from);
       if (_halfs[hh.id].topo.endVertices[1] == to) {
         return hh;
@@ -242,6 +395,21 @@ public:
     return HalfHandle();
   }
 
+  // edge index
+  // makes findEdge, and thus addEdge and addFace, O(1) instead of linear in
+  // the degree for vertices whose degree exceeds EdgeIndexMinDegree, lower
+  // degree vertices are still scanned since that is cheaper than hashing
+  static const size_t EdgeIndexMinDegree = 16;
+  void enableEdgeIndex(bool enable = true) {
+    _edgeIndexEnabled = enable;
+    if (enable) {
+      rebuildEdgeIndex();
+    } else {
+      _edgeIndex.clear();
+    }
+  }
+  bool edgeIndexEnabled() const { return _edgeIndexEnabled; }
+
   size_t degree(VertHandle v) const {
     return _verts[v.id].topo.halfedges.size();
   }
@@ -265,10 +433,17 @@ public:
       hh.reset();
     }
   }
-  void remove(HalfHandle e) {
+  void remove(HalfHandle h) {
     if (h.invalid() || removed(h))
       return;
     HalfHandle hop = _halfs[h.id].topo.opposite;
+    VertHandle from = _halfs[h.id].topo.from(), to = _halfs[h.id].topo.to();
+    if (indexed(from)) {
+      _edgeIndex.erase(from.id, to.id);
+    }
+    if (indexed(to)) {
+      _edgeIndex.erase(to.id, from.id);
+    }
     _halfs[h.id].exists = false;
     _halfs[hop.id].exists = false;
 
@@ -317,51 +492,107 @@ public:
     return *this;
   }
 
-  // garbage collection
-  template <class VertHandlePtrContainerT = std::vector<VertHandle *>,
-            class HalfHandlePtrContainerT = std::vector<HalfHandle *>,
-            class FaceHandlePtrContainerT = std::vector<FaceHandle *>>
-  void gc(const VertHandlePtrContainerT &vps = VertHandlePtrContainerT(),
-          const HalfHandlePtrContainerT &hps = HalfHandlePtrContainerT(),
-          const FaceHandlePtrContainerT &fps = FaceHandlePtrContainerT()) {
-    std::vector<VertHandle> vnlocs;
-    std::vector<HalfHandle> hnlocs;
-    std::vector<FaceHandle> fnlocs;
-    RemoveAndMap(_verts, vnlocs);
-    RemoveAndMap(_halfs, hnlocs);
-    RemoveAndMap(_faces, fnlocs);
+  // compaction
+  // removes the deleted elements and remaps all handles in the mesh, the
+  // returned tables map old handle ids to new handles (invalid if removed)
+  struct HandleMaps {
+    std::vector<VertHandle> verts;
+    std::vector<HalfHandle> halfs;
+    std::vector<FaceHandle> faces;
+  };
+  HandleMaps compact() {
+    HandleMaps maps;
+    RemoveAndMap(_verts, maps.verts);
+    RemoveAndMap(_halfs, maps.halfs);
+    RemoveAndMap(_faces, maps.faces);
 
     for (size_t i = 0; i < _verts.size(); i++) {
-      UpdateOldHandle(vnlocs, _verts[i].topo.hd);
-      UpdateOldHandleContainer(hnlocs, _verts[i].topo.halfedges);
+      UpdateOldHandle(maps.verts, _verts[i].topo.hd);
+      UpdateOldHandleContainer(maps.halfs, _verts[i].topo.halfedges);
       RemoveInValidHandleFromContainer(_verts[i].topo.halfedges);
     }
     for (size_t i = 0; i < _halfs.size(); i++) {
-      UpdateOldHandle(hnlocs, _halfs[i].topo.hd);
-      UpdateOldHandleContainer(vnlocs, _halfs[i].topo.endVertices);
-      UpdateOldHandle(hnlocs, _halfs[i].topo.opposite);
-      UpdateOldHandle(fnlocs, _halfs[i].topo.face);
+      UpdateOldHandle(maps.halfs, _halfs[i].topo.hd);
+      UpdateOldHandleContainer(maps.verts, _halfs[i].topo.endVertices);
+      UpdateOldHandle(maps.halfs, _halfs[i].topo.opposite);
+      UpdateOldHandle(maps.faces, _halfs[i].topo.face);
     }
     for (size_t i = 0; i < _faces.size(); i++) {
-      UpdateOldHandle(fnlocs, _faces[i].topo.hd);
-      UpdateOldHandleContainer(hnlocs, _faces[i].topo.halfedges);
+      UpdateOldHandle(maps.faces, _faces[i].topo.hd);
+      UpdateOldHandleContainer(maps.halfs, _faces[i].topo.halfedges);
       RemoveInValidHandleFromContainer(_faces[i].topo.halfedges);
     }
+    if (_edgeIndexEnabled) {
+      rebuildEdgeIndex();
+    }
+    return maps;
+  }
+
+  // garbage collection
+  template <class VertHandlePtrContainerT = std::vector<VertHandle *>,
+            class HalfHandlePtrContainerT = std::vector<HalfHandle *>,
+            class FaceHandlePtrContainerT = std::vector<FaceHandle *>>
+  void gc(const VertHandlePtrContainerT &vps = VertHandlePtrContainerT(),
+          const HalfHandlePtrContainerT &hps = HalfHandlePtrContainerT(),
+          const FaceHandlePtrContainerT &fps = FaceHandlePtrContainerT()) {
+    HandleMaps maps = compact();
     for (auto vp : vps) {
-      UpdateOldHandle(vnlocs, *vp);
+      UpdateOldHandle(maps.verts, *vp);
     }
     for (auto hp : hps) {
-      UpdateOldHandle(hnlocs, *hp);
+      UpdateOldHandle(maps.halfs, *hp);
     }
     for (auto fp : fps) {
-      UpdateOldHandle(fnlocs, *fp);
+      UpdateOldHandle(maps.faces, *fp);
     }
   }
 
+  // a structure of arrays copy of the topology for traversal heavy code
+  MeshTopologyArrays topologyArrays() const {
+    MeshTopologyArrays arrays;
+    size_t nh = _halfs.size();
+    arrays.halfFrom.resize(nh, -1);
+    arrays.halfTo.resize(nh, -1);
+    arrays.halfOpposite.resize(nh, -1);
+    arrays.halfFace.resize(nh, -1);
+    for (size_t i = 0; i < nh; i++) {
+      auto &h = _halfs[i];
+      if (!h.exists) {
+        continue;
+      }
+      arrays.halfFrom[i] = h.topo.from().id;
+      arrays.halfTo[i] = h.topo.to().id;
+      arrays.halfOpposite[i] = h.topo.opposite.id;
+      arrays.halfFace[i] =
+          h.topo.face.valid() && _faces[h.topo.face.id].exists
+              ? h.topo.face.id
+              : -1;
+    }
+    auto flatten = [this](const auto &elements, std::vector<int> &offsets,
+                          std::vector<int> &halfs) {
+      offsets.resize(elements.size() + 1);
+      offsets[0] = 0;
+      for (size_t i = 0; i < elements.size(); i++) {
+        if (elements[i].exists) {
+          for (HalfHandle hh : elements[i].topo.halfedges) {
+            if (hh.valid() && _halfs[hh.id].exists) {
+              halfs.push_back(hh.id);
+            }
+          }
+        }
+        offsets[i + 1] = halfs.size();
+      }
+    };
+    flatten(_verts, arrays.vertHalfOffsets, arrays.vertHalfs);
+    flatten(_faces, arrays.faceHalfOffsets, arrays.faceHalfs);
+    return arrays;
+  }
+
   void clear() {
     _verts.clear();
     _halfs.clear();
     _faces.clear();
+    _edgeIndex.clear();
   }
 
   template <class T>
@@ -377,14 +608,54 @@ public:
     return HandledTable<FaceHandle, T>(_faces.size(), v);
   }
 
-  template <class Archive> void serialize(Archive &ar) {
+  template <class Archive> void save(Archive &ar) const {
     ar(_verts, _halfs, _faces);
   }
+  template <class Archive> void load(Archive &ar) {
+    ar(_verts, _halfs, _faces);
+    if (_edgeIndexEnabled) {
+      rebuildEdgeIndex();
+    }
+  }
+
+private:
+  // whether the outgoing half edges of v are in the edge index, the degree
+  // never decreases until compaction which rebuilds the index
+  bool indexed(VertHandle v) const {
+    return _edgeIndexEnabled &&
+           _verts[v.id].topo.halfedges.size() > EdgeIndexMinDegree;
+  }
+  void indexOutgoingEdge(VertHandle from, HalfHandle hh) {
+    if (!indexed(from)) {
+      return;
+    }
+    auto &hs = _verts[from.id].topo.halfedges;
+    if (hs.size() > EdgeIndexMinDegree + 1) {
+      _edgeIndex.insert(from.id, _halfs[hh.id].topo.to().id, hh.id);
+      return;
+    }
+    // the vertex has just become indexed
+    for (HalfHandle h : hs) {
+      if (_halfs[h.id].exists) {
+        _edgeIndex.insert(from.id, _halfs[h.id].topo.to().id, h.id);
+      }
+    }
+  }
+  void rebuildEdgeIndex() {
+    _edgeIndex.clear();
+    for (auto &h : _halfs) {
+      if (h.exists && indexed(h.topo.from())) {
+        _edgeIndex.insert(h.topo.from().id, h.topo.to().id, h.topo.hd.id);
+      }
+    }
+  }
 
 private:
   TripletArray<VertTopo, VertDataT> _verts;
   TripletArray<HalfTopo, HalfDataT> _halfs;
   TripletArray<FaceTopo, FaceDataT> _faces;
+  bool _edgeIndexEnabled = false;
+  HalfEdgeIndex _edgeIndex;
 };
 
 using Mesh2 = Mesh<Point2>;
@@ -0,0 +1,237 @@
+#include "clock.hpp"
+#include "mesh.hpp"
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+namespace {
+using TestMesh = core::Mesh<int>;
+
+// a fan of n triangles around vertex 0
+TestMesh MakeFan(int n, bool edgeIndex) {
+  TestMesh mesh;
+  mesh.enableEdgeIndex(edgeIndex);
+  auto center = mesh.addVertex(0);
+  std::vector<TestMesh::VertHandle> rim;
+  for (int i = 0; i < n; i++) {
+    rim.push_back(mesh.addVertex(i + 1));
+  }
+  for (int i = 0; i < n; i++) {
+    mesh.addFace(center, rim[i], rim[(i + 1) % n]);
+  }
+  return mesh;
+}
+
+// a grid of n x n quads
+TestMesh MakeGrid(int n, bool edgeIndex) {
+  TestMesh mesh;
+  mesh.enableEdgeIndex(edgeIndex);
+  std::vector<TestMesh::VertHandle> verts;
+  verts.reserve((n + 1) * (n + 1));
+  for (int i = 0; i < (n + 1) * (n + 1); i++) {
+    verts.push_back(mesh.addVertex(i));
+  }
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      int v = y * (n + 1) + x;
+      mesh.addFace(verts[v], verts[v + 1], verts[v + n + 2], verts[v + n + 1]);
+    }
+  }
+  return mesh;
+}
+
+void ExpectSameEdges(const TestMesh &a, const TestMesh &b) {
+  int nverts = a.internalVertices().size();
+  ASSERT_EQ(nverts, b.internalVertices().size());
+  for (int i = 0; i < nverts; i++) {
+    for (int j = 0; j < nverts; j++) {
+      TestMesh::VertHandle from(i), to(j);
+      EXPECT_EQ(a.findEdge(from, to), b.findEdge(from, to));
+    }
+  }
+}
+}
+
+TEST(Mesh, EdgeIndex) {
+  auto scanned = MakeFan(100, false);
+  auto indexed = MakeFan(100, true);
+  ASSERT_TRUE(indexed.edgeIndexEnabled());
+  ExpectSameEdges(scanned, indexed);
+
+  for (auto mesh : {&scanned, &indexed}) {
+    for (int i = 1; i <= 100; i += 7) {
+      mesh->remove(TestMesh::VertHandle(i));
+    }
+    mesh->remove(mesh->findEdge(TestMesh::VertHandle(0),
+                                TestMesh::VertHandle(50)));
+  }
+  EXPECT_TRUE(indexed
+                  .findEdge(TestMesh::VertHandle(0), TestMesh::VertHandle(50))
+                  .invalid());
+  ExpectSameEdges(scanned, indexed);
+
+  scanned.compact();
+  indexed.compact();
+  ExpectSameEdges(scanned, indexed);
+}
+
+TEST(Mesh, Compact) {
+  auto mesh = MakeGrid(10, true);
+  auto kept = TestMesh::VertHandle(120);
+  mesh.remove(TestMesh::VertHandle(0));
+  mesh.remove(TestMesh::VertHandle(60));
+
+  auto maps = mesh.compact();
+  EXPECT_EQ(121, maps.verts.size());
+  EXPECT_TRUE(maps.verts[0].invalid() && maps.verts[60].invalid());
+  EXPECT_EQ(119, mesh.internalVertices().size());
+  EXPECT_EQ(118, maps.verts[kept.id].id);
+  EXPECT_EQ(120, mesh.data(maps.verts[kept.id]));
+  EXPECT_EQ(100 - 5, mesh.internalFaces().size());
+
+  for (auto &h : mesh.internalHalfEdges()) {
+    EXPECT_TRUE(h.exists);
+    EXPECT_EQ(h.topo.hd, mesh.topo(h.topo.opposite).opposite);
+    EXPECT_EQ(h.topo.hd, mesh.findEdge(h.topo.from(), h.topo.to()));
+  }
+  for (auto &f : mesh.internalFaces()) {
+    EXPECT_EQ(4, f.topo.halfedges.size());
+    for (auto hh : f.topo.halfedges) {
+      EXPECT_EQ(f.topo.hd, mesh.topo(hh).face);
+    }
+  }
+}
+
+TEST(Mesh, TopologyArrays) {
+  auto mesh = MakeGrid(4, false);
+  mesh.remove(TestMesh::VertHandle(6));
+  auto arrays = mesh.topologyArrays();
+  ASSERT_EQ(mesh.internalVertices().size(), arrays.nvertices());
+  ASSERT_EQ(mesh.internalHalfEdges().size(), arrays.nhalfedges());
+  ASSERT_EQ(mesh.internalFaces().size(), arrays.nfaces());
+  for (auto &h : mesh.halfedges()) {
+    int id = h.topo.hd.id;
+    EXPECT_EQ(h.topo.from().id, arrays.halfFrom[id]);
+    EXPECT_EQ(h.topo.to().id, arrays.halfTo[id]);
+    EXPECT_EQ(h.topo.opposite.id, arrays.halfOpposite[id]);
+  }
+  for (auto &f : mesh.faces()) {
+    int id = f.topo.hd.id;
+    EXPECT_EQ(f.topo.halfedges.size(),
+              arrays.faceHalfOffsets[id + 1] - arrays.faceHalfOffsets[id]);
+  }
+  EXPECT_EQ(0, arrays.vertHalfOffsets[7] - arrays.vertHalfOffsets[6]);
+}
+
+TEST(Mesh, BuildAndTraverse) {
+  const int n = 30;
+  for (bool edgeIndex : {false, true}) {
+    auto mesh = MakeGrid(n, edgeIndex);
+    ASSERT_EQ(n * n, mesh.internalFaces().size());
+    ASSERT_EQ(4 * n * n + 4 * n, mesh.internalHalfEdges().size());
+  }
+
+  auto mesh = MakeGrid(n, false);
+  for (int i = 0; i < mesh.internalVertices().size(); i += 10) {
+    mesh.remove(TestMesh::VertHandle(i));
+  }
+
+  // the same sum over the face corners through each layout
+  int sum1 = 0, nfaces = 0;
+  for (auto &f : mesh.faces()) {
+    for (auto hh : f.topo.halfedges) {
+      sum1 += mesh.data(mesh.topo(hh).from());
+    }
+    nfaces++;
+  }
+  auto maps = mesh.compact();
+  int sum2 = 0, sum3 = 0;
+  for (auto &f : mesh.internalFaces()) {
+    for (auto hh : f.topo.halfedges) {
+      sum2 += mesh.data(mesh.topo(hh).from());
+      sum3 += mesh.topo(hh).from().id;
+    }
+  }
+  auto arrays = mesh.topologyArrays();
+  int sum4 = 0;
+  for (int hh : arrays.faceHalfs) {
+    sum4 += arrays.halfFrom[hh];
+  }
+  EXPECT_EQ(nfaces, arrays.nfaces());
+  EXPECT_EQ(sum1, sum2);
+  EXPECT_EQ(sum3, sum4);
+}
+
+TEST(Mesh, BuildFan) {
+  for (bool edgeIndex : {false, true}) {
+    auto mesh = MakeFan(500, edgeIndex);
+    EXPECT_EQ(500, mesh.degree(TestMesh::VertHandle(0)));
+    EXPECT_EQ(500, mesh.internalFaces().size());
+  }
+}
+
+// timings, run with --gtest_also_run_disabled_tests
+TEST(Mesh, DISABLED_BuildAndTraverseMillionFaces) {
+  const int n = 1000;
+  for (bool edgeIndex : {false, true}) {
+    TestMesh mesh;
+    auto buildTime =
+        misc::TimeCost([&mesh, edgeIndex]() { mesh = MakeGrid(n, edgeIndex); });
+    ASSERT_EQ(n * n, mesh.internalFaces().size());
+    std::cout << "build " << n * n << " faces, edge index " << edgeIndex
+              << ": " << buildTime.count() << "ms" << std::endl;
+  }
+
+  auto mesh = MakeGrid(n, false);
+  for (int i = 0; i < mesh.internalVertices().size(); i += 10) {
+    mesh.remove(TestMesh::VertHandle(i));
+  }
+
+  // the same sum over the face corners through each layout
+  size_t sum1 = 0;
+  auto rangeTime = misc::TimeCost([&mesh, &sum1]() {
+    for (auto &f : mesh.faces()) {
+      for (auto hh : f.topo.halfedges) {
+        sum1 += mesh.topo(hh).from().id;
+      }
+    }
+  });
+  auto compactTime = misc::TimeCost([&mesh]() { mesh.compact(); });
+  size_t sum2 = 0;
+  auto compactedTime = misc::TimeCost([&mesh, &sum2]() {
+    for (auto &f : mesh.internalFaces()) {
+      for (auto hh : f.topo.halfedges) {
+        sum2 += mesh.topo(hh).from().id;
+      }
+    }
+  });
+  core::MeshTopologyArrays arrays;
+  auto flattenTime =
+      misc::TimeCost([&mesh, &arrays]() { arrays = mesh.topologyArrays(); });
+  size_t sum3 = 0;
+  auto arraysTime = misc::TimeCost([&arrays, &sum3]() {
+    for (int hh : arrays.faceHalfs) {
+      sum3 += arrays.halfFrom[hh];
+    }
+  });
+  EXPECT_EQ(sum2, sum3);
+  EXPECT_GT(sum1, 0);
+
+  std::cout << "traverse " << arrays.nfaces() << " faces, filtered: "
+            << rangeTime.count() << "ms, compact: " << compactTime.count()
+            << "ms, compacted: " << compactedTime.count()
+            << "ms, to arrays: " << flattenTime.count()
+            << "ms, arrays: " << arraysTime.count() << "ms" << std::endl;
+}
+
+TEST(Mesh, DISABLED_BuildHighValenceFan) {
+  for (bool edgeIndex : {false, true}) {
+    TestMesh mesh;
+    auto buildTime = misc::TimeCost(
+        [&mesh, edgeIndex]() { mesh = MakeFan(20000, edgeIndex); });
+    EXPECT_EQ(20000, mesh.degree(TestMesh::VertHandle(0)));
+    std::cout << "build fan of 20000, edge index " << edgeIndex << ": "
+              << buildTime.count() << "ms" << std::endl;
+  }
+}
@@ -0,0 +1,607 @@
+#include "pch.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "discretization.hpp"
+#include "mesh_export.hpp"
+#include "utility.hpp"
+
+namespace pano {
+namespace core {
+
+namespace {
+
+inline bool IsLittleEndianHost() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+}
+
+// BinaryFileWriter
+// collects small writes into a fixed size buffer, scalars are stored little
+// endian regardless of the host
+class BinaryFileWriter {
+public:
+  explicit BinaryFileWriter(const std::string &fileName,
+                            size_t capacity = 1 << 20)
+      : _ofs(fileName, std::ios::binary), _capacity(capacity), _written(0),
+        _swap(!IsLittleEndianHost()) {
+    _buffer.reserve(_capacity);
+  }
+  ~BinaryFileWriter() { flush(); }
+
+  bool good() const { return !!_ofs; }
+  size_t written() const { return _written; }
+
+  void write(const void *data, size_t n) {
+    if (_buffer.size() + n > _capacity) {
+      flush();
+    }
+    if (n >= _capacity) {
+      _ofs.write(static_cast<const char *>(data), n);
+    } else {
+      auto p = static_cast<const char *>(data);
+      _buffer.insert(_buffer.end(), p, p + n);
+    }
+    _written += n;
+  }
+  void write(const std::string &s) { write(s.data(), s.size()); }
+
+  template <class T> void put(T v) {
+    static_assert(std::is_arithmetic<T>::value, "scalars only");
+    if (_swap) {
+      auto p = reinterpret_cast<uint8_t *>(&v);
+      std::reverse(p, p + sizeof(T));
+    }
+    write(&v, sizeof(T));
+  }
+
+  // write n scalars laid out contiguously
+  template <class T> void putArray(const T *data, size_t n) {
+    if (!_swap) {
+      write(data, n * sizeof(T));
+      return;
+    }
+    for (size_t i = 0; i < n; i++) {
+      put(data[i]);
+    }
+  }
+
+  void flush() {
+    if (!_buffer.empty()) {
+      _ofs.write(_buffer.data(), _buffer.size());
+      _buffer.clear();
+    }
+    _ofs.flush();
+  }
+
+private:
+  std::ofstream _ofs;
+  std::vector<char> _buffer;
+  size_t _capacity;
+  size_t _written;
+  bool _swap;
+};
+
+inline Vec2f EquirectangularTexCoord(const PanoramicCamera &cam,
+                                     const Point3 &p) {
+  auto sz = cam.screenSize();
+  Point2 s = cam.toScreen(p);
+  return Vec2f(s[0] / sz.width, s[1] / sz.height);
+}
+
+// EquirectangularSeam
+// the half plane behind a panorama where u wraps around, u tends to 1 on the
+// side of the camera y axis and to 0 on the other (see PanoramicCamera)
+struct EquirectangularSeam {
+  Point3 eye;
+  Vec3 x, y;
+  explicit EquirectangularSeam(const PanoramicCamera &cam)
+      : eye(cam.eye()), x(normalize(cam.center() - cam.eye())),
+        y(normalize(cam.up().cross(x))) {}
+  double side(const Point3 &p) const { return (p - eye).dot(y); }
+  bool onSeam(const Point3 &p) const {
+    return (p - eye).dot(x) < 0 && std::abs(side(p)) <= 1e-9 * norm(p - eye);
+  }
+};
+
+// SplitAtEquirectangularSeam
+// cuts polygons crossing the seam by the plane of the seam, each piece then
+// has its texture coordinates in one piece of the panorama
+void SplitAtEquirectangularSeam(const Polygon3 &poly,
+                                const EquirectangularSeam &seam,
+                                std::vector<Polygon3> &pieces) {
+  size_t n = poly.corners.size();
+  std::vector<double> sides(n);
+  for (size_t i = 0; i < n; i++) {
+    sides[i] = seam.side(poly.corners[i]);
+  }
+  auto cut = [&poly, &sides, n](size_t i) {
+    size_t j = (i + 1) % n;
+    double t = sides[i] / (sides[i] - sides[j]);
+    return poly.corners[i] + (poly.corners[j] - poly.corners[i]) * t;
+  };
+  bool crossesSeam = false;
+  for (size_t i = 0; i < n; i++) {
+    if (sides[i] * sides[(i + 1) % n] < 0 &&
+        (cut(i) - seam.eye).dot(seam.x) < 0) {
+      crossesSeam = true;
+    }
+  }
+  if (!crossesSeam) {
+    pieces.push_back(poly);
+    return;
+  }
+  Polygon3 positive, negative;
+  positive.normal = negative.normal = poly.normal;
+  for (size_t i = 0; i < n; i++) {
+    if (sides[i] >= 0) {
+      positive.corners.push_back(poly.corners[i]);
+    }
+    if (sides[i] <= 0) {
+      negative.corners.push_back(poly.corners[i]);
+    }
+    if (sides[i] * sides[(i + 1) % n] < 0) {
+      Point3 q = cut(i);
+      positive.corners.push_back(q);
+      negative.corners.push_back(q);
+    }
+  }
+  for (auto *piece : {&positive, &negative}) {
+    if (piece->corners.size() >= 3) {
+      pieces.push_back(std::move(*piece));
+    }
+  }
+}
+
+// triangles of a trimesh crossing the longitude seam get their own copies of
+// the vertices on the left side with u shifted by one, the texture then wraps
+// around
+void FixEquirectangularSeams(ExportMesh &mesh) {
+  std::unordered_map<uint32_t, uint32_t> shifted;
+  auto shiftedCopy = [&mesh, &shifted](uint32_t v) -> uint32_t {
+    auto it = shifted.find(v);
+    if (it != shifted.end()) {
+      return it->second;
+    }
+    uint32_t nv = static_cast<uint32_t>(mesh.positions.size());
+    mesh.positions.push_back(mesh.positions[v]);
+    if (mesh.hasNormals()) {
+      mesh.normals.push_back(mesh.normals[v]);
+    }
+    if (mesh.hasColors()) {
+      mesh.colors.push_back(mesh.colors[v]);
+    }
+    Vec2f uv = mesh.texCoords[v];
+    uv[0] += 1.0f;
+    mesh.texCoords.push_back(uv);
+    shifted.emplace(v, nv);
+    return nv;
+  };
+  for (size_t t = 0; t < mesh.numberOfTriangles(); t++) {
+    uint32_t *tri = mesh.indices.data() + t * 3;
+    float umin = std::numeric_limits<float>::max();
+    float umax = std::numeric_limits<float>::lowest();
+    for (int k = 0; k < 3; k++) {
+      umin = std::min(umin, mesh.texCoords[tri[k]][0]);
+      umax = std::max(umax, mesh.texCoords[tri[k]][0]);
+    }
+    if (umax - umin <= 0.5f) {
+      continue;
+    }
+    for (int k = 0; k < 3; k++) {
+      if (mesh.texCoords[tri[k]][0] < 0.5f) {
+        uint32_t nv = shiftedCopy(tri[k]);
+        tri[k] = nv;
+      }
+    }
+  }
+}
+
+// ReadImageFileForGLB
+// glTF images are png or jpeg, told apart by their signatures
+bool ReadImageFileForGLB(const std::string &fileName, std::vector<char> &bytes,
+                         std::string &mimeType) {
+  std::ifstream ifs(fileName, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  bytes.assign(std::istreambuf_iterator<char>(ifs),
+               std::istreambuf_iterator<char>());
+  static const char png[] = {'\x89', 'P', 'N', 'G'};
+  static const char jpeg[] = {'\xFF', '\xD8', '\xFF'};
+  if (bytes.size() >= sizeof(png) &&
+      std::memcmp(bytes.data(), png, sizeof(png)) == 0) {
+    mimeType = "image/png";
+  } else if (bytes.size() >= sizeof(jpeg) &&
+             std::memcmp(bytes.data(), jpeg, sizeof(jpeg)) == 0) {
+    mimeType = "image/jpeg";
+  } else {
+    return false;
+  }
+  return true;
+}
+}
+
+Vec3 PolygonNormal(const std::vector<Point3> &corners) {
+  Vec3 n(0, 0, 0);
+  for (size_t i = 0; i < corners.size(); i++) {
+    auto &a = corners[i];
+    auto &b = corners[(i + 1) % corners.size()];
+    n[0] += (a[1] - b[1]) * (a[2] + b[2]);
+    n[1] += (a[2] - b[2]) * (a[0] + b[0]);
+    n[2] += (a[0] - b[0]) * (a[1] + b[1]);
+  }
+  double len = norm(n);
+  return len == 0 ? n : n / len;
+}
+
+ExportMesh MakeExportMesh(const std::vector<Polygon3> &polygons,
+                          const ExportMeshOptions &options,
+                          const std::vector<Vec4ub> &polygonColors) {
+  assert(polygonColors.empty() || polygonColors.size() == polygons.size());
+  bool withColors = options.withColors && !polygonColors.empty();
+  bool withTexCoords = options.withTexCoords && options.panorama;
+
+  ExportMesh mesh;
+  size_t ncorners = 0;
+  for (auto &poly : polygons) {
+    ncorners += poly.corners.size();
+  }
+  mesh.positions.reserve(ncorners);
+  mesh.indices.reserve(ncorners * 3);
+
+  std::unique_ptr<EquirectangularSeam> seam;
+  if (withTexCoords) {
+    seam = std::make_unique<EquirectangularSeam>(*options.panorama);
+  }
+  std::vector<int> cornerIds;
+  std::vector<Polygon3> pieces;
+  for (int i = 0; i < polygons.size(); i++) {
+    if (polygons[i].corners.size() < 3) {
+      continue;
+    }
+    pieces.clear();
+    if (seam) {
+      SplitAtEquirectangularSeam(polygons[i], *seam, pieces);
+    } else {
+      pieces.push_back(polygons[i]);
+    }
+    for (auto &poly : pieces) {
+      Vec3 n = norm(poly.normal) == 0 ? PolygonNormal(poly.corners)
+                                      : normalize(poly.normal);
+      // corners on the seam take the u of the side of their piece
+      double side = 0.0;
+      if (seam) {
+        for (auto &c : poly.corners) {
+          side += seam->side(c);
+        }
+      }
+      uint32_t first = static_cast<uint32_t>(mesh.positions.size());
+      for (auto &c : poly.corners) {
+        mesh.positions.push_back(ecast<float>(c));
+        if (options.withNormals) {
+          mesh.normals.push_back(ecast<float>(n));
+        }
+        if (withColors) {
+          mesh.colors.push_back(polygonColors[i]);
+        }
+        if (withTexCoords) {
+          Vec2f uv = EquirectangularTexCoord(*options.panorama, c);
+          if (seam->onSeam(c)) {
+            uv[0] = side > 0 ? 1.0f : 0.0f;
+          }
+          mesh.texCoords.push_back(uv);
+        }
+      }
+
+      Vec3 x, y;
+      std::tie(x, y) = ProposeXYDirectionsFromZDirection(n);
+      cornerIds.resize(poly.corners.size());
+      std::iota(cornerIds.begin(), cornerIds.end(), 0);
+      TriangulatePolygon(
+          cornerIds.begin(), cornerIds.end(),
+          [&poly, &x, &y](int k) {
+            return Vec2(poly.corners[k].dot(x), poly.corners[k].dot(y));
+          },
+          [&mesh, &poly, &n, first](int a, int b, int c) {
+            auto &pa = poly.corners[a];
+            if ((poly.corners[b] - pa).cross(poly.corners[c] - pa).dot(n) <
+                0) {
+              std::swap(b, c);
+            }
+            mesh.indices.push_back(first + a);
+            mesh.indices.push_back(first + b);
+            mesh.indices.push_back(first + c);
+          });
+    }
+  }
+
+  if (withTexCoords) {
+    mesh.textureFile = options.textureFile;
+  }
+  return mesh;
+}
+
+ExportMesh MakeExportMesh(const gui::TriMesh &trimesh,
+                          const ExportMeshOptions &options) {
+  ExportMesh mesh;
+  size_t nverts = trimesh.vertices.size();
+  mesh.positions.reserve(nverts);
+  if (options.withNormals) {
+    mesh.normals.reserve(nverts);
+  }
+  if (options.withColors) {
+    mesh.colors.reserve(nverts);
+  }
+  if (options.withTexCoords) {
+    mesh.texCoords.reserve(nverts);
+  }
+  for (auto &v : trimesh.vertices) {
+    Vec3f p(v.position[0], v.position[1], v.position[2]);
+    p /= v.position[3];
+    mesh.positions.push_back(p);
+    if (options.withNormals) {
+      mesh.normals.push_back(v.normal);
+    }
+    if (options.withColors) {
+      Vec4ub c;
+      for (int k = 0; k < 4; k++) {
+        c[k] = static_cast<uint8_t>(BoundBetween(v.color[k], 0.0f, 1.0f) *
+                                        255.0f +
+                                    0.5f);
+      }
+      mesh.colors.push_back(c);
+    }
+    if (options.withTexCoords) {
+      mesh.texCoords.push_back(
+          options.panorama
+              ? EquirectangularTexCoord(*options.panorama, ecast<double>(p))
+              : v.texCoord);
+    }
+  }
+  mesh.indices.assign(trimesh.iTriangles.begin(), trimesh.iTriangles.end());
+
+  if (options.withTexCoords) {
+    mesh.textureFile = options.textureFile;
+    if (options.panorama) {
+      FixEquirectangularSeams(mesh);
+    }
+  }
+  return mesh;
+}
+
+bool SaveToPLY(const std::string &fileName, const ExportMesh &mesh) {
+  BinaryFileWriter writer(fileName);
+  if (!writer.good()) {
+    return false;
+  }
+
+  std::ostringstream header;
+  header << "ply\n"
+         << "format binary_little_endian 1.0\n"
+         << "comment generated by panoramix\n";
+  if (mesh.hasTexCoords() && !mesh.textureFile.empty()) {
+    header << "comment TextureFile " << mesh.textureFile << "\n";
+  }
+  header << "element vertex " << mesh.numberOfVertices() << "\n"
+         << "property float x\nproperty float y\nproperty float z\n";
+  if (mesh.hasNormals()) {
+    header << "property float nx\nproperty float ny\nproperty float nz\n";
+  }
+  if (mesh.hasColors()) {
+    header << "property uchar red\nproperty uchar green\n"
+           << "property uchar blue\nproperty uchar alpha\n";
+  }
+  if (mesh.hasTexCoords()) {
+    header << "property float s\nproperty float t\n";
+  }
+  header << "element face " << mesh.numberOfTriangles() << "\n"
+         << "property list uchar uint vertex_indices\n"
+         << "end_header\n";
+  writer.write(header.str());
+
+  // vertices are interleaved
+  for (size_t i = 0; i < mesh.numberOfVertices(); i++) {
+    writer.putArray(mesh.positions[i].val, 3);
+    if (mesh.hasNormals()) {
+      writer.putArray(mesh.normals[i].val, 3);
+    }
+    if (mesh.hasColors()) {
+      writer.putArray(mesh.colors[i].val, 4);
+    }
+    if (mesh.hasTexCoords()) {
+      writer.put(mesh.texCoords[i][0]);
+      writer.put(1.0f - mesh.texCoords[i][1]);
+    }
+  }
+  for (size_t t = 0; t < mesh.numberOfTriangles(); t++) {
+    writer.put(uint8_t(3));
+    writer.putArray(mesh.indices.data() + t * 3, 3);
+  }
+
+  writer.flush();
+  return writer.good();
+}
+
+bool SaveToGLB(const std::string &fileName, const ExportMesh &mesh) {
+  enum : uint32_t {
+    GLBMagic = 0x46546C67,
+    GLBVersion = 2,
+    JSONChunk = 0x4E4F534A,
+    BINChunk = 0x004E4942,
+    ArrayBuffer = 34962,
+    ElementArrayBuffer = 34963,
+    UnsignedByte = 5121,
+    UnsignedInt = 5125,
+    Float = 5126
+  };
+
+  // the binary chunk holds one tightly packed view per attribute, every
+  // element size is a multiple of 4 so no padding is needed in between, the
+  // embedded texture comes last
+  struct View {
+    const void *data;
+    size_t byteLength;
+    size_t componentSize;
+    uint32_t target;
+  };
+  std::vector<View> views;
+  std::ostringstream accessors;
+  std::ostringstream attributes;
+  size_t nverts = mesh.numberOfVertices();
+  auto addAccessor = [&views, &accessors](const void *data, size_t elemSize,
+                                          uint32_t target, size_t count,
+                                          uint32_t componentType,
+                                          const char *type,
+                                          bool normalized = false) {
+    int id = static_cast<int>(views.size());
+    size_t componentSize = componentType == UnsignedByte ? 1 : 4;
+    views.push_back(View{data, elemSize * count, componentSize, target});
+    accessors << (id == 0 ? "" : ",") << "{\"bufferView\":" << id
+              << ",\"componentType\":" << componentType
+              << ",\"count\":" << count << ",\"type\":\"" << type << "\"";
+    if (normalized) {
+      accessors << ",\"normalized\":true";
+    }
+    return id;
+  };
+
+  bool hasGeometry = nverts > 0 && mesh.numberOfTriangles() > 0;
+  int indicesView = -1;
+  if (hasGeometry) {
+    Vec3f pmin = mesh.positions.front(), pmax = pmin;
+    for (auto &p : mesh.positions) {
+      for (int k = 0; k < 3; k++) {
+        pmin[k] = std::min(pmin[k], p[k]);
+        pmax[k] = std::max(pmax[k], p[k]);
+      }
+    }
+    attributes << "\"POSITION\":"
+               << addAccessor(mesh.positions.data(), sizeof(Vec3f),
+                              ArrayBuffer, nverts, Float, "VEC3");
+    accessors << std::setprecision(9) << ",\"min\":[" << pmin[0] << ","
+              << pmin[1] << "," << pmin[2] << "],\"max\":[" << pmax[0] << ","
+              << pmax[1] << "," << pmax[2] << "]}";
+    if (mesh.hasNormals()) {
+      attributes << ",\"NORMAL\":"
+                 << addAccessor(mesh.normals.data(), sizeof(Vec3f),
+                                ArrayBuffer, nverts, Float, "VEC3");
+      accessors << "}";
+    }
+    if (mesh.hasColors()) {
+      attributes << ",\"COLOR_0\":"
+                 << addAccessor(mesh.colors.data(), sizeof(Vec4ub),
+                                ArrayBuffer, nverts, UnsignedByte, "VEC4",
+                                true);
+      accessors << "}";
+    }
+    if (mesh.hasTexCoords()) {
+      attributes << ",\"TEXCOORD_0\":"
+                 << addAccessor(mesh.texCoords.data(), sizeof(Vec2f),
+                                ArrayBuffer, nverts, Float, "VEC2");
+      accessors << "}";
+    }
+    indicesView =
+        addAccessor(mesh.indices.data(), sizeof(uint32_t), ElementArrayBuffer,
+                    mesh.indices.size(), UnsignedInt, "SCALAR");
+    accessors << "}";
+  }
+
+  // the texture is embedded so that the file can be moved on its own
+  bool textured = hasGeometry && mesh.hasTexCoords() &&
+                  !mesh.textureFile.empty();
+  std::vector<char> image;
+  std::string mimeType;
+  int imageView = -1;
+  if (textured) {
+    textured = ReadImageFileForGLB(mesh.textureFile, image, mimeType);
+    if (textured) {
+      imageView = static_cast<int>(views.size());
+      views.push_back(View{image.data(), image.size(), 1, 0});
+    } else {
+      std::cout << "texture " << mesh.textureFile
+                << " is not a readable png or jpeg file, it is not embedded"
+                << std::endl;
+    }
+  }
+
+  size_t binLength = 0;
+  std::ostringstream bufferViews;
+  for (int i = 0; i < views.size(); i++) {
+    bufferViews << (i == 0 ? "" : ",") << "{\"buffer\":0,\"byteOffset\":"
+                << binLength << ",\"byteLength\":" << views[i].byteLength;
+    if (views[i].target != 0) {
+      bufferViews << ",\"target\":" << views[i].target;
+    }
+    bufferViews << "}";
+    binLength += views[i].byteLength;
+  }
+  size_t binPadding = (4 - binLength % 4) % 4;
+  binLength += binPadding;
+
+  std::ostringstream json;
+  json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"panoramix\"},"
+       << "\"scene\":0,";
+  if (!hasGeometry) {
+    json << "\"scenes\":[{\"nodes\":[]}]}";
+  } else {
+    json << "\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+         << "\"meshes\":[{\"primitives\":[{\"attributes\":{"
+         << attributes.str() << "},\"indices\":" << indicesView
+         << ",\"material\":0,\"mode\":4}]}],";
+    // layouts are seen from the inside
+    json << "\"materials\":[{\"doubleSided\":true,\"pbrMetallicRoughness\":{"
+         << "\"metallicFactor\":0";
+    if (textured) {
+      json << ",\"baseColorTexture\":{\"index\":0}}}],"
+           << "\"textures\":[{\"sampler\":0,\"source\":0}],"
+           << "\"images\":[{\"bufferView\":" << imageView
+           << ",\"mimeType\":\"" << mimeType << "\"}],"
+           << "\"samplers\":[{\"magFilter\":9729,\"minFilter\":9729,"
+           << "\"wrapS\":10497,\"wrapT\":33071}],";
+    } else {
+      json << "}}],";
+    }
+    json << "\"buffers\":[{\"byteLength\":" << binLength << "}],"
+         << "\"bufferViews\":[" << bufferViews.str() << "],"
+         << "\"accessors\":[" << accessors.str() << "]}";
+  }
+  std::string jsonChunk = json.str();
+  jsonChunk.resize((jsonChunk.size() + 3) / 4 * 4, ' ');
+
+  BinaryFileWriter writer(fileName);
+  if (!writer.good()) {
+    return false;
+  }
+  size_t total = 12 + 8 + jsonChunk.size() + (hasGeometry ? 8 + binLength : 0);
+  writer.put<uint32_t>(GLBMagic);
+  writer.put<uint32_t>(GLBVersion);
+  writer.put<uint32_t>(static_cast<uint32_t>(total));
+  writer.put<uint32_t>(static_cast<uint32_t>(jsonChunk.size()));
+  writer.put<uint32_t>(JSONChunk);
+  writer.write(jsonChunk);
+  if (hasGeometry) {
+    writer.put<uint32_t>(static_cast<uint32_t>(binLength));
+    writer.put<uint32_t>(BINChunk);
+    for (int i = 0; i < views.size(); i++) {
+      if (views[i].componentSize == 1) {
+        writer.write(views[i].data, views[i].byteLength);
+      } else {
+        // float or uint32 components
+        writer.putArray(static_cast<const uint32_t *>(views[i].data),
+                        views[i].byteLength / sizeof(uint32_t));
+      }
+    }
+    for (size_t i = 0; i < binPadding; i++) {
+      writer.put(uint8_t(0));
+    }
+  }
+
+  writer.flush();
+  return writer.good();
+}
+}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "basic_types.hpp"
+#include "cameras.hpp"
+#include "mesh.hpp"
+
+namespace pano {
+namespace gui {
+class TriMesh;
+}
+namespace core {
+
+// ExportMesh
+// an indexed triangle mesh laid out as it is written to binary files,
+// attribute arrays are either empty or sized as positions
+struct ExportMesh {
+  std::vector<Vec3f> positions;
+  std::vector<Vec3f> normals;
+  std::vector<Vec4ub> colors;
+  std::vector<Vec2f> texCoords; // origin at the top left of the texture
+  std::vector<uint32_t> indices; // 3 per triangle
+  std::string textureFile;       // image referenced by texCoords
+
+  size_t numberOfVertices() const { return positions.size(); }
+  size_t numberOfTriangles() const { return indices.size() / 3; }
+  bool hasNormals() const { return !normals.empty(); }
+  bool hasColors() const { return !colors.empty(); }
+  bool hasTexCoords() const { return !texCoords.empty(); }
+};
+
+// ExportMeshOptions
+struct ExportMeshOptions {
+  bool withNormals = true;
+  bool withColors = false;
+  bool withTexCoords = false;
+  // if set, texCoords are equirectangular coordinates of this panorama,
+  // otherwise they are taken from the source mesh when it has any. polygons
+  // crossing the seam of the panorama are split there, triangles of meshes get
+  // copies of their vertices with u beyond 1
+  const PanoramicCamera *panorama = nullptr;
+  std::string textureFile;
+};
+
+// PolygonNormal
+// Newell's method, robust for nonconvex and nearly degenerate loops
+Vec3 PolygonNormal(const std::vector<Point3> &corners);
+
+// MakeExportMesh
+// polygons are triangulated with flat normals, polygonColors is either empty
+// or has one color per polygon
+ExportMesh MakeExportMesh(const std::vector<Polygon3> &polygons,
+                          const ExportMeshOptions &options,
+                          const std::vector<Vec4ub> &polygonColors = {});
+ExportMesh MakeExportMesh(const gui::TriMesh &mesh,
+                          const ExportMeshOptions &options);
+// getPosition: (VertHandle) -> Point3
+template <class VertDataT, class HalfDataT, class FaceDataT,
+          class VertPositionGetterT>
+ExportMesh MakeExportMesh(const Mesh<VertDataT, HalfDataT, FaceDataT> &mesh,
+                          VertPositionGetterT getPosition,
+                          const ExportMeshOptions &options) {
+  std::vector<Polygon3> polygons;
+  polygons.reserve(mesh.internalFaces().size());
+  for (auto &f : mesh.faces()) {
+    Polygon3 poly;
+    poly.corners.reserve(f.topo.halfedges.size());
+    for (auto h : f.topo.halfedges) {
+      poly.corners.push_back(getPosition(mesh.topo(h).from()));
+    }
+    if (poly.corners.size() < 3) {
+      continue;
+    }
+    poly.normal = PolygonNormal(poly.corners);
+    polygons.push_back(std::move(poly));
+  }
+  return MakeExportMesh(polygons, options);
+}
+
+// SaveToPLY
+// binary little endian PLY, texture coordinates use the bottom left origin
+bool SaveToPLY(const std::string &fileName, const ExportMesh &mesh);
+
+// SaveToGLB
+// binary glTF 2.0, the texture (if any) is embedded if it is a png or jpeg
+// file, it repeats horizontally
+bool SaveToGLB(const std::string &fileName, const ExportMesh &mesh);
+}
+}
@@ -0,0 +1,175 @@
+#include "cameras.hpp"
+#include "clock.hpp"
+#include "mesh_export.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+namespace {
+std::vector<core::Polygon3> RandomQuads(int n) {
+  std::vector<core::Polygon3> polygons(n);
+  for (auto &poly : polygons) {
+    core::Point3 c(std::rand() % 100 - 50, std::rand() % 100 - 50,
+                   std::rand() % 100 - 50);
+    core::Vec3 x(1, 0, 0), y(0, 1, 0);
+    poly.corners = {c, c + x, c + x + y, c + y};
+    poly.normal = x.cross(y);
+  }
+  return polygons;
+}
+
+size_t FileSize(const std::string &fileName) {
+  std::ifstream ifs(fileName, std::ios::binary | std::ios::ate);
+  return static_cast<size_t>(ifs.tellg());
+}
+}
+
+TEST(MeshExport, Polygons) {
+  core::Polygon3 poly;
+  poly.corners = {core::Point3(0, 0, 0), core::Point3(2, 0, 0),
+                  core::Point3(2, 2, 0), core::Point3(1, 1, 0),
+                  core::Point3(0, 2, 0)};
+  poly.normal = core::Vec3(0, 0, 0);
+  core::ExportMeshOptions options;
+  options.withColors = true;
+  auto mesh = core::MakeExportMesh(std::vector<core::Polygon3>{poly}, options,
+                                   {core::Vec4ub(1, 2, 3, 4)});
+  EXPECT_EQ(5, mesh.numberOfVertices());
+  EXPECT_EQ(3, mesh.numberOfTriangles());
+  ASSERT_TRUE(mesh.hasNormals() && mesh.hasColors());
+  EXPECT_FALSE(mesh.hasTexCoords());
+  for (auto &n : mesh.normals) {
+    EXPECT_FLOAT_EQ(1.0f, n[2]);
+  }
+  for (size_t t = 0; t < mesh.numberOfTriangles(); t++) {
+    auto &a = mesh.positions[mesh.indices[t * 3]];
+    auto &b = mesh.positions[mesh.indices[t * 3 + 1]];
+    auto &c = mesh.positions[mesh.indices[t * 3 + 2]];
+    EXPECT_GT((b - a).cross(c - a)[2], 0);
+  }
+}
+
+TEST(MeshExport, EquirectangularSeam) {
+  core::PanoramicCamera cam(100);
+  // a wall behind the camera spans the longitude seam
+  core::Polygon3 poly;
+  poly.corners = {core::Point3(-1, -1, -1), core::Point3(-1, 1, -1),
+                  core::Point3(-1, 1, 1), core::Point3(-1, -1, 1)};
+  poly.normal = core::Vec3(1, 0, 0);
+  core::ExportMeshOptions options;
+  options.withTexCoords = true;
+  options.panorama = &cam;
+  auto mesh =
+      core::MakeExportMesh(std::vector<core::Polygon3>{poly}, options);
+  ASSERT_TRUE(mesh.hasTexCoords());
+  // split into two quads, each on one side of the seam
+  EXPECT_EQ(8, mesh.numberOfVertices());
+  EXPECT_EQ(4, mesh.numberOfTriangles());
+  for (auto &uv : mesh.texCoords) {
+    EXPECT_GE(uv[0], 0.0f);
+    EXPECT_LE(uv[0], 1.0f);
+  }
+  for (size_t t = 0; t < mesh.numberOfTriangles(); t++) {
+    float umin = 2, umax = -1;
+    for (int k = 0; k < 3; k++) {
+      float u = mesh.texCoords[mesh.indices[t * 3 + k]][0];
+      umin = std::min(umin, u);
+      umax = std::max(umax, u);
+    }
+    EXPECT_LE(umax - umin, 0.5f);
+  }
+}
+
+TEST(MeshExport, GLBEmbedsTexture) {
+  core::PanoramicCamera cam(100);
+  core::Polygon3 poly;
+  poly.corners = {core::Point3(1, -1, -1), core::Point3(1, 1, -1),
+                  core::Point3(1, 1, 1), core::Point3(1, -1, 1)};
+  poly.normal = core::Vec3(-1, 0, 0);
+  // only the signature tells the image type
+  std::string textureFile = "mesh_export_test_texture.png";
+  std::string texture = "\x89PNG\r\n\x1A\n01234";
+  std::ofstream(textureFile, std::ios::binary) << texture;
+  core::ExportMeshOptions options;
+  options.withTexCoords = true;
+  options.panorama = &cam;
+  options.textureFile = textureFile;
+  auto mesh =
+      core::MakeExportMesh(std::vector<core::Polygon3>{poly}, options);
+  std::string glbFile = "mesh_export_test_textured.glb";
+  ASSERT_TRUE(core::SaveToGLB(glbFile, mesh));
+
+  std::ifstream glb(glbFile, std::ios::binary);
+  uint32_t header[5];
+  glb.read(reinterpret_cast<char *>(header), sizeof(header));
+  EXPECT_EQ(FileSize(glbFile), header[2]);
+  std::string json(header[3], ' ');
+  glb.read(&json[0], json.size());
+  EXPECT_NE(std::string::npos, json.find("\"mimeType\":\"image/png\""));
+  EXPECT_EQ(std::string::npos, json.find("\"uri\""));
+  uint32_t binHeader[2];
+  glb.read(reinterpret_cast<char *>(binHeader), sizeof(binHeader));
+  EXPECT_EQ(0u, binHeader[0] % 4);
+  std::string bin(binHeader[0], '\0');
+  glb.read(&bin[0], bin.size());
+  EXPECT_NE(std::string::npos, bin.find(texture));
+  glb.close();
+
+  std::remove(textureFile.c_str());
+  std::remove(glbFile.c_str());
+}
+
+TEST(MeshExport, SaveVsObj) {
+  auto polygons = RandomQuads(200000);
+  core::ExportMeshOptions options;
+  auto mesh = core::MakeExportMesh(polygons, options);
+
+  std::string objFile = "mesh_export_test.obj";
+  std::string plyFile = "mesh_export_test.ply";
+  std::string glbFile = "mesh_export_test.glb";
+  auto objTime = misc::TimeCost([&]() {
+    std::ofstream ofs(objFile);
+    for (auto &poly : polygons) {
+      for (auto &v : poly.corners) {
+        ofs << "v " << v[0] << " " << v[1] << " " << v[2] << std::endl;
+      }
+    }
+    int vid = 1;
+    for (auto &poly : polygons) {
+      ofs << "f ";
+      for (int k = 0; k < poly.corners.size(); k++) {
+        ofs << (vid++) << " ";
+      }
+      ofs << std::endl;
+    }
+  });
+  bool plySaved = false, glbSaved = false;
+  auto plyTime =
+      misc::TimeCost([&]() { plySaved = core::SaveToPLY(plyFile, mesh); });
+  auto glbTime =
+      misc::TimeCost([&]() { glbSaved = core::SaveToGLB(glbFile, mesh); });
+  ASSERT_TRUE(plySaved && glbSaved);
+
+  std::cout << "obj: " << objTime.count() << "ms, " << FileSize(objFile)
+            << " bytes" << std::endl;
+  std::cout << "ply: " << plyTime.count() << "ms, " << FileSize(plyFile)
+            << " bytes" << std::endl;
+  std::cout << "glb: " << glbTime.count() << "ms, " << FileSize(glbFile)
+            << " bytes" << std::endl;
+
+  std::ifstream glb(glbFile, std::ios::binary);
+  uint32_t header[3];
+  glb.read(reinterpret_cast<char *>(header), sizeof(header));
+  EXPECT_EQ(0x46546C67u, header[0]);
+  EXPECT_EQ(2u, header[1]);
+  EXPECT_EQ(FileSize(glbFile), header[2]);
+  glb.close();
+
+  std::remove(objFile.c_str());
+  std::remove(plyFile.c_str());
+  std::remove(glbFile.c_str());
+}
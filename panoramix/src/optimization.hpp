@@ -3,6 +3,7 @@
 #include "basic_types.hpp"
 #include "containers.hpp"
 #include "eigen.hpp"
+#include "parallel.hpp"
 
 namespace pano {
 namespace experimental {
@@ -20,9 +21,81 @@ int SimulatedAnnealing(StateT &initialState, EnergyFunT energyFun,
                        NeighborsFunT neighborsFun, RNG &&rng,
                        double stopWhenEnergyIsLowerThan = 1e-5);
 
+// ParallelTemperingOptions
+struct ParallelTemperingOptions {
+  std::vector<double> temperatures; // one chain each, ascending
+  int swapInterval;                 // iterations between swap moves
+  int maxIters;
+  int stagnationIters; // stop if no improvement for so long, 0 to disable
+  double stopWhenEnergyIsLowerThan;
+  unsigned seed;
+  ParallelTemperingOptions()
+      : temperatures({0.01, 0.03, 0.1, 0.3, 1.0}), swapInterval(100),
+        maxIters(100000), stagnationIters(0),
+        stopWhenEnergyIsLowerThan(1e-5), seed(0) {}
+};
+
+// ParallelTempering
+// replica exchange: a chain per temperature makes the moves of
+// SimulatedAnnealing on its own thread, every swapInterval iterations chains
+// of neighboring temperatures exchange their states with the probability
+// min(1, exp((Ei - Ej)(1/Ti - 1/Tj))), the chains and the swaps use their own
+// rngs seeded from options.seed so the result is reproducible
+// - EnergyFunT: (StateT)->Scalar, called concurrently
+// - NeighborsFunT: (StateT, int iter, ((StateT)->void) callback ), called
+// concurrently
+template <class StateT, class EnergyFunT, class NeighborsFunT>
+int ParallelTempering(StateT &initialState, EnergyFunT energyFun,
+                      NeighborsFunT neighborsFun,
+                      const ParallelTemperingOptions &options =
+                          ParallelTemperingOptions());
+
 template <class EnergyFunT>
 std::vector<bool> BeamSearch(size_t nconfigs, EnergyFunT energy_fun,
                              size_t beam_width);
+
+// BitState
+// a binary state packed into 64 bit words
+class BitState {
+public:
+  BitState() : _nbits(0) {}
+  explicit BitState(size_t nbits) : _nbits(nbits), _words((nbits + 63) / 64) {}
+  explicit BitState(const std::vector<bool> &bits);
+
+  size_t size() const { return _nbits; }
+  bool operator[](size_t i) const { return test(i); }
+  bool test(size_t i) const { return (_words[i / 64] >> (i % 64)) & 1; }
+  void set(size_t i, bool b = true) {
+    uint64_t mask = uint64_t(1) << (i % 64);
+    _words[i / 64] = b ? (_words[i / 64] | mask) : (_words[i / 64] & ~mask);
+  }
+  size_t count() const;
+
+  const std::vector<uint64_t> &words() const { return _words; }
+  std::vector<bool> toStdVector() const;
+
+  bool operator==(const BitState &s) const {
+    return _nbits == s._nbits && _words == s._words;
+  }
+  bool operator!=(const BitState &s) const { return !(*this == s); }
+
+private:
+  size_t _nbits;
+  std::vector<uint64_t> _words;
+};
+
+// ParallelBeamSearch
+// BeamSearch on packed states, the children of the beam are expanded and
+// scored on several threads and the per thread best are merged into the next
+// beam, children reached from several parents are scored once: states are
+// keyed by zobrist hashes (xor of a random word per set bit) in a hashed
+// visited set, which holds at most maxVisitedStates keys per generation by
+// expanding fewer parents of the beam
+// - EnergyFunT: (const BitState &)->Scalar, called concurrently
+template <class EnergyFunT>
+BitState ParallelBeamSearch(size_t nconfigs, EnergyFunT energyFun,
+                            size_t beamWidth,
+                            size_t maxVisitedStates = 1 << 24);
 }
 }
 
@@ -94,6 +167,115 @@ int SimulatedAnnealing(StateT &initialState, EnergyFunT energyFun,
   return i;
 }
 
+template <class StateT, class EnergyFunT, class NeighborsFunT>
+int ParallelTempering(StateT &initialState, EnergyFunT energyFun,
+                      NeighborsFunT neighborsFun,
+                      const ParallelTemperingOptions &options) {
+  struct Chain {
+    StateT state;
+    double energy;
+    StateT bestState;
+    double bestEnergy;
+    std::mt19937 rng;
+    bool stuck; // no neighbors
+  };
+
+  int nchains = options.temperatures.size();
+  assert(nchains > 0 && options.swapInterval > 0);
+  StateT &finalState = initialState;
+  double finalEnergy = energyFun(initialState);
+
+  std::vector<Chain> chains;
+  chains.reserve(nchains);
+  for (int c = 0; c < nchains; c++) {
+    chains.push_back(Chain{initialState, finalEnergy, initialState,
+                           finalEnergy, std::mt19937(options.seed + c),
+                           false});
+  }
+  std::mt19937 swapRng(options.seed + nchains);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+  int concurrency =
+      std::min<int>(std::max<int>(std::thread::hardware_concurrency(), 1),
+                    nchains);
+  int i = 0;
+  int lastImprovement = 0;
+  int nswaps = 0;
+  while (i < options.maxIters) {
+    int niters = std::min(options.swapInterval, options.maxIters - i);
+    ParallelRun(nchains, concurrency, [&](int c) {
+      Chain &chain = chains[c];
+      double temperature = options.temperatures[c];
+      std::uniform_real_distribution<double> chainDist(0.0, 1.0);
+      for (int k = 0; k < niters && !chain.stuck; k++) {
+        StateT newStateWithLowestEnergy;
+        double lowestEnergy = std::numeric_limits<double>::infinity();
+        bool hasNewState = false;
+        neighborsFun(chain.state, i + k,
+                     [&newStateWithLowestEnergy, &lowestEnergy, &hasNewState,
+                      &energyFun](auto &&newState) {
+                       double newEnergy = energyFun(newState);
+                       if (newEnergy < lowestEnergy) {
+                         newStateWithLowestEnergy = newState;
+                         lowestEnergy = newEnergy;
+                         hasNewState = true;
+                       }
+                     });
+        if (!hasNewState) {
+          chain.stuck = true;
+          break;
+        }
+
+        double prob = 1.0;
+        if (chain.energy <= lowestEnergy) {
+          prob = exp(-(lowestEnergy - chain.energy) / temperature);
+        }
+        if (prob >= chainDist(chain.rng)) {
+          chain.state = std::move(newStateWithLowestEnergy);
+          chain.energy = lowestEnergy;
+          if (chain.energy < chain.bestEnergy) {
+            chain.bestState = chain.state;
+            chain.bestEnergy = chain.energy;
+            if (chain.bestEnergy < options.stopWhenEnergyIsLowerThan) {
+              break;
+            }
+          }
+        }
+      }
+    });
+    i += niters;
+
+    bool allStuck = true;
+    for (auto &chain : chains) {
+      if (chain.bestEnergy < finalEnergy) {
+        finalState = chain.bestState;
+        finalEnergy = chain.bestEnergy;
+        lastImprovement = i;
+      }
+      allStuck = allStuck && chain.stuck;
+    }
+    if (finalEnergy < options.stopWhenEnergyIsLowerThan || allStuck ||
+        (options.stagnationIters > 0 &&
+         i - lastImprovement >= options.stagnationIters)) {
+      break;
+    }
+
+    // swap moves between even or odd pairs of neighboring temperatures
+    for (int c = nswaps++ % 2; c + 1 < nchains; c += 2) {
+      Chain &a = chains[c];
+      Chain &b = chains[c + 1];
+      double x = (a.energy - b.energy) * (1.0 / options.temperatures[c] -
+                                          1.0 / options.temperatures[c + 1]);
+      if (x >= 0 || exp(x) >= dist(swapRng)) {
+        std::swap(a.state, b.state);
+        std::swap(a.energy, b.energy);
+        std::swap(a.stuck, b.stuck);
+      }
+    }
+  }
+  return i;
+}
+
 template <class EnergyFunT>
 std::vector<bool> BeamSearch(size_t nconfigs, EnergyFunT energy_fun,
                              size_t beam_width) {
@@ -141,5 +323,159 @@ std::vector<bool> BeamSearch(size_t nconfigs, EnergyFunT energy_fun,
 
   return cur_best_config;
 }
+
+inline BitState::BitState(const std::vector<bool> &bits)
+    : BitState(bits.size()) {
+  for (size_t i = 0; i < bits.size(); i++) {
+    if (bits[i]) {
+      set(i);
+    }
+  }
+}
+
+inline size_t BitState::count() const {
+  size_t c = 0;
+  for (uint64_t w : _words) {
+    w = w - ((w >> 1) & 0x5555555555555555ull);
+    w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+    w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    c += (w * 0x0101010101010101ull) >> 56;
+  }
+  return c;
+}
+
+inline std::vector<bool> BitState::toStdVector() const {
+  std::vector<bool> bits(_nbits);
+  for (size_t i = 0; i < _nbits; i++) {
+    bits[i] = test(i);
+  }
+  return bits;
+}
+
+template <class EnergyFunT>
+BitState ParallelBeamSearch(size_t nconfigs, EnergyFunT energyFun,
+                            size_t beamWidth, size_t maxVisitedStates) {
+  struct Node {
+    BitState state;
+    uint64_t key;
+    double energy;
+  };
+  // a child of the beam, ordered by energy then key so that the result does
+  // not depend on the number of threads
+  struct Candidate {
+    double energy;
+    uint64_t key;
+    int parent;
+    int bit;
+    bool operator<(const Candidate &c) const {
+      return energy < c.energy || (energy == c.energy && key < c.key);
+    }
+  };
+
+  std::vector<uint64_t> zobrist(nconfigs);
+  std::mt19937_64 rng(nconfigs);
+  for (auto &z : zobrist) {
+    z = rng();
+  }
+
+  std::vector<Node> beam(1, Node{BitState(nconfigs), 0, 0.0});
+  beam[0].energy = energyFun(beam[0].state);
+  Node best = beam[0];
+  best.energy = std::numeric_limits<double>::infinity();
+
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  // candidates by the thread expanding them and the thread scoring them
+  std::vector<std::vector<std::vector<Candidate>>> shards(
+      concurrency, std::vector<std::vector<Candidate>>(concurrency));
+  std::vector<std::vector<Candidate>> tops(concurrency);
+
+  while (!beam.empty()) {
+    if (beam.front().energy < best.energy) {
+      best = beam.front();
+    }
+
+    // expand the best parents whose children fit in the visited set
+    int nparents = 0;
+    size_t nchildren = 0;
+    while (nparents < beam.size()) {
+      size_t n = nconfigs - beam[nparents].state.count();
+      if (nparents > 0 && nchildren + n > maxVisitedStates) {
+        break;
+      }
+      nchildren += n;
+      nparents++;
+    }
+
+    ParallelRun(concurrency, concurrency, [&](int t) {
+      for (auto &shard : shards[t]) {
+        shard.clear();
+      }
+      for (int p = t; p < nparents; p += concurrency) {
+        auto &parent = beam[p];
+        for (int k = 0; k < nconfigs; k++) {
+          if (!parent.state.test(k)) {
+            uint64_t key = parent.key ^ zobrist[k];
+            shards[t][(key >> 32) % concurrency].push_back(
+                Candidate{0.0, key, p, k});
+          }
+        }
+      }
+    });
+
+    double bound = best.energy;
+    ParallelRun(concurrency, concurrency, [&](int t) {
+      size_t n = 0;
+      for (int from = 0; from < concurrency; from++) {
+        n += shards[from][t].size();
+      }
+      std::unordered_set<uint64_t> visited;
+      visited.reserve(n);
+      auto &top = tops[t];
+      top.clear();
+      BitState child;
+      for (int from = 0; from < concurrency; from++) {
+        for (auto &c : shards[from][t]) {
+          if (!visited.insert(c.key).second) {
+            continue;
+          }
+          child = beam[c.parent].state;
+          child.set(c.bit);
+          c.energy = energyFun(child);
+          if (c.energy > bound) {
+            continue;
+          }
+          // a max heap of the beamWidth best
+          if (top.size() < beamWidth) {
+            top.push_back(c);
+            std::push_heap(top.begin(), top.end());
+          } else if (c < top.front()) {
+            std::pop_heap(top.begin(), top.end());
+            top.back() = c;
+            std::push_heap(top.begin(), top.end());
+          }
+        }
+      }
+    });
+
+    // merge the best of all threads into the next beam
+    std::vector<Candidate> merged;
+    for (auto &top : tops) {
+      merged.insert(merged.end(), top.begin(), top.end());
+    }
+    size_t nkept = std::min(merged.size(), beamWidth);
+    std::partial_sort(merged.begin(), merged.begin() + nkept, merged.end());
+    std::vector<Node> next(nkept);
+    for (size_t i = 0; i < nkept; i++) {
+      auto &c = merged[i];
+      next[i].state = beam[c.parent].state;
+      next[i].state.set(c.bit);
+      next[i].key = c.key;
+      next[i].energy = c.energy;
+    }
+    beam = std::move(next);
+  }
+
+  return best.state;
+}
+}
 }
-}
\ No newline at end of file
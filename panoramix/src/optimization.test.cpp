@@ -1,4 +1,5 @@
 #include "../panoramix.unittest.hpp"
+#include "clock.hpp"
 #include "optimization.hpp"
 
 using namespace pano;
@@ -18,4 +19,147 @@ TEST(OptimizationTest, SimulatedAnnealing) {
                          },
                          rng);
   ASSERT_TRUE(abs(solution - 1) < 0.1);
-}
\ No newline at end of file
+}
+
+namespace {
+// a deterministic pseudo random number in [-1, 1)
+double Hash(double s, int iter) {
+  double x = std::sin(s * 78.233 + iter * 12.9898) * 43758.5453;
+  return (x - std::floor(x)) * 2 - 1;
+}
+}
+
+TEST(OptimizationTest, ParallelTempering) {
+  // a wide basin at -10 the chains fall into first and a narrow global
+  // minimum at 3 behind a barrier
+  auto energy = [](double s) {
+    return std::min(0.05 * (s + 10) * (s + 10) + 0.5, 2 * (s - 3) * (s - 3));
+  };
+  auto neighbors = [](double s, int iter, auto &&forEachNeighbor) {
+    forEachNeighbor(s + Hash(s, iter) * 0.5);
+  };
+  const double target = 1e-3;
+  const int maxIters = 200000;
+
+  double solution1 = -20.0;
+  int niters1 = 0;
+  std::default_random_engine rng;
+  auto time1 = misc::TimeCost([&]() {
+    niters1 = SimulatedAnnealing(
+        solution1, energy, [](int iter) { return 1.0 / (iter + 1); },
+        [&neighbors](double s, int iter, auto &&forEachNeighbor) {
+          if (iter < maxIters) {
+            neighbors(s, iter, forEachNeighbor);
+          }
+        },
+        rng, target);
+  });
+
+  ParallelTemperingOptions options;
+  options.temperatures = {0.01, 0.1, 0.3, 1.0, 3.0};
+  options.maxIters = maxIters;
+  options.stopWhenEnergyIsLowerThan = target;
+  double solution2 = -20.0;
+  int niters2 = 0;
+  auto time2 = misc::TimeCost([&]() {
+    niters2 = ParallelTempering(solution2, energy, neighbors, options);
+  });
+  EXPECT_LT(energy(solution2), target);
+
+  // reproducible
+  double solution3 = -20.0;
+  int niters3 = ParallelTempering(solution3, energy, neighbors, options);
+  EXPECT_EQ(niters2, niters3);
+  EXPECT_EQ(solution2, solution3);
+
+  // stagnation
+  options.stopWhenEnergyIsLowerThan = 0.0;
+  options.stagnationIters = 1000;
+  double solution4 = -20.0;
+  int niters4 = ParallelTempering(solution4, energy, neighbors, options);
+  EXPECT_LT(niters4, maxIters);
+
+  std::cout << "SimulatedAnnealing: energy " << energy(solution1) << " after "
+            << niters1 << " iterations in " << time1.count()
+            << "ms, ParallelTempering: energy " << energy(solution2)
+            << " after " << niters2 << " iterations in " << time2.count()
+            << "ms" << std::endl;
+}
+
+namespace {
+std::vector<double> RandomWeights(int n) {
+  std::default_random_engine rng(n);
+  std::uniform_real_distribution<double> dist(-1.0, 0.0);
+  std::vector<double> weights(n);
+  for (auto &w : weights) {
+    w = dist(rng);
+  }
+  return weights;
+}
+}
+
+TEST(OptimizationTest, ParallelBeamSearch) {
+  const int n = 300, k = 12;
+  auto weights = RandomWeights(n);
+  auto energy = [&weights, k](const auto &state) {
+    double e = 0.0;
+    int count = 0;
+    for (int i = 0; i < state.size(); i++) {
+      if (state[i]) {
+        e += weights[i];
+        count++;
+      }
+    }
+    return e + 0.05 * (count - k) * (count - k);
+  };
+
+  std::vector<bool> result1;
+  BitState result2, result3;
+  auto time1 = misc::TimeCost([&]() { result1 = BeamSearch(n, energy, 8); });
+  auto time2 =
+      misc::TimeCost([&]() { result2 = ParallelBeamSearch(n, energy, 8); });
+  // a visited set smaller than the children of the beam
+  auto time3 = misc::TimeCost(
+      [&]() { result3 = ParallelBeamSearch(n, energy, 8, 1000); });
+  EXPECT_EQ(result1, result2.toStdVector());
+  EXPECT_DOUBLE_EQ(energy(result1), energy(result3));
+  std::cout << "BeamSearch: " << time1.count()
+            << "ms, ParallelBeamSearch: " << time2.count() << "ms, "
+            << time3.count() << "ms with a capped visited set" << std::endl;
+}
+
+TEST(OptimizationTest, ParallelBeamSearchThousandsOfVariables) {
+  const int n = 4000, k = 20;
+  auto weights = RandomWeights(n);
+  // visits the set bits only
+  auto energy = [&weights, k](const BitState &state) {
+    double e = 0.0;
+    int count = 0;
+    for (int w = 0; w < state.words().size(); w++) {
+      uint64_t word = state.words()[w];
+      for (int b = 0; word != 0; b++, word >>= 1) {
+        if (word & 1) {
+          e += weights[w * 64 + b];
+          count++;
+        }
+      }
+    }
+    return e + 0.05 * (count - k) * (count - k);
+  };
+
+  BitState result;
+  auto time =
+      misc::TimeCost([&]() { result = ParallelBeamSearch(n, energy, 16); });
+  std::vector<double> sorted = weights;
+  std::sort(sorted.begin(), sorted.end());
+  double optimum = 0.0;
+  int count = 0;
+  while (count < n && sorted[count] + 0.05 * (2 * (count - k) + 1) < 0) {
+    optimum += sorted[count] + 0.05 * (2 * (count - k) + 1);
+    count++;
+  }
+  optimum += 0.05 * k * k;
+  EXPECT_NEAR(optimum, energy(result), 1e-9);
+  std::cout << "ParallelBeamSearch with " << n << " variables: "
+            << time.count() << "ms" << std::endl;
+}
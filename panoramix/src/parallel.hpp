@@ -2,6 +2,8 @@
 
 #include <thread>
 
+#include "memory.hpp"
+
 namespace pano {
 namespace core {
 template <class FunT> void ParallelRun(int n, int concurrency_num, FunT &&fun);
@@ -18,8 +20,15 @@ namespace core {
 template <class FunT> void ParallelRun(int n, int concurrency_num, FunT &&fun) {
   std::vector<std::thread> threads;
   threads.reserve(concurrency_num);
+  // allocations of the threads count to the memory scope of the caller
+  int memoryScope = misc::MemoryScope::CurrentId();
   for (int i = 0; i < n; i++) {
-    threads.emplace_back(std::forward<FunT>(fun), i);
+    threads.emplace_back(
+        [fun, memoryScope](int i) {
+          misc::MemoryScope::Attach attach(memoryScope);
+          fun(i);
+        },
+        i);
     if (threads.size() >= concurrency_num || i == n - 1) {
       for (auto &t : threads) {
         t.join();
@@ -33,13 +42,15 @@ template <class FunT>
 void ParallelRun(int n, int concurrency_num, int batch_num, FunT &&fun) {
   std::vector<std::thread> threads;
   threads.reserve(concurrency_num);
+  int memoryScope = misc::MemoryScope::CurrentId();
   for (int bid = 0; bid < n / batch_num + 1; bid++) {
     int bfirst = bid * batch_num;
     int blast = std::min(n, (bid + 1) * batch_num) - 1;
     std::cout << "processing " << bfirst << "-" << blast << "  with total " << n
               << std::endl;
     threads.emplace_back(
-        [fun](int first, int last) {
+        [fun, memoryScope](int first, int last) {
+          misc::MemoryScope::Attach attach(memoryScope);
           for (int i = first; i <= last; i++) {
             fun(i);
           }
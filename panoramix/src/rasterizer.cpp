@@ -0,0 +1,228 @@
+#include "pch.hpp"
+
+#include "parallel.hpp"
+#include "rasterizer.hpp"
+#include "utility.hpp"
+
+namespace pano {
+namespace core {
+
+namespace {
+
+// a triangle relative to the eye, prepared for ray intersection
+struct RasterTriangle {
+  Point3 a;
+  Vec3 e1, e2;
+};
+
+// a triangulated polygon relative to the eye, its plane and the spherical cap
+// (center direction and angular radius) that contains it on the view sphere
+struct RasterFace {
+  std::vector<RasterTriangle> triangles;
+  Vec3 normal;
+  // range of normal.dot(p) over the corners, a single value if planar
+  double offsetMin, offsetMax;
+  Vec3 capCenter;
+  double capRadius;
+};
+
+// tiles of this size are culled against the face caps
+const int RasterTileSize = 32;
+
+RasterFace MakeRasterFace(const Polygon3 &polygon, const Point3 &eye) {
+  RasterFace face;
+  face.capCenter = Vec3(0, 0, 0);
+  face.capRadius = M_PI;
+  face.offsetMin = face.offsetMax = 0;
+  if (polygon.corners.size() < 3 || norm(polygon.normal) == 0) {
+    return face;
+  }
+
+  std::vector<Point3> corners(polygon.corners.size());
+  for (int i = 0; i < corners.size(); i++) {
+    corners[i] = polygon.corners[i] - eye;
+  }
+  face.normal = normalize(polygon.normal);
+  face.offsetMin = std::numeric_limits<double>::max();
+  face.offsetMax = std::numeric_limits<double>::lowest();
+  for (auto &p : corners) {
+    double offset = face.normal.dot(p);
+    face.offsetMin = std::min(face.offsetMin, offset);
+    face.offsetMax = std::max(face.offsetMax, offset);
+  }
+
+  Vec3 x, y;
+  std::tie(x, y) = ProposeXYDirectionsFromZDirection(face.normal);
+  TriangulatePolygon(
+      corners.begin(), corners.end(),
+      [&x, &y](const Point3 &v) { return Vec2(v.dot(x), v.dot(y)); },
+      [&face](const Point3 &a, const Point3 &b, const Point3 &c) {
+        face.triangles.push_back(RasterTriangle{a, b - a, c - a});
+      });
+
+  // a polygon never crosses its own plane through the eye, so the cap of its
+  // corners contains it as long as the cap is less than a hemisphere
+  for (auto &p : corners) {
+    face.capCenter += normalize(p);
+  }
+  if (norm(face.capCenter) > 1e-8) {
+    face.capCenter = normalize(face.capCenter);
+    double radius = 0.0;
+    for (auto &p : corners) {
+      radius = std::max(radius, AngleBetweenDirected(face.capCenter, p));
+    }
+    if (radius < M_PI_2) {
+      face.capRadius = radius;
+    }
+  }
+  return face;
+}
+
+// intersect the ray from the eye along dir with the triangle
+inline bool IntersectRayAndTriangle(const Vec3 &dir, const RasterTriangle &tri,
+                                    double &lambda) {
+  Vec3 p = dir.cross(tri.e2);
+  double det = tri.e1.dot(p);
+  if (det == 0) {
+    return false;
+  }
+  double invDet = 1.0 / det;
+  Vec3 t = -tri.a;
+  double u = t.dot(p) * invDet;
+  if (u < 0 || u > 1) {
+    return false;
+  }
+  Vec3 q = t.cross(tri.e1);
+  double v = dir.dot(q) * invDet;
+  if (v < 0 || u + v > 1) {
+    return false;
+  }
+  lambda = tri.e2.dot(q) * invDet;
+  return lambda > 0;
+}
+
+template <class CameraT>
+RasterizedPolygons
+RasterizePolygonsWithCamera(const std::vector<Polygon3> &polygons,
+                            const CameraT &cam) {
+  Sizei size = cam.screenSize();
+  int nfaces = polygons.size();
+  std::vector<RasterFace> faces(nfaces);
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    for (int i = t; i < nfaces; i += concurrency) {
+      faces[i] = MakeRasterFace(polygons[i], cam.eye());
+    }
+  });
+
+  RasterizedPolygons result;
+  result.faceIds = Imagei(size, -1);
+  result.depths = Imaged(size, 0.0);
+  result.normals = Image3d(size, Vec3(0, 0, 0));
+
+  int ntilesX = (size.width + RasterTileSize - 1) / RasterTileSize;
+  int ntilesY = (size.height + RasterTileSize - 1) / RasterTileSize;
+  int ntiles = ntilesX * ntilesY;
+  ParallelRun(concurrency, concurrency, [&](int t) {
+    std::vector<Vec3> dirs;
+    std::vector<int> candidates;
+    for (int tile = t; tile < ntiles; tile += concurrency) {
+      int x0 = (tile % ntilesX) * RasterTileSize;
+      int y0 = (tile / ntilesX) * RasterTileSize;
+      int x1 = std::min(x0 + RasterTileSize, size.width);
+      int y1 = std::min(y0 + RasterTileSize, size.height);
+
+      // directions of the tile pixels and the cap containing them
+      dirs.clear();
+      Vec3 tileCenter(0, 0, 0);
+      for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+          dirs.push_back(normalize(cam.direction(Pixel(x, y))));
+          tileCenter += dirs.back();
+        }
+      }
+      tileCenter = normalize(tileCenter);
+      double tileRadius = 0.0;
+      for (auto &d : dirs) {
+        tileRadius = std::max(tileRadius, AngleBetweenDirected(tileCenter, d));
+      }
+
+      candidates.clear();
+      for (int i = 0; i < nfaces; i++) {
+        auto &face = faces[i];
+        if (face.triangles.empty()) {
+          continue;
+        }
+        if (face.capRadius >= M_PI_2 ||
+            AngleBetweenDirected(tileCenter, face.capCenter) <=
+                tileRadius + face.capRadius + 1e-6) {
+          candidates.push_back(i);
+        }
+      }
+      if (candidates.empty()) {
+        continue;
+      }
+
+      // depth test against the candidates only, the plane distance rejects
+      // occluded faces before their triangles are tested
+      auto dirIt = dirs.begin();
+      for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++, ++dirIt) {
+          auto &dir = *dirIt;
+          double depth = std::numeric_limits<double>::infinity();
+          int faceid = -1;
+          for (int i : candidates) {
+            auto &face = faces[i];
+            double cosine = face.normal.dot(dir);
+            if (cosine == 0) {
+              continue;
+            }
+            double lambdaMin = face.offsetMin / cosine;
+            double lambdaMax = face.offsetMax / cosine;
+            if (lambdaMin > lambdaMax) {
+              std::swap(lambdaMin, lambdaMax);
+            }
+            if (lambdaMin >= depth || lambdaMax <= 0) {
+              continue;
+            }
+            for (auto &tri : face.triangles) {
+              double lambda = 0.0;
+              if (IntersectRayAndTriangle(dir, tri, lambda)) {
+                if (lambda < depth) {
+                  depth = lambda;
+                  faceid = i;
+                }
+                break;
+              }
+            }
+          }
+          if (faceid != -1) {
+            auto &n = faces[faceid].normal;
+            result.faceIds(y, x) = faceid;
+            result.depths(y, x) = depth;
+            result.normals(y, x) = n.dot(dir) > 0 ? -n : n;
+          }
+        }
+      }
+    }
+  });
+  return result;
+}
+}
+
+RasterizedPolygons RasterizePolygons(const std::vector<Polygon3> &polygons,
+                                     const PerspectiveCamera &cam) {
+  return RasterizePolygonsWithCamera(polygons, cam);
+}
+
+RasterizedPolygons RasterizePolygons(const std::vector<Polygon3> &polygons,
+                                     const PanoramicCamera &cam) {
+  return RasterizePolygonsWithCamera(polygons, cam);
+}
+
+RasterizedPolygons RasterizePolygons(const std::vector<Polygon3> &polygons,
+                                     const PartialPanoramicCamera &cam) {
+  return RasterizePolygonsWithCamera(polygons, cam);
+}
+}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "basic_types.hpp"
+#include "cameras.hpp"
+
+namespace pano {
+namespace core {
+
+// RasterizedPolygons
+// pixels covered by no polygon have face id -1, depth 0 and a zero normal
+struct RasterizedPolygons {
+  Imagei faceIds; // indices into the rasterized polygons
+  Imaged depths;   // distances from the eye
+  Image3d normals; // unit normals facing the eye
+};
+
+// RasterizePolygons
+// renders the polygons seen from the camera with per pixel occlusion, the
+// image is split into tiles which are shaded in parallel against the polygons
+// whose bounding caps on the view sphere overlap them
+RasterizedPolygons RasterizePolygons(const std::vector<Polygon3> &polygons,
+                                     const PerspectiveCamera &cam);
+RasterizedPolygons RasterizePolygons(const std::vector<Polygon3> &polygons,
+                                     const PanoramicCamera &cam);
+RasterizedPolygons RasterizePolygons(const std::vector<Polygon3> &polygons,
+                                     const PartialPanoramicCamera &cam);
+}
+}
@@ -0,0 +1,77 @@
+#include "cameras.hpp"
+#include "rasterizer.hpp"
+
+#include "../panoramix.unittest.hpp"
+
+using namespace pano;
+
+namespace {
+// the six faces of the cube [-1, 1]^3
+std::vector<core::Polygon3> UnitCube() {
+  std::vector<core::Polygon3> faces;
+  for (int axis = 0; axis < 3; axis++) {
+    for (double side : {-1.0, 1.0}) {
+      int u = (axis + 1) % 3, v = (axis + 2) % 3;
+      core::Polygon3 face;
+      for (auto uv : {core::Vec2(-1, -1), core::Vec2(1, -1), core::Vec2(1, 1),
+                      core::Vec2(-1, 1)}) {
+        core::Point3 p;
+        p[axis] = side;
+        p[u] = uv[0];
+        p[v] = uv[1];
+        face.corners.push_back(p);
+      }
+      face.normal = core::Vec3(0, 0, 0);
+      face.normal[axis] = side;
+      faces.push_back(face);
+    }
+  }
+  return faces;
+}
+}
+
+TEST(Rasterizer, PanoramaInsideCube) {
+  core::PanoramicCamera cam(50);
+  auto result = core::RasterizePolygons(UnitCube(), cam);
+  ASSERT_TRUE(cam.screenSize() == result.faceIds.size());
+  for (auto it = result.faceIds.begin(); it != result.faceIds.end(); ++it) {
+    auto p = it.pos();
+    // watertight, every pixel sees a face
+    ASSERT_NE(-1, *it);
+    double depth = result.depths(p);
+    EXPECT_GE(depth, 1.0 - 1e-6);
+    EXPECT_LE(depth, std::sqrt(3.0) + 1e-6);
+    auto dir = core::normalize(cam.direction(p));
+    auto &n = result.normals(p);
+    // the visible face is the one the ray leaves the cube through
+    int axis = *it / 2;
+    EXPECT_NEAR(1.0, std::abs(dir[axis]) * depth, 1e-6);
+    EXPECT_LT(n.dot(dir), 0);
+  }
+}
+
+TEST(Rasterizer, PerspectiveOcclusion) {
+  core::PerspectiveCamera cam(200, 200, core::Point2(100, 100), 100,
+                              core::Point3(0, 0, 0), core::Point3(1, 0, 0),
+                              core::Vec3(0, 0, 1));
+  auto square = [](double x, double halfSize) {
+    core::Polygon3 poly;
+    poly.corners = {core::Point3(x, -halfSize, -halfSize),
+                    core::Point3(x, halfSize, -halfSize),
+                    core::Point3(x, halfSize, halfSize),
+                    core::Point3(x, -halfSize, halfSize)};
+    poly.normal = core::Vec3(1, 0, 0);
+    return poly;
+  };
+  // a far large square partly hidden by a near small one
+  auto result =
+      core::RasterizePolygons({square(10, 5), square(2, 0.5)}, cam);
+  EXPECT_EQ(1, result.faceIds(100, 100));
+  EXPECT_NEAR(2.0, result.depths(100, 100), 1e-6);
+  EXPECT_NEAR(-1.0, result.normals(100, 100)[0], 1e-9);
+  // 40 pixels off the center, outside the near square
+  EXPECT_EQ(0, result.faceIds(60, 100));
+  EXPECT_NEAR(std::sqrt(100 + 16), result.depths(60, 100), 1e-6);
+  EXPECT_EQ(-1, result.faceIds(0, 0));
+  EXPECT_EQ(0.0, result.depths(0, 0));
+}
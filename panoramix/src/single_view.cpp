@@ -64,14 +64,20 @@ std::vector<int> ComputeSpatialRegionPropertiesTemplated(
     }
 
     Vec3 centerDirection(0, 0, 0);
-    std::vector<Vec3> directions;
-    directions.reserve(ElementsNum(contours));
+    std::vector<Point2> contourPoints;
+    contourPoints.reserve(ElementsNum(contours));
     for (auto &cs : contours) {
       for (auto &c : cs) {
-        directions.push_back(normalize(cam.toSpace(c)));
-        centerDirection += directions.back();
+        contourPoints.emplace_back(c.x, c.y);
       }
     }
+    std::vector<Vec3> directions(contourPoints.size());
+    cam.toSpaceBatch(contourPoints.data(), directions.data(),
+                     contourPoints.size());
+    for (auto &d : directions) {
+      d = normalize(d);
+      centerDirection += d;
+    }
     centerDirection /= norm(centerDirection);
     // get max angle distance from center direction
     double radiusAngle = 0.0;
@@ -119,15 +125,19 @@ std::vector<int> ComputeSpatialRegionPropertiesTemplated(
     std::vector<std::vector<Vec3>> normalizedContours(contours.size());
     double area = 0.0;
     for (int k = 0; k < contours.size(); k++) {
-      normalizedContours[k].reserve(contours[k].size());
-      for (auto &p : contours[k]) {
-        normalizedContours[k].push_back(normalize(sCam.toSpace(p)));
-        center += normalizedContours[k].back();
-      }
+      std::vector<Point2> contourd(contours[k].size());
       std::vector<Point2f> contourf(contours[k].size());
       for (int kk = 0; kk < contours[k].size(); kk++) {
+        contourd[kk] = Point2(contours[k][kk].x, contours[k][kk].y);
         contourf[kk] = ecast<float>(contours[k][kk]);
       }
+      normalizedContours[k].resize(contourd.size());
+      sCam.toSpaceBatch(contourd.data(), normalizedContours[k].data(),
+                        contourd.size());
+      for (auto &d : normalizedContours[k]) {
+        d = normalize(d);
+        center += d;
+      }
       area += cv::contourArea(contourf);
     }
     center = normalize(center);
@@ -195,15 +205,258 @@ PerfectRegionMaskView(const std::vector<std::vector<Vec3>> &contours,
 
   // project contours to ppc
   std::vector<std::vector<Point2i>> contourProjs(contours.size());
+  std::vector<Point2> screenps;
   for (int k = 0; k < contours.size(); k++) {
+    screenps.resize(contours[k].size());
+    ppc.toScreenBatch(contours[k].data(), screenps.data(), screenps.size());
     auto &contourProj = contourProjs[k];
-    contourProj.reserve(contours[k].size());
-    for (auto &d : contours[k]) {
-      contourProj.push_back(ecast<int>(ppc.toScreen(d)));
+    contourProj.reserve(screenps.size());
+    for (auto &p : screenps) {
+      contourProj.push_back(ecast<int>(p));
     }
   }
   cv::fillPoly(mask, contourProjs, (uint8_t)1);
   return View<PartialPanoramicCamera, Imageub>{mask, ppc};
 }
+
+namespace {
+// a perspective tile of a pyramid level and the lines it refines, a tile
+// covering a piece of a long line keeps its segments for that line
+struct LineTile {
+  PerspectiveCamera camera;
+  std::vector<int> lineIds;
+  int longLineId = -1;
+  std::vector<Line3> segments;
+  bool detected = false;
+};
+
+// refits the line to the segments on its great circle, fails if they cover
+// less than half of it
+bool RefitLine(Line3 &line, const std::vector<Line3> &segments,
+               double angleThres) {
+  Vec3 n = normalize(line.first.cross(line.second));
+  Vec3 x = normalize(line.first);
+  Vec3 y = n.cross(x);
+  double span = AngleBetweenDirected(line.first, line.second);
+  double maxOffset = sin(angleThres);
+  Mat3 scatter = Mat3::zeros();
+  double support = 0.0;
+  for (auto &segment : segments) {
+    Vec3 a = normalize(segment.first), b = normalize(segment.second);
+    if (std::abs(a.dot(n)) > maxOffset || std::abs(b.dot(n)) > maxOffset) {
+      continue;
+    }
+    // the part of the segment along the line
+    double ta = atan2(a.dot(y), a.dot(x)), tb = atan2(b.dot(y), b.dot(x));
+    if (ta > tb) {
+      std::swap(ta, tb);
+    }
+    double overlap = std::min(tb, span) - std::max(ta, 0.0);
+    if (overlap <= 0) {
+      continue;
+    }
+    double length = AngleBetweenDirected(a, b);
+    scatter += (a * a.t() + b * b.t()) * length;
+    support += overlap;
+  }
+  if (support < span / 2) {
+    return false;
+  }
+
+  // the normal of the fitted plane through the eye
+  cv::Mat eigenValues, eigenVectors;
+  cv::eigen(scatter, eigenValues, eigenVectors);
+  Vec3 fitted(eigenVectors.at<double>(2, 0), eigenVectors.at<double>(2, 1),
+              eigenVectors.at<double>(2, 2));
+  if (fitted.dot(n) < 0) {
+    fitted = -fitted;
+  }
+  line.first = normalize(line.first - fitted * fitted.dot(line.first));
+  line.second = normalize(line.second - fitted * fitted.dot(line.second));
+  return true;
+}
+}
+
+std::vector<Line3> RefineLinesInPanoramaPyramid(
+    const std::vector<Line3> &lines, const Image &panorama, int coarseHeight,
+    int maxTileSize, double maxTileSpanAngle,
+    std::vector<LineRefinementLevel> *levels, const misc::Deadline &deadline) {
+  if (levels) {
+    levels->clear();
+  }
+  std::vector<Line3> refined = lines;
+  if (coarseHeight >= panorama.rows || lines.empty()) {
+    return refined;
+  }
+
+  // long lines get their tiles first, shorter ones often fit in them
+  std::vector<int> order(lines.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<double> spans(lines.size());
+  for (int i = 0; i < lines.size(); i++) {
+    spans[i] = AngleBetweenDirected(lines[i].first, lines[i].second);
+  }
+  std::sort(order.begin(), order.end(),
+            [&spans](int a, int b) { return spans[a] > spans[b]; });
+
+  int concurrency = std::max<int>(std::thread::hardware_concurrency(), 1);
+  for (int height = coarseHeight * 2;; height *= 2) {
+    height = std::min(height, panorama.rows);
+    LineRefinementLevel level = {height, 0, 0, 0, 0.0};
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // only this level is kept besides the panorama
+    Image levelImage = panorama;
+    if (height != panorama.rows) {
+      cv::resize(panorama, levelImage,
+                 cv::Size(panorama.cols * height / panorama.rows, height), 0,
+                 0, cv::INTER_AREA);
+    }
+    auto levelView = CreatePanoramicView(levelImage);
+    double focal = levelView.camera.focal();
+    // margin around the lines, covers the error of the previous level
+    double marginAngle = 16.0 / focal;
+
+    std::vector<LineTile> tiles;
+    std::vector<bool> assigned(refined.size(), false);
+    size_t maxTileBytes = 0;
+    // a tile around the piece of line, it also refines the short lines that
+    // lie well inside it
+    auto addTile = [&](const Line3 &piece, double span) -> LineTile & {
+      Vec3 center = normalize(piece.first + piece.second);
+      double halfAngle = span / 2 + marginAngle;
+      double tileFocal = focal;
+      int size = static_cast<int>(2 * tileFocal * tan(halfAngle)) + 1;
+      if (size > maxTileSize) {
+        size = maxTileSize;
+        tileFocal = size / 2.0 / tan(halfAngle);
+      }
+      LineTile tile;
+      tile.camera = PerspectiveCamera(
+          size, size, Point2(size / 2.0, size / 2.0), tileFocal, Origin(),
+          center, ProposeXYDirectionsFromZDirection(center).second);
+      double border = marginAngle * tileFocal / 2;
+      auto inside = [&tile, size, border](const Vec3 &p) {
+        if (!tile.camera.isVisibleOnScreen(p)) {
+          return false;
+        }
+        auto q = tile.camera.toScreen(p);
+        return IsBetween(q[0], border, size - border) &&
+               IsBetween(q[1], border, size - border);
+      };
+      for (int j : order) {
+        if (!assigned[j] && spans[j] <= maxTileSpanAngle &&
+            inside(refined[j].first) && inside(refined[j].second)) {
+          assigned[j] = true;
+          tile.lineIds.push_back(j);
+        }
+      }
+      maxTileBytes = std::max<size_t>(
+          maxTileBytes,
+          size_t(size) * size * (levelImage.elemSize() + 2 * sizeof(float)));
+      tiles.push_back(std::move(tile));
+      return tiles.back();
+    };
+    for (int i : order) {
+      if (assigned[i]) {
+        continue;
+      }
+      auto &line = refined[i];
+      if (spans[i] <= maxTileSpanAngle) {
+        auto &tile = addTile(line, spans[i]);
+        if (!assigned[i]) {
+          assigned[i] = true;
+          tile.lineIds.push_back(i);
+        }
+        continue;
+      }
+      // a long line is split into pieces of at most maxTileSpanAngle, each
+      // in its own tile, and refit to the segments of all of them
+      assigned[i] = true;
+      int npieces = static_cast<int>(std::ceil(spans[i] / maxTileSpanAngle));
+      double pieceSpan = spans[i] / npieces;
+      for (int k = 0; k < npieces; k++) {
+        Line3 piece(
+            normalize(RotateDirection(line.first, line.second, pieceSpan * k)),
+            normalize(RotateDirection(line.first, line.second,
+                                      pieceSpan * (k + 1))));
+        addTile(piece, pieceSpan).longLineId = i;
+      }
+    }
+
+    // each line belongs to one tile, so the tiles refit them in parallel
+    std::vector<uint8_t> refitted(refined.size(), false);
+    std::vector<Line3> refitting = refined;
+    int ntiles = tiles.size();
+    ParallelRun(concurrency, concurrency, [&](int t) {
+      LineSegmentExtractor lineExtractor;
+      lineExtractor.params().algorithm = LineSegmentExtractor::LSD;
+      std::vector<Line3> segments;
+      for (int k = t; k < ntiles; k += concurrency) {
+        if (deadline.expired()) {
+          break;
+        }
+        auto &tile = tiles[k];
+        tile.detected = true;
+        Image tileImage =
+            MakeCameraSampler(tile.camera, levelView.camera)(levelView.image);
+        auto line2s = lineExtractor(tileImage);
+        segments.clear();
+        for (auto &l : line2s) {
+          segments.emplace_back(normalize(tile.camera.toSpace(l.first)),
+                                normalize(tile.camera.toSpace(l.second)));
+        }
+        double angleThres = 6.0 / tile.camera.focal();
+        for (int i : tile.lineIds) {
+          if (RefitLine(refitting[i], segments, angleThres)) {
+            refitted[i] = true;
+          }
+        }
+        if (tile.longLineId != -1) {
+          tile.segments = segments;
+        }
+      }
+    });
+    // the long lines once all their pieces are detected
+    for (int k = 0; k < ntiles;) {
+      int i = tiles[k].longLineId;
+      if (i == -1) {
+        k++;
+        continue;
+      }
+      double angleThres = 6.0 / tiles[k].camera.focal();
+      std::vector<Line3> segments;
+      bool detected = true;
+      for (; k < ntiles && tiles[k].longLineId == i; k++) {
+        segments.insert(segments.end(), tiles[k].segments.begin(),
+                        tiles[k].segments.end());
+        detected = detected && tiles[k].detected;
+      }
+      // a long line with skipped pieces keeps its last fit
+      if (detected && RefitLine(refitting[i], segments, angleThres)) {
+        refitted[i] = true;
+      }
+    }
+    refined = std::move(refitting);
+
+    level.ntiles = ntiles;
+    level.nrefined = std::count(refitted.begin(), refitted.end(), true);
+    level.peakBytes = panorama.total() * panorama.elemSize() +
+                      std::min(concurrency, ntiles) * maxTileBytes;
+    if (height != panorama.rows) {
+      level.peakBytes += levelImage.total() * levelImage.elemSize();
+    }
+    level.time = std::chrono::duration<double, std::milli>(
+                     std::chrono::high_resolution_clock::now() - start)
+                     .count();
+    if (levels) {
+      levels->push_back(level);
+    }
+    if (height == panorama.rows || deadline.expired()) {
+      break;
+    }
+  }
+  return refined;
+}
+}
 }
-}
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "basic_types.hpp"
 #include "cameras.hpp"
+#include "clock.hpp"
 
 namespace pano {
 namespace core {
@@ -39,6 +40,33 @@ template <class T, class FunT>
 void ForEachPixelWithinViewCone(const View<PanoramicCamera, Image_<T>> &view,
                                 const Vec3 &center, double angle_radius,
                                 FunT fun);
+
+// LineRefinementLevel
+struct LineRefinementLevel {
+  int height;
+  int ntiles;
+  int nrefined; // lines refit at this level
+  size_t peakBytes; // the panorama, the level image and the tiles in flight
+  double time; // ms
+};
+
+// RefineLinesInPanoramaPyramid
+// refines lines detected on the panorama resized to coarseHeight against
+// larger versions of it, the height doubles each level up to the height of
+// the panorama, each level is made only when it is reached and line segments
+// are only detected in perspective tiles around the lines, then each line is
+// refit to the segments on its great circle, lines longer than
+// maxTileSpanAngle are split into pieces over several tiles and refit to the
+// segments of all of them, lines without enough support are kept. the whole
+// panorama is taken decoded, so memory still grows with its size, only the
+// line detection is spared the full resolution. once the deadline expires no
+// further tile is detected, the lines of the skipped tiles keep their last
+// fit and no finer level is made
+std::vector<Line3> RefineLinesInPanoramaPyramid(
+    const std::vector<Line3> &lines, const Image &panorama, int coarseHeight,
+    int maxTileSize = 800, double maxTileSpanAngle = M_PI / 3,
+    std::vector<LineRefinementLevel> *levels = nullptr,
+    const misc::Deadline &deadline = misc::Deadline());
 }
 }
 
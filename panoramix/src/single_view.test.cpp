@@ -1,4 +1,6 @@
 #include "cameras.hpp"
+#include "clock.hpp"
+#include "line_detection.hpp"
 #include "segmentation.hpp"
 #include "single_view.hpp"
 #include "utility.hpp"
@@ -32,3 +34,197 @@ TEST(SingleView, ComputeSpatialRegionProperties) {
   std::vector<std::vector<std::vector<Vec3>>> contours;
   ComputeSpatialRegionProperties(segs, view.camera, &contours);
 }
+
+namespace {
+// a 6 x 8 x 3 room around the eye whose walls, floor and ceiling are
+// checkered with 0.5 cells, the planes through the eye and the checker edges
+// are the ground truth of the lines
+const Vec3 RoomHalfSize(3, 4, 1.5);
+const double RoomCellSize = 0.5;
+
+Image3ub RenderCheckeredRoom(int height) {
+  Image3ub panorama(height, height * 2);
+  auto cam = CreatePanoramicCamera(panorama);
+  std::vector<Point2> pixels(panorama.cols);
+  std::vector<Point3> dirs(panorama.cols);
+  for (int y = 0; y < panorama.rows; y++) {
+    for (int x = 0; x < panorama.cols; x++) {
+      pixels[x] = Point2(x, y);
+    }
+    cam.toSpaceBatch(pixels.data(), dirs.data(), pixels.size());
+    for (int x = 0; x < panorama.cols; x++) {
+      auto &d = dirs[x];
+      double t = std::numeric_limits<double>::max();
+      int axis = 0;
+      for (int i = 0; i < 3; i++) {
+        if (d[i] != 0 && RoomHalfSize[i] / abs(d[i]) < t) {
+          t = RoomHalfSize[i] / abs(d[i]);
+          axis = i;
+        }
+      }
+      Point3 p = d * t;
+      int parity = 0;
+      for (int i = 0; i < 3; i++) {
+        if (i != axis) {
+          parity += (int)std::floor(p[i] / RoomCellSize);
+        }
+      }
+      uint8_t shade = parity % 2 ? 60 + 30 * axis : 230 - 30 * axis;
+      panorama(y, x) = Vec3ub(shade, shade, shade);
+    }
+  }
+  return panorama;
+}
+
+std::vector<Vec3> CheckeredRoomLineNormals() {
+  std::vector<Vec3> normals;
+  for (int a = 0; a < 3; a++) {
+    for (int s : {-1, 1}) {
+      for (int b = 0; b < 3; b++) {
+        if (b == a) {
+          continue;
+        }
+        int c = 3 - a - b;
+        int ncells = (int)std::round(RoomHalfSize[b] / RoomCellSize);
+        for (int k = -ncells; k <= ncells; k++) {
+          Point3 p(0, 0, 0);
+          p[a] = s * RoomHalfSize[a];
+          p[b] = k * RoomCellSize;
+          Vec3 dir(0, 0, 0);
+          dir[c] = 1;
+          normals.push_back(normalize(p.cross(dir)));
+        }
+      }
+    }
+  }
+  return normals;
+}
+
+// mean over the lines of the angle between the line and its closest ground
+// truth plane, measured at both ends and the middle
+double MeanLineError(const std::vector<Line3> &lines,
+                     const std::vector<Vec3> &normals) {
+  double sum = 0.0;
+  for (auto &l : lines) {
+    Point3 points[] = {normalize(l.first), normalize(l.second),
+                       normalize(l.center())};
+    double best = M_PI;
+    for (auto &n : normals) {
+      double err = 0.0;
+      for (auto &p : points) {
+        err = std::max(err, std::asin(std::min(abs(n.dot(p)), 1.0)));
+      }
+      best = std::min(best, err);
+    }
+    sum += best;
+  }
+  return lines.empty() ? 0.0 : sum / lines.size();
+}
+
+// detect lines the way the reconstruction does on the resized panorama
+std::vector<Line3> DetectPanoramaLines(const Image3ub &panorama) {
+  auto view = CreatePanoramicView(panorama);
+  auto cams = CreateCubicFacedCameras(view.camera, panorama.rows,
+                                      panorama.rows, panorama.rows * 0.4);
+  std::vector<Line3> lines;
+  LineSegmentExtractor lineExtractor;
+  lineExtractor.params().algorithm = LineSegmentExtractor::LSD;
+  for (auto &cam : cams) {
+    for (auto &l : lineExtractor(view.sampled(cam).image)) {
+      lines.emplace_back(normalize(cam.toSpace(l.first)),
+                         normalize(cam.toSpace(l.second)));
+    }
+  }
+  return MergeLines(lines, DegreesToRadians(3), DegreesToRadians(5));
+}
+}
+
+TEST(SingleView, RefineLinesInPanoramaPyramid) {
+  const int coarseHeight = 500;
+  auto normals = CheckeredRoomLineNormals();
+  for (int height : {1000, 2000, 4000}) {
+    Image3ub panorama = RenderCheckeredRoom(height);
+    Image3ub coarse;
+    cv::resize(panorama, coarse, cv::Size(coarseHeight * 2, coarseHeight), 0,
+               0, cv::INTER_AREA);
+    auto lines = DetectPanoramaLines(coarse);
+    ASSERT_FALSE(lines.empty());
+
+    std::vector<LineRefinementLevel> levels;
+    std::vector<Line3> refined;
+    auto refineTime = misc::TimeCost([&]() {
+      refined = RefineLinesInPanoramaPyramid(lines, panorama, coarseHeight, 800,
+                                             M_PI / 3, &levels);
+    });
+    ASSERT_EQ(lines.size(), refined.size());
+    ASSERT_FALSE(levels.empty());
+    EXPECT_EQ(height, levels.back().height);
+
+    double coarseError = MeanLineError(lines, normals);
+    double refinedError = MeanLineError(refined, normals);
+    EXPECT_LE(refinedError, coarseError);
+
+    // the whole panorama sampled into cubic faces at full resolution, what
+    // the refinement avoids
+    auto fullTime =
+        misc::TimeCost([&panorama]() { DetectPanoramaLines(panorama); });
+
+    size_t peakBytes = 0;
+    int nrefined = 0;
+    for (auto &level : levels) {
+      peakBytes = std::max(peakBytes, level.peakBytes);
+      nrefined += level.nrefined;
+    }
+    std::cout << "height " << height << ": " << lines.size() << " lines, "
+              << nrefined << " refits, error " << coarseError * 180 / M_PI
+              << " -> " << refinedError * 180 / M_PI << " degrees, "
+              << refineTime.count() << "ms, peak "
+              << peakBytes / (1 << 20) << "MB; full resolution detection "
+              << fullTime.count() << "ms, panorama "
+              << panorama.total() * panorama.elemSize() / (1 << 20) << "MB"
+              << std::endl;
+  }
+}
+
+TEST(SingleView, RefineLongLinesInPanoramaPyramid) {
+  Image3ub panorama = RenderCheckeredRoom(1000);
+  auto normals = CheckeredRoomLineNormals();
+  // a checker edge across the front wall spanning about 100 degrees, one end
+  // moved off it
+  Line3 line(normalize(Point3(3, -3.5, 0.5)), normalize(Point3(3, 3.5, 0.55)));
+  ASSERT_GT(AngleBetweenDirected(line.first, line.second), M_PI / 3);
+
+  std::vector<LineRefinementLevel> levels;
+  auto refined = RefineLinesInPanoramaPyramid({line}, panorama, 500, 800,
+                                              M_PI / 3, &levels);
+  ASSERT_EQ(1, refined.size());
+  ASSERT_EQ(1, levels.size());
+  EXPECT_EQ(2, levels.front().ntiles);
+  EXPECT_EQ(1, levels.front().nrefined);
+  EXPECT_LT(MeanLineError(refined, normals), MeanLineError({line}, normals));
+}
+
+TEST(SingleView, RefineLinesInPanoramaPyramidStopsAtDeadline) {
+  Image3ub panorama = RenderCheckeredRoom(2000);
+  Image3ub coarse;
+  cv::resize(panorama, coarse, cv::Size(1000, 500), 0, 0, cv::INTER_AREA);
+  auto lines = DetectPanoramaLines(coarse);
+  ASSERT_FALSE(lines.empty());
+
+  // cancelled, the first level makes its tiles but detects none of them and
+  // no finer level is made
+  misc::Deadline deadline;
+  deadline.cancel();
+  std::vector<LineRefinementLevel> levels;
+  auto refined = RefineLinesInPanoramaPyramid(lines, panorama, 500, 800,
+                                              M_PI / 3, &levels, deadline);
+  ASSERT_EQ(1, levels.size());
+  EXPECT_EQ(1000, levels.front().height);
+  EXPECT_LT(0, levels.front().ntiles);
+  EXPECT_EQ(0, levels.front().nrefined);
+  ASSERT_EQ(lines.size(), refined.size());
+  for (int i = 0; i < lines.size(); i++) {
+    EXPECT_EQ(0.0, Distance(lines[i].first, refined[i].first));
+    EXPECT_EQ(0.0, Distance(lines[i].second, refined[i].second));
+  }
+}
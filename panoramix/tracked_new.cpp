@@ -0,0 +1,40 @@
+#include <new>
+
+#include "memory.hpp"
+
+// all of operator new goes through the counters of memory.hpp. not part of
+// the library, only the executables built with PANORAMIX_TRACK_OPERATOR_NEW
+// link it, and never on msvc, where blocks allocated inside the dlls of
+// opencv or qt may be freed here without the header
+void *operator new(size_t size) {
+  void *p = pano::misc::TrackedAllocate(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new[](size_t size) {
+  void *p = pano::misc::TrackedAllocate(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return pano::misc::TrackedAllocate(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return pano::misc::TrackedAllocate(size);
+}
+void operator delete(void *p) noexcept { pano::misc::TrackedFree(p); }
+void operator delete[](void *p) noexcept { pano::misc::TrackedFree(p); }
+void operator delete(void *p, size_t) noexcept { pano::misc::TrackedFree(p); }
+void operator delete[](void *p, size_t) noexcept {
+  pano::misc::TrackedFree(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  pano::misc::TrackedFree(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  pano::misc::TrackedFree(p);
+}